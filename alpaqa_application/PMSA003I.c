@@ -2,16 +2,22 @@
 
 static uint8_t rawData[32];
 
-bool readAqiDataFromDevice(int i2cFile)
+static inline uint16_t frameWord(const uint8_t * frame, int offset);
+
+bool readAqiDataFromDevice(I2C_BUS * bus)
 {
-    if(ioctl(i2cFile, I2C_SLAVE, PMSA003I_ADDR) < 0)
-    {
-        // Failed to acquire bus access or communicate with device
-        //printf("Failed to acquire bus or communicate with PMSA003I\n");
-        return false;
-    }
+    return readAqiDataInto(bus, rawData);
+}
+
+// A read on its own, for going back for a frame that failed its checksum. The
+// sensor hands out the same frame until it has measured the next one.
+bool readAqiDataInto(I2C_BUS * bus, uint8_t * frame)
+{
+    I2C_BATCH batch;
 
-    if(read(i2cFile, rawData, PMSA003I_READ_BYTES) != PMSA003I_READ_BYTES)
+    i2cBatchInit(&batch);
+    queueAqiDataReadInto(&batch, frame);
+    if(!i2cBusTransfer(bus, &batch))
     {
         // Failed to read
         //printf("Failed to read data from PMSA003I\n");
@@ -20,16 +26,90 @@ bool readAqiDataFromDevice(int i2cFile)
     return true;
 }
 
+// Adds the frame read to a batch so it can share a bus transfer with other sensors.
+// Returns the message index for i2cBatchMessageOk(), or -1 if the batch is full.
+int queueAqiDataRead(I2C_BATCH * batch)
+{
+    return queueAqiDataReadInto(batch, rawData);
+}
+
+// Reads into the caller's frame instead of the driver's, for more than one PMSA003I
+// or for reads from more than one thread. frame holds PMSA003I_READ_BYTES.
+int queueAqiDataReadInto(I2C_BATCH * batch, uint8_t * frame)
+{
+    return i2cBatchAddRead(batch, PMSA003I_ADDR, frame, PMSA003I_READ_BYTES);
+}
+
 // Units are micro grams / meters^3
 // Note: Values are overlapped. PM10 contains0-10ug, PM2.5 contains 0-2.5, PM1.0 contains 0-1ug.
 // AQI calculation uses the highest concentration pollutant, so always PM10.
 bool getParticulateMatterData(PARTICULATE_MATTER_DATA *data)
 {
-    // Currently only want environmental PM for 1.0, 2.5, and 10
+    return decodeParticulateMatterData(rawData, data);
+}
+
+// The last frame read, for handing off to another thread to decode
+const uint8_t * getAqiRawData(void)
+{
+    return rawData;
+}
+
+// Leaves data alone and returns false when the frame does not check out
+bool decodeParticulateMatterData(const uint8_t * frame, PARTICULATE_MATTER_DATA * data)
+{
+    if(checkParticulateMatterFrame(frame) != PMSA003I_FRAME_OK)
+    {
+        return false;
+    }
+
+    // Environmental PM for 1.0, 2.5, and 10
     // So, bytes 10/11, 12/13, and 14/15 respectively
-    // Byte order is: High/Low
-    data->pm1_0 = (rawData[10] << 8) | rawData[11];
-    data->pm2_5 = (rawData[12] << 8) | rawData[13];
-    data->pm10_0 = (rawData[14] << 8) | rawData[15];
+    data->pm1_0 = frameWord(frame, 10);
+    data->pm2_5 = frameWord(frame, 12);
+    data->pm10_0 = frameWord(frame, 14);
     return true;
 }
+
+// The frame starts 0x42 0x4D and a length word, and ends with the sum of all the
+// bytes before the checksum. A bus glitch that shifts or flips bytes fails one of them.
+PMSA003I_FRAME_STATUS checkParticulateMatterFrame(const uint8_t * frame)
+{
+    uint16_t checksum = 0;
+
+    if(frame[0] != PMSA003I_START_1 || frame[1] != PMSA003I_START_2)
+    {
+        return PMSA003I_FRAME_BAD_START;
+    }
+    if(frameWord(frame, 2) != PMSA003I_FRAME_LENGTH)
+    {
+        return PMSA003I_FRAME_BAD_LENGTH;
+    }
+    // Thirty bytes, the compiler turns this into a few vector adds
+    for(int idx = 0; idx < PMSA003I_CHECKSUM_OFFSET; idx++)
+    {
+        checksum += frame[idx];
+    }
+    return checksum == frameWord(frame, PMSA003I_CHECKSUM_OFFSET) ? PMSA003I_FRAME_OK : PMSA003I_FRAME_BAD_CHECKSUM;
+}
+
+// All twelve channels, bytes 4 to 27. Same rules as decodeParticulateMatterData().
+bool decodeParticulateMatterFrame(const uint8_t * frame, PMSA003I_FRAME_DATA * data)
+{
+    uint16_t * words = (uint16_t *)data;
+
+    if(checkParticulateMatterFrame(frame) != PMSA003I_FRAME_OK)
+    {
+        return false;
+    }
+    for(size_t idx = 0; idx < sizeof(PMSA003I_FRAME_DATA) / sizeof(uint16_t); idx++)
+    {
+        words[idx] = frameWord(frame, 4 + (idx * 2));
+    }
+    return true;
+}
+
+// Byte order is: High/Low
+static inline uint16_t frameWord(const uint8_t * frame, int offset)
+{
+    return (frame[offset] << 8) | frame[offset + 1];
+}
@@ -4,12 +4,16 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
-#include <sys/ioctl.h>
-#include <linux/i2c-dev.h>
-#include <unistd.h>
+
+#include "i2cBus.h"
 
 #define PMSA003I_ADDR 0x12
 #define PMSA003I_READ_BYTES 32
+#define PMSA003I_START_1 0x42
+#define PMSA003I_START_2 0x4D
+// The length word counts the thirteen data words and the checksum after it
+#define PMSA003I_FRAME_LENGTH (2 * 13 + 2)
+#define PMSA003I_CHECKSUM_OFFSET 30
 
 typedef struct 
 {
@@ -18,7 +22,43 @@ typedef struct
     uint16_t pm10_0;
 } PARTICULATE_MATTER_DATA;
 
-bool readAqiDataFromDevice(int i2cFile);
+// Every data word of a frame in frame order, as unpacked from the big endian bytes.
+// All of them are 16 bits, so nothing pads it.
+typedef struct
+{
+    // Standard particle (CF=1), micro grams / meters^3
+    uint16_t pm1_0Standard;
+    uint16_t pm2_5Standard;
+    uint16_t pm10_0Standard;
+    // Environmental units, what PARTICULATE_MATTER_DATA holds
+    uint16_t pm1_0;
+    uint16_t pm2_5;
+    uint16_t pm10_0;
+    // Particles per 0.1 L of air above each diameter in um
+    uint16_t particles0_3;
+    uint16_t particles0_5;
+    uint16_t particles1_0;
+    uint16_t particles2_5;
+    uint16_t particles5_0;
+    uint16_t particles10_0;
+} PMSA003I_FRAME_DATA;
+
+typedef enum
+{
+    PMSA003I_FRAME_OK = 0,
+    PMSA003I_FRAME_BAD_START,
+    PMSA003I_FRAME_BAD_LENGTH,
+    PMSA003I_FRAME_BAD_CHECKSUM
+} PMSA003I_FRAME_STATUS;
+
+bool readAqiDataFromDevice(I2C_BUS * bus);
+bool readAqiDataInto(I2C_BUS * bus, uint8_t * frame);
+int queueAqiDataRead(I2C_BATCH * batch);
+int queueAqiDataReadInto(I2C_BATCH * batch, uint8_t * frame);
 bool getParticulateMatterData(PARTICULATE_MATTER_DATA * data);
+const uint8_t * getAqiRawData(void);
+bool decodeParticulateMatterData(const uint8_t * frame, PARTICULATE_MATTER_DATA * data);
+PMSA003I_FRAME_STATUS checkParticulateMatterFrame(const uint8_t * frame);
+bool decodeParticulateMatterFrame(const uint8_t * frame, PMSA003I_FRAME_DATA * data);
 
 #endif
\ No newline at end of file
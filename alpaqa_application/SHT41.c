@@ -1,32 +1,103 @@
 #include "SHT41.h"
 
+#include <string.h>
+
+#define SHT41_BATCH_LANES 4
+
+// GCC vector types, which become NEON on the Pi and SSE on x86
+typedef uint16_t SHT41_TICKS __attribute__((vector_size(SHT41_BATCH_LANES * sizeof(uint16_t))));
+typedef float SHT41_FLOATS __attribute__((vector_size(SHT41_BATCH_LANES * sizeof(float))));
+typedef int32_t SHT41_MASK __attribute__((vector_size(SHT41_BATCH_LANES * sizeof(int32_t))));
+
 static uint8_t rawData[6];
+static uint8_t measureCmd[1] = {SHT41_HIGH_PRECISION};
+static uint32_t measureWaitMs = SHT41_HIGH_PRECISION_WAIT_MS;
+
+// SHT41_CRC_POLYNOMIAL applied to every byte value, so the CRC costs a lookup per byte
+static const uint8_t crcTable[256] =
+{
+    0x00, 0x31, 0x62, 0x53, 0xC4, 0xF5, 0xA6, 0x97, 0xB9, 0x88, 0xDB, 0xEA, 0x7D, 0x4C, 0x1F, 0x2E,
+    0x43, 0x72, 0x21, 0x10, 0x87, 0xB6, 0xE5, 0xD4, 0xFA, 0xCB, 0x98, 0xA9, 0x3E, 0x0F, 0x5C, 0x6D,
+    0x86, 0xB7, 0xE4, 0xD5, 0x42, 0x73, 0x20, 0x11, 0x3F, 0x0E, 0x5D, 0x6C, 0xFB, 0xCA, 0x99, 0xA8,
+    0xC5, 0xF4, 0xA7, 0x96, 0x01, 0x30, 0x63, 0x52, 0x7C, 0x4D, 0x1E, 0x2F, 0xB8, 0x89, 0xDA, 0xEB,
+    0x3D, 0x0C, 0x5F, 0x6E, 0xF9, 0xC8, 0x9B, 0xAA, 0x84, 0xB5, 0xE6, 0xD7, 0x40, 0x71, 0x22, 0x13,
+    0x7E, 0x4F, 0x1C, 0x2D, 0xBA, 0x8B, 0xD8, 0xE9, 0xC7, 0xF6, 0xA5, 0x94, 0x03, 0x32, 0x61, 0x50,
+    0xBB, 0x8A, 0xD9, 0xE8, 0x7F, 0x4E, 0x1D, 0x2C, 0x02, 0x33, 0x60, 0x51, 0xC6, 0xF7, 0xA4, 0x95,
+    0xF8, 0xC9, 0x9A, 0xAB, 0x3C, 0x0D, 0x5E, 0x6F, 0x41, 0x70, 0x23, 0x12, 0x85, 0xB4, 0xE7, 0xD6,
+    0x7A, 0x4B, 0x18, 0x29, 0xBE, 0x8F, 0xDC, 0xED, 0xC3, 0xF2, 0xA1, 0x90, 0x07, 0x36, 0x65, 0x54,
+    0x39, 0x08, 0x5B, 0x6A, 0xFD, 0xCC, 0x9F, 0xAE, 0x80, 0xB1, 0xE2, 0xD3, 0x44, 0x75, 0x26, 0x17,
+    0xFC, 0xCD, 0x9E, 0xAF, 0x38, 0x09, 0x5A, 0x6B, 0x45, 0x74, 0x27, 0x16, 0x81, 0xB0, 0xE3, 0xD2,
+    0xBF, 0x8E, 0xDD, 0xEC, 0x7B, 0x4A, 0x19, 0x28, 0x06, 0x37, 0x64, 0x55, 0xC2, 0xF3, 0xA0, 0x91,
+    0x47, 0x76, 0x25, 0x14, 0x83, 0xB2, 0xE1, 0xD0, 0xFE, 0xCF, 0x9C, 0xAD, 0x3A, 0x0B, 0x58, 0x69,
+    0x04, 0x35, 0x66, 0x57, 0xC0, 0xF1, 0xA2, 0x93, 0xBD, 0x8C, 0xDF, 0xEE, 0x79, 0x48, 0x1B, 0x2A,
+    0xC1, 0xF0, 0xA3, 0x92, 0x05, 0x34, 0x67, 0x56, 0x78, 0x49, 0x1A, 0x2B, 0xBC, 0x8D, 0xDE, 0xEF,
+    0x82, 0xB3, 0xE0, 0xD1, 0x46, 0x77, 0x24, 0x15, 0x3B, 0x0A, 0x59, 0x68, 0xFF, 0xCE, 0x9D, 0xAC
+};
+
+// Lower precision trades repeatability for a much shorter conversion, which is
+// what allows sampling the SHT41 well above 1 Hz
+void setTempAndHumidityPrecision(SHT41_PRECISION precision)
+{
+    switch(precision)
+    {
+        case SHT41_PRECISION_LOW:
+            measureCmd[0] = SHT41_LOW_PRECISION;
+            measureWaitMs = SHT41_LOW_PRECISION_WAIT_MS;
+            break;
+        case SHT41_PRECISION_MEDIUM:
+            measureCmd[0] = SHT41_MEDIUM_PRECISION;
+            measureWaitMs = SHT41_MEDIUM_PRECISION_WAIT_MS;
+            break;
+        case SHT41_PRECISION_HIGH:
+        default:
+            measureCmd[0] = SHT41_HIGH_PRECISION;
+            measureWaitMs = SHT41_HIGH_PRECISION_WAIT_MS;
+            break;
+    }
+}
 
-bool readTempAndHumidityFromDevice(int i2cFile)
+// Blocking read: trigger, wait out the conversion, collect
+bool readTempAndHumidityFromDevice(I2C_BUS * bus)
 {
-    uint8_t writeCmd[1];
+    struct timespec triggeredAt;
 
-    if(ioctl(i2cFile, I2C_SLAVE, SHT41_ADDR) < 0)
+    if(!triggerTempAndHumidityMeasurement(bus, &triggeredAt))
     {
-        // Failed to acquire bus access or communicate with device
-        //printf("Failed to acquire bus or communicate with SHT41\n");
         return false;
     }
+    return collectTempAndHumidityFromDevice(bus, &triggeredAt);
+}
+
+// Split-phase read. The trigger returns as soon as the command is on the bus, leaving
+// the caller free to do other work during the conversion; the collect only waits for
+// whatever part of the conversion time is still left.
+bool triggerTempAndHumidityMeasurement(I2C_BUS * bus, struct timespec * triggeredAt)
+{
+    I2C_BATCH batch;
 
-    // Write precision we want, then wait
-    writeCmd[0] = SHT41_HIGH_PRECISION;
-    if(write(i2cFile, writeCmd, 1) != 1)
+    // Write precision we want
+    i2cBatchInit(&batch);
+    queueTempAndHumidityCommand(&batch);
+    if(!i2cBusTransfer(bus, &batch))
     {
         //printf("Failed to write desired precision to SHT41");
         return false;
     }
+    markTempAndHumidityTriggered(triggeredAt);
+    return true;
+}
 
-    struct timespec ts;
-    ts.tv_sec = 0;
-    ts.tv_nsec = SHT41_HIGH_PRECISION_WAIT_MS * 1000000;
-    nanosleep(&ts, NULL);
+bool collectTempAndHumidityFromDevice(I2C_BUS * bus, const struct timespec * triggeredAt)
+{
+    I2C_BATCH batch;
+    struct timespec ready;
+
+    getTempAndHumidityReadyTime(bus, triggeredAt, &ready);
+    i2cBusWaitUntil(bus, &ready);
 
-    if(read(i2cFile, rawData, SHT41_READ_BYTES) != SHT41_READ_BYTES)
+    i2cBatchInit(&batch);
+    queueTempAndHumidityRead(&batch);
+    if(!i2cBusTransfer(bus, &batch))
     {
         // Failed to read
         //printf("Failed to read data from SHT41\n");
@@ -35,13 +106,97 @@ bool readTempAndHumidityFromDevice(int i2cFile)
     return true;
 }
 
+// For callers that send the command in a shared batch: call right after the transfer
+void markTempAndHumidityTriggered(struct timespec * triggeredAt)
+{
+    clock_gettime(CLOCK_MONOTONIC, triggeredAt);
+}
+
+void getTempAndHumidityReadyTime(I2C_BUS * bus, const struct timespec * triggeredAt, struct timespec * ready)
+{
+    i2cBusConversionDeadline(bus, triggeredAt, measureWaitMs, ready);
+}
+
+// The measurement command and the result read can each ride along in a batch with
+// other sensors, as long as the conversion wait sits between the two transfers.
+// Both return the message index for i2cBatchMessageOk(), or -1 if the batch is full.
+int queueTempAndHumidityCommand(I2C_BATCH * batch)
+{
+    return i2cBatchAddWrite(batch, SHT41_ADDR, measureCmd, sizeof(measureCmd));
+}
+
+int queueTempAndHumidityRead(I2C_BATCH * batch)
+{
+    return queueTempAndHumidityReadInto(batch, rawData);
+}
+
+// As queueAqiDataReadInto(), frame holds SHT41_READ_BYTES
+int queueTempAndHumidityReadInto(I2C_BATCH * batch, uint8_t * frame)
+{
+    return i2cBatchAddRead(batch, SHT41_ADDR, frame, SHT41_READ_BYTES);
+}
+
 bool getTempAndHumidityData(TEMP_HUMIDITY_DATA *data)
 {
-    float rawTemperature;
-    float rawHumidity;
+    return decodeTempAndHumidityData(rawData, data);
+}
+
+// The last result read, for handing off to another thread to decode
+const uint8_t * getTempAndHumidityRawData(void)
+{
+    return rawData;
+}
+
+// Leaves data alone and returns false when either word fails its CRC
+bool decodeTempAndHumidityData(const uint8_t * frame, TEMP_HUMIDITY_DATA * data)
+{
+    uint16_t temperatureTicks;
+    uint16_t humidityTicks;
 
-    // Raw temperature data is bytes 0 and 1, byte 2 is checksum (ignored for now)
-    rawTemperature = (rawData[0] * 256) + rawData[1];
+    if(!decodeTempAndHumidityTicks(frame, &temperatureTicks, &humidityTicks))
+    {
+        return false;
+    }
+    convertTempAndHumidityTicks(temperatureTicks, humidityTicks, data);
+    return true;
+}
+
+bool decodeTempAndHumidityTicks(const uint8_t * frame, uint16_t * temperatureTicks, uint16_t * humidityTicks)
+{
+    if(!checkTempAndHumidityFrame(frame))
+    {
+        return false;
+    }
+
+    // Raw temperature data is bytes 0 and 1, byte 2 is its CRC
+    *temperatureTicks = (frame[0] << 8) | frame[1];
+
+    // Raw humidity data is bytes 3 and 4, byte 5 is its CRC
+    *humidityTicks = (frame[3] << 8) | frame[4];
+    return true;
+}
+
+bool checkTempAndHumidityFrame(const uint8_t * frame)
+{
+    return tempAndHumidityCrc(&frame[0], 2) == frame[2] && tempAndHumidityCrc(&frame[3], 2) == frame[5];
+}
+
+uint8_t tempAndHumidityCrc(const uint8_t * data, size_t length)
+{
+    uint8_t crc = SHT41_CRC_INIT;
+
+    for(size_t idx = 0; idx < length; idx++)
+    {
+        crc = crcTable[crc ^ data[idx]];
+    }
+    return crc;
+}
+
+// Kept separate from the frame decode so logged ticks convert exactly as live readings do
+void convertTempAndHumidityTicks(uint16_t temperatureTicks, uint16_t humidityTicks, TEMP_HUMIDITY_DATA * data)
+{
+    float rawTemperature = temperatureTicks;
+    float rawHumidity = humidityTicks;
 
     // Conversion to degrees F from datasheet: -49 + 315 * (rawTemperature / 65535)
     data->temperatureF = -49 + (315 * rawTemperature / 65535);
@@ -49,9 +204,6 @@ bool getTempAndHumidityData(TEMP_HUMIDITY_DATA *data)
     // Conversion to degree C from datasheet: -45 + 175 * (rawTemperature / 65535)
     data->temperatureC = -45 + (175 * rawTemperature / 65535);
 
-    // Raw humidity data is bytes 3 and 4, byte 5 is checksum (ignored for now)
-    rawHumidity = (rawData[3] * 256) + rawData[4];
-
     // Conversion to % relative humidity from datasheet: -6 + 125*(rawHumidity / 65535)
     data->humidity = -6 + ( 125 * rawHumidity / 65535 );
     
@@ -64,6 +216,49 @@ bool getTempAndHumidityData(TEMP_HUMIDITY_DATA *data)
     {
         data->humidity = 0;
     }
+}
 
-    return true;
+// Same arithmetic as convertTempAndHumidityTicks(), SHT41_BATCH_LANES ticks at a time
+void convertTempAndHumidityTicksBatch(const uint16_t * temperatureTicks, const uint16_t * humidityTicks, TEMP_HUMIDITY_DATA * data, size_t count)
+{
+    SHT41_TICKS ticks;
+    SHT41_FLOATS rawTemperature;
+    SHT41_FLOATS rawHumidity;
+    SHT41_FLOATS temperatureF;
+    SHT41_FLOATS temperatureC;
+    SHT41_FLOATS humidity;
+    SHT41_MASK crop;
+    const SHT41_FLOATS empty = {0};
+    const SHT41_FLOATS full = empty + 100;
+    size_t idx;
+
+    for(idx = 0; idx + SHT41_BATCH_LANES <= count; idx += SHT41_BATCH_LANES)
+    {
+        memcpy(&ticks, &temperatureTicks[idx], sizeof(ticks));
+        rawTemperature = __builtin_convertvector(ticks, SHT41_FLOATS);
+        memcpy(&ticks, &humidityTicks[idx], sizeof(ticks));
+        rawHumidity = __builtin_convertvector(ticks, SHT41_FLOATS);
+
+        temperatureF = -49 + (315 * rawTemperature / 65535);
+        temperatureC = -45 + (175 * rawTemperature / 65535);
+        humidity = -6 + (125 * rawHumidity / 65535);
+
+        // Crop relative humidity to bounds (0%-100%)
+        crop = humidity > 100;
+        humidity = (SHT41_FLOATS)(((SHT41_MASK)humidity & ~crop) | ((SHT41_MASK)full & crop));
+        crop = humidity < 0;
+        humidity = (SHT41_FLOATS)(((SHT41_MASK)humidity & ~crop) | ((SHT41_MASK)empty & crop));
+
+        for(size_t lane = 0; lane < SHT41_BATCH_LANES; lane++)
+        {
+            data[idx + lane].temperatureF = temperatureF[lane];
+            data[idx + lane].temperatureC = temperatureC[lane];
+            data[idx + lane].humidity = humidity[lane];
+        }
+    }
+
+    for(; idx < count; idx++)
+    {
+        convertTempAndHumidityTicks(temperatureTicks[idx], humidityTicks[idx], &data[idx]);
+    }
 }
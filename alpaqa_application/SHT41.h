@@ -4,16 +4,29 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
-#include <sys/ioctl.h>
 #include <time.h>
-#include <linux/i2c-dev.h>
-#include <unistd.h>
+
+#include "i2cBus.h"
 
 #define SHT41_ADDR 0x44
 #define SHT41_HIGH_PRECISION 0xFD
+#define SHT41_MEDIUM_PRECISION 0xF6
+#define SHT41_LOW_PRECISION 0xE0
 #define SHT41_READ_BYTES 6
+// CRC-8 from the SHT4x datasheet: polynomial 0x31, init 0xFF, no reflection
+#define SHT41_CRC_POLYNOMIAL 0x31
+#define SHT41_CRC_INIT 0xFF
 
 #define SHT41_HIGH_PRECISION_WAIT_MS 9
+#define SHT41_MEDIUM_PRECISION_WAIT_MS 5
+#define SHT41_LOW_PRECISION_WAIT_MS 2
+
+typedef enum
+{
+    SHT41_PRECISION_HIGH = 0,
+    SHT41_PRECISION_MEDIUM,
+    SHT41_PRECISION_LOW
+} SHT41_PRECISION;
 
 typedef struct 
 {
@@ -22,7 +35,22 @@ typedef struct
     float humidity;
 } TEMP_HUMIDITY_DATA;
 
-bool readTempAndHumidityFromDevice(int i2cFile);
+bool readTempAndHumidityFromDevice(I2C_BUS * bus);
+bool triggerTempAndHumidityMeasurement(I2C_BUS * bus, struct timespec * triggeredAt);
+bool collectTempAndHumidityFromDevice(I2C_BUS * bus, const struct timespec * triggeredAt);
+void markTempAndHumidityTriggered(struct timespec * triggeredAt);
+void getTempAndHumidityReadyTime(I2C_BUS * bus, const struct timespec * triggeredAt, struct timespec * ready);
+void setTempAndHumidityPrecision(SHT41_PRECISION precision);
+int queueTempAndHumidityCommand(I2C_BATCH * batch);
+int queueTempAndHumidityRead(I2C_BATCH * batch);
+int queueTempAndHumidityReadInto(I2C_BATCH * batch, uint8_t * frame);
 bool getTempAndHumidityData(TEMP_HUMIDITY_DATA *data);
+const uint8_t * getTempAndHumidityRawData(void);
+bool decodeTempAndHumidityData(const uint8_t * frame, TEMP_HUMIDITY_DATA * data);
+bool decodeTempAndHumidityTicks(const uint8_t * frame, uint16_t * temperatureTicks, uint16_t * humidityTicks);
+bool checkTempAndHumidityFrame(const uint8_t * frame);
+uint8_t tempAndHumidityCrc(const uint8_t * data, size_t length);
+void convertTempAndHumidityTicks(uint16_t temperatureTicks, uint16_t humidityTicks, TEMP_HUMIDITY_DATA * data);
+void convertTempAndHumidityTicksBatch(const uint16_t * temperatureTicks, const uint16_t * humidityTicks, TEMP_HUMIDITY_DATA * data, size_t count);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,663 @@
+#define _GNU_SOURCE
+#include "alpaqaAcquisition.h"
+#include "alpaqaLatency.h"
+#include "alpaqaTime.h"
+#include "PMSA003I.h"
+#include "SHT41.h"
+
+#include <errno.h>
+#include <math.h>
+#include <sched.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+// Status fields are plain integers written by one thread and read by others.
+// Relaxed atomics keep each field whole without any locking on the sampling path.
+#define publish(acquisition, field, value) __atomic_store_n(&(acquisition)->status.field, (value), __ATOMIC_RELAXED)
+#define observe(acquisition, field) __atomic_load_n(&(acquisition)->status.field, __ATOMIC_RELAXED)
+
+// Weight of the newest reading in the running level and spread, so they follow the
+// last dozen or so readings
+#define TREND_WEIGHT 0.125f
+
+static void * acquisitionThread(void * arg);
+static void applyThreadPolicy(ALPAQA_ACQUISITION * acquisition);
+static void pmDue(void * context);
+static void shtDue(void * context);
+static void shtCollectDue(void * context);
+static void stopRequested(void * context);
+static void flushBatch(void * context);
+static bool transferLocation(ALPAQA_ACQUISITION * acquisition, uint32_t idx, bool * triggered);
+static void pushFrame(ALPAQA_ACQUISITION * acquisition, uint8_t location, ALPAQA_SENSOR sensor, bool ok, const uint8_t * data, uint16_t length,
+                      uint64_t deadlineNs, uint64_t timestampNs, uint64_t realtimeNs);
+static void publishStatus(ALPAQA_ACQUISITION * acquisition);
+static void trackParticulateMatter(ALPAQA_ACQUISITION * acquisition, ACQUISITION_SENSORS * sensors);
+static void trackTemperature(ALPAQA_ACQUISITION * acquisition, ACQUISITION_SENSORS * sensors);
+static bool trackReading(uint32_t * readings, float * mean, float * variance, float value, float threshold);
+static bool locationsSteady(const ALPAQA_ACQUISITION * acquisition);
+static void adaptPeriods(ALPAQA_ACQUISITION * acquisition, bool sampled);
+
+bool acquisitionStart(ALPAQA_ACQUISITION * acquisition, const ALPAQA_ACQUISITION_CONFIG * config)
+{
+    sigset_t allSignals;
+    sigset_t previousSignals;
+    int result;
+
+    memset(acquisition, 0, sizeof(ALPAQA_ACQUISITION));
+    acquisition->config = *config;
+    acquisition->scheduler.epollFd = -1;
+    acquisition->notifyFd = -1;
+    acquisition->stopFd = -1;
+    atomic_init(&acquisition->stopping, false);
+
+    if(acquisition->config.locationCount > ACQUISITION_MAX_LOCATIONS)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    if(acquisition->config.locationCount == 0)
+    {
+        acquisition->config.locations[0].location = 0;
+        acquisition->config.locations[0].muxChannel = I2C_MUX_NONE;
+        acquisition->config.locationCount = 1;
+    }
+
+    // Stretches go in doubling steps, the last one capped at the longest period allowed
+    acquisition->maxPeriodScale = 1;
+    if(config->pmPeriodMs > 0 && config->adaptivePeriodMaxMs > config->pmPeriodMs)
+    {
+        acquisition->maxPeriodScale = config->adaptivePeriodMaxMs / config->pmPeriodMs;
+    }
+    if(config->shtPeriodMs == 0 || acquisition->config.pmSteadyThreshold <= 0 || acquisition->config.temperatureSteadyThreshold <= 0)
+    {
+        acquisition->maxPeriodScale = 1;
+    }
+    acquisition->status.periodScale = 1;
+
+    if(!ringInit(&acquisition->ring, ACQUISITION_RING_SIZE, sizeof(ALPAQA_FRAME)))
+    {
+        return false;
+    }
+
+    acquisition->notifyFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    acquisition->stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(acquisition->notifyFd < 0 || acquisition->stopFd < 0)
+    {
+        acquisitionStop(acquisition);
+        return false;
+    }
+
+    // Each sensor runs on its own absolute schedule. Reads that come due on the same
+    // wakeup are sent together by flushBatch() once all of them have been queued.
+    if(!schedulerInit(&acquisition->scheduler) ||
+    (acquisition->pmSchedule = schedulerAddPeriodic(&acquisition->scheduler, "PMSA003I", config->pmPeriodMs * NS_PER_MS, pmDue, acquisition)) < 0 ||
+    (acquisition->shtSchedule = schedulerAddPeriodic(&acquisition->scheduler, "SHT41", config->shtPeriodMs * NS_PER_MS, shtDue, acquisition)) < 0 ||
+    (acquisition->shtCollectSchedule = schedulerAddOneShot(&acquisition->scheduler, "SHT41 collect", shtCollectDue, acquisition)) < 0 ||
+    schedulerAddFd(&acquisition->scheduler, "Stop", acquisition->stopFd, stopRequested, acquisition) < 0)
+    {
+        acquisitionStop(acquisition);
+        return false;
+    }
+    schedulerSetAfterDispatch(&acquisition->scheduler, flushBatch, acquisition);
+
+    // Signals are for the main thread, keep them away from the sampling loop
+    sigfillset(&allSignals);
+    pthread_sigmask(SIG_BLOCK, &allSignals, &previousSignals);
+    result = pthread_create(&acquisition->thread, NULL, acquisitionThread, acquisition);
+    pthread_sigmask(SIG_SETMASK, &previousSignals, NULL);
+
+    if(result != 0)
+    {
+        errno = result;
+        acquisitionStop(acquisition);
+        return false;
+    }
+    acquisition->threadStarted = true;
+    return true;
+}
+
+void acquisitionStop(ALPAQA_ACQUISITION * acquisition)
+{
+    uint64_t one = 1;
+
+    if(acquisition->threadStarted)
+    {
+        atomic_store(&acquisition->stopping, true);
+        if(write(acquisition->stopFd, &one, sizeof(one)) != sizeof(one))
+        {
+            // The flag alone still stops the thread on its next wakeup
+        }
+        pthread_join(acquisition->thread, NULL);
+        acquisition->threadStarted = false;
+    }
+
+    schedulerClose(&acquisition->scheduler);
+    if(acquisition->notifyFd >= 0)
+    {
+        close(acquisition->notifyFd);
+        acquisition->notifyFd = -1;
+    }
+    if(acquisition->stopFd >= 0)
+    {
+        close(acquisition->stopFd);
+        acquisition->stopFd = -1;
+    }
+    ringFree(&acquisition->ring);
+}
+
+// Readable whenever frames have been pushed since the last acquisitionClearNotify()
+int acquisitionNotifyFd(const ALPAQA_ACQUISITION * acquisition)
+{
+    return acquisition->notifyFd;
+}
+
+void acquisitionClearNotify(ALPAQA_ACQUISITION * acquisition)
+{
+    uint64_t count;
+
+    if(read(acquisition->notifyFd, &count, sizeof(count)) != sizeof(count))
+    {
+        // Nothing pending
+    }
+}
+
+bool acquisitionPop(ALPAQA_ACQUISITION * acquisition, ALPAQA_FRAME * frame)
+{
+    return ringPop(&acquisition->ring, frame);
+}
+
+void acquisitionGetStatus(ALPAQA_ACQUISITION * acquisition, ALPAQA_ACQUISITION_STATUS * status)
+{
+    status->bus.syscalls = observe(acquisition, bus.syscalls);
+    status->bus.transfers = observe(acquisition, bus.transfers);
+    status->bus.messages = observe(acquisition, bus.messages);
+    status->bus.failures = observe(acquisition, bus.failures);
+    status->bus.totalNs = observe(acquisition, bus.totalNs);
+    status->bus.maxNs = observe(acquisition, bus.maxNs);
+    status->pmSamples = observe(acquisition, pmSamples);
+    status->shtSamples = observe(acquisition, shtSamples);
+    status->pmMissed = observe(acquisition, pmMissed);
+    status->shtMissed = observe(acquisition, shtMissed);
+    status->shtSkipped = observe(acquisition, shtSkipped);
+    status->periodScale = observe(acquisition, periodScale);
+    status->periodChanges = observe(acquisition, periodChanges);
+    status->pmSamplesFixed = observe(acquisition, pmSamplesFixed);
+    status->wakeups = observe(acquisition, wakeups);
+    status->pmRetries = observe(acquisition, pmRetries);
+    status->pmRejected = observe(acquisition, pmRejected);
+    status->shtRejected = observe(acquisition, shtRejected);
+    status->maxLatenessNs = observe(acquisition, maxLatenessNs);
+    status->conversionLastNs = observe(acquisition, conversionLastNs);
+    status->conversionTotalNs = observe(acquisition, conversionTotalNs);
+    status->conversionMaxNs = observe(acquisition, conversionMaxNs);
+    status->framesDropped = ringDropped(&acquisition->ring);
+    status->pinned = observe(acquisition, pinned);
+    status->realtime = observe(acquisition, realtime);
+    status->finished = observe(acquisition, finished);
+}
+
+void jitterRecord(JITTER_STATS * stats, const ALPAQA_FRAME * frame)
+{
+    uint64_t lateNs = frame->timestampNs > frame->deadlineNs ? frame->timestampNs - frame->deadlineNs : 0;
+
+    if(stats->count == 0 || lateNs < stats->minNs)
+    {
+        stats->minNs = lateNs;
+    }
+    if(lateNs > stats->maxNs)
+    {
+        stats->maxNs = lateNs;
+    }
+    stats->count++;
+    stats->sumNs += lateNs;
+    stats->sumSquaresNs += (double)lateNs * lateNs;
+}
+
+double jitterMeanUs(const JITTER_STATS * stats)
+{
+    return stats->count > 0 ? stats->sumNs / stats->count / 1000.0 : 0.0;
+}
+
+double jitterStdDevUs(const JITTER_STATS * stats)
+{
+    double mean;
+    double variance;
+
+    if(stats->count < 2)
+    {
+        return 0.0;
+    }
+    mean = stats->sumNs / stats->count;
+    variance = (stats->sumSquaresNs / stats->count) - (mean * mean);
+    return variance > 0 ? sqrt(variance) / 1000.0 : 0.0;
+}
+
+static void * acquisitionThread(void * arg)
+{
+    ALPAQA_ACQUISITION * acquisition = arg;
+    uint64_t one = 1;
+
+    applyThreadPolicy(acquisition);
+
+    while(!atomic_load(&acquisition->stopping))
+    {
+        if(!schedulerRunOnce(&acquisition->scheduler))
+        {
+            break;
+        }
+        publish(acquisition, wakeups, acquisition->status.wakeups + 1);
+    }
+
+    publish(acquisition, finished, true);
+    publishStatus(acquisition);
+    if(write(acquisition->notifyFd, &one, sizeof(one)) != sizeof(one))
+    {
+        // Consumer is already due to wake up
+    }
+    return NULL;
+}
+
+// Pinning and real-time priority are best effort, the status shows what took effect
+static void applyThreadPolicy(ALPAQA_ACQUISITION * acquisition)
+{
+    if(acquisition->config.cpu >= 0)
+    {
+        cpu_set_t cpus;
+
+        CPU_ZERO(&cpus);
+        CPU_SET(acquisition->config.cpu, &cpus);
+        publish(acquisition, pinned, pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0);
+    }
+
+    if(acquisition->config.fifoPriority > 0)
+    {
+        struct sched_param param;
+
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = acquisition->config.fifoPriority;
+        publish(acquisition, realtime, pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0);
+    }
+}
+
+static void pmDue(void * context)
+{
+    ALPAQA_ACQUISITION * acquisition = context;
+
+    acquisition->pmQueued = true;
+    acquisition->pmDeadlineNs = schedulerGet(&acquisition->scheduler, acquisition->pmSchedule)->deadlineNs;
+}
+
+static void shtDue(void * context)
+{
+    ALPAQA_ACQUISITION * acquisition = context;
+
+    // A conversion still in flight means the period is shorter than the conversion time
+    if(acquisition->shtPending)
+    {
+        publish(acquisition, shtSkipped, acquisition->status.shtSkipped + 1);
+        return;
+    }
+    acquisition->shtCommandQueued = true;
+    acquisition->shtDeadlineNs = schedulerGet(&acquisition->scheduler, acquisition->shtSchedule)->deadlineNs;
+}
+
+static void shtCollectDue(void * context)
+{
+    ALPAQA_ACQUISITION * acquisition = context;
+
+    acquisition->shtReadQueued = true;
+}
+
+static void stopRequested(void * context)
+{
+    ALPAQA_ACQUISITION * acquisition = context;
+    uint64_t count;
+
+    if(read(acquisition->stopFd, &count, sizeof(count)) != sizeof(count))
+    {
+        // The stopping flag is what matters
+    }
+}
+
+// Sends everything the schedules queued on this wakeup, one transfer per location, and
+// hands the results to the consumer
+static void flushBatch(void * context)
+{
+    ALPAQA_ACQUISITION * acquisition = context;
+    bool pushed = false;
+    bool triggered = false;
+    uint64_t one = 1;
+
+    if(!acquisition->pmQueued && !acquisition->shtCommandQueued && !acquisition->shtReadQueued)
+    {
+        return;
+    }
+
+    for(uint32_t idx = 0; idx < acquisition->config.locationCount; idx++)
+    {
+        pushed |= transferLocation(acquisition, idx, &triggered);
+    }
+
+    // Collected once the last conversion started is done
+    if(triggered)
+    {
+        struct timespec ready;
+
+        getTempAndHumidityReadyTime(acquisition->config.bus, &acquisition->shtTriggered, &ready);
+        acquisition->shtPending = schedulerArmAt(&acquisition->scheduler, acquisition->shtCollectSchedule, timespecToNs(&ready));
+    }
+
+    if(acquisition->pmQueued)
+    {
+        publish(acquisition, pmSamples, acquisition->status.pmSamples + 1);
+        publish(acquisition, pmSamplesFixed, acquisition->status.pmSamplesFixed + acquisition->status.periodScale);
+        if(acquisition->config.maxPmSamples != 0 && acquisition->status.pmSamples >= acquisition->config.maxPmSamples)
+        {
+            atomic_store(&acquisition->stopping, true);
+        }
+    }
+    if(acquisition->shtReadQueued)
+    {
+        acquisition->shtPending = false;
+        publish(acquisition, shtSamples, acquisition->status.shtSamples + 1);
+    }
+    adaptPeriods(acquisition, acquisition->pmQueued);
+
+    acquisition->pmQueued = false;
+    acquisition->shtCommandQueued = false;
+    acquisition->shtReadQueued = false;
+
+    publishStatus(acquisition);
+
+    // One wakeup for the consumer per flush, however many frames it produced
+    if(pushed && write(acquisition->notifyFd, &one, sizeof(one)) != sizeof(one))
+    {
+        // Counter is already pending, the consumer will drain everything
+    }
+}
+
+// Everything due for one location goes in a single transfer, after the mux has been
+// switched to its channel. Returns whether any frames were pushed.
+static bool transferLocation(ALPAQA_ACQUISITION * acquisition, uint32_t idx, bool * triggered)
+{
+    const ACQUISITION_LOCATION * location = &acquisition->config.locations[idx];
+    ACQUISITION_SENSORS * sensors = &acquisition->sensors[idx];
+    bool recordLatency = acquisition->config.recordLatency;
+    I2C_BATCH batch;
+    uint64_t startNs;
+    uint64_t doneNs;
+    uint64_t doneRealtimeNs;
+    bool pmOk;
+    bool shtOk;
+    bool pushed = false;
+
+    i2cBatchInit(&batch);
+    sensors->pmMessage = acquisition->pmQueued ? queueAqiDataReadInto(&batch, sensors->pmFrame) : -1;
+    sensors->shtCommandMessage = acquisition->shtCommandQueued ? queueTempAndHumidityCommand(&batch) : -1;
+    sensors->shtReadMessage = acquisition->shtReadQueued && sensors->shtStarted ?
+                              queueTempAndHumidityReadInto(&batch, sensors->shtFrame) : -1;
+    if(batch.count == 0)
+    {
+        return false;
+    }
+
+    // A channel that cannot be selected fails every message behind it, the batch
+    // starts out with all of them failed
+    startNs = monotonicNowNs();
+    if(location->muxChannel == I2C_MUX_NONE || i2cMuxSelect(acquisition->config.bus, location->muxChannel))
+    {
+        i2cBusTransfer(acquisition->config.bus, &batch);
+    }
+    doneNs = monotonicNowNs();
+    doneRealtimeNs = realtimeNowNs();
+    if(recordLatency)
+    {
+        latencyRecord(LATENCY_I2C_TRANSFER, doneNs - startNs);
+    }
+
+    if(sensors->shtCommandMessage >= 0)
+    {
+        sensors->shtStarted = i2cBatchMessageOk(&batch, sensors->shtCommandMessage);
+        if(sensors->shtStarted)
+        {
+            // The measurement is taken now, the result only arrives once the conversion is done
+            markTempAndHumidityTriggered(&acquisition->shtTriggered);
+            sensors->shtTriggeredNs = doneNs;
+            sensors->shtRealtimeNs = doneRealtimeNs;
+            *triggered = true;
+        }
+        else
+        {
+            pushFrame(acquisition, location->location, SENSOR_SHT41, false, NULL, 0, acquisition->shtDeadlineNs, doneNs,
+                      doneRealtimeNs);
+            pushed = true;
+        }
+    }
+
+    if(sensors->pmMessage >= 0)
+    {
+        // Deadline to the bus being free for the read, the wakeup and any queued work
+        if(recordLatency && idx == 0)
+        {
+            latencyRecord(LATENCY_SAMPLE_LATENESS, startNs > acquisition->pmDeadlineNs ? startNs - acquisition->pmDeadlineNs : 0);
+        }
+        // Only the frame is read again, the mux is still on this channel and nothing
+        // else in the batch has to be repeated
+        pmOk = i2cBatchMessageOk(&batch, sensors->pmMessage);
+        if(pmOk && checkParticulateMatterFrame(sensors->pmFrame) != PMSA003I_FRAME_OK)
+        {
+            publish(acquisition, pmRetries, acquisition->status.pmRetries + 1);
+            pmOk = readAqiDataInto(acquisition->config.bus, sensors->pmFrame);
+            // Still bad after the retry: pushed as a failed read so it neither shows the
+            // sensor as connected nor feeds the steady air tracking
+            if(pmOk && checkParticulateMatterFrame(sensors->pmFrame) != PMSA003I_FRAME_OK)
+            {
+                publish(acquisition, pmRejected, acquisition->status.pmRejected + 1);
+                pmOk = false;
+            }
+        }
+        if(pmOk && acquisition->maxPeriodScale > 1)
+        {
+            trackParticulateMatter(acquisition, sensors);
+        }
+        pushFrame(acquisition, location->location, SENSOR_PMSA003I, pmOk,
+                  sensors->pmFrame, PMSA003I_READ_BYTES, acquisition->pmDeadlineNs, doneNs, doneRealtimeNs);
+        pushed = true;
+    }
+
+    if(sensors->shtReadMessage >= 0)
+    {
+        uint64_t conversionNs = doneNs - sensors->shtTriggeredNs;
+
+        sensors->shtStarted = false;
+        shtOk = i2cBatchMessageOk(&batch, sensors->shtReadMessage);
+        if(shtOk && !checkTempAndHumidityFrame(sensors->shtFrame))
+        {
+            publish(acquisition, shtRejected, acquisition->status.shtRejected + 1);
+            shtOk = false;
+        }
+        else if(shtOk && acquisition->maxPeriodScale > 1)
+        {
+            trackTemperature(acquisition, sensors);
+        }
+        pushFrame(acquisition, location->location, SENSOR_SHT41, shtOk,
+                  sensors->shtFrame, SHT41_READ_BYTES, acquisition->shtDeadlineNs, sensors->shtTriggeredNs, sensors->shtRealtimeNs);
+        pushed = true;
+
+        if(recordLatency)
+        {
+            latencyRecord(LATENCY_SHT_CONVERSION, conversionNs);
+        }
+        publish(acquisition, conversionLastNs, conversionNs);
+        publish(acquisition, conversionTotalNs, acquisition->status.conversionTotalNs + conversionNs);
+        if(conversionNs > acquisition->status.conversionMaxNs)
+        {
+            publish(acquisition, conversionMaxNs, conversionNs);
+        }
+    }
+    return pushed;
+}
+
+static void pushFrame(ALPAQA_ACQUISITION * acquisition, uint8_t location, ALPAQA_SENSOR sensor, bool ok, const uint8_t * data,
+                      uint16_t length, uint64_t deadlineNs, uint64_t timestampNs, uint64_t realtimeNs)
+{
+    ALPAQA_FRAME frame;
+
+    frame.deadlineNs = deadlineNs;
+    frame.timestampNs = timestampNs;
+    frame.realtimeNs = realtimeNs;
+    frame.location = location;
+    frame.sensor = sensor;
+    frame.ok = ok;
+    frame.length = length;
+    if(data != NULL && length > 0)
+    {
+        memcpy(frame.data, data, length);
+    }
+
+    // A full ring drops the frame, the consumer sees that in the dropped count
+    ringPush(&acquisition->ring, &frame);
+}
+
+static void publishStatus(ALPAQA_ACQUISITION * acquisition)
+{
+    const I2C_BUS_STATS * bus = &acquisition->config.bus->stats;
+    const ALPAQA_SCHEDULE * pm = schedulerGet(&acquisition->scheduler, acquisition->pmSchedule);
+    const ALPAQA_SCHEDULE * sht = schedulerGet(&acquisition->scheduler, acquisition->shtSchedule);
+
+    publish(acquisition, bus.syscalls, bus->syscalls);
+    publish(acquisition, bus.transfers, bus->transfers);
+    publish(acquisition, bus.messages, bus->messages);
+    publish(acquisition, bus.failures, bus->failures);
+    publish(acquisition, bus.totalNs, bus->totalNs);
+    publish(acquisition, bus.maxNs, bus->maxNs);
+    publish(acquisition, pmMissed, pm->missed);
+    publish(acquisition, shtMissed, sht->missed);
+    publish(acquisition, maxLatenessNs, pm->maxLatenessNs > sht->maxLatenessNs ? pm->maxLatenessNs : sht->maxLatenessNs);
+}
+
+static void trackParticulateMatter(ALPAQA_ACQUISITION * acquisition, ACQUISITION_SENSORS * sensors)
+{
+    PMSA003I_FRAME_DATA data;
+
+    // A frame that failed its checksum twice tells nothing about the air
+    if(decodeParticulateMatterFrame(sensors->pmFrame, &data) &&
+       trackReading(&sensors->pmReadings, &sensors->pmMean, &sensors->pmVariance, data.pm2_5,
+                    acquisition->config.pmSteadyThreshold))
+    {
+        acquisition->readingJumped = true;
+    }
+}
+
+static void trackTemperature(ALPAQA_ACQUISITION * acquisition, ACQUISITION_SENSORS * sensors)
+{
+    TEMP_HUMIDITY_DATA data;
+    uint16_t temperatureTicks;
+    uint16_t humidityTicks;
+
+    if(decodeTempAndHumidityTicks(sensors->shtFrame, &temperatureTicks, &humidityTicks))
+    {
+        convertTempAndHumidityTicks(temperatureTicks, humidityTicks, &data);
+        if(trackReading(&sensors->temperatureReadings, &sensors->temperatureMean, &sensors->temperatureVariance,
+                        data.temperatureC, acquisition->config.temperatureSteadyThreshold))
+        {
+            acquisition->readingJumped = true;
+        }
+    }
+}
+
+// Exponentially weighted level and spread of one reading. Returns whether the reading
+// landed far enough from the level to count as a change, once there is a level to go by.
+static bool trackReading(uint32_t * readings, float * mean, float * variance, float value, float threshold)
+{
+    float delta = value - *mean;
+    bool jumped = *readings >= ACQUISITION_STEADY_SAMPLES && fabsf(delta) > ACQUISITION_CHANGE_THRESHOLDS * threshold;
+
+    if(*readings == 0)
+    {
+        *mean = value;
+        *variance = 0;
+    }
+    else
+    {
+        *mean += TREND_WEIGHT * delta;
+        *variance = (1.0f - TREND_WEIGHT) * (*variance + (TREND_WEIGHT * delta * delta));
+    }
+    if(*readings < UINT32_MAX)
+    {
+        (*readings)++;
+    }
+    return jumped;
+}
+
+// Steady once every location has enough readings of both kinds and none of them is
+// spread wider than its threshold. A sensor that never gives a good reading is left
+// out rather than holding the rate up.
+static bool locationsSteady(const ALPAQA_ACQUISITION * acquisition)
+{
+    float pmThreshold = acquisition->config.pmSteadyThreshold;
+    float temperatureThreshold = acquisition->config.temperatureSteadyThreshold;
+
+    for(uint32_t idx = 0; idx < acquisition->config.locationCount; idx++)
+    {
+        const ACQUISITION_SENSORS * sensors = &acquisition->sensors[idx];
+
+        if((sensors->pmReadings > 0 &&
+            (sensors->pmReadings < ACQUISITION_STEADY_SAMPLES || sensors->pmVariance >= pmThreshold * pmThreshold)) ||
+           (sensors->temperatureReadings > 0 &&
+            (sensors->temperatureReadings < ACQUISITION_STEADY_SAMPLES ||
+             sensors->temperatureVariance >= temperatureThreshold * temperatureThreshold)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Runs after every flush. Any change goes straight back to the configured periods,
+// so the next sample is at most one of them away. Steady air doubles them every
+// ACQUISITION_STEADY_SAMPLES samples. Both schedules stay on the grid of the
+// configured periods, so PMSA003I and SHT41 still share their wakeups.
+static void adaptPeriods(ALPAQA_ACQUISITION * acquisition, bool sampled)
+{
+    uint32_t scale = acquisition->status.periodScale;
+
+    if(acquisition->maxPeriodScale <= 1)
+    {
+        return;
+    }
+
+    if(acquisition->readingJumped || !locationsSteady(acquisition))
+    {
+        acquisition->steadySamples = 0;
+        scale = 1;
+    }
+    else if(sampled && ++acquisition->steadySamples >= ACQUISITION_STEADY_SAMPLES)
+    {
+        acquisition->steadySamples = 0;
+        scale = scale * 2 < acquisition->maxPeriodScale ? scale * 2 : acquisition->maxPeriodScale;
+    }
+    acquisition->readingJumped = false;
+
+    if(scale == acquisition->status.periodScale)
+    {
+        return;
+    }
+    // Both schedules move together or neither does, the scale tried again next flush
+    if(!schedulerSetPeriod(&acquisition->scheduler, acquisition->pmSchedule,
+                           (uint64_t)acquisition->config.pmPeriodMs * scale * NS_PER_MS))
+    {
+        return;
+    }
+    if(!schedulerSetPeriod(&acquisition->scheduler, acquisition->shtSchedule,
+                           (uint64_t)acquisition->config.shtPeriodMs * scale * NS_PER_MS))
+    {
+        schedulerSetPeriod(&acquisition->scheduler, acquisition->pmSchedule,
+                           (uint64_t)acquisition->config.pmPeriodMs * acquisition->status.periodScale * NS_PER_MS);
+        return;
+    }
+    publish(acquisition, periodScale, scale);
+    publish(acquisition, periodChanges, acquisition->status.periodChanges + 1);
+}
@@ -0,0 +1,194 @@
+#ifndef ALPAQAACQUISITION_H
+#define ALPAQAACQUISITION_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "i2cBus.h"
+#include "alpaqaRing.h"
+#include "alpaqaScheduler.h"
+
+#define ACQUISITION_FRAME_BYTES 32
+#define ACQUISITION_RING_SIZE 1024
+// One location per mux channel at most
+#define ACQUISITION_MAX_LOCATIONS I2C_MUX_CHANNELS
+// Adaptive sampling doubles the periods after this many steady PMSA003I samples in a
+// row, and goes straight back to the configured ones when a reading moves by more
+// than this many thresholds
+#define ACQUISITION_STEADY_SAMPLES 8
+#define ACQUISITION_CHANGE_THRESHOLDS 3
+// Standard deviations under which the air counts as steady, ug/m^3 and degrees C
+#define ACQUISITION_DEFAULT_PM_STEADY 1.0f
+#define ACQUISITION_DEFAULT_TEMPERATURE_STEADY 0.1f
+
+typedef enum
+{
+    SENSOR_PMSA003I = 0,
+    SENSOR_SHT41,
+    SENSOR_COUNT
+} ALPAQA_SENSOR;
+
+// One raw sensor read as it came off the bus. Decoding happens on the consumer side
+// so the acquisition thread does nothing but bus work and the checksum that decides
+// whether to read again. ok only says the bus transfer went through.
+typedef struct
+{
+    // When the sample was scheduled and when it was actually taken (CLOCK_MONOTONIC),
+    // plus the wall clock time of the sample for logging
+    uint64_t deadlineNs;
+    uint64_t timestampNs;
+    uint64_t realtimeNs;
+    uint8_t location;
+    uint8_t sensor;
+    bool ok;
+    uint16_t length;
+    uint8_t data[ACQUISITION_FRAME_BYTES];
+} ALPAQA_FRAME;
+
+// A PMSA003I and SHT41 pair, on the bus itself or behind a mux channel
+typedef struct
+{
+    // Tagged on its frames so the consumer can tell locations apart
+    uint8_t location;
+    // I2C_MUX_NONE when the sensors are wired to the bus itself
+    int muxChannel;
+} ACQUISITION_LOCATION;
+
+typedef struct
+{
+    I2C_BUS * bus;
+    // No locations means one, location 0, on the bus itself
+    ACQUISITION_LOCATION locations[ACQUISITION_MAX_LOCATIONS];
+    uint32_t locationCount;
+    // Latency stages take one writer each, so with a thread per bus only one of them records
+    bool recordLatency;
+    uint32_t pmPeriodMs;
+    uint32_t shtPeriodMs;
+    // While the PM2.5 and temperature of every location stay steady, both periods
+    // stretch by the same factor until PMSA003I is sampled this often. 0 keeps them fixed.
+    uint32_t adaptivePeriodMaxMs;
+    float pmSteadyThreshold;
+    float temperatureSteadyThreshold;
+    // Stop after this many PMSA003I samples, 0 runs until acquisitionStop()
+    uint64_t maxPmSamples;
+    // CPU to pin the thread to, -1 leaves it to the kernel
+    int cpu;
+    // SCHED_FIFO priority, 0 keeps normal scheduling
+    int fifoPriority;
+} ALPAQA_ACQUISITION_CONFIG;
+
+// Written only by the acquisition thread, read from anywhere through acquisitionGetStatus()
+typedef struct
+{
+    I2C_BUS_STATS bus;
+    uint64_t pmSamples;
+    uint64_t shtSamples;
+    uint64_t pmMissed;
+    uint64_t shtMissed;
+    uint64_t shtSkipped;
+    // How far adaptive sampling has stretched both periods, 1 at the configured rate.
+    // A stretched PMSA003I sample stands in for that many at the configured rate, the
+    // fixed count adds them up for comparison.
+    uint32_t periodScale;
+    uint64_t periodChanges;
+    uint64_t pmSamplesFixed;
+    // Passes through the sampling loop, every one of them a wakeup of the thread
+    uint64_t wakeups;
+    // Frames that came off the bus but failed their checksum. A PMSA003I frame is
+    // read once more on its own and only rejected if that fails too. An SHT41 result
+    // can only be read once, so it is rejected straight away.
+    uint64_t pmRetries;
+    uint64_t pmRejected;
+    uint64_t shtRejected;
+    uint64_t maxLatenessNs;
+    // SHT41 measurement command to result, the longest transaction chain in a sample
+    uint64_t conversionLastNs;
+    uint64_t conversionTotalNs;
+    uint64_t conversionMaxNs;
+    uint64_t framesDropped;
+    bool pinned;
+    bool realtime;
+    bool finished;
+} ALPAQA_ACQUISITION_STATUS;
+
+// Sampling jitter: how far after its deadline each sample was actually taken
+typedef struct
+{
+    uint64_t count;
+    uint64_t minNs;
+    uint64_t maxNs;
+    double sumNs;
+    double sumSquaresNs;
+} JITTER_STATS;
+
+// Each location reads into buffers of its own, and the SHT41s are triggered and
+// collected together, one transfer per location
+typedef struct
+{
+    int pmMessage;
+    int shtCommandMessage;
+    int shtReadMessage;
+    bool shtStarted;
+    uint64_t shtTriggeredNs;
+    uint64_t shtRealtimeNs;
+    uint8_t pmFrame[ACQUISITION_FRAME_BYTES];
+    uint8_t shtFrame[ACQUISITION_FRAME_BYTES];
+    // Recent level and spread of the good readings, for adaptive sampling
+    uint32_t pmReadings;
+    float pmMean;
+    float pmVariance;
+    uint32_t temperatureReadings;
+    float temperatureMean;
+    float temperatureVariance;
+} ACQUISITION_SENSORS;
+
+typedef struct
+{
+    ALPAQA_ACQUISITION_CONFIG config;
+    ALPAQA_SCHEDULER scheduler;
+    ALPAQA_RING ring;
+    int notifyFd;
+    int stopFd;
+    pthread_t thread;
+    bool threadStarted;
+    atomic_bool stopping;
+
+    int pmSchedule;
+    int shtSchedule;
+    int shtCollectSchedule;
+
+    // What the schedules that came due on the current wakeup asked for, sent by flushBatch()
+    bool pmQueued;
+    bool shtCommandQueued;
+    bool shtReadQueued;
+    bool shtPending;
+    // The last SHT41 triggered, which the collect has to wait for
+    struct timespec shtTriggered;
+    uint64_t shtDeadlineNs;
+    uint64_t pmDeadlineNs;
+    ACQUISITION_SENSORS sensors[ACQUISITION_MAX_LOCATIONS];
+
+    // 1 when adaptive sampling is off
+    uint32_t maxPeriodScale;
+    uint32_t steadySamples;
+    // Set by a reading far from its recent level, cleared once the periods are reset
+    bool readingJumped;
+
+    ALPAQA_ACQUISITION_STATUS status;
+} ALPAQA_ACQUISITION;
+
+bool acquisitionStart(ALPAQA_ACQUISITION * acquisition, const ALPAQA_ACQUISITION_CONFIG * config);
+void acquisitionStop(ALPAQA_ACQUISITION * acquisition);
+int acquisitionNotifyFd(const ALPAQA_ACQUISITION * acquisition);
+void acquisitionClearNotify(ALPAQA_ACQUISITION * acquisition);
+bool acquisitionPop(ALPAQA_ACQUISITION * acquisition, ALPAQA_FRAME * frame);
+void acquisitionGetStatus(ALPAQA_ACQUISITION * acquisition, ALPAQA_ACQUISITION_STATUS * status);
+
+void jitterRecord(JITTER_STATS * stats, const ALPAQA_FRAME * frame);
+double jitterMeanUs(const JITTER_STATS * stats);
+double jitterStdDevUs(const JITTER_STATS * stats);
+
+#endif
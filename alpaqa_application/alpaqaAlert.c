@@ -0,0 +1,454 @@
+#include "alpaqaAlert.h"
+#include "alpaqaTime.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RULE_DELIMITERS " \t\r\n"
+
+static const char * channelNames[ALERT_CHANNEL_COUNT] =
+{
+    "pm1_0",
+    "pm2_5",
+    "pm10_0",
+    "instant_aqi",
+    "aqi",
+    "nowcast_aqi",
+    "temperature_f",
+    "humidity",
+    "heat_index"
+};
+
+static const char * kindNames[] = {"above", "below", "rises", "falls"};
+
+static bool parseName(const char * token, char * name);
+static bool parseChannel(const char * token, uint8_t * channel);
+static bool parseKind(const char * token, uint8_t * kind);
+static bool parseFloat(const char * token, float * value);
+static bool parseSeconds(const char * token, uint64_t * ns);
+static bool evaluateRule(const ALERT_RULE * rule, ALERT_STATE * state, float value, uint64_t timeNs, float * measured);
+static float windowChange(const ALERT_RULE * rule, ALERT_STATE * state, float value, uint64_t timeNs);
+
+void alertsInit(ALPAQA_ALERTS * alerts)
+{
+    memset(alerts, 0, sizeof(ALPAQA_ALERTS));
+}
+
+// One rule per line:
+//   NAME CHANNEL above|below LEVEL [clear LEVEL] [for SECONDS]
+//   NAME CHANNEL rises|falls CHANGE within SECONDS [clear CHANGE] [for SECONDS]
+// The clear level defaults to the raise level, set it back from there for hysteresis.
+bool alertsAddRule(ALPAQA_ALERTS * alerts, const char * line)
+{
+    char copy[ALERT_LINE_SIZE];
+    ALERT_RULE rule;
+    char * save = NULL;
+    char * token;
+    bool clearGiven = false;
+    bool rate;
+
+    if(alerts->compiled || alerts->ruleCount >= ALERT_MAX_RULES)
+    {
+        errno = alerts->compiled ? EBUSY : ENOSPC;
+        return false;
+    }
+    if(strlen(line) >= sizeof(copy))
+    {
+        errno = EINVAL;
+        return false;
+    }
+    strcpy(copy, line);
+    memset(&rule, 0, sizeof(rule));
+
+    if(!parseName(strtok_r(copy, RULE_DELIMITERS, &save), rule.name) ||
+       !parseChannel(strtok_r(NULL, RULE_DELIMITERS, &save), &rule.channel) ||
+       !parseKind(strtok_r(NULL, RULE_DELIMITERS, &save), &rule.kind) ||
+       !parseFloat(strtok_r(NULL, RULE_DELIMITERS, &save), &rule.raise))
+    {
+        errno = EINVAL;
+        return false;
+    }
+    rate = rule.kind == ALERT_RISES || rule.kind == ALERT_FALLS;
+
+    while((token = strtok_r(NULL, RULE_DELIMITERS, &save)) != NULL)
+    {
+        const char * value = strtok_r(NULL, RULE_DELIMITERS, &save);
+        bool parsed;
+
+        if(strcmp(token, "clear") == 0)
+        {
+            parsed = parseFloat(value, &rule.clear);
+            clearGiven = true;
+        }
+        else if(strcmp(token, "for") == 0)
+        {
+            parsed = parseSeconds(value, &rule.holdNs);
+        }
+        else if(strcmp(token, "within") == 0 && rate)
+        {
+            parsed = parseSeconds(value, &rule.windowNs);
+        }
+        else
+        {
+            parsed = false;
+        }
+        if(!parsed)
+        {
+            errno = EINVAL;
+            return false;
+        }
+    }
+
+    if(!clearGiven)
+    {
+        rule.clear = rule.raise;
+    }
+    // The clear level has to be on the near side of the raise level, or the alert
+    // would clear the moment it was raised
+    if((rule.kind == ALERT_BELOW ? rule.clear < rule.raise : rule.clear > rule.raise) ||
+       (rate && (rule.raise <= 0 || rule.windowNs < NS_PER_SECOND)))
+    {
+        errno = EINVAL;
+        return false;
+    }
+    rule.bucketNs = rate ? rule.windowNs / ALERT_RATE_BUCKETS : 0;
+
+    alerts->rules[alerts->ruleCount++] = rule;
+    return true;
+}
+
+// Blank lines and anything after a # are skipped. On a bad rule, errorLine is its line number.
+bool alertsLoad(ALPAQA_ALERTS * alerts, const char * filename, uint32_t * errorLine)
+{
+    char line[ALERT_LINE_SIZE];
+    FILE * file;
+    uint32_t lineNumber = 0;
+
+    *errorLine = 0;
+    file = fopen(filename, "r");
+    if(file == NULL)
+    {
+        return false;
+    }
+
+    while(fgets(line, sizeof(line), file) != NULL)
+    {
+        char * comment = strchr(line, '#');
+        char * start = line;
+
+        lineNumber++;
+        if(strchr(line, '\n') == NULL && !feof(file))
+        {
+            *errorLine = lineNumber;
+            fclose(file);
+            errno = EINVAL;
+            return false;
+        }
+        if(comment != NULL)
+        {
+            *comment = '\0';
+        }
+        while(isspace((unsigned char)*start))
+        {
+            start++;
+        }
+        if(*start != '\0' && !alertsAddRule(alerts, start))
+        {
+            *errorLine = lineNumber;
+            fclose(file);
+            return false;
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+// Sorts the rules by channel, keeping their order within one, and sets up the state
+// every location keeps for each of them. Rules can no longer be added after this.
+bool alertsCompile(ALPAQA_ALERTS * alerts, uint32_t locationCount)
+{
+    ALERT_RULE rule;
+    uint32_t next = 0;
+
+    for(uint32_t idx = 1; idx < alerts->ruleCount; idx++)
+    {
+        uint32_t slot = idx;
+
+        rule = alerts->rules[idx];
+        while(slot > 0 && alerts->rules[slot - 1].channel > rule.channel)
+        {
+            alerts->rules[slot] = alerts->rules[slot - 1];
+            slot--;
+        }
+        alerts->rules[slot] = rule;
+    }
+
+    for(int channel = 0; channel < ALERT_CHANNEL_COUNT; channel++)
+    {
+        alerts->channelFirst[channel] = next;
+        while(next < alerts->ruleCount && alerts->rules[next].channel == channel)
+        {
+            next++;
+        }
+    }
+    alerts->channelFirst[ALERT_CHANNEL_COUNT] = next;
+
+    alerts->states = calloc(locationCount > 0 && alerts->ruleCount > 0 ? locationCount * alerts->ruleCount : 1,
+                            sizeof(ALERT_STATE));
+    if(alerts->states == NULL)
+    {
+        return false;
+    }
+    alerts->locationCount = locationCount;
+    alerts->compiled = true;
+    return true;
+}
+
+// values is indexed by channel and only read for the channels in channelMask. timeNs
+// is CLOCK_MONOTONIC, for hold times and rate windows, realtimeNs goes on the events.
+// events needs room for ALERT_MAX_RULES. Returns how many alerts were raised or cleared.
+uint32_t alertsEvaluate(ALPAQA_ALERTS * alerts, uint32_t location, uint32_t channelMask, const float * values,
+                        uint64_t timeNs, uint64_t realtimeNs, ALERT_EVENT * events)
+{
+    ALERT_STATE * states;
+    uint32_t count = 0;
+
+    if(!alerts->compiled || location >= alerts->locationCount)
+    {
+        return 0;
+    }
+    states = &alerts->states[location * alerts->ruleCount];
+
+    channelMask &= (1u << ALERT_CHANNEL_COUNT) - 1;
+    while(channelMask != 0)
+    {
+        int channel = __builtin_ctz(channelMask);
+
+        channelMask &= channelMask - 1;
+        for(uint32_t idx = alerts->channelFirst[channel]; idx < alerts->channelFirst[channel + 1]; idx++)
+        {
+            float measured;
+
+            if(!evaluateRule(&alerts->rules[idx], &states[idx], values[channel], timeNs, &measured))
+            {
+                continue;
+            }
+            events[count].realtimeNs = realtimeNs;
+            events[count].location = location;
+            events[count].rule = idx;
+            events[count].raised = states[idx].active;
+            events[count].value = measured;
+            count++;
+            if(states[idx].active)
+            {
+                alerts->active++;
+                alerts->raised++;
+            }
+            else
+            {
+                alerts->active--;
+                alerts->cleared++;
+            }
+        }
+    }
+    return count;
+}
+
+// One line of key=value pairs. Names and channels are plain words, so a shell hook
+// can eval the line as it is.
+int alertsFormatEvent(const ALPAQA_ALERTS * alerts, const ALERT_EVENT * event, char * buffer, size_t size)
+{
+    const ALERT_RULE * rule = &alerts->rules[event->rule];
+    bool rate = rule->kind == ALERT_RISES || rule->kind == ALERT_FALLS;
+
+    return snprintf(buffer, size, "time=%llu.%03llu alert=%s state=%s location=%u channel=%s %s=%0.1f\n",
+                    (unsigned long long)(event->realtimeNs / NS_PER_SECOND),
+                    (unsigned long long)((event->realtimeNs % NS_PER_SECOND) / NS_PER_MS),
+                    rule->name, event->raised ? "raised" : "cleared", event->location,
+                    channelNames[rule->channel], rate ? "change" : "value", event->value);
+}
+
+const char * alertsChannelName(ALERT_CHANNEL channel)
+{
+    return channel < ALERT_CHANNEL_COUNT ? channelNames[channel] : "unknown";
+}
+
+void alertsFree(ALPAQA_ALERTS * alerts)
+{
+    free(alerts->states);
+    alertsInit(alerts);
+}
+
+static bool parseName(const char * token, char * name)
+{
+    size_t length;
+
+    if(token == NULL || (length = strlen(token)) == 0 || length >= ALERT_NAME_SIZE)
+    {
+        return false;
+    }
+    for(size_t idx = 0; idx < length; idx++)
+    {
+        if(!isalnum((unsigned char)token[idx]) && token[idx] != '_' && token[idx] != '-' && token[idx] != '.')
+        {
+            return false;
+        }
+    }
+    strcpy(name, token);
+    return true;
+}
+
+static bool parseChannel(const char * token, uint8_t * channel)
+{
+    for(int idx = 0; token != NULL && idx < ALERT_CHANNEL_COUNT; idx++)
+    {
+        if(strcmp(token, channelNames[idx]) == 0)
+        {
+            *channel = idx;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool parseKind(const char * token, uint8_t * kind)
+{
+    for(size_t idx = 0; token != NULL && idx < sizeof(kindNames) / sizeof(kindNames[0]); idx++)
+    {
+        if(strcmp(token, kindNames[idx]) == 0)
+        {
+            *kind = idx;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool parseFloat(const char * token, float * value)
+{
+    char * end;
+
+    if(token == NULL)
+    {
+        return false;
+    }
+    *value = strtof(token, &end);
+    return end != token && *end == '\0' && isfinite(*value);
+}
+
+static bool parseSeconds(const char * token, uint64_t * ns)
+{
+    float seconds;
+
+    // Up to a month, which is as far back as anything else in the app looks
+    if(!parseFloat(token, &seconds) || seconds < 0 || seconds > 31.0f * 24 * 60 * 60)
+    {
+        return false;
+    }
+    *ns = (uint64_t)((double)seconds * NS_PER_SECOND);
+    return true;
+}
+
+// Returns whether the alert was raised or cleared by this value. measured is what the
+// rule compared: the value itself, or its change over the window.
+static bool evaluateRule(const ALERT_RULE * rule, ALERT_STATE * state, float value, uint64_t timeNs, float * measured)
+{
+    bool beyond;
+    bool back;
+
+    *measured = value;
+    switch(rule->kind)
+    {
+        case ALERT_ABOVE:
+            beyond = value > rule->raise;
+            back = value < rule->clear;
+            break;
+        case ALERT_BELOW:
+            beyond = value < rule->raise;
+            back = value > rule->clear;
+            break;
+        default:
+            *measured = windowChange(rule, state, value, timeNs);
+            beyond = *measured >= rule->raise;
+            back = *measured < rule->clear;
+            break;
+    }
+
+    if(state->active)
+    {
+        if(!back)
+        {
+            return false;
+        }
+        state->active = false;
+        state->pending = false;
+        return true;
+    }
+
+    if(!beyond)
+    {
+        state->pending = false;
+        return false;
+    }
+    if(!state->pending)
+    {
+        state->pending = true;
+        state->pendingSinceNs = timeNs;
+    }
+    if(timeNs - state->pendingSinceNs < rule->holdNs)
+    {
+        return false;
+    }
+    state->active = true;
+    state->pending = false;
+    return true;
+}
+
+// The window slides a bucket at a time, so the low and high cover between the window
+// and the window plus one bucket of samples
+static float windowChange(const ALERT_RULE * rule, ALERT_STATE * state, float value, uint64_t timeNs)
+{
+    uint64_t bucket = timeNs / rule->bucketNs;
+    uint32_t slot;
+    float low = value;
+    float high = value;
+
+    // Starting out, or after a gap longer than the window, there is nothing to keep
+    if(!state->started || bucket >= state->newestBucket + ALERT_RATE_BUCKETS)
+    {
+        for(uint32_t idx = 0; idx < ALERT_RATE_BUCKETS; idx++)
+        {
+            state->bucketMin[idx] = INFINITY;
+            state->bucketMax[idx] = -INFINITY;
+        }
+        state->started = true;
+        state->newestBucket = bucket;
+    }
+    while(state->newestBucket < bucket)
+    {
+        state->newestBucket++;
+        state->bucketMin[state->newestBucket % ALERT_RATE_BUCKETS] = INFINITY;
+        state->bucketMax[state->newestBucket % ALERT_RATE_BUCKETS] = -INFINITY;
+    }
+    // A sample timed before the newest one goes in with it
+    slot = (bucket > state->newestBucket ? bucket : state->newestBucket) % ALERT_RATE_BUCKETS;
+
+    if(value < state->bucketMin[slot])
+    {
+        state->bucketMin[slot] = value;
+    }
+    if(value > state->bucketMax[slot])
+    {
+        state->bucketMax[slot] = value;
+    }
+    for(uint32_t idx = 0; idx < ALERT_RATE_BUCKETS; idx++)
+    {
+        low = state->bucketMin[idx] < low ? state->bucketMin[idx] : low;
+        high = state->bucketMax[idx] > high ? state->bucketMax[idx] : high;
+    }
+    return rule->kind == ALERT_RISES ? value - low : high - value;
+}
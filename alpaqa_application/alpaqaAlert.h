@@ -0,0 +1,110 @@
+#ifndef ALPAQAALERT_H
+#define ALPAQAALERT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ALERT_MAX_RULES 32
+#define ALERT_NAME_SIZE 24
+// A rate rule keeps the low and high of its window in this many buckets
+#define ALERT_RATE_BUCKETS 16
+#define ALERT_LINE_SIZE 256
+// Longest event line alertsFormatEvent() writes
+#define ALERT_MESSAGE_SIZE 160
+
+typedef enum
+{
+    ALERT_PM1_0 = 0,
+    ALERT_PM2_5,
+    ALERT_PM10_0,
+    ALERT_INSTANT_AQI,
+    ALERT_AQI,
+    ALERT_NOWCAST_AQI,
+    ALERT_TEMPERATURE_F,
+    ALERT_HUMIDITY,
+    ALERT_HEAT_INDEX,
+    ALERT_CHANNEL_COUNT
+} ALERT_CHANNEL;
+
+// What each frame type brings, for the channel mask handed to alertsEvaluate()
+#define ALERT_PM_CHANNELS ((1u << ALERT_PM1_0) | (1u << ALERT_PM2_5) | (1u << ALERT_PM10_0) | (1u << ALERT_INSTANT_AQI) | \
+                           (1u << ALERT_AQI) | (1u << ALERT_NOWCAST_AQI))
+#define ALERT_SHT_CHANNELS ((1u << ALERT_TEMPERATURE_F) | (1u << ALERT_HUMIDITY) | (1u << ALERT_HEAT_INDEX))
+
+typedef enum
+{
+    ALERT_ABOVE = 0,
+    ALERT_BELOW,
+    // Change from the low (rises) or high (falls) of the window to the newest value
+    ALERT_RISES,
+    ALERT_FALLS
+} ALERT_KIND;
+
+// A rule as compiled from a line of the rules file. An alert is raised once its
+// condition has held for holdNs, and cleared only once the value is back past the
+// clear level, so a reading hovering at the raise level does not flap.
+typedef struct
+{
+    char name[ALERT_NAME_SIZE];
+    uint8_t channel;
+    uint8_t kind;
+    float raise;
+    float clear;
+    uint64_t holdNs;
+    // Rate rules only
+    uint64_t windowNs;
+    uint64_t bucketNs;
+} ALERT_RULE;
+
+typedef struct
+{
+    bool active;
+    bool pending;
+    uint64_t pendingSinceNs;
+    // Rate rules only: bucket numbers are time / bucketNs
+    bool started;
+    uint64_t newestBucket;
+    float bucketMin[ALERT_RATE_BUCKETS];
+    float bucketMax[ALERT_RATE_BUCKETS];
+} ALERT_STATE;
+
+typedef struct
+{
+    uint64_t realtimeNs;
+    uint8_t location;
+    uint8_t rule;
+    bool raised;
+    float value;
+} ALERT_EVENT;
+
+// Rules are added as text, then compiled once into a table sorted by channel. A
+// sample only visits the rules on the channels it updated, each with its own state
+// per location.
+typedef struct
+{
+    ALERT_RULE rules[ALERT_MAX_RULES];
+    uint32_t ruleCount;
+    // The rules on channel c are rules[channelFirst[c]] up to rules[channelFirst[c + 1]]
+    uint8_t channelFirst[ALERT_CHANNEL_COUNT + 1];
+    uint32_t locationCount;
+    // locationCount * ruleCount of them, location major
+    ALERT_STATE * states;
+    bool compiled;
+
+    uint32_t active;
+    uint64_t raised;
+    uint64_t cleared;
+} ALPAQA_ALERTS;
+
+void alertsInit(ALPAQA_ALERTS * alerts);
+bool alertsAddRule(ALPAQA_ALERTS * alerts, const char * line);
+bool alertsLoad(ALPAQA_ALERTS * alerts, const char * filename, uint32_t * errorLine);
+bool alertsCompile(ALPAQA_ALERTS * alerts, uint32_t locationCount);
+uint32_t alertsEvaluate(ALPAQA_ALERTS * alerts, uint32_t location, uint32_t channelMask, const float * values,
+                        uint64_t timeNs, uint64_t realtimeNs, ALERT_EVENT * events);
+int alertsFormatEvent(const ALPAQA_ALERTS * alerts, const ALERT_EVENT * event, char * buffer, size_t size);
+const char * alertsChannelName(ALERT_CHANNEL channel);
+void alertsFree(ALPAQA_ALERTS * alerts);
+
+#endif
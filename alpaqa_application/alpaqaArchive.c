@@ -0,0 +1,537 @@
+#include "alpaqaArchive.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define VARINT_MAX_BYTES 10
+// Sanity limit on what a reader allocates for a block
+#define ARCHIVE_MAX_BLOCK_RECORDS (1 << 20)
+
+#define GATHER(field) for(uint32_t idx = 0; idx < count; idx++) { values[idx] = records[idx].field; }
+#define SCATTER(field, type) for(uint32_t idx = 0; idx < count; idx++) { records[idx].field = (type)values[idx]; }
+
+static bool encodeBlock(FILE * file, const ALPAQA_LOG_RECORD * records, uint32_t count, int64_t * values,
+                        uint8_t * locations, uint8_t * columns);
+static uint32_t encodeColumn(const int64_t * values, const uint8_t * locations, uint32_t count, bool deltaOfDelta,
+                             uint8_t * out);
+static bool decodeBlock(ALPAQA_ARCHIVE_READER * reader, const ARCHIVE_BLOCK_HEADER * block, const uint8_t * data);
+static bool decodeColumn(const uint8_t * in, uint32_t size, const uint8_t * locations, uint32_t count, bool deltaOfDelta,
+                         int64_t * values);
+static void gatherColumn(ARCHIVE_COLUMN column, const ALPAQA_LOG_RECORD * records, uint32_t count, int64_t * values);
+static void scatterColumn(ARCHIVE_COLUMN column, ALPAQA_LOG_RECORD * records, uint32_t count, const int64_t * values);
+
+static inline uint64_t zigzag(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static inline uint8_t * writeVarint(uint8_t * cursor, uint64_t value)
+{
+    while(value >= 0x80)
+    {
+        *cursor++ = (uint8_t)value | 0x80;
+        value >>= 7;
+    }
+    *cursor++ = (uint8_t)value;
+    return cursor;
+}
+
+// Nearly every value fits in one byte, that case is kept to a compare and a load
+static inline bool readVarint(const uint8_t ** cursor, const uint8_t * end, uint64_t * value)
+{
+    const uint8_t * in = *cursor;
+    uint64_t result = 0;
+
+    if(in < end && *in < 0x80)
+    {
+        *value = *in;
+        *cursor = in + 1;
+        return true;
+    }
+    for(uint32_t shift = 0; in < end && shift < 64; shift += 7)
+    {
+        uint8_t byte = *in++;
+
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if(byte < 0x80)
+        {
+            *value = result;
+            *cursor = in;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Written beside the target, synced and renamed over it, so an archive is either
+// complete or not there. The log itself is left alone.
+bool archiveEncodeLog(const char * logFilename, const char * archiveFilename, uint64_t * archiveBytes)
+{
+    ALPAQA_LOG_READER reader;
+    ALPAQA_ARCHIVE_HEADER header;
+    char tempFilename[PATH_MAX];
+    ALPAQA_LOG_RECORD * records;
+    int64_t * values;
+    uint8_t * locations;
+    uint8_t * columns;
+    FILE * file;
+    bool written = true;
+
+    if(snprintf(tempFilename, sizeof(tempFilename), "%s.tmp", archiveFilename) >= (int)sizeof(tempFilename))
+    {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+    if(!alpaqaLogReaderOpen(&reader, logFilename))
+    {
+        return false;
+    }
+
+    records = malloc(ARCHIVE_BLOCK_RECORDS * sizeof(ALPAQA_LOG_RECORD));
+    values = malloc(ARCHIVE_BLOCK_RECORDS * sizeof(int64_t));
+    locations = malloc(ARCHIVE_BLOCK_RECORDS);
+    columns = malloc(ARCHIVE_COLUMNS * ARCHIVE_BLOCK_RECORDS * VARINT_MAX_BYTES);
+    file = fopen(tempFilename, "w");
+    if(records == NULL || values == NULL || locations == NULL || columns == NULL || file == NULL)
+    {
+        written = false;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ALPAQA_ARCHIVE_MAGIC, ALPAQA_LOG_MAGIC_SIZE);
+    header.version = ALPAQA_ARCHIVE_VERSION;
+    header.headerSize = sizeof(ALPAQA_ARCHIVE_HEADER);
+    header.columns = ARCHIVE_COLUMNS;
+    header.blockRecords = ARCHIVE_BLOCK_RECORDS;
+    header.createdNs = reader.header->createdNs;
+    header.records = reader.count;
+    written = written && fwrite(&header, sizeof(header), 1, file) == 1;
+
+    // Older record versions come out of the reader with the newer fields zeroed
+    for(uint64_t first = 0; written && first < reader.count; first += ARCHIVE_BLOCK_RECORDS)
+    {
+        uint32_t count = reader.count - first < ARCHIVE_BLOCK_RECORDS ? reader.count - first : ARCHIVE_BLOCK_RECORDS;
+
+        for(uint32_t idx = 0; idx < count; idx++)
+        {
+            records[idx] = *alpaqaLogReaderGet(&reader, first + idx);
+        }
+        written = encodeBlock(file, records, count, values, locations, columns);
+    }
+
+    if(file != NULL)
+    {
+        written = written && fflush(file) == 0 && fsync(fileno(file)) == 0;
+        if(archiveBytes != NULL)
+        {
+            *archiveBytes = ftell(file);
+        }
+        if(fclose(file) != 0)
+        {
+            written = false;
+        }
+    }
+    free(records);
+    free(values);
+    free(locations);
+    free(columns);
+    alpaqaLogReaderClose(&reader);
+
+    if(!written || rename(tempFilename, archiveFilename) != 0)
+    {
+        unlink(tempFilename);
+        return false;
+    }
+    return true;
+}
+
+bool archiveReaderOpen(ALPAQA_ARCHIVE_READER * reader, const char * filename)
+{
+    struct stat fileStat;
+    void * map;
+    int fd;
+
+    memset(reader, 0, sizeof(ALPAQA_ARCHIVE_READER));
+
+    fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        return false;
+    }
+    if(fstat(fd, &fileStat) != 0 || (uint64_t)fileStat.st_size < sizeof(ALPAQA_ARCHIVE_HEADER))
+    {
+        close(fd);
+        errno = EINVAL;
+        return false;
+    }
+    map = mmap(NULL, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+    {
+        return false;
+    }
+    madvise(map, fileStat.st_size, MADV_SEQUENTIAL);
+
+    reader->map = map;
+    reader->mapSize = fileStat.st_size;
+    reader->header = map;
+    if(memcmp(reader->header->magic, ALPAQA_ARCHIVE_MAGIC, ALPAQA_LOG_MAGIC_SIZE) != 0 ||
+       reader->header->version != ALPAQA_ARCHIVE_VERSION || reader->header->columns != ARCHIVE_COLUMNS ||
+       reader->header->headerSize < sizeof(ALPAQA_ARCHIVE_HEADER) || reader->header->headerSize > reader->mapSize ||
+       reader->header->blockRecords == 0 || reader->header->blockRecords > ARCHIVE_MAX_BLOCK_RECORDS)
+    {
+        archiveReaderClose(reader);
+        errno = EINVAL;
+        return false;
+    }
+
+    reader->records = malloc(reader->header->blockRecords * sizeof(ALPAQA_LOG_RECORD));
+    reader->values = malloc(reader->header->blockRecords * sizeof(int64_t));
+    reader->locations = malloc(reader->header->blockRecords);
+    if(reader->records == NULL || reader->values == NULL || reader->locations == NULL)
+    {
+        archiveReaderClose(reader);
+        return false;
+    }
+    reader->nextBlock = reader->header->headerSize;
+    return true;
+}
+
+// Decodes the next block and hands all of its records over at once, 0 at the end.
+// The records are good until the next call.
+uint32_t archiveReaderNextBlock(ALPAQA_ARCHIVE_READER * reader, const ALPAQA_LOG_RECORD ** records)
+{
+    ARCHIVE_BLOCK_HEADER block;
+    size_t dataStart;
+
+    reader->count = 0;
+    reader->next = 0;
+    if(reader->corrupt || reader->nextBlock + sizeof(block) > reader->mapSize)
+    {
+        return 0;
+    }
+
+    // Column sizes are arbitrary, so block headers are not aligned
+    memcpy(&block, reader->map + reader->nextBlock, sizeof(block));
+    dataStart = reader->nextBlock + sizeof(block);
+    if(block.records == 0 || block.records > reader->header->blockRecords || block.size > reader->mapSize - dataStart ||
+       !decodeBlock(reader, &block, reader->map + dataStart))
+    {
+        reader->corrupt = true;
+        errno = EINVAL;
+        return 0;
+    }
+
+    reader->nextBlock = dataStart + block.size;
+    reader->count = block.records;
+    *records = reader->records;
+    return reader->count;
+}
+
+// One record at a time, decoding a block whenever the last one runs out
+const ALPAQA_LOG_RECORD * archiveReaderNext(ALPAQA_ARCHIVE_READER * reader)
+{
+    const ALPAQA_LOG_RECORD * records;
+
+    if(reader->next >= reader->count && archiveReaderNextBlock(reader, &records) == 0)
+    {
+        return NULL;
+    }
+    return &reader->records[reader->next++];
+}
+
+void archiveReaderClose(ALPAQA_ARCHIVE_READER * reader)
+{
+    if(reader->map != NULL)
+    {
+        munmap((void *)reader->map, reader->mapSize);
+    }
+    free(reader->records);
+    free(reader->values);
+    free(reader->locations);
+    memset(reader, 0, sizeof(ALPAQA_ARCHIVE_READER));
+}
+
+static bool encodeBlock(FILE * file, const ALPAQA_LOG_RECORD * records, uint32_t count, int64_t * values,
+                        uint8_t * locations, uint8_t * columns)
+{
+    ARCHIVE_BLOCK_HEADER block;
+    uint8_t * cursor = columns;
+
+    memset(&block, 0, sizeof(block));
+    block.records = count;
+    block.firstNs = alpaqaLogRecordTimeNs(&records[0]);
+    for(uint32_t idx = 0; idx < count; idx++)
+    {
+        uint64_t timeNs = alpaqaLogRecordTimeNs(&records[idx]);
+
+        locations[idx] = records[idx].location;
+        if(timeNs > block.maxNs)
+        {
+            block.maxNs = timeNs;
+        }
+    }
+
+    for(uint32_t column = 0; column < ARCHIVE_COLUMNS; column++)
+    {
+        gatherColumn(column, records, count, values);
+        block.columnSizes[column] = encodeColumn(values, column == ARCHIVE_LOCATION ? NULL : locations, count,
+                                                 column == ARCHIVE_TIME, cursor);
+        cursor += block.columnSizes[column];
+        block.size += block.columnSizes[column];
+    }
+
+    return fwrite(&block, sizeof(block), 1, file) == 1 && fwrite(columns, block.size, 1, file) == 1;
+}
+
+// Without locations every value is a delta from the one before it
+static uint32_t encodeColumn(const int64_t * values, const uint8_t * locations, uint32_t count, bool deltaOfDelta,
+                             uint8_t * out)
+{
+    int64_t previous[ARCHIVE_LOCATIONS] = {0};
+    int64_t previousDelta[ARCHIVE_LOCATIONS] = {0};
+    uint8_t * cursor = out;
+    uint64_t run = 0;
+
+    for(uint32_t idx = 0; idx < count; idx++)
+    {
+        uint8_t location = locations != NULL ? locations[idx] : 0;
+        int64_t delta = values[idx] - previous[location];
+
+        previous[location] = values[idx];
+        if(deltaOfDelta)
+        {
+            int64_t change = delta - previousDelta[location];
+
+            previousDelta[location] = delta;
+            delta = change;
+        }
+
+        if(delta == 0)
+        {
+            run++;
+            continue;
+        }
+        if(run > 0)
+        {
+            cursor = writeVarint(cursor, (run << 1) | 1);
+            run = 0;
+        }
+        cursor = writeVarint(cursor, zigzag(delta) << 1);
+    }
+    if(run > 0)
+    {
+        cursor = writeVarint(cursor, (run << 1) | 1);
+    }
+    return cursor - out;
+}
+
+static bool decodeBlock(ALPAQA_ARCHIVE_READER * reader, const ARCHIVE_BLOCK_HEADER * block, const uint8_t * data)
+{
+    uint32_t count = block->records;
+    const uint8_t * locations = reader->locations;
+    uint64_t total = 0;
+
+    for(uint32_t column = 0; column < ARCHIVE_COLUMNS; column++)
+    {
+        total += block->columnSizes[column];
+    }
+    if(total != block->size)
+    {
+        return false;
+    }
+
+    for(uint32_t column = 0; column < ARCHIVE_COLUMNS; column++)
+    {
+        if(!decodeColumn(data, block->columnSizes[column], column == ARCHIVE_LOCATION ? NULL : locations, count,
+                         column == ARCHIVE_TIME, reader->values))
+        {
+            return false;
+        }
+        if(column == ARCHIVE_LOCATION)
+        {
+            for(uint32_t idx = 0; idx < count; idx++)
+            {
+                if((uint64_t)reader->values[idx] >= ARCHIVE_LOCATIONS)
+                {
+                    return false;
+                }
+                reader->locations[idx] = reader->values[idx];
+            }
+            // Deltas per location are plain deltas when there is only one, and
+            // those decode without a lookup per value
+            if(memcmp(reader->locations, reader->locations + 1, count - 1) == 0)
+            {
+                locations = NULL;
+            }
+        }
+        scatterColumn(column, reader->records, count, reader->values);
+        data += block->columnSizes[column];
+    }
+    return true;
+}
+
+static bool decodeColumn(const uint8_t * in, uint32_t size, const uint8_t * locations, uint32_t count, bool deltaOfDelta,
+                         int64_t * values)
+{
+    int64_t previous[ARCHIVE_LOCATIONS] = {0};
+    int64_t previousDelta[ARCHIVE_LOCATIONS] = {0};
+    const uint8_t * end = in + size;
+    uint32_t idx = 0;
+
+    while(idx < count)
+    {
+        uint64_t token;
+
+        if(!readVarint(&in, end, &token))
+        {
+            return false;
+        }
+
+        if(token & 1)
+        {
+            uint64_t run = token >> 1;
+
+            if(run == 0 || run > count - idx)
+            {
+                return false;
+            }
+            // Nothing changed, a time column keeps its interval
+            for(uint32_t last = idx + run; idx < last; idx++)
+            {
+                uint8_t location = locations != NULL ? locations[idx] : 0;
+
+                previous[location] += deltaOfDelta ? previousDelta[location] : 0;
+                values[idx] = previous[location];
+            }
+        }
+        else
+        {
+            uint8_t location = locations != NULL ? locations[idx] : 0;
+            int64_t delta = unzigzag(token >> 1);
+
+            if(deltaOfDelta)
+            {
+                delta += previousDelta[location];
+                previousDelta[location] = delta;
+            }
+            previous[location] += delta;
+            values[idx++] = previous[location];
+        }
+    }
+    return in == end;
+}
+
+static void gatherColumn(ARCHIVE_COLUMN column, const ALPAQA_LOG_RECORD * records, uint32_t count, int64_t * values)
+{
+    switch(column)
+    {
+        case ARCHIVE_LOCATION:
+            GATHER(location);
+            break;
+        case ARCHIVE_TIME:
+            for(uint32_t idx = 0; idx < count; idx++)
+            {
+                values[idx] = ((int64_t)records[idx].timestampSeconds * 1000) + records[idx].timestampMs;
+            }
+            break;
+        case ARCHIVE_FLAGS:
+            GATHER(flags);
+            break;
+        case ARCHIVE_PM1_0:
+            GATHER(pm1_0);
+            break;
+        case ARCHIVE_PM2_5:
+            GATHER(pm2_5);
+            break;
+        case ARCHIVE_PM10_0:
+            GATHER(pm10_0);
+            break;
+        case ARCHIVE_TEMPERATURE_TICKS:
+            GATHER(temperatureTicks);
+            break;
+        case ARCHIVE_HUMIDITY_TICKS:
+            GATHER(humidityTicks);
+            break;
+        case ARCHIVE_INSTANT_AQI:
+            GATHER(instantAqi);
+            break;
+        case ARCHIVE_CALCULATED_AQI:
+            GATHER(calculatedAqi);
+            break;
+        case ARCHIVE_HEAT_INDEX:
+            GATHER(heatIndexCenti);
+            break;
+        case ARCHIVE_NOWCAST_AQI:
+            GATHER(nowcastAqi);
+            break;
+        case ARCHIVE_RESERVED:
+        default:
+            GATHER(reserved2);
+            break;
+    }
+}
+
+// The log writes milliseconds below 1000, so the time splits back exactly
+static void scatterColumn(ARCHIVE_COLUMN column, ALPAQA_LOG_RECORD * records, uint32_t count, const int64_t * values)
+{
+    switch(column)
+    {
+        case ARCHIVE_LOCATION:
+            SCATTER(location, uint8_t);
+            break;
+        case ARCHIVE_TIME:
+            for(uint32_t idx = 0; idx < count; idx++)
+            {
+                records[idx].timestampSeconds = (uint32_t)(values[idx] / 1000);
+                records[idx].timestampMs = (uint16_t)(values[idx] % 1000);
+            }
+            break;
+        case ARCHIVE_FLAGS:
+            SCATTER(flags, uint8_t);
+            break;
+        case ARCHIVE_PM1_0:
+            SCATTER(pm1_0, uint16_t);
+            break;
+        case ARCHIVE_PM2_5:
+            SCATTER(pm2_5, uint16_t);
+            break;
+        case ARCHIVE_PM10_0:
+            SCATTER(pm10_0, uint16_t);
+            break;
+        case ARCHIVE_TEMPERATURE_TICKS:
+            SCATTER(temperatureTicks, uint16_t);
+            break;
+        case ARCHIVE_HUMIDITY_TICKS:
+            SCATTER(humidityTicks, uint16_t);
+            break;
+        case ARCHIVE_INSTANT_AQI:
+            SCATTER(instantAqi, uint16_t);
+            break;
+        case ARCHIVE_CALCULATED_AQI:
+            SCATTER(calculatedAqi, uint16_t);
+            break;
+        case ARCHIVE_HEAT_INDEX:
+            SCATTER(heatIndexCenti, int16_t);
+            break;
+        case ARCHIVE_NOWCAST_AQI:
+            SCATTER(nowcastAqi, uint16_t);
+            break;
+        case ARCHIVE_RESERVED:
+        default:
+            SCATTER(reserved2, uint16_t);
+            break;
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef ALPAQAARCHIVE_H
+#define ALPAQAARCHIVE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "alpaqaLog.h"
+
+#define ALPAQA_ARCHIVE_MAGIC "AQARCHIV"
+#define ALPAQA_ARCHIVE_VERSION 1
+#define ALPAQA_ARCHIVE_SUFFIX ".aqz"
+// Records per block. Blocks are coded on their own, so a reader needs one in memory.
+#define ARCHIVE_BLOCK_RECORDS 4096
+#define ARCHIVE_LOCATIONS 256
+
+// Every record field has a column of its own in each block, so a channel that barely
+// moves is a run of zero deltas. Location comes first, the other columns are deltas
+// from the previous record of the same location.
+typedef enum
+{
+    ARCHIVE_LOCATION = 0,
+    // Milliseconds, stored as the change in the interval between samples
+    ARCHIVE_TIME,
+    ARCHIVE_FLAGS,
+    ARCHIVE_PM1_0,
+    ARCHIVE_PM2_5,
+    ARCHIVE_PM10_0,
+    ARCHIVE_TEMPERATURE_TICKS,
+    ARCHIVE_HUMIDITY_TICKS,
+    ARCHIVE_INSTANT_AQI,
+    ARCHIVE_CALCULATED_AQI,
+    ARCHIVE_HEAT_INDEX,
+    ARCHIVE_NOWCAST_AQI,
+    ARCHIVE_RESERVED,
+    ARCHIVE_COLUMNS
+} ARCHIVE_COLUMN;
+
+typedef struct
+{
+    char magic[ALPAQA_LOG_MAGIC_SIZE];
+    uint16_t version;
+    uint16_t headerSize;
+    uint16_t columns;
+    uint16_t reserved;
+    uint32_t blockRecords;
+    uint32_t reserved2;
+    // Creation time of the log the archive was made from
+    uint64_t createdNs;
+    uint64_t records;
+} ALPAQA_ARCHIVE_HEADER;
+
+// Column data follows in column order. Each column is a string of zigzag varints,
+// the low bit of which tells a delta (0) from a run of that many zero deltas (1).
+typedef struct
+{
+    uint32_t records;
+    uint32_t size;
+    uint64_t firstNs;
+    uint64_t maxNs;
+    uint32_t columnSizes[ARCHIVE_COLUMNS];
+    uint32_t reserved;
+} ARCHIVE_BLOCK_HEADER;
+
+typedef struct
+{
+    const uint8_t * map;
+    size_t mapSize;
+    const ALPAQA_ARCHIVE_HEADER * header;
+    size_t nextBlock;
+    ALPAQA_LOG_RECORD * records;
+    // One column of the block at a time
+    int64_t * values;
+    uint8_t * locations;
+    uint32_t count;
+    uint32_t next;
+    // Set when a block does not decode, reading stops there
+    bool corrupt;
+} ALPAQA_ARCHIVE_READER;
+
+bool archiveEncodeLog(const char * logFilename, const char * archiveFilename, uint64_t * archiveBytes);
+
+bool archiveReaderOpen(ALPAQA_ARCHIVE_READER * reader, const char * filename);
+uint32_t archiveReaderNextBlock(ALPAQA_ARCHIVE_READER * reader, const ALPAQA_LOG_RECORD ** records);
+const ALPAQA_LOG_RECORD * archiveReaderNext(ALPAQA_ARCHIVE_READER * reader);
+void archiveReaderClose(ALPAQA_ARCHIVE_READER * reader);
+
+#endif
@@ -1,4 +1,9 @@
 #include "alpaqaCalc.h"
+#include "alpaqaTime.h"
+
+#include <pthread.h>
+
+#define HEAT_INDEX_LANES 4
 
 typedef struct
 {
@@ -24,22 +29,167 @@ const BREAKPOINTS breakpoints_table[BREAKPOINT_TABLE_SIZE] =
     {{351, 500}, {505, 604}, {401, 500}}
 };
 
-static AQI_DATA aqiBuffer[AQI_BUFFER_SIZE];
-static uint32_t bufferIdx;
-static uint32_t runningSumPm2_5;
-static uint32_t runningSumPm10_0;
-static bool bufferFull;
+// AQI for every whole concentration the table covers, filled in from it on first use
+static uint16_t aqiByPm2_5[AQI_PM2_5_MAX + 1];
+static uint16_t aqiByPm10_0[AQI_PM10_0_MAX + 1];
+static pthread_once_t aqiTablesOnce = PTHREAD_ONCE_INIT;
+
+// Heat index is worked out HEAT_INDEX_LANES samples at a time with GCC vector types,
+// which become NEON on the Pi and SSE on x86. The batch loads are written out for 4.
+typedef float HEAT_FLOATS __attribute__((vector_size(HEAT_INDEX_LANES * sizeof(float))));
+typedef double HEAT_DOUBLES __attribute__((vector_size(HEAT_INDEX_LANES * sizeof(double))));
+typedef int32_t HEAT_MASK __attribute__((vector_size(HEAT_INDEX_LANES * sizeof(int32_t))));
+
+// Behind the calc functions that take no context
+static ALPAQA_CALC_CONTEXT defaultContext;
 
 static uint16_t calculateAqiIndex(uint16_t pm2_5, uint16_t pm10_0);
+static inline uint16_t lookupAqiIndex(uint16_t pm2_5, uint16_t pm10_0);
+static void buildAqiTables(void);
+static void creditLastSample(ALPAQA_CALC_CONTEXT * context, uint64_t timeNs);
+static HEAT_FLOATS heatIndexLanes(HEAT_FLOATS temperatureF, HEAT_FLOATS humidity);
+static HEAT_FLOATS heatSelect(HEAT_MASK mask, HEAT_FLOATS ifSet, HEAT_FLOATS ifClear);
 static uint16_t calculatePollutantIndex(uint16_t pollutantConcentration, uint16_t breakpointHigh, uint16_t breakpointLow, uint16_t aqiHigh, uint16_t aqiLow);
 
+void calcContextInit(ALPAQA_CALC_CONTEXT * context)
+{
+    rollupInit(&context->rollup);
+    nowcastInit(&context->nowcast);
+    context->lastSampleNs = 0;
+    context->lastCreditedSeconds = 0;
+    memset(&context->state, 0, sizeof(ALPAQA_CALC_STATE));
+}
+
+// Restores the rollup saved in filename, if there is a good one, and brings it up to
+// nowSeconds so the time the app was down shows as a gap rather than being skipped over.
+// The file is kept open for calcContextSaveState().
+// Returns: Boolean indicating if history was restored, with the time it was saved.
+bool calcContextLoadState(ALPAQA_CALC_CONTEXT * context, const char * filename, uint64_t nowSeconds, uint64_t * savedSeconds)
+{
+    uint64_t savedNs;
+
+    *savedSeconds = 0;
+    if(!calcStateOpen(&context->state, filename) || !calcStateLoad(&context->state, &context->rollup, &savedNs))
+    {
+        return false;
+    }
+
+    rollupAdvance(&context->rollup, nowSeconds);
+    nowcastInit(&context->nowcast);
+    *savedSeconds = savedNs / NS_PER_SECOND;
+    return context->rollup.started;
+}
+
+// The last sample is saved with the time it has stood for up to now
+bool calcContextSaveState(ALPAQA_CALC_CONTEXT * context)
+{
+    creditLastSample(context, realtimeNowNs());
+    return calcStateSave(&context->state, &context->rollup);
+}
+
+void calcContextCloseState(ALPAQA_CALC_CONTEXT * context)
+{
+    calcStateClose(&context->state);
+}
+
+// timeNs is the wall clock time of the sample. A reading stands for the air until
+// the next one. It goes into the rollup straight away for its own second, and the
+// rest of the whole seconds up to the next one are added when that comes in. The
+// 24 hour average stays time weighted when sampling slows down, and the first
+// reading of a change only counts for its own time.
+void calcContextStoreAqiData(ALPAQA_CALC_CONTEXT * context, const PARTICULATE_MATTER_DATA * data, uint64_t timeNs)
+{
+    creditLastSample(context, timeNs);
+    rollupAdd(&context->rollup, timeNs / NS_PER_SECOND, data->pm2_5, data->pm10_0);
+    context->lastSampleNs = timeNs;
+    context->lastPm2_5 = data->pm2_5;
+    context->lastPm10_0 = data->pm10_0;
+    context->lastCreditedSeconds = 1;
+}
+
+// Brings the last sample up to the whole seconds from it to timeNs, at most
+// CALC_MAX_SAMPLE_SECONDS. Filed under the newest second, which is the sample's own
+// unless a gap has moved the rollup on.
+static void creditLastSample(ALPAQA_CALC_CONTEXT * context, uint64_t timeNs)
+{
+    uint64_t seconds;
+
+    if(context->lastSampleNs == 0 || timeNs <= context->lastSampleNs)
+    {
+        return;
+    }
+    seconds = (timeNs - context->lastSampleNs + (NS_PER_SECOND / 2)) / NS_PER_SECOND;
+    if(seconds > CALC_MAX_SAMPLE_SECONDS)
+    {
+        seconds = CALC_MAX_SAMPLE_SECONDS;
+    }
+    if(seconds > context->lastCreditedSeconds)
+    {
+        rollupAddWeighted(&context->rollup, context->lastSampleNs / NS_PER_SECOND, context->lastPm2_5,
+                          context->lastPm10_0, (uint32_t)seconds - context->lastCreditedSeconds);
+        context->lastCreditedSeconds = (uint32_t)seconds;
+    }
+}
+
+// This calculates the AQI using the forumulas and guidance in the U.S. EPA Technical Assistance Document for AQI.
+// The function uses the PM2.5 and PM10 data as that is what the connected PMSA003I sensor has that is applicable.
+// Returns: Boolean indicating if enough historical data exists for accurate 24 hour guidance. Without 24 hours of
+// data, the calculation will be a best effort averaged estimate with the data that has been collected so far.
+// calcContextNowCastAQI() is the one to use for shorter term decisions
+bool calcContextAQI(const ALPAQA_CALC_CONTEXT * context, uint16_t * aqi)
+{
+    uint16_t averagePm2_5;
+    uint16_t averagePm10_0;
+    bool full24Hour;
+
+    // Averages whatever has been collected if there is less than 24 hours of it
+    full24Hour = rollupWindowAverage(&context->rollup, AQI_AVERAGE_SECONDS, &averagePm2_5, &averagePm10_0);
+
+    // Return the calculated index
+    *aqi = calculateAqiIndex(averagePm2_5, averagePm10_0);
+
+    return full24Hour;
+}
+
+// The EPA NowCast: a 12 hour average weighted towards recent hours when the air is changing,
+// so it follows a smoke event within the hour rather than a day later.
+// Returns: Boolean indicating if at least 2 of the last 3 hours had data, the minimum the EPA
+// requires. Otherwise the index is a best effort over the hours collected so far.
+bool calcContextNowCastAQI(ALPAQA_CALC_CONTEXT * context, uint16_t * aqi)
+{
+    uint16_t nowcastPm2_5;
+    uint16_t nowcastPm10_0;
+    bool valid;
+
+    valid = nowcastCompute(&context->nowcast, &context->rollup, &nowcastPm2_5, &nowcastPm10_0);
+    *aqi = calculateAqiIndex(nowcastPm2_5, nowcastPm10_0);
+
+    return valid;
+}
+
 void initAlpaqaCalc()
 {
-    memset(aqiBuffer, 0, sizeof(aqiBuffer));
-    bufferIdx = 0;
-    bufferFull = false;
-    runningSumPm2_5 = 0;
-    runningSumPm10_0 = 0;
+    calcContextInit(&defaultContext);
+}
+
+bool loadAlpaqaCalcState(const char * filename, uint64_t nowSeconds, uint64_t * savedSeconds)
+{
+    return calcContextLoadState(&defaultContext, filename, nowSeconds, savedSeconds);
+}
+
+bool saveAlpaqaCalcState()
+{
+    return calcContextSaveState(&defaultContext);
+}
+
+void closeAlpaqaCalcState()
+{
+    calcContextCloseState(&defaultContext);
+}
+
+const ALPAQA_CALC_STATE * alpaqaCalcState()
+{
+    return &defaultContext.state;
 }
 
 // This uses the heat index equations given by NOAA, using a simple equation first
@@ -76,36 +226,40 @@ float calcHeatIndex(const TEMP_HUMIDITY_DATA * data)
     return heatIndex;
 }
 
-// This calculates the AQI using the forumulas and guidance in the U.S. EPA Technical Assistance Document for AQI.
-// The function uses the PM2.5 and PM10 data as that is what the connected PMSA003I sensor has that is applicable.
-// Returns: Boolean indicating if enough historical data exists for accurate 24 hour guidance. Without 24 hours of
-// data, the calculation will be a best effort averaged estimate with the data that has been collected so far.
-// It may be useful to expand this to use the NowCast algorithm for shorter term calculations
-bool calcAQI(uint16_t * aqi)
+// calcHeatIndex() for whole runs of samples, as reprocessing and backfill have.
+// Gives the same bits: every lane does the same double and float steps the
+// branches above would have.
+void calcHeatIndexBatch(const TEMP_HUMIDITY_DATA * data, float * heatIndex, size_t count)
 {
-    uint16_t averagePm2_5;
-    uint16_t averagePm10_0;
-    uint32_t numberOfSamples;
+    size_t idx;
 
-    // If the buffer is full, we have 24 hours of samples
-    if(bufferFull)
+    for(idx = 0; idx + HEAT_INDEX_LANES <= count; idx += HEAT_INDEX_LANES)
     {
-        numberOfSamples = AQI_BUFFER_SIZE;
+        const TEMP_HUMIDITY_DATA * sample = &data[idx];
+        HEAT_FLOATS temperatureF;
+        HEAT_FLOATS humidity;
+        HEAT_FLOATS result;
+
+        temperatureF = (HEAT_FLOATS){sample[0].temperatureF, sample[1].temperatureF, sample[2].temperatureF, sample[3].temperatureF};
+        humidity = (HEAT_FLOATS){sample[0].humidity, sample[1].humidity, sample[2].humidity, sample[3].humidity};
+        result = heatIndexLanes(temperatureF, humidity);
+        memcpy(&heatIndex[idx], &result, sizeof(result));
     }
-    // Otherwise, use the buffer count. No zero.
-    else
+
+    for(; idx < count; idx++)
     {
-        numberOfSamples = bufferIdx > 0 ? bufferIdx : 1;
+        heatIndex[idx] = calcHeatIndex(&data[idx]);
     }
+}
 
-    // Find the averages collected so far
-    averagePm2_5 = runningSumPm2_5 / bufferIdx;
-    averagePm10_0 = runningSumPm10_0 / bufferIdx;
-
-    // Return the calculated index
-    *aqi = calculateAqiIndex(averagePm2_5, averagePm10_0);
+bool calcAQI(uint16_t * aqi)
+{
+    return calcContextAQI(&defaultContext, aqi);
+}
 
-    return bufferFull;
+bool calcNowCastAQI(uint16_t * aqi)
+{
+    return calcContextNowCastAQI(&defaultContext, aqi);
 }
 
 // Calculates an instant AQI based on PM data now. Not as useful and fluctuates more.
@@ -114,71 +268,62 @@ uint16_t calcInstantAQI(const PARTICULATE_MATTER_DATA * data)
     return calculateAqiIndex(data->pm2_5, data->pm10_0);
 }
 
-void storeAqiData(const PARTICULATE_MATTER_DATA * data)
+void calcInstantAQIBatch(const PARTICULATE_MATTER_DATA * data, uint16_t * aqi, size_t count)
 {
-    // Keep a running sum to save time, add the new values to the sum
-    runningSumPm2_5 += data->pm2_5;
-    runningSumPm10_0 += data->pm10_0;
-
-    // If the buffer is full, subtract the last value (what is being overwritten) from the running sum
-    if(bufferFull)
+    pthread_once(&aqiTablesOnce, buildAqiTables);
+    for(size_t idx = 0; idx < count; idx++)
     {
-        runningSumPm2_5 -= aqiBuffer[bufferIdx].pm2_5;
-        runningSumPm10_0 -= aqiBuffer[bufferIdx].pm10_0;
+        aqi[idx] = lookupAqiIndex(data[idx].pm2_5, data[idx].pm10_0);
     }
+}
 
-    // Update the buffer with the new values
-    aqiBuffer[bufferIdx].pm2_5 = data->pm2_5;
-    aqiBuffer[bufferIdx].pm10_0 = data->pm10_0;
+void storeAqiData(const PARTICULATE_MATTER_DATA * data, uint64_t timeNs)
+{
+    calcContextStoreAqiData(&defaultContext, data, timeNs);
+}
 
-    // Increment index and mark if the buffer is full
-    bufferIdx++;
-    if(bufferIdx >= AQI_BUFFER_SIZE)
-    {
-        bufferIdx = 0;
-        bufferFull = true;
-    }
+// Longer history than the 24 hour average, for weekly and monthly views
+const ALPAQA_ROLLUP * aqiHistory()
+{
+    return &defaultContext.rollup;
 }
 
 uint16_t calculateAqiIndex(uint16_t pm2_5, uint16_t pm10_0)
 {
-    uint16_t breakpointMin;
-    uint16_t breakpointMax;
-    uint16_t aqiMin;
-    uint16_t aqiMax;
-    uint16_t maxPm;
-    uint8_t idx;
+    pthread_once(&aqiTablesOnce, buildAqiTables);
+    return lookupAqiIndex(pm2_5, pm10_0);
+}
+
+// The pollutant with the higher concentration picks the row. Concentrations past the
+// top of the table read as its last entry.
+static inline uint16_t lookupAqiIndex(uint16_t pm2_5, uint16_t pm10_0)
+{
+    if(pm2_5 > pm10_0)
+    {
+        return aqiByPm2_5[pm2_5 < AQI_PM2_5_MAX ? pm2_5 : AQI_PM2_5_MAX];
+    }
+    return aqiByPm10_0[pm10_0 < AQI_PM10_0_MAX ? pm10_0 : AQI_PM10_0_MAX];
+}
 
-    // Probably a better way to do this...maybe revisit
-    for(idx = 0; idx < BREAKPOINT_TABLE_SIZE; idx++)
+// The concentrations are whole ug/m^3 and the rows have no gaps between them, so every
+// one of them can be worked out once with equation 1 rather than searched for each time
+static void buildAqiTables(void)
+{
+    for(uint8_t idx = 0; idx < BREAKPOINT_TABLE_SIZE; idx++)
     {
-        if(pm2_5 > pm10_0)
+        const BREAKPOINTS * row = &breakpoints_table[idx];
+
+        for(uint16_t pm = row->breakpointPm2_5.breakpointMin; pm <= row->breakpointPm2_5.breakpointMax; pm++)
         {
-            if( pm2_5 >= breakpoints_table[idx].breakpointPm2_5.breakpointMin &&
-            pm2_5 <= breakpoints_table[idx].breakpointPm2_5.breakpointMax)
-            {
-                breakpointMin = breakpoints_table[idx].breakpointPm2_5.breakpointMin;
-                breakpointMax = breakpoints_table[idx].breakpointPm2_5.breakpointMax;
-                aqiMin = breakpoints_table[idx].breakpoints_aqi.breakpointMin;
-                aqiMax = breakpoints_table[idx].breakpoints_aqi.breakpointMax;
-                maxPm = pm2_5;
-            }
+            aqiByPm2_5[pm] = calculatePollutantIndex(pm, row->breakpointPm2_5.breakpointMax, row->breakpointPm2_5.breakpointMin,
+                                                     row->breakpoints_aqi.breakpointMax, row->breakpoints_aqi.breakpointMin);
         }
-        else
+        for(uint16_t pm = row->breakpoints_pm10_0.breakpointMin; pm <= row->breakpoints_pm10_0.breakpointMax; pm++)
         {
-            if( pm10_0 >= breakpoints_table[idx].breakpoints_pm10_0.breakpointMin &&
-            pm10_0 <= breakpoints_table[idx].breakpoints_pm10_0.breakpointMax)
-            {
-                breakpointMin = breakpoints_table[idx].breakpoints_pm10_0.breakpointMin;
-                breakpointMax = breakpoints_table[idx].breakpoints_pm10_0.breakpointMax;
-                aqiMin = breakpoints_table[idx].breakpoints_aqi.breakpointMin;
-                aqiMax = breakpoints_table[idx].breakpoints_aqi.breakpointMax;
-                maxPm = pm10_0;
-            }
+            aqiByPm10_0[pm] = calculatePollutantIndex(pm, row->breakpoints_pm10_0.breakpointMax, row->breakpoints_pm10_0.breakpointMin,
+                                                      row->breakpoints_aqi.breakpointMax, row->breakpoints_aqi.breakpointMin);
         }
     }
-
-    return calculatePollutantIndex(maxPm, breakpointMax, breakpointMin, aqiMax, aqiMin);
 }
 
 uint16_t calculatePollutantIndex(uint16_t pollutantConcentration, uint16_t breakpointHigh, uint16_t breakpointLow, uint16_t aqiHigh, uint16_t aqiLow)
@@ -186,3 +331,47 @@ uint16_t calculatePollutantIndex(uint16_t pollutantConcentration, uint16_t break
     // Equation 1 from the aqi technical assistance document
     return (uint16_t)(((float)(aqiHigh-aqiLow)/(breakpointHigh-breakpointLow)) * (float)(pollutantConcentration - breakpointLow) + aqiLow);
 }
+
+// Every lane takes both formulas and keeps the one the scalar code would have branched to
+static HEAT_FLOATS heatIndexLanes(HEAT_FLOATS temperatureF, HEAT_FLOATS humidity)
+{
+    HEAT_DOUBLES t = __builtin_convertvector(temperatureF, HEAT_DOUBLES);
+    HEAT_DOUBLES rh = __builtin_convertvector(humidity, HEAT_DOUBLES);
+    HEAT_FLOATS simple = __builtin_convertvector(SIMPLE_HEAT_INDEX(t, rh), HEAT_FLOATS);
+    HEAT_FLOATS from95 = temperatureF - 95.0f;
+    HEAT_MASK useComplex;
+    HEAT_MASK dry;
+    HEAT_MASK humid;
+    HEAT_FLOATS heatIndex;
+    int32_t anyComplex = 0;
+
+    useComplex = ((simple + temperatureF) / 2.0f) >= (float)SIMPLE_HEAT_FORMULA_THRESHOLD;
+    for(size_t lane = 0; lane < HEAT_INDEX_LANES; lane++)
+    {
+        anyComplex |= useComplex[lane];
+    }
+    // Indoors the simple formula is nearly always enough
+    if(!anyComplex)
+    {
+        return simple;
+    }
+    heatIndex = heatSelect(useComplex, __builtin_convertvector(COMPLEX_HEAT_INDEX(t, rh), HEAT_FLOATS), simple);
+
+    // The dry adjustment's square root was taken of an integer division, which is 1
+    // within a degree of 95 F and 0 elsewhere, and is kept that way
+    dry = useComplex & (humidity < (float)COMPLEX_ADJUST_1_RH_LESS) &
+          (temperatureF > (float)COMPLEX_ADJUST_1_TEMP_GREATER) & (temperatureF < (float)COMPLEX_ADJUST_1_TEMP_LESS) &
+          (from95 > -1.0f) & (from95 < 1.0f);
+    heatIndex = heatSelect(dry, heatIndex - ((13.0f - humidity) / 4.0f), heatIndex);
+
+    humid = useComplex & (humidity > (float)COMPLEX_ADJUST_2_RH_GREATER) &
+            (temperatureF > (float)COMPLEX_ADJUST_2_TEMP_GREATER) & (temperatureF < (float)COMPLEX_ADJUST_2_TEMP_LESS);
+    heatIndex = heatSelect(humid, heatIndex + COMPLEX_ADJUST_2_FORMULA(temperatureF, humidity), heatIndex);
+
+    return heatIndex;
+}
+
+static HEAT_FLOATS heatSelect(HEAT_MASK mask, HEAT_FLOATS ifSet, HEAT_FLOATS ifClear)
+{
+    return (HEAT_FLOATS)(((HEAT_MASK)ifSet & mask) | ((HEAT_MASK)ifClear & ~mask));
+}
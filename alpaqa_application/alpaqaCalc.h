@@ -3,6 +3,9 @@
 
 #include "SHT41.h"
 #include "PMSA003I.h"
+#include "alpaqaRollup.h"
+#include "alpaqaNowCast.h"
+#include "alpaqaCalcState.h"
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
@@ -30,18 +33,52 @@
 #define SIMPLE_HEAT_INDEX(T, RH) ( 0.5 * (T + 61.0 + ((T - 68.0) * 1.2) + (RH * 0.094)))
 #define SIMPLE_HEAT_FORMULA_THRESHOLD 80
 
-#define AQI_BUFFER_SIZE (60 * 60 * 24)
+#define AQI_AVERAGE_SECONDS ROLLUP_DAY
+// Longest time one sample stands for in the averages. A longer gap in sampling
+// only counts for this long, so adaptive periods must stay within it.
+#define CALC_MAX_SAMPLE_SECONDS 60
 #define BREAKPOINT_TABLE_SIZE 7
+// Top of the last breakpoint row for each pollutant
+#define AQI_PM2_5_MAX 500
+#define AQI_PM10_0_MAX 604
+
+// Everything the averaged AQIs of one location need. The calc functions that take
+// no context all share one, for the tools that only ever handle one location.
 typedef struct
 {
-    uint16_t pm2_5;
-    uint16_t pm10_0;
-} AQI_DATA;
+    // Seconds for the last few minutes, minutes for a day and hours for a month
+    ALPAQA_ROLLUP rollup;
+    ALPAQA_NOWCAST nowcast;
+    // The last sample stored, and the seconds of it in the rollup so far. The rest
+    // goes in once the next sample or a state save shows how long it stood for.
+    uint64_t lastSampleNs;
+    uint16_t lastPm2_5;
+    uint16_t lastPm10_0;
+    uint32_t lastCreditedSeconds;
+    // Where the rollup is saved so a restart picks up where it left off
+    ALPAQA_CALC_STATE state;
+} ALPAQA_CALC_CONTEXT;
+
+void calcContextInit(ALPAQA_CALC_CONTEXT * context);
+bool calcContextLoadState(ALPAQA_CALC_CONTEXT * context, const char * filename, uint64_t nowSeconds, uint64_t * savedSeconds);
+bool calcContextSaveState(ALPAQA_CALC_CONTEXT * context);
+void calcContextCloseState(ALPAQA_CALC_CONTEXT * context);
+void calcContextStoreAqiData(ALPAQA_CALC_CONTEXT * context, const PARTICULATE_MATTER_DATA * data, uint64_t timeNs);
+bool calcContextAQI(const ALPAQA_CALC_CONTEXT * context, uint16_t * aqi);
+bool calcContextNowCastAQI(ALPAQA_CALC_CONTEXT * context, uint16_t * aqi);
 
 void initAlpaqaCalc();
+bool loadAlpaqaCalcState(const char * filename, uint64_t nowSeconds, uint64_t * savedSeconds);
+bool saveAlpaqaCalcState();
+void closeAlpaqaCalcState();
+const ALPAQA_CALC_STATE * alpaqaCalcState();
 float calcHeatIndex(const TEMP_HUMIDITY_DATA * data);
+void calcHeatIndexBatch(const TEMP_HUMIDITY_DATA * data, float * heatIndex, size_t count);
 bool calcAQI(uint16_t * aqi);
+bool calcNowCastAQI(uint16_t * aqi);
 uint16_t calcInstantAQI(const PARTICULATE_MATTER_DATA * data);
-void storeAqiData(const PARTICULATE_MATTER_DATA * data);
+void calcInstantAQIBatch(const PARTICULATE_MATTER_DATA * data, uint16_t * aqi, size_t count);
+void storeAqiData(const PARTICULATE_MATTER_DATA * data, uint64_t timeNs);
+const ALPAQA_ROLLUP * aqiHistory();
 
 #endif
\ No newline at end of file
@@ -0,0 +1,187 @@
+#include "alpaqaCalcState.h"
+#include "alpaqaTime.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CRC32_POLYNOMIAL 0xEDB88320U
+
+static bool validHeader(const CALC_STATE_FILE * file);
+static bool validSlot(const CALC_STATE_SLOT * slot);
+static uint32_t crc32(const void * data, size_t length);
+
+// Maps the state file, creating it or wiping it if it is not a state file of
+// this version and layout. Nothing is loaded until calcStateLoad().
+bool calcStateOpen(ALPAQA_CALC_STATE * state, const char * filename)
+{
+    struct stat fileStat;
+    void * map;
+    int fd;
+
+    memset(state, 0, sizeof(ALPAQA_CALC_STATE));
+
+    fd = open(filename, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(fd < 0)
+    {
+        return false;
+    }
+
+    if(fstat(fd, &fileStat) != 0 ||
+       ((uint64_t)fileStat.st_size != sizeof(CALC_STATE_FILE) && ftruncate(fd, sizeof(CALC_STATE_FILE)) != 0))
+    {
+        close(fd);
+        return false;
+    }
+
+    map = mmap(NULL, sizeof(CALC_STATE_FILE), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+    {
+        return false;
+    }
+    state->file = map;
+
+    if(!validHeader(state->file))
+    {
+        memset(state->file, 0, sizeof(CALC_STATE_FILE));
+        memcpy(state->file->magic, CALC_STATE_MAGIC, CALC_STATE_MAGIC_SIZE);
+        state->file->version = CALC_STATE_VERSION;
+        state->file->slotCount = CALC_STATE_SLOTS;
+        state->file->slotSize = sizeof(CALC_STATE_SLOT);
+        msync(state->file, sizeof(CALC_STATE_FILE), MS_SYNC);
+    }
+
+    for(int idx = 0; idx < CALC_STATE_SLOTS; idx++)
+    {
+        if(validSlot(&state->file->slots[idx]) && state->file->slots[idx].generation > state->generation)
+        {
+            state->generation = state->file->slots[idx].generation;
+        }
+    }
+    return true;
+}
+
+// Copies out the newest saved rollup. False if there is none that checks out.
+bool calcStateLoad(const ALPAQA_CALC_STATE * state, ALPAQA_ROLLUP * rollup, uint64_t * savedNs)
+{
+    const CALC_STATE_SLOT * newest = NULL;
+
+    if(state->file == NULL)
+    {
+        return false;
+    }
+
+    for(int idx = 0; idx < CALC_STATE_SLOTS; idx++)
+    {
+        const CALC_STATE_SLOT * slot = &state->file->slots[idx];
+
+        if(validSlot(slot) && (newest == NULL || slot->generation > newest->generation))
+        {
+            newest = slot;
+        }
+    }
+    if(newest == NULL)
+    {
+        return false;
+    }
+
+    memcpy(rollup, &newest->rollup, sizeof(ALPAQA_ROLLUP));
+    *savedNs = newest->savedNs;
+    return true;
+}
+
+// Writes the rollup over the older slot and waits for it to reach the disk. The
+// slot is marked invalid while it is being written and its generation is only
+// set once the checksum covers what was copied.
+bool calcStateSave(ALPAQA_CALC_STATE * state, const ALPAQA_ROLLUP * rollup)
+{
+    CALC_STATE_SLOT * slot;
+    uintptr_t pageMask = (uintptr_t)sysconf(_SC_PAGESIZE) - 1;
+    uintptr_t syncStart;
+    uint64_t startNs;
+    uint64_t elapsedNs;
+    bool synced;
+
+    if(state->file == NULL)
+    {
+        return false;
+    }
+
+    startNs = monotonicNowNs();
+    slot = &state->file->slots[(state->generation + 1) % CALC_STATE_SLOTS];
+    slot->generation = 0;
+    memcpy(&slot->rollup, rollup, sizeof(ALPAQA_ROLLUP));
+    slot->size = sizeof(ALPAQA_ROLLUP);
+    slot->savedNs = realtimeNowNs();
+    slot->checksum = crc32(&slot->rollup, sizeof(ALPAQA_ROLLUP));
+    __atomic_store_n(&slot->generation, state->generation + 1, __ATOMIC_RELEASE);
+    state->generation++;
+
+    // msync() wants a page aligned start
+    syncStart = (uintptr_t)slot & ~pageMask;
+    synced = msync((void *)syncStart, ((uintptr_t)slot - syncStart) + sizeof(CALC_STATE_SLOT), MS_SYNC) == 0;
+
+    elapsedNs = monotonicNowNs() - startNs;
+    if(elapsedNs > state->maxSaveNs)
+    {
+        state->maxSaveNs = elapsedNs;
+    }
+    state->saves++;
+    return synced;
+}
+
+void calcStateClose(ALPAQA_CALC_STATE * state)
+{
+    if(state->file != NULL)
+    {
+        munmap(state->file, sizeof(CALC_STATE_FILE));
+    }
+    state->file = NULL;
+}
+
+static bool validHeader(const CALC_STATE_FILE * file)
+{
+    return memcmp(file->magic, CALC_STATE_MAGIC, CALC_STATE_MAGIC_SIZE) == 0 &&
+           file->version == CALC_STATE_VERSION &&
+           file->slotCount == CALC_STATE_SLOTS &&
+           file->slotSize == sizeof(CALC_STATE_SLOT);
+}
+
+static bool validSlot(const CALC_STATE_SLOT * slot)
+{
+    return slot->generation != 0 && slot->size == sizeof(ALPAQA_ROLLUP) &&
+           slot->checksum == crc32(&slot->rollup, sizeof(ALPAQA_ROLLUP));
+}
+
+// Standard CRC-32 (the zlib one), table driven
+static uint32_t crc32(const void * data, size_t length)
+{
+    static uint32_t table[256];
+    static bool tableReady;
+    const uint8_t * bytes = data;
+    uint32_t crc = 0xFFFFFFFFU;
+
+    if(!tableReady)
+    {
+        for(uint32_t idx = 0; idx < 256; idx++)
+        {
+            uint32_t value = idx;
+
+            for(int bit = 0; bit < 8; bit++)
+            {
+                value = (value & 1) ? (value >> 1) ^ CRC32_POLYNOMIAL : (value >> 1);
+            }
+            table[idx] = value;
+        }
+        tableReady = true;
+    }
+
+    for(size_t idx = 0; idx < length; idx++)
+    {
+        crc = table[(crc ^ bytes[idx]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFU;
+}
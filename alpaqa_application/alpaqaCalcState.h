@@ -0,0 +1,50 @@
+#ifndef ALPAQACALCSTATE_H
+#define ALPAQACALCSTATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "alpaqaRollup.h"
+
+#define CALC_STATE_MAGIC "AQSTATE1"
+#define CALC_STATE_MAGIC_SIZE 8
+#define CALC_STATE_VERSION 2
+#define CALC_STATE_SLOTS 2
+
+// The rollup is saved into alternate slots, each with its own checksum, so a
+// crash or power cut part way through a save still leaves the previous one.
+// Loading takes the newest slot that checks out.
+typedef struct
+{
+    uint64_t generation;
+    uint64_t savedNs;
+    uint32_t checksum;
+    uint32_t size;
+    ALPAQA_ROLLUP rollup;
+} CALC_STATE_SLOT;
+
+typedef struct
+{
+    char magic[CALC_STATE_MAGIC_SIZE];
+    uint16_t version;
+    uint16_t slotCount;
+    // Catches a file written by a build with a different rollup layout
+    uint32_t slotSize;
+    CALC_STATE_SLOT slots[CALC_STATE_SLOTS];
+} CALC_STATE_FILE;
+
+typedef struct
+{
+    CALC_STATE_FILE * file;
+    uint64_t generation;
+    uint64_t saves;
+    uint64_t maxSaveNs;
+} ALPAQA_CALC_STATE;
+
+bool calcStateOpen(ALPAQA_CALC_STATE * state, const char * filename);
+bool calcStateLoad(const ALPAQA_CALC_STATE * state, ALPAQA_ROLLUP * rollup, uint64_t * savedNs);
+bool calcStateSave(ALPAQA_CALC_STATE * state, const ALPAQA_ROLLUP * rollup);
+void calcStateClose(ALPAQA_CALC_STATE * state);
+
+#endif
@@ -0,0 +1,170 @@
+#include "alpaqaDevices.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+static bool parseSpec(const char * spec, char * deviceFilename, int * muxChannel);
+static ALPAQA_DEVICE_BUS * findBus(ALPAQA_DEVICES * devices, const char * deviceFilename);
+
+void devicesInit(ALPAQA_DEVICES * devices)
+{
+    memset(devices, 0, sizeof(ALPAQA_DEVICES));
+}
+
+// Takes DEVICE or DEVICE:CHANNEL, the channel being the one the location's sensors
+// sit behind on a TCA9548A. Both sensors have fixed addresses, so a bus carries either
+// one location wired to it directly or one location per mux channel, never a mix.
+bool devicesAdd(ALPAQA_DEVICES * devices, const char * spec)
+{
+    char deviceFilename[DEVICES_NAME_SIZE];
+    ALPAQA_DEVICE_BUS * bus;
+    int muxChannel;
+
+    if(!parseSpec(spec, deviceFilename, &muxChannel))
+    {
+        return false;
+    }
+    if(devices->locationCount >= DEVICES_MAX_LOCATIONS)
+    {
+        errno = ENOSPC;
+        return false;
+    }
+
+    bus = findBus(devices, deviceFilename);
+    if(bus == NULL)
+    {
+        if(devices->busCount >= DEVICES_MAX_BUSES)
+        {
+            errno = ENOSPC;
+            return false;
+        }
+        bus = &devices->buses[devices->busCount++];
+        strcpy(bus->deviceFilename, deviceFilename);
+    }
+    else if(muxChannel == I2C_MUX_NONE || bus->locations[0].muxChannel == I2C_MUX_NONE)
+    {
+        errno = EADDRINUSE;
+        return false;
+    }
+    else
+    {
+        for(uint32_t idx = 0; idx < bus->locationCount; idx++)
+        {
+            if(bus->locations[idx].muxChannel == muxChannel)
+            {
+                errno = EADDRINUSE;
+                return false;
+            }
+        }
+    }
+
+    bus->locations[bus->locationCount].location = devices->locationCount;
+    bus->locations[bus->locationCount].muxChannel = muxChannel;
+    bus->locationCount++;
+    devices->locationBus[devices->locationCount] = bus - devices->buses;
+    devices->locationMux[devices->locationCount] = muxChannel;
+    devices->locationCount++;
+    return true;
+}
+
+// Every bus gets the same periods and thread policy. Only the first records stage
+// latencies, the histograms take one writer each.
+bool devicesStart(ALPAQA_DEVICES * devices, const ALPAQA_ACQUISITION_CONFIG * config)
+{
+    ALPAQA_ACQUISITION_CONFIG busConfig;
+
+    for(uint32_t idx = 0; idx < devices->busCount; idx++)
+    {
+        ALPAQA_DEVICE_BUS * bus = &devices->buses[idx];
+
+        busConfig = *config;
+        busConfig.bus = &bus->bus;
+        memcpy(busConfig.locations, bus->locations, sizeof(busConfig.locations));
+        busConfig.locationCount = bus->locationCount;
+        busConfig.recordLatency = idx == 0;
+        if(!acquisitionStart(&bus->acquisition, &busConfig))
+        {
+            devicesStop(devices);
+            return false;
+        }
+        bus->started = true;
+    }
+    return true;
+}
+
+void devicesStop(ALPAQA_DEVICES * devices)
+{
+    for(uint32_t idx = 0; idx < devices->busCount; idx++)
+    {
+        if(devices->buses[idx].started)
+        {
+            acquisitionStop(&devices->buses[idx].acquisition);
+            devices->buses[idx].started = false;
+        }
+    }
+}
+
+// Sampling has to be stopped first
+void devicesClose(ALPAQA_DEVICES * devices)
+{
+    for(uint32_t idx = 0; idx < devices->busCount; idx++)
+    {
+        if(devices->buses[idx].opened)
+        {
+            i2cBusClose(&devices->buses[idx].bus);
+            devices->buses[idx].opened = false;
+        }
+    }
+}
+
+ALPAQA_DEVICE_BUS * devicesLocationBus(ALPAQA_DEVICES * devices, uint32_t location)
+{
+    return &devices->buses[devices->locationBus[location]];
+}
+
+// The channel is whatever follows the last colon, as long as it is a number
+static bool parseSpec(const char * spec, char * deviceFilename, int * muxChannel)
+{
+    const char * colon = strrchr(spec, ':');
+    size_t length = strlen(spec);
+    char * end;
+
+    *muxChannel = I2C_MUX_NONE;
+    if(colon != NULL && colon[1] != '\0')
+    {
+        long channel = strtol(colon + 1, &end, 10);
+
+        if(*end == '\0')
+        {
+            if(channel < 0 || channel >= I2C_MUX_CHANNELS)
+            {
+                errno = EINVAL;
+                return false;
+            }
+            *muxChannel = (int)channel;
+            length = colon - spec;
+        }
+    }
+
+    if(length == 0 || length >= DEVICES_NAME_SIZE)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    memcpy(deviceFilename, spec, length);
+    deviceFilename[length] = '\0';
+    return true;
+}
+
+static ALPAQA_DEVICE_BUS * findBus(ALPAQA_DEVICES * devices, const char * deviceFilename)
+{
+    for(uint32_t idx = 0; idx < devices->busCount; idx++)
+    {
+        if(strcmp(devices->buses[idx].deviceFilename, deviceFilename) == 0)
+        {
+            return &devices->buses[idx];
+        }
+    }
+    return NULL;
+}
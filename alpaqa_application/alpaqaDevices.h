@@ -0,0 +1,45 @@
+#ifndef ALPAQADEVICES_H
+#define ALPAQADEVICES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "i2cBus.h"
+#include "alpaqaAcquisition.h"
+
+#define DEVICES_MAX_BUSES 4
+#define DEVICES_MAX_LOCATIONS ACQUISITION_MAX_LOCATIONS
+#define DEVICES_NAME_SIZE 64
+
+// One adapter with its own sampling thread and frame ring, so a slow or stuck bus
+// only ever holds up the locations wired to it
+typedef struct
+{
+    char deviceFilename[DEVICES_NAME_SIZE];
+    I2C_BUS bus;
+    bool opened;
+    ALPAQA_ACQUISITION acquisition;
+    bool started;
+    // Locations on this bus, in the order they were added
+    ACQUISITION_LOCATION locations[ACQUISITION_MAX_LOCATIONS];
+    uint32_t locationCount;
+} ALPAQA_DEVICE_BUS;
+
+// Locations are numbered in the order they are added, location 0 being the primary one
+typedef struct
+{
+    ALPAQA_DEVICE_BUS buses[DEVICES_MAX_BUSES];
+    uint32_t busCount;
+    uint8_t locationBus[DEVICES_MAX_LOCATIONS];
+    int locationMux[DEVICES_MAX_LOCATIONS];
+    uint32_t locationCount;
+} ALPAQA_DEVICES;
+
+void devicesInit(ALPAQA_DEVICES * devices);
+bool devicesAdd(ALPAQA_DEVICES * devices, const char * spec);
+bool devicesStart(ALPAQA_DEVICES * devices, const ALPAQA_ACQUISITION_CONFIG * config);
+void devicesStop(ALPAQA_DEVICES * devices);
+void devicesClose(ALPAQA_DEVICES * devices);
+ALPAQA_DEVICE_BUS * devicesLocationBus(ALPAQA_DEVICES * devices, uint32_t location);
+
+#endif
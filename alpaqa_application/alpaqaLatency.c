@@ -0,0 +1,197 @@
+#include "alpaqaLatency.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define relaxedLoad(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+#define relaxedStore(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+
+static uint32_t bucketIndex(uint64_t valueNs);
+static uint64_t bucketHighestNs(uint32_t bucket);
+
+static const char * stageNames[LATENCY_STAGE_COUNT] =
+{
+    "i2c_transfer",
+    "sht_conversion",
+    "sample_lateness",
+    "frame_calc",
+    "frame_stats",
+    "shared_publish",
+    "alert_eval",
+    "render",
+    "log_append",
+    "server_publish",
+    "screen_flush",
+    "report",
+    "state_save",
+    "server_io",
+    "log_write",
+    "log_sync"
+};
+
+// About 70 KB in all, always there so any thread can record without setup
+static LATENCY_HISTOGRAM histograms[LATENCY_STAGE_COUNT];
+
+void latencyRecord(LATENCY_STAGE stage, uint64_t elapsedNs)
+{
+    latencyHistogramRecord(&histograms[stage], elapsedNs);
+}
+
+// Wait-free for the one thread that owns the histogram. Also for histograms of the
+// caller's own, which then have to start zeroed.
+void latencyHistogramRecord(LATENCY_HISTOGRAM * histogram, uint64_t elapsedNs)
+{
+    uint32_t bucket = bucketIndex(elapsedNs);
+
+    relaxedStore(histogram->buckets[bucket], relaxedLoad(histogram->buckets[bucket]) + 1);
+    relaxedStore(histogram->totalNs, relaxedLoad(histogram->totalNs) + elapsedNs);
+    if(elapsedNs > relaxedLoad(histogram->maxNs))
+    {
+        relaxedStore(histogram->maxNs, elapsedNs);
+    }
+    relaxedStore(histogram->count, relaxedLoad(histogram->count) + 1);
+}
+
+// The count is taken from the buckets so percentiles always add up
+void latencySnapshot(LATENCY_STAGE stage, LATENCY_HISTOGRAM * snapshot)
+{
+    const LATENCY_HISTOGRAM * histogram = &histograms[stage];
+
+    snapshot->count = 0;
+    snapshot->totalNs = relaxedLoad(histogram->totalNs);
+    snapshot->maxNs = relaxedLoad(histogram->maxNs);
+    for(uint32_t idx = 0; idx < LATENCY_BUCKETS; idx++)
+    {
+        snapshot->buckets[idx] = relaxedLoad(histogram->buckets[idx]);
+        snapshot->count += snapshot->buckets[idx];
+    }
+}
+
+// Reports the top of the bucket the fraction falls in, never more than the maximum seen
+bool latencyValue(const LATENCY_HISTOGRAM * histogram, double fraction, uint64_t * valueNs)
+{
+    uint64_t rank;
+    uint64_t seen = 0;
+
+    if(histogram->count == 0)
+    {
+        return false;
+    }
+
+    rank = (uint64_t)(fraction * histogram->count + 0.5);
+    if(rank < 1)
+    {
+        rank = 1;
+    }
+    if(rank > histogram->count)
+    {
+        rank = histogram->count;
+    }
+
+    for(uint32_t idx = 0; idx < LATENCY_BUCKETS; idx++)
+    {
+        seen += histogram->buckets[idx];
+        if(seen >= rank)
+        {
+            *valueNs = bucketHighestNs(idx);
+            if(*valueNs > histogram->maxNs)
+            {
+                *valueNs = histogram->maxNs;
+            }
+            return true;
+        }
+    }
+    *valueNs = histogram->maxNs;
+    return true;
+}
+
+const char * latencyStageName(LATENCY_STAGE stage)
+{
+    return stage < LATENCY_STAGE_COUNT ? stageNames[stage] : "unknown";
+}
+
+// Written beside the target and renamed over it, so a reader never sees half a table
+bool latencyWriteFile(const char * filename)
+{
+    static LATENCY_HISTOGRAM snapshot;
+    static const double fractions[] = {0.5, 0.9, 0.99, 0.999};
+    char tempFilename[PATH_MAX];
+    FILE * file;
+    bool written;
+
+    if(snprintf(tempFilename, sizeof(tempFilename), "%s.tmp", filename) >= (int)sizeof(tempFilename))
+    {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+
+    file = fopen(tempFilename, "w");
+    if(file == NULL)
+    {
+        return false;
+    }
+
+    fprintf(file, "# Stage latency in microseconds, since the app started\n");
+    fprintf(file, "stage, count, mean, p50, p90, p99, p99.9, max\n");
+    for(uint32_t stage = 0; stage < LATENCY_STAGE_COUNT; stage++)
+    {
+        latencySnapshot(stage, &snapshot);
+        fprintf(file, "%s, %llu, %0.1f", stageNames[stage], (unsigned long long)snapshot.count,
+                snapshot.count > 0 ? (double)snapshot.totalNs / snapshot.count / 1000.0 : 0.0);
+        for(uint32_t idx = 0; idx < sizeof(fractions) / sizeof(fractions[0]); idx++)
+        {
+            uint64_t valueNs = 0;
+
+            latencyValue(&snapshot, fractions[idx], &valueNs);
+            fprintf(file, ", %0.1f", (double)valueNs / 1000.0);
+        }
+        fprintf(file, ", %0.1f\n", (double)snapshot.maxNs / 1000.0);
+    }
+
+    written = !ferror(file);
+    if(fclose(file) != 0)
+    {
+        written = false;
+    }
+    if(!written || rename(tempFilename, filename) != 0)
+    {
+        unlink(tempFilename);
+        return false;
+    }
+    return true;
+}
+
+// The leading bit picks the power of two and the next LATENCY_SUB_BITS bits the
+// bucket within it
+static uint32_t bucketIndex(uint64_t valueNs)
+{
+    uint32_t shift;
+
+    if(valueNs < LATENCY_SUB_BUCKETS)
+    {
+        return (uint32_t)valueNs;
+    }
+    if(valueNs >= (1ULL << LATENCY_MAX_BITS))
+    {
+        return LATENCY_BUCKETS - 1;
+    }
+    shift = (63 - __builtin_clzll(valueNs)) - LATENCY_SUB_BITS;
+    return (shift << LATENCY_SUB_BITS) + (uint32_t)(valueNs >> shift);
+}
+
+static uint64_t bucketHighestNs(uint32_t bucket)
+{
+    uint32_t shift;
+    uint64_t mantissa;
+
+    if(bucket < 2 * LATENCY_SUB_BUCKETS)
+    {
+        return bucket;
+    }
+    shift = (bucket >> LATENCY_SUB_BITS) - 1;
+    mantissa = bucket - (shift << LATENCY_SUB_BITS);
+    return ((mantissa + 1) << shift) - 1;
+}
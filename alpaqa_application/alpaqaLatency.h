@@ -0,0 +1,77 @@
+#ifndef ALPAQALATENCY_H
+#define ALPAQALATENCY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "alpaqaTime.h"
+
+// Log-linear buckets: every power of two is split into 1 << LATENCY_SUB_BITS equal
+// buckets, so a bucket is never wider than 1/16 of the values in it. Below 16 ns
+// each nanosecond has its own bucket, and anything from 2^LATENCY_MAX_BITS ns (about
+// 69 s) up is counted in the last one.
+#define LATENCY_SUB_BITS 4
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+#define LATENCY_MAX_BITS 36
+#define LATENCY_BUCKETS ((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+typedef enum
+{
+    // Acquisition thread
+    LATENCY_I2C_TRANSFER = 0,
+    LATENCY_SHT_CONVERSION,
+    LATENCY_SAMPLE_LATENESS,
+    // Main loop
+    LATENCY_FRAME_CALC,
+    LATENCY_FRAME_STATS,
+    LATENCY_SHARED_PUBLISH,
+    LATENCY_ALERT_EVAL,
+    LATENCY_RENDER,
+    LATENCY_LOG_APPEND,
+    LATENCY_SERVER_PUBLISH,
+    LATENCY_SCREEN_FLUSH,
+    LATENCY_REPORT,
+    LATENCY_STATE_SAVE,
+    LATENCY_SERVER_IO,
+    // Log thread
+    LATENCY_LOG_WRITE,
+    LATENCY_LOG_SYNC,
+    LATENCY_STAGE_COUNT
+} LATENCY_STAGE;
+
+// Every stage is recorded from one thread only, so its writer needs no locked
+// instructions: each field is read and stored back with relaxed atomics, which keeps
+// readers on other threads from seeing torn values. A snapshot taken while a sample
+// is going in can be one count out between the fields, never more.
+typedef struct
+{
+    uint64_t count;
+    uint64_t totalNs;
+    uint64_t maxNs;
+    uint64_t buckets[LATENCY_BUCKETS];
+} LATENCY_HISTOGRAM;
+
+void latencyRecord(LATENCY_STAGE stage, uint64_t elapsedNs);
+void latencyHistogramRecord(LATENCY_HISTOGRAM * histogram, uint64_t elapsedNs);
+void latencySnapshot(LATENCY_STAGE stage, LATENCY_HISTOGRAM * snapshot);
+bool latencyValue(const LATENCY_HISTOGRAM * histogram, double fraction, uint64_t * valueNs);
+const char * latencyStageName(LATENCY_STAGE stage);
+bool latencyWriteFile(const char * filename);
+
+// Probes are a CLOCK_MONOTONIC read on each side of a stage, a vDSO call with no
+// syscall behind it
+static inline uint64_t latencyStart(void)
+{
+    return monotonicNowNs();
+}
+
+// Records the stage and returns the end time, for a following stage to start from
+static inline uint64_t latencyEnd(LATENCY_STAGE stage, uint64_t startNs)
+{
+    uint64_t endNs = monotonicNowNs();
+
+    latencyRecord(stage, endNs - startNs);
+    return endNs;
+}
+
+#endif
@@ -0,0 +1,355 @@
+#include "alpaqaLog.h"
+#include "alpaqaTime.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static bool validHeader(const ALPAQA_LOG_HEADER * header);
+static bool moveOlderVersion(const char * filename);
+
+// Opens a log for appending, writing the header if it is new. An existing file
+// must be a log, a torn record left by a crash is cut off. A log from an older
+// version is moved aside to <filename>.v<version> and a new one started.
+bool alpaqaLogOpen(ALPAQA_LOG_WRITER * writer, const char * filename)
+{
+    struct stat fileStat;
+    ALPAQA_LOG_HEADER header;
+    uint64_t recordBytes;
+
+    writer->size = 0;
+    writer->filename = filename;
+    writer->createdNs = 0;
+    if(!moveOlderVersion(filename))
+    {
+        writer->fd = -1;
+        return false;
+    }
+
+    writer->fd = open(filename, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(writer->fd < 0)
+    {
+        return false;
+    }
+
+    if(fstat(writer->fd, &fileStat) != 0)
+    {
+        alpaqaLogClose(writer);
+        return false;
+    }
+
+    // Shorter than a header is a log that died before its header was all written.
+    // There are no records in it to keep, so it is started over.
+    if(fileStat.st_size < (off_t)sizeof(header))
+    {
+        if(fileStat.st_size != 0 && ftruncate(writer->fd, 0) != 0)
+        {
+            alpaqaLogClose(writer);
+            return false;
+        }
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, ALPAQA_LOG_MAGIC, ALPAQA_LOG_MAGIC_SIZE);
+        header.version = ALPAQA_LOG_VERSION;
+        header.headerSize = sizeof(ALPAQA_LOG_HEADER);
+        header.recordSize = sizeof(ALPAQA_LOG_RECORD);
+        header.createdNs = realtimeNowNs();
+        if(write(writer->fd, &header, sizeof(header)) != sizeof(header))
+        {
+            alpaqaLogClose(writer);
+            return false;
+        }
+        writer->size = sizeof(header);
+        writer->createdNs = header.createdNs;
+        return true;
+    }
+
+    if(pread(writer->fd, &header, sizeof(header), 0) != sizeof(header) ||
+       !validHeader(&header) || header.version != ALPAQA_LOG_VERSION ||
+       header.recordSize != sizeof(ALPAQA_LOG_RECORD))
+    {
+        alpaqaLogClose(writer);
+        errno = EINVAL;
+        return false;
+    }
+
+    writer->createdNs = header.createdNs;
+    recordBytes = (uint64_t)fileStat.st_size - header.headerSize;
+    writer->size = header.headerSize + recordBytes - (recordBytes % header.recordSize);
+    if(writer->size != (uint64_t)fileStat.st_size && ftruncate(writer->fd, writer->size) != 0)
+    {
+        alpaqaLogClose(writer);
+        return false;
+    }
+    return true;
+}
+
+bool alpaqaLogAppend(ALPAQA_LOG_WRITER * writer, const ALPAQA_LOG_RECORD * record)
+{
+    if(writer->fd < 0 || write(writer->fd, record, sizeof(ALPAQA_LOG_RECORD)) != sizeof(ALPAQA_LOG_RECORD))
+    {
+        return false;
+    }
+    writer->size += sizeof(ALPAQA_LOG_RECORD);
+    return true;
+}
+
+// Writes whole records from several buffers at once. Short writes are resumed so a
+// record is never left half written unless the file itself fails. The iovecs are
+// used up in the process.
+bool alpaqaLogWritev(ALPAQA_LOG_WRITER * writer, struct iovec * iov, int count)
+{
+    ssize_t written;
+
+    while(count > 0)
+    {
+        if(iov->iov_len == 0)
+        {
+            iov++;
+            count--;
+            continue;
+        }
+
+        written = writev(writer->fd, iov, count);
+        if(written < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        writer->size += written;
+
+        while(count > 0 && (size_t)written >= iov->iov_len)
+        {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if(count > 0)
+        {
+            iov->iov_base = (uint8_t *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return true;
+}
+
+bool alpaqaLogSync(ALPAQA_LOG_WRITER * writer)
+{
+    return writer->fd >= 0 && fdatasync(writer->fd) == 0;
+}
+
+// Closes the log as segmentFilename and starts a new one under the old name. The
+// caller syncs first if the segment has to be on the card.
+bool alpaqaLogRotate(ALPAQA_LOG_WRITER * writer, const char * segmentFilename)
+{
+    alpaqaLogClose(writer);
+    if(rename(writer->filename, segmentFilename) != 0)
+    {
+        int renameErrno = errno;
+
+        // Carry on in the same file rather than stop logging
+        alpaqaLogOpen(writer, writer->filename);
+        errno = renameErrno;
+        return false;
+    }
+    return alpaqaLogOpen(writer, writer->filename);
+}
+
+void alpaqaLogClose(ALPAQA_LOG_WRITER * writer)
+{
+    if(writer->fd >= 0)
+    {
+        close(writer->fd);
+    }
+    writer->fd = -1;
+}
+
+// Maps the whole file read-only. Records appended after this are not seen.
+bool alpaqaLogReaderOpen(ALPAQA_LOG_READER * reader, const char * filename)
+{
+    struct stat fileStat;
+    int fd;
+    void * map;
+
+    memset(reader, 0, sizeof(ALPAQA_LOG_READER));
+
+    fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        return false;
+    }
+
+    if(fstat(fd, &fileStat) != 0 || (uint64_t)fileStat.st_size < sizeof(ALPAQA_LOG_HEADER))
+    {
+        close(fd);
+        errno = EINVAL;
+        return false;
+    }
+
+    map = mmap(NULL, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+    {
+        return false;
+    }
+    madvise(map, fileStat.st_size, MADV_SEQUENTIAL);
+
+    reader->map = map;
+    reader->mapSize = fileStat.st_size;
+    reader->header = map;
+    if(!validHeader(reader->header) || reader->header->headerSize > reader->mapSize ||
+       reader->header->recordSize < ALPAQA_LOG_RECORD_V1_SIZE)
+    {
+        alpaqaLogReaderClose(reader);
+        errno = EINVAL;
+        return false;
+    }
+
+    reader->records = reader->map + reader->header->headerSize;
+    reader->count = (reader->mapSize - reader->header->headerSize) / reader->header->recordSize;
+    return true;
+}
+
+// Records are handed out in place. Only records shorter than this version's are
+// copied, and the pointer is then good until the next call.
+const ALPAQA_LOG_RECORD * alpaqaLogReaderGet(ALPAQA_LOG_READER * reader, uint64_t index)
+{
+    const uint8_t * record;
+
+    if(index >= reader->count)
+    {
+        return NULL;
+    }
+
+    record = reader->records + (index * reader->header->recordSize);
+    if(reader->header->recordSize < sizeof(ALPAQA_LOG_RECORD))
+    {
+        memset(&reader->upgraded, 0, sizeof(ALPAQA_LOG_RECORD));
+        memcpy(&reader->upgraded, record, reader->header->recordSize);
+        return &reader->upgraded;
+    }
+    return (const ALPAQA_LOG_RECORD *)record;
+}
+
+void alpaqaLogReaderClose(ALPAQA_LOG_READER * reader)
+{
+    if(reader->map != NULL)
+    {
+        munmap((void *)reader->map, reader->mapSize);
+    }
+    memset(reader, 0, sizeof(ALPAQA_LOG_READER));
+}
+
+void alpaqaLogRecordSetTime(ALPAQA_LOG_RECORD * record, uint64_t realtimeNs)
+{
+    record->timestampSeconds = realtimeNs / NS_PER_SECOND;
+    record->timestampMs = (realtimeNs % NS_PER_SECOND) / NS_PER_MS;
+}
+
+uint64_t alpaqaLogRecordTimeNs(const ALPAQA_LOG_RECORD * record)
+{
+    return ((uint64_t)record->timestampSeconds * NS_PER_SECOND) + ((uint64_t)record->timestampMs * NS_PER_MS);
+}
+
+void alpaqaLogRecordSetHeatIndex(ALPAQA_LOG_RECORD * record, float heatIndex)
+{
+    float centi = roundf(heatIndex * 100.0f);
+
+    if(centi > INT16_MAX)
+    {
+        centi = INT16_MAX;
+    }
+    if(centi < INT16_MIN)
+    {
+        centi = INT16_MIN;
+    }
+    record->heatIndexCenti = centi;
+}
+
+float alpaqaLogRecordHeatIndex(const ALPAQA_LOG_RECORD * record)
+{
+    return record->heatIndexCenti / 100.0f;
+}
+
+void alpaqaLogRecordPM(const ALPAQA_LOG_RECORD * record, PARTICULATE_MATTER_DATA * data)
+{
+    data->pm1_0 = record->pm1_0;
+    data->pm2_5 = record->pm2_5;
+    data->pm10_0 = record->pm10_0;
+}
+
+void alpaqaLogRecordTempHumidity(const ALPAQA_LOG_RECORD * record, TEMP_HUMIDITY_DATA * data)
+{
+    convertTempAndHumidityTicks(record->temperatureTicks, record->humidityTicks, data);
+}
+
+// Formats a record as the line alpaqa_app used to write to its text log, optionally
+// preceded by the sample time in seconds
+int alpaqaLogFormatCsv(const ALPAQA_LOG_RECORD * record, bool timestamp, char * buffer, size_t size)
+{
+    TEMP_HUMIDITY_DATA tempHumidityData;
+    int length = 0;
+
+    alpaqaLogRecordTempHumidity(record, &tempHumidityData);
+
+    if(timestamp)
+    {
+        length = snprintf(buffer, size, "%lu.%03u, ", (unsigned long)record->timestampSeconds, record->timestampMs);
+        if(length < 0 || (size_t)length >= size)
+        {
+            return -1;
+        }
+    }
+
+    // PM 1.0, PM 2.5, PM 10.0, AQI, AQI avg, Temp F, Temp C, Humidity, Heat Index, NowCast AQI.
+    // NowCast is last so the older columns keep their places.
+    return length + snprintf(buffer + length, size - length, "%d, %d, %d, %d, %d, %0.2f, %0.2f, %0.2f, %0.2f, %d\n",
+                             record->pm1_0, record->pm2_5, record->pm10_0,
+                             record->instantAqi, record->calculatedAqi,
+                             tempHumidityData.temperatureF, tempHumidityData.temperatureC,
+                             tempHumidityData.humidity,
+                             record->heatIndexCenti / 100.0,
+                             record->nowcastAqi);
+}
+
+static bool validHeader(const ALPAQA_LOG_HEADER * header)
+{
+    return memcmp(header->magic, ALPAQA_LOG_MAGIC, ALPAQA_LOG_MAGIC_SIZE) == 0 &&
+           header->headerSize >= sizeof(ALPAQA_LOG_HEADER);
+}
+
+static bool moveOlderVersion(const char * filename)
+{
+    ALPAQA_LOG_HEADER header;
+    char olderFilename[PATH_MAX];
+    ssize_t length;
+    int fd;
+
+    fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        return errno == ENOENT;
+    }
+    length = pread(fd, &header, sizeof(header), 0);
+    close(fd);
+
+    if(length != sizeof(header) || !validHeader(&header) || header.version >= ALPAQA_LOG_VERSION)
+    {
+        return true;
+    }
+
+    if(snprintf(olderFilename, sizeof(olderFilename), "%s.v%u", filename, header.version) >= (int)sizeof(olderFilename))
+    {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+    return rename(filename, olderFilename) == 0;
+}
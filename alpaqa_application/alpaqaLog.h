@@ -0,0 +1,99 @@
+#ifndef ALPAQALOG_H
+#define ALPAQALOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "PMSA003I.h"
+#include "SHT41.h"
+
+#define ALPAQA_LOG_MAGIC "AQLOGBIN"
+#define ALPAQA_LOG_MAGIC_SIZE 8
+#define ALPAQA_LOG_VERSION 2
+// Version 1 records stop before nowcastAqi
+#define ALPAQA_LOG_RECORD_V1_SIZE 24
+
+#define ALPAQA_LOG_PM_OK 0x01
+#define ALPAQA_LOG_SHT_OK 0x02
+#define ALPAQA_LOG_AQI_FULL_24_HOUR 0x04
+#define ALPAQA_LOG_NOWCAST_VALID 0x08
+
+// The file starts with this header followed by fixed size records. Readers step
+// through records by the recordSize stored here, so later versions can append
+// fields to the record without breaking older readers.
+typedef struct
+{
+    char magic[ALPAQA_LOG_MAGIC_SIZE];
+    uint16_t version;
+    uint16_t headerSize;
+    uint16_t recordSize;
+    uint16_t reserved;
+    uint64_t createdNs;
+} ALPAQA_LOG_HEADER;
+
+// Sensor values are stored as they came off the bus, the derived values as the
+// app displayed them. Everything else is recomputed from these when reading.
+typedef struct
+{
+    // CLOCK_REALTIME of the report the record was written for
+    uint32_t timestampSeconds;
+    uint16_t timestampMs;
+    uint8_t flags;
+    // Which location the readings are from, 0 in logs from before there were several
+    uint8_t location;
+    uint16_t pm1_0;
+    uint16_t pm2_5;
+    uint16_t pm10_0;
+    uint16_t temperatureTicks;
+    uint16_t humidityTicks;
+    uint16_t instantAqi;
+    uint16_t calculatedAqi;
+    // Hundredths of a degree F, the precision the text log was written with
+    int16_t heatIndexCenti;
+    // Version 2
+    uint16_t nowcastAqi;
+    uint16_t reserved2;
+} ALPAQA_LOG_RECORD;
+
+typedef struct
+{
+    int fd;
+    uint64_t size;
+    // As opened, kept for rotation
+    const char * filename;
+    uint64_t createdNs;
+} ALPAQA_LOG_WRITER;
+
+typedef struct
+{
+    const uint8_t * map;
+    size_t mapSize;
+    const ALPAQA_LOG_HEADER * header;
+    const uint8_t * records;
+    uint64_t count;
+    // Records from older versions are copied here with the newer fields zeroed
+    ALPAQA_LOG_RECORD upgraded;
+} ALPAQA_LOG_READER;
+
+bool alpaqaLogOpen(ALPAQA_LOG_WRITER * writer, const char * filename);
+bool alpaqaLogAppend(ALPAQA_LOG_WRITER * writer, const ALPAQA_LOG_RECORD * record);
+bool alpaqaLogWritev(ALPAQA_LOG_WRITER * writer, struct iovec * iov, int count);
+bool alpaqaLogSync(ALPAQA_LOG_WRITER * writer);
+bool alpaqaLogRotate(ALPAQA_LOG_WRITER * writer, const char * segmentFilename);
+void alpaqaLogClose(ALPAQA_LOG_WRITER * writer);
+
+bool alpaqaLogReaderOpen(ALPAQA_LOG_READER * reader, const char * filename);
+const ALPAQA_LOG_RECORD * alpaqaLogReaderGet(ALPAQA_LOG_READER * reader, uint64_t index);
+void alpaqaLogReaderClose(ALPAQA_LOG_READER * reader);
+
+void alpaqaLogRecordSetTime(ALPAQA_LOG_RECORD * record, uint64_t realtimeNs);
+uint64_t alpaqaLogRecordTimeNs(const ALPAQA_LOG_RECORD * record);
+void alpaqaLogRecordSetHeatIndex(ALPAQA_LOG_RECORD * record, float heatIndex);
+float alpaqaLogRecordHeatIndex(const ALPAQA_LOG_RECORD * record);
+void alpaqaLogRecordPM(const ALPAQA_LOG_RECORD * record, PARTICULATE_MATTER_DATA * data);
+void alpaqaLogRecordTempHumidity(const ALPAQA_LOG_RECORD * record, TEMP_HUMIDITY_DATA * data);
+int alpaqaLogFormatCsv(const ALPAQA_LOG_RECORD * record, bool timestamp, char * buffer, size_t size);
+
+#endif
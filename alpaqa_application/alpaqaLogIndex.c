@@ -0,0 +1,328 @@
+#include "alpaqaLogIndex.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Records read back from the log per pread() while catching up
+#define CATCH_UP_RECORDS 256
+
+static bool indexFilename(const char * logFilename, char * filename, size_t size);
+static bool validIndexHeader(const ALPAQA_LOG_INDEX_HEADER * header, uint64_t logCreatedNs, uint32_t recordsPerEntry);
+static bool catchUp(ALPAQA_LOG_INDEX_WRITER * index, const ALPAQA_LOG_WRITER * log);
+
+// Picks up an existing index for the log where it left off, or starts a new one.
+// Whatever the log holds that the index does not, after a crash or on a log that
+// never had one, is indexed from the log before returning.
+bool alpaqaLogIndexOpen(ALPAQA_LOG_INDEX_WRITER * index, const ALPAQA_LOG_WRITER * log, const char * logFilename,
+                        uint32_t recordsPerEntry)
+{
+    ALPAQA_LOG_HEADER logHeader;
+    ALPAQA_LOG_INDEX_HEADER header;
+    ALPAQA_LOG_INDEX_ENTRY entry;
+    char filename[PATH_MAX];
+    struct stat fileStat;
+    uint64_t logRecords;
+    uint64_t keep = 0;
+
+    memset(index, 0, sizeof(ALPAQA_LOG_INDEX_WRITER));
+    index->fd = -1;
+    index->recordsPerEntry = recordsPerEntry > 0 ? recordsPerEntry : ALPAQA_LOG_INDEX_DEFAULT_RECORDS;
+
+    if(log->fd < 0 || pread(log->fd, &logHeader, sizeof(logHeader), 0) != sizeof(logHeader) ||
+       logHeader.recordSize != sizeof(ALPAQA_LOG_RECORD) || log->size < logHeader.headerSize)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    if(!indexFilename(logFilename, filename, sizeof(filename)))
+    {
+        return false;
+    }
+    index->recordSize = logHeader.recordSize;
+    logRecords = (log->size - logHeader.headerSize) / logHeader.recordSize;
+
+    index->fd = open(filename, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(index->fd < 0 || fstat(index->fd, &fileStat) != 0)
+    {
+        alpaqaLogIndexClose(index);
+        return false;
+    }
+
+    // Entries past the end of the log are dropped, and so is the last one kept: its
+    // block may have been cut short, so it is indexed again from the log
+    if((uint64_t)fileStat.st_size >= sizeof(header) &&
+       pread(index->fd, &header, sizeof(header), 0) == sizeof(header) &&
+       validIndexHeader(&header, logHeader.createdNs, index->recordsPerEntry))
+    {
+        keep = ((uint64_t)fileStat.st_size - sizeof(header)) / sizeof(entry);
+        if(keep > (logRecords + index->recordsPerEntry - 1) / index->recordsPerEntry)
+        {
+            keep = (logRecords + index->recordsPerEntry - 1) / index->recordsPerEntry;
+        }
+    }
+
+    if(keep > 0 && pread(index->fd, &entry, sizeof(entry), sizeof(header) + (keep - 1) * sizeof(entry)) == sizeof(entry))
+    {
+        keep--;
+        index->maxNs = entry.priorMaxNs;
+    }
+    else
+    {
+        keep = 0;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, ALPAQA_LOG_INDEX_MAGIC, ALPAQA_LOG_MAGIC_SIZE);
+        header.version = ALPAQA_LOG_INDEX_VERSION;
+        header.headerSize = sizeof(ALPAQA_LOG_INDEX_HEADER);
+        header.entrySize = sizeof(ALPAQA_LOG_INDEX_ENTRY);
+        header.recordsPerEntry = index->recordsPerEntry;
+        header.logCreatedNs = logHeader.createdNs;
+        if(pwrite(index->fd, &header, sizeof(header), 0) != sizeof(header))
+        {
+            alpaqaLogIndexClose(index);
+            return false;
+        }
+    }
+
+    index->entries = keep;
+    index->records = keep * index->recordsPerEntry;
+    index->nextOffset = logHeader.headerSize + (index->records * index->recordSize);
+    if(ftruncate(index->fd, sizeof(header) + (keep * sizeof(entry))) != 0 || !catchUp(index, log))
+    {
+        alpaqaLogIndexClose(index);
+        return false;
+    }
+    return true;
+}
+
+// Called with the records just written to the log, in the order they were written
+bool alpaqaLogIndexAdd(ALPAQA_LOG_INDEX_WRITER * index, const ALPAQA_LOG_RECORD * records, uint32_t count)
+{
+    ALPAQA_LOG_INDEX_ENTRY entry;
+
+    if(index->fd < 0)
+    {
+        return false;
+    }
+
+    for(uint32_t idx = 0; idx < count; idx++)
+    {
+        uint64_t timeNs = alpaqaLogRecordTimeNs(&records[idx]);
+
+        if(index->records % index->recordsPerEntry == 0)
+        {
+            entry.offset = index->nextOffset;
+            entry.firstNs = timeNs;
+            entry.priorMaxNs = index->maxNs;
+            if(pwrite(index->fd, &entry, sizeof(entry), sizeof(ALPAQA_LOG_INDEX_HEADER) + (index->entries * sizeof(entry))) !=
+               sizeof(entry))
+            {
+                return false;
+            }
+            index->entries++;
+        }
+        if(timeNs > index->maxNs)
+        {
+            index->maxNs = timeNs;
+        }
+        index->records++;
+        index->nextOffset += index->recordSize;
+    }
+    return true;
+}
+
+void alpaqaLogIndexClose(ALPAQA_LOG_INDEX_WRITER * index)
+{
+    if(index->fd >= 0)
+    {
+        close(index->fd);
+    }
+    index->fd = -1;
+}
+
+// Maps the log and its index. Without a usable index, queries still work, they
+// just start from the first record.
+bool alpaqaLogQueryOpen(ALPAQA_LOG_QUERY * query, const char * logFilename)
+{
+    char filename[PATH_MAX];
+    const ALPAQA_LOG_INDEX_HEADER * header;
+    struct stat fileStat;
+    uint64_t logEnd;
+    void * map;
+    int fd;
+
+    memset(query, 0, sizeof(ALPAQA_LOG_QUERY));
+    if(!alpaqaLogReaderOpen(&query->log, logFilename))
+    {
+        return false;
+    }
+    // A query only touches the blocks it reads, read-ahead over the rest is wasted
+    madvise((void *)query->log.map, query->log.mapSize, MADV_RANDOM);
+
+    if(!indexFilename(logFilename, filename, sizeof(filename)))
+    {
+        return true;
+    }
+    fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        return true;
+    }
+    if(fstat(fd, &fileStat) != 0 || (uint64_t)fileStat.st_size < sizeof(ALPAQA_LOG_INDEX_HEADER))
+    {
+        close(fd);
+        return true;
+    }
+    map = mmap(NULL, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+    {
+        return true;
+    }
+
+    header = map;
+    query->indexMap = map;
+    query->indexMapSize = fileStat.st_size;
+    if(!validIndexHeader(header, query->log.header->createdNs, header->recordsPerEntry) || header->recordsPerEntry == 0 ||
+       query->log.header->recordSize != sizeof(ALPAQA_LOG_RECORD))
+    {
+        munmap(map, fileStat.st_size);
+        query->indexMap = NULL;
+        return true;
+    }
+
+    // Entries for records written after the log was mapped are left out
+    query->entries = (const ALPAQA_LOG_INDEX_ENTRY *)(query->indexMap + header->headerSize);
+    query->entryCount = (query->indexMapSize - header->headerSize) / sizeof(ALPAQA_LOG_INDEX_ENTRY);
+    query->recordsPerEntry = header->recordsPerEntry;
+    logEnd = query->log.header->headerSize + (query->log.count * query->log.header->recordSize);
+    while(query->entryCount > 0 && query->entries[query->entryCount - 1].offset >= logEnd)
+    {
+        query->entryCount--;
+    }
+    return true;
+}
+
+// Starts at the last block everything before which is older than fromNs. The scan
+// ends at the first record at or past toNs, so a clock stepped back across the
+// range can hide the records logged after the step.
+void alpaqaLogQueryStart(ALPAQA_LOG_QUERY * query, uint64_t fromNs, uint64_t toNs)
+{
+    uint64_t low = 0;
+    uint64_t high = query->entryCount;
+
+    query->fromNs = fromNs;
+    query->toNs = toNs;
+    query->next = 0;
+
+    while(low < high)
+    {
+        uint64_t middle = low + ((high - low) / 2);
+
+        if(query->entries[middle].priorMaxNs < fromNs)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    if(low > 0)
+    {
+        query->next = (query->entries[low - 1].offset - query->log.header->headerSize) / query->log.header->recordSize;
+    }
+}
+
+// NULL once the range is done. The record is only good until the next call.
+const ALPAQA_LOG_RECORD * alpaqaLogQueryNext(ALPAQA_LOG_QUERY * query)
+{
+    const ALPAQA_LOG_RECORD * record;
+
+    while((record = alpaqaLogReaderGet(&query->log, query->next)) != NULL)
+    {
+        uint64_t timeNs = alpaqaLogRecordTimeNs(record);
+
+        query->next++;
+        if(timeNs >= query->toNs)
+        {
+            query->next = query->log.count;
+            return NULL;
+        }
+        if(timeNs >= query->fromNs)
+        {
+            return record;
+        }
+    }
+    return NULL;
+}
+
+bool alpaqaLogQueryIndexed(const ALPAQA_LOG_QUERY * query)
+{
+    return query->indexMap != NULL;
+}
+
+void alpaqaLogQueryClose(ALPAQA_LOG_QUERY * query)
+{
+    if(query->indexMap != NULL)
+    {
+        munmap((void *)query->indexMap, query->indexMapSize);
+    }
+    alpaqaLogReaderClose(&query->log);
+    memset(query, 0, sizeof(ALPAQA_LOG_QUERY));
+}
+
+static bool indexFilename(const char * logFilename, char * filename, size_t size)
+{
+    if(snprintf(filename, size, "%s" ALPAQA_LOG_INDEX_SUFFIX, logFilename) >= (int)size)
+    {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+    return true;
+}
+
+static bool validIndexHeader(const ALPAQA_LOG_INDEX_HEADER * header, uint64_t logCreatedNs, uint32_t recordsPerEntry)
+{
+    return memcmp(header->magic, ALPAQA_LOG_INDEX_MAGIC, ALPAQA_LOG_MAGIC_SIZE) == 0 &&
+           header->version == ALPAQA_LOG_INDEX_VERSION &&
+           header->headerSize == sizeof(ALPAQA_LOG_INDEX_HEADER) &&
+           header->entrySize == sizeof(ALPAQA_LOG_INDEX_ENTRY) &&
+           header->recordsPerEntry == recordsPerEntry &&
+           header->logCreatedNs == logCreatedNs;
+}
+
+static bool catchUp(ALPAQA_LOG_INDEX_WRITER * index, const ALPAQA_LOG_WRITER * log)
+{
+    ALPAQA_LOG_RECORD records[CATCH_UP_RECORDS];
+
+    while(index->nextOffset + index->recordSize <= log->size)
+    {
+        uint64_t count = (log->size - index->nextOffset) / index->recordSize;
+        ssize_t length;
+
+        if(count > CATCH_UP_RECORDS)
+        {
+            count = CATCH_UP_RECORDS;
+        }
+        length = pread(log->fd, records, count * index->recordSize, index->nextOffset);
+        if(length < (ssize_t)index->recordSize)
+        {
+            if(length >= 0)
+            {
+                errno = EIO;
+            }
+            return false;
+        }
+        if(!alpaqaLogIndexAdd(index, records, length / index->recordSize))
+        {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,78 @@
+#ifndef ALPAQALOGINDEX_H
+#define ALPAQALOGINDEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "alpaqaLog.h"
+
+#define ALPAQA_LOG_INDEX_MAGIC "AQLOGIDX"
+#define ALPAQA_LOG_INDEX_VERSION 1
+// A year of 1 Hz records is about 30000 entries, 720 KB, and a query reads at most
+// one block of records it does not want
+#define ALPAQA_LOG_INDEX_DEFAULT_RECORDS 1024
+#define ALPAQA_LOG_INDEX_SUFFIX ".idx"
+
+// The index sits beside the log as <log>.idx, tied to it by the log's creation time.
+// It only ever holds what can be rebuilt from the log, so it is never synced.
+typedef struct
+{
+    char magic[ALPAQA_LOG_MAGIC_SIZE];
+    uint16_t version;
+    uint16_t headerSize;
+    uint16_t entrySize;
+    uint16_t reserved;
+    uint32_t recordsPerEntry;
+    uint32_t reserved2;
+    uint64_t logCreatedNs;
+} ALPAQA_LOG_INDEX_HEADER;
+
+// One entry per recordsPerEntry records, for the record starting the block. Record
+// times follow the wall clock, which can step back, so searches go by the latest
+// time before the block rather than the block's own times: that one never goes down.
+typedef struct
+{
+    // Byte offset of the block's first record in the log
+    uint64_t offset;
+    uint64_t firstNs;
+    // Latest time of any record before the block, 0 for the first
+    uint64_t priorMaxNs;
+} ALPAQA_LOG_INDEX_ENTRY;
+
+typedef struct
+{
+    int fd;
+    uint32_t recordsPerEntry;
+    uint64_t records;
+    uint64_t maxNs;
+    uint64_t nextOffset;
+    uint64_t entries;
+    uint16_t recordSize;
+} ALPAQA_LOG_INDEX_WRITER;
+
+// Records in [fromNs, toNs), read straight from the mapped log
+typedef struct
+{
+    ALPAQA_LOG_READER log;
+    const uint8_t * indexMap;
+    size_t indexMapSize;
+    const ALPAQA_LOG_INDEX_ENTRY * entries;
+    uint64_t entryCount;
+    uint32_t recordsPerEntry;
+    uint64_t next;
+    uint64_t fromNs;
+    uint64_t toNs;
+} ALPAQA_LOG_QUERY;
+
+bool alpaqaLogIndexOpen(ALPAQA_LOG_INDEX_WRITER * index, const ALPAQA_LOG_WRITER * log, const char * logFilename,
+                        uint32_t recordsPerEntry);
+bool alpaqaLogIndexAdd(ALPAQA_LOG_INDEX_WRITER * index, const ALPAQA_LOG_RECORD * records, uint32_t count);
+void alpaqaLogIndexClose(ALPAQA_LOG_INDEX_WRITER * index);
+
+bool alpaqaLogQueryOpen(ALPAQA_LOG_QUERY * query, const char * logFilename);
+void alpaqaLogQueryStart(ALPAQA_LOG_QUERY * query, uint64_t fromNs, uint64_t toNs);
+const ALPAQA_LOG_RECORD * alpaqaLogQueryNext(ALPAQA_LOG_QUERY * query);
+bool alpaqaLogQueryIndexed(const ALPAQA_LOG_QUERY * query);
+void alpaqaLogQueryClose(ALPAQA_LOG_QUERY * query);
+
+#endif
@@ -0,0 +1,364 @@
+#include "alpaqaLogThread.h"
+#include "alpaqaArchive.h"
+#include "alpaqaLatency.h"
+#include "alpaqaTime.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Segments rotated within the same second get a number after the time
+#define MAX_SEGMENT_SUFFIX 100
+// A full or read only directory is not tried again on every commit
+#define ROTATE_RETRY_SECONDS 60
+
+static void * logThreadMain(void * arg);
+static bool commitDue(const ALPAQA_LOG_THREAD * logThread, uint64_t nowNs);
+static void commit(ALPAQA_LOG_THREAD * logThread, uint32_t buffer, bool forceSync);
+static bool rotateDue(const ALPAQA_LOG_THREAD * logThread);
+static void rotate(ALPAQA_LOG_THREAD * logThread);
+static bool segmentFilename(const ALPAQA_LOG_WRITER * log, char * filename, size_t size);
+
+bool logThreadStart(ALPAQA_LOG_THREAD * logThread, ALPAQA_LOG_WRITER * log, ALPAQA_LOG_INDEX_WRITER * index,
+                    const ALPAQA_LOG_THREAD_CONFIG * config)
+{
+    pthread_condattr_t condAttr;
+    sigset_t allSignals;
+    sigset_t previousSignals;
+    int result;
+
+    memset(logThread, 0, sizeof(ALPAQA_LOG_THREAD));
+    logThread->config = *config;
+    logThread->log = log;
+    logThread->index = index;
+    logThread->stats.fileSize = log->size;
+    logThread->lastSyncNs = monotonicNowNs();
+
+    if(logThread->config.flushBytes < sizeof(ALPAQA_LOG_RECORD))
+    {
+        logThread->config.flushBytes = sizeof(ALPAQA_LOG_RECORD);
+    }
+
+    // Room for the flush threshold twice over, so records keep coming in while a
+    // slow commit of the other buffer is still going
+    logThread->capacity = ((logThread->config.flushBytes / sizeof(ALPAQA_LOG_RECORD)) + 1) * 2 * sizeof(ALPAQA_LOG_RECORD);
+    logThread->buffers[0] = malloc(logThread->capacity);
+    logThread->buffers[1] = malloc(logThread->capacity);
+    if(logThread->buffers[0] == NULL || logThread->buffers[1] == NULL)
+    {
+        free(logThread->buffers[0]);
+        free(logThread->buffers[1]);
+        return false;
+    }
+
+    // Flush deadlines are on the monotonic clock like the rest of the app
+    pthread_condattr_init(&condAttr);
+    pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+    pthread_cond_init(&logThread->wake, &condAttr);
+    pthread_condattr_destroy(&condAttr);
+    pthread_mutex_init(&logThread->lock, NULL);
+
+    // SIGTERM has to reach the main thread so it can stop this one and drain
+    sigfillset(&allSignals);
+    pthread_sigmask(SIG_BLOCK, &allSignals, &previousSignals);
+    result = pthread_create(&logThread->thread, NULL, logThreadMain, logThread);
+    pthread_sigmask(SIG_SETMASK, &previousSignals, NULL);
+
+    if(result != 0)
+    {
+        errno = result;
+        pthread_cond_destroy(&logThread->wake);
+        pthread_mutex_destroy(&logThread->lock);
+        free(logThread->buffers[0]);
+        free(logThread->buffers[1]);
+        return false;
+    }
+    logThread->threadStarted = true;
+    return true;
+}
+
+bool logThreadAppend(ALPAQA_LOG_THREAD * logThread, const ALPAQA_LOG_RECORD * record)
+{
+    uint32_t active;
+    bool appended = false;
+
+    if(!logThread->threadStarted)
+    {
+        return false;
+    }
+
+    pthread_mutex_lock(&logThread->lock);
+    active = logThread->active;
+    if(logThread->fill[active] + sizeof(ALPAQA_LOG_RECORD) <= logThread->capacity)
+    {
+        bool first = logThread->fill[active] == 0;
+
+        if(first)
+        {
+            logThread->oldestPendingNs = monotonicNowNs();
+        }
+        memcpy(logThread->buffers[active] + logThread->fill[active], record, sizeof(ALPAQA_LOG_RECORD));
+        logThread->fill[active] += sizeof(ALPAQA_LOG_RECORD);
+        appended = true;
+
+        // The first record starts the flush interval, the thread was waiting without one
+        if(first || logThread->fill[active] >= logThread->config.flushBytes)
+        {
+            pthread_cond_signal(&logThread->wake);
+        }
+    }
+    else
+    {
+        logThread->stats.recordsDropped++;
+    }
+    pthread_mutex_unlock(&logThread->lock);
+    return appended;
+}
+
+void logThreadGetStats(ALPAQA_LOG_THREAD * logThread, ALPAQA_LOG_THREAD_STATS * stats)
+{
+    if(!logThread->threadStarted)
+    {
+        *stats = logThread->stats;
+        return;
+    }
+
+    pthread_mutex_lock(&logThread->lock);
+    *stats = logThread->stats;
+    stats->pendingBytes = logThread->fill[0] + logThread->fill[1];
+    pthread_mutex_unlock(&logThread->lock);
+}
+
+// Writes out everything still buffered, syncs it, and joins the thread
+void logThreadStop(ALPAQA_LOG_THREAD * logThread)
+{
+    if(!logThread->threadStarted)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&logThread->lock);
+    logThread->stopping = true;
+    pthread_cond_signal(&logThread->wake);
+    pthread_mutex_unlock(&logThread->lock);
+
+    pthread_join(logThread->thread, NULL);
+    logThread->threadStarted = false;
+
+    pthread_cond_destroy(&logThread->wake);
+    pthread_mutex_destroy(&logThread->lock);
+    free(logThread->buffers[0]);
+    free(logThread->buffers[1]);
+    logThread->buffers[0] = NULL;
+    logThread->buffers[1] = NULL;
+}
+
+static void * logThreadMain(void * arg)
+{
+    ALPAQA_LOG_THREAD * logThread = arg;
+    struct timespec deadline;
+    uint32_t committing;
+    bool stopping;
+
+    pthread_mutex_lock(&logThread->lock);
+    for(;;)
+    {
+        while(!logThread->stopping && !commitDue(logThread, monotonicNowNs()))
+        {
+            if(logThread->fill[logThread->active] == 0)
+            {
+                pthread_cond_wait(&logThread->wake, &logThread->lock);
+            }
+            else
+            {
+                nsToTimespec(logThread->oldestPendingNs + (logThread->config.flushIntervalMs * NS_PER_MS), &deadline);
+                pthread_cond_timedwait(&logThread->wake, &logThread->lock, &deadline);
+            }
+        }
+        stopping = logThread->stopping;
+
+        // Swap so new records land in the other buffer while this one is written.
+        // The other buffer is always empty here, the last commit emptied it.
+        committing = logThread->active;
+        logThread->active ^= 1;
+        pthread_mutex_unlock(&logThread->lock);
+
+        if(logThread->fill[committing] > 0 || stopping)
+        {
+            commit(logThread, committing, stopping);
+        }
+        if(!stopping && rotateDue(logThread))
+        {
+            rotate(logThread);
+        }
+
+        pthread_mutex_lock(&logThread->lock);
+        logThread->fill[committing] = 0;
+        if(stopping && logThread->fill[logThread->active] == 0)
+        {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&logThread->lock);
+    return NULL;
+}
+
+static bool commitDue(const ALPAQA_LOG_THREAD * logThread, uint64_t nowNs)
+{
+    uint32_t fill = logThread->fill[logThread->active];
+
+    return fill > 0 &&
+           (fill >= logThread->config.flushBytes ||
+            nowNs >= logThread->oldestPendingNs + (logThread->config.flushIntervalMs * NS_PER_MS));
+}
+
+// Runs without the lock held, only this thread touches the buffer being committed
+static void commit(ALPAQA_LOG_THREAD * logThread, uint32_t buffer, bool forceSync)
+{
+    struct iovec iov;
+    uint64_t startNs = monotonicNowNs();
+    uint64_t writtenNs;
+    uint64_t endNs;
+    uint64_t sizeBefore = logThread->log->size;
+    bool written;
+    bool indexed = true;
+    bool synced = false;
+
+    iov.iov_base = logThread->buffers[buffer];
+    iov.iov_len = logThread->fill[buffer];
+    written = alpaqaLogWritev(logThread->log, &iov, 1);
+    // Only the records that made it into the log are indexed
+    if(logThread->index != NULL)
+    {
+        indexed = alpaqaLogIndexAdd(logThread->index, (const ALPAQA_LOG_RECORD *)logThread->buffers[buffer],
+                                    (logThread->log->size - sizeBefore) / sizeof(ALPAQA_LOG_RECORD));
+    }
+    writtenNs = latencyEnd(LATENCY_LOG_WRITE, startNs);
+    endNs = writtenNs;
+
+    if(forceSync || (logThread->config.syncIntervalMs > 0 &&
+                     startNs - logThread->lastSyncNs >= logThread->config.syncIntervalMs * NS_PER_MS))
+    {
+        synced = alpaqaLogSync(logThread->log);
+        logThread->lastSyncNs = startNs;
+        endNs = latencyEnd(LATENCY_LOG_SYNC, writtenNs);
+    }
+
+    pthread_mutex_lock(&logThread->lock);
+    logThread->stats.flushes++;
+    logThread->stats.syncs += synced ? 1 : 0;
+    logThread->stats.writeErrors += written ? 0 : 1;
+    logThread->stats.indexErrors += indexed ? 0 : 1;
+    logThread->stats.bytesWritten += logThread->log->size - sizeBefore;
+    logThread->stats.fileSize = logThread->log->size;
+    logThread->stats.lastCommitNs = endNs - startNs;
+    if(logThread->stats.lastCommitNs > logThread->stats.maxCommitNs)
+    {
+        logThread->stats.maxCommitNs = logThread->stats.lastCommitNs;
+    }
+    pthread_mutex_unlock(&logThread->lock);
+}
+
+static bool rotateDue(const ALPAQA_LOG_THREAD * logThread)
+{
+    const ALPAQA_LOG_WRITER * log = logThread->log;
+
+    return log->fd >= 0 && log->size > sizeof(ALPAQA_LOG_HEADER) && monotonicNowNs() >= logThread->rotateRetryNs &&
+           ((logThread->config.rotateBytes > 0 && log->size >= logThread->config.rotateBytes) ||
+            (logThread->config.rotateSeconds > 0 &&
+             realtimeNowNs() >= log->createdNs + (logThread->config.rotateSeconds * NS_PER_SECOND)));
+}
+
+// The segment is synced before it is renamed, so a crash leaves either the old log
+// or a whole segment and a new log. Its index goes with it and a new one is started.
+// If the log could not be moved aside it carries on as it was, index and all, and
+// rotation waits ROTATE_RETRY_SECONDS before trying again.
+static void rotate(ALPAQA_LOG_THREAD * logThread)
+{
+    char segment[PATH_MAX];
+    char filename[PATH_MAX];
+    char segmentIndex[PATH_MAX];
+    uint64_t archiveBytes = 0;
+    uint64_t startNs;
+    uint64_t archiveNs = 0;
+    bool rotated;
+    bool archived = false;
+
+    rotated = segmentFilename(logThread->log, segment, sizeof(segment)) &&
+              snprintf(segmentIndex, sizeof(segmentIndex), "%s" ALPAQA_LOG_INDEX_SUFFIX, segment) < (int)sizeof(segmentIndex) &&
+              alpaqaLogSync(logThread->log) && alpaqaLogRotate(logThread->log, segment);
+
+    if(!rotated)
+    {
+        logThread->rotateRetryNs = monotonicNowNs() + (ROTATE_RETRY_SECONDS * NS_PER_SECOND);
+    }
+    else if(logThread->index != NULL)
+    {
+        uint32_t recordsPerEntry = logThread->index->recordsPerEntry;
+
+        alpaqaLogIndexClose(logThread->index);
+        snprintf(filename, sizeof(filename), "%s" ALPAQA_LOG_INDEX_SUFFIX, logThread->log->filename);
+        rename(filename, segmentIndex);
+        alpaqaLogIndexOpen(logThread->index, logThread->log, logThread->log->filename, recordsPerEntry);
+    }
+
+    if(rotated && logThread->config.archive &&
+       snprintf(filename, sizeof(filename), "%s" ALPAQA_ARCHIVE_SUFFIX, segment) < (int)sizeof(filename))
+    {
+        startNs = monotonicNowNs();
+        archived = archiveEncodeLog(segment, filename, &archiveBytes);
+        archiveNs = monotonicNowNs() - startNs;
+        if(archived)
+        {
+            unlink(segment);
+            unlink(segmentIndex);
+        }
+    }
+
+    pthread_mutex_lock(&logThread->lock);
+    logThread->stats.rotations += rotated ? 1 : 0;
+    logThread->stats.rotateErrors += rotated && (archived || !logThread->config.archive) ? 0 : 1;
+    logThread->stats.archiveBytes += archiveBytes;
+    if(archived)
+    {
+        logThread->stats.lastArchiveNs = archiveNs;
+    }
+    logThread->stats.fileSize = logThread->log->size;
+    pthread_mutex_unlock(&logThread->lock);
+}
+
+// <log>.YYYYmmddTHHMMSSZ from the log's creation time, numbered if that is taken
+static bool segmentFilename(const ALPAQA_LOG_WRITER * log, char * filename, size_t size)
+{
+    time_t createdSeconds = log->createdNs / NS_PER_SECOND;
+    char archiveFilename[PATH_MAX];
+    char timeText[32];
+    struct tm createdTm;
+    int length;
+
+    gmtime_r(&createdSeconds, &createdTm);
+    strftime(timeText, sizeof(timeText), "%Y%m%dT%H%M%SZ", &createdTm);
+
+    for(int suffix = 0; suffix < MAX_SEGMENT_SUFFIX; suffix++)
+    {
+        length = suffix == 0 ? snprintf(filename, size, "%s.%s", log->filename, timeText) :
+                               snprintf(filename, size, "%s.%s-%d", log->filename, timeText, suffix);
+        if(length < 0 || (size_t)length >= size ||
+           snprintf(archiveFilename, sizeof(archiveFilename), "%s" ALPAQA_ARCHIVE_SUFFIX, filename) >= (int)sizeof(archiveFilename))
+        {
+            errno = ENAMETOOLONG;
+            return false;
+        }
+        if(access(filename, F_OK) != 0 && access(archiveFilename, F_OK) != 0)
+        {
+            return true;
+        }
+    }
+    errno = EEXIST;
+    return false;
+}
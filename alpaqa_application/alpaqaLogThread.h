@@ -0,0 +1,89 @@
+#ifndef ALPAQALOGTHREAD_H
+#define ALPAQALOGTHREAD_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "alpaqaLog.h"
+#include "alpaqaLogIndex.h"
+
+#define LOG_THREAD_DEFAULT_FLUSH_BYTES 4096
+#define LOG_THREAD_DEFAULT_FLUSH_MS 10000
+#define LOG_THREAD_DEFAULT_SYNC_MS 60000
+#define LOG_THREAD_DEFAULT_ROTATE_BYTES (32ull * 1024 * 1024)
+#define LOG_THREAD_DEFAULT_ROTATE_SECONDS 86400
+
+typedef struct
+{
+    // Commit once this many bytes are waiting or the oldest waiting record is this
+    // old, whichever comes first. Together they bound what a crash can lose.
+    uint32_t flushBytes;
+    uint32_t flushIntervalMs;
+    // fdatasync() after a commit when the last one is at least this old, 0 leaves
+    // it to the kernel. Stopping the thread always syncs.
+    uint32_t syncIntervalMs;
+    // Start a new log once this one holds this many bytes or was created this long
+    // ago, 0 for no limit. The old one is renamed after its creation time.
+    uint64_t rotateBytes;
+    uint32_t rotateSeconds;
+    // Encode rotated segments into archives and delete the raw files
+    bool archive;
+} ALPAQA_LOG_THREAD_CONFIG;
+
+typedef struct
+{
+    uint64_t flushes;
+    uint64_t syncs;
+    uint64_t bytesWritten;
+    uint64_t recordsDropped;
+    uint64_t writeErrors;
+    uint64_t indexErrors;
+    // A commit is the write plus the sync if one was due
+    uint64_t lastCommitNs;
+    uint64_t maxCommitNs;
+    uint64_t fileSize;
+    uint32_t pendingBytes;
+    uint64_t rotations;
+    uint64_t rotateErrors;
+    // Total size of the archives written, and how long the last one took to encode
+    uint64_t archiveBytes;
+    uint64_t lastArchiveNs;
+} ALPAQA_LOG_THREAD_STATS;
+
+// Records go into one of two buffers while the thread writes out the other, so
+// the caller never waits on the card. A buffer that fills while the other is
+// still being written drops records rather than blocking, and counts them.
+// Rotation and archiving run on the thread between commits, so records only
+// buffer up meanwhile.
+typedef struct
+{
+    ALPAQA_LOG_THREAD_CONFIG config;
+    ALPAQA_LOG_WRITER * log;
+    // NULL when the log is not indexed
+    ALPAQA_LOG_INDEX_WRITER * index;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    bool threadStarted;
+    bool stopping;
+
+    uint8_t * buffers[2];
+    uint32_t fill[2];
+    uint32_t capacity;
+    uint32_t active;
+    uint64_t oldestPendingNs;
+    uint64_t lastSyncNs;
+    // After a failed rotation, monotonic time it is next tried
+    uint64_t rotateRetryNs;
+
+    ALPAQA_LOG_THREAD_STATS stats;
+} ALPAQA_LOG_THREAD;
+
+bool logThreadStart(ALPAQA_LOG_THREAD * logThread, ALPAQA_LOG_WRITER * log, ALPAQA_LOG_INDEX_WRITER * index,
+                    const ALPAQA_LOG_THREAD_CONFIG * config);
+bool logThreadAppend(ALPAQA_LOG_THREAD * logThread, const ALPAQA_LOG_RECORD * record);
+void logThreadGetStats(ALPAQA_LOG_THREAD * logThread, ALPAQA_LOG_THREAD_STATS * stats);
+void logThreadStop(ALPAQA_LOG_THREAD * logThread);
+
+#endif
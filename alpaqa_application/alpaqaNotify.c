@@ -0,0 +1,349 @@
+#define _GNU_SOURCE
+#include "alpaqaNotify.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// The hook thread's counts are plain integers read from the main thread
+#define publish(notify, field, value) __atomic_store_n(&(notify)->stats.field, (value), __ATOMIC_RELAXED)
+#define observe(notify, field) __atomic_load_n(&(notify)->stats.field, __ATOMIC_RELAXED)
+
+extern char ** environ;
+
+static bool startExec(ALPAQA_NOTIFY * notify, const char * execCommand);
+static void * execThread(void * arg);
+static bool runHook(ALPAQA_NOTIFY * notify);
+static void sendFifo(ALPAQA_NOTIFY * notify, const char * text, size_t length);
+static ssize_t writeWithoutSigpipe(int fd, const void * data, size_t length);
+
+bool notifyStart(ALPAQA_NOTIFY * notify, const char * fifoPath, const char * datagramPath, const char * execCommand)
+{
+    memset(notify, 0, sizeof(ALPAQA_NOTIFY));
+    notify->fifoFd = -1;
+    notify->datagramFd = -1;
+    notify->execWakeFd = -1;
+    atomic_init(&notify->stopping, false);
+    atomic_init(&notify->execPid, 0);
+
+    if(fifoPath != NULL && fifoPath[0] != '\0')
+    {
+        notify->fifoPath = fifoPath;
+    }
+
+    if(datagramPath != NULL && datagramPath[0] != '\0')
+    {
+        if(strlen(datagramPath) >= sizeof(notify->datagramAddress.sun_path))
+        {
+            errno = ENAMETOOLONG;
+            return false;
+        }
+        notify->datagramAddress.sun_family = AF_UNIX;
+        strcpy(notify->datagramAddress.sun_path, datagramPath);
+        notify->datagramAddressLength = sizeof(notify->datagramAddress);
+        notify->datagramFd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if(notify->datagramFd < 0)
+        {
+            return false;
+        }
+    }
+
+    if(execCommand != NULL && execCommand[0] != '\0' && !startExec(notify, execCommand))
+    {
+        notifyStop(notify);
+        return false;
+    }
+    return true;
+}
+
+// text is one line, newline included. Never waits on a reader.
+void notifySend(ALPAQA_NOTIFY * notify, const char * text)
+{
+    NOTIFY_MESSAGE message;
+    size_t length = strlen(text);
+    uint64_t one = 1;
+
+    if(notify->fifoPath != NULL)
+    {
+        sendFifo(notify, text, length);
+    }
+
+    if(notify->datagramFd >= 0)
+    {
+        if(sendto(notify->datagramFd, text, length, MSG_DONTWAIT | MSG_NOSIGNAL,
+                  (const struct sockaddr *)&notify->datagramAddress, notify->datagramAddressLength) == (ssize_t)length)
+        {
+            notify->stats.sent[NOTIFY_DATAGRAM]++;
+        }
+        else
+        {
+            notify->stats.dropped[NOTIFY_DATAGRAM]++;
+        }
+    }
+
+    if(notify->execStarted)
+    {
+        snprintf(message.text, sizeof(message.text), "%s", text);
+        if(!ringPush(&notify->execQueue, &message))
+        {
+            notify->stats.dropped[NOTIFY_EXEC]++;
+        }
+        else if(write(notify->execWakeFd, &one, sizeof(one)) != sizeof(one))
+        {
+            // The hook thread is already due to wake up
+        }
+    }
+}
+
+// The exec sent and failed counts are the hook thread's, everything else is ours
+void notifyGetStats(ALPAQA_NOTIFY * notify, NOTIFY_STATS * stats)
+{
+    stats->sent[NOTIFY_FIFO] = notify->stats.sent[NOTIFY_FIFO];
+    stats->sent[NOTIFY_DATAGRAM] = notify->stats.sent[NOTIFY_DATAGRAM];
+    stats->sent[NOTIFY_EXEC] = observe(notify, sent[NOTIFY_EXEC]);
+    for(int sink = 0; sink < NOTIFY_SINK_COUNT; sink++)
+    {
+        stats->dropped[sink] = notify->stats.dropped[sink];
+    }
+    stats->execFailed = observe(notify, execFailed);
+}
+
+bool notifyActive(const ALPAQA_NOTIFY * notify)
+{
+    return notify->fifoPath != NULL || notify->datagramFd >= 0 || notify->execStarted;
+}
+
+// A hook still running is sent SIGTERM and waited for, messages queued behind it
+// are dropped
+void notifyStop(ALPAQA_NOTIFY * notify)
+{
+    uint64_t one = 1;
+    pid_t pid;
+
+    if(notify->execStarted)
+    {
+        atomic_store(&notify->stopping, true);
+        if(write(notify->execWakeFd, &one, sizeof(one)) != sizeof(one))
+        {
+            // The flag alone stops the thread after its current hook
+        }
+        if((pid = atomic_load(&notify->execPid)) > 0)
+        {
+            kill(pid, SIGTERM);
+        }
+        pthread_join(notify->execThread, NULL);
+        notify->execStarted = false;
+    }
+    if(notify->execWakeFd >= 0)
+    {
+        close(notify->execWakeFd);
+        notify->execWakeFd = -1;
+    }
+    ringFree(&notify->execQueue);
+    free(notify->execEnvironment);
+    notify->execEnvironment = NULL;
+
+    if(notify->fifoFd >= 0)
+    {
+        close(notify->fifoFd);
+        notify->fifoFd = -1;
+    }
+    if(notify->datagramFd >= 0)
+    {
+        close(notify->datagramFd);
+        notify->datagramFd = -1;
+    }
+    notify->fifoPath = NULL;
+}
+
+static bool startExec(ALPAQA_NOTIFY * notify, const char * execCommand)
+{
+    sigset_t allSignals;
+    sigset_t previousSignals;
+    uint32_t variables = 0;
+    int result;
+
+    notify->execCommand = execCommand;
+    if(!ringInit(&notify->execQueue, NOTIFY_EXEC_QUEUE, sizeof(NOTIFY_MESSAGE)))
+    {
+        return false;
+    }
+    notify->execWakeFd = eventfd(0, EFD_CLOEXEC);
+    if(notify->execWakeFd < 0)
+    {
+        return false;
+    }
+
+    // Taken once here, the hook thread must not read environ while the main thread may change it
+    while(environ != NULL && environ[variables] != NULL)
+    {
+        variables++;
+    }
+    notify->execEnvironment = calloc(variables + 2, sizeof(char *));
+    if(notify->execEnvironment == NULL)
+    {
+        return false;
+    }
+    if(variables > 0)
+    {
+        memcpy(notify->execEnvironment, environ, variables * sizeof(char *));
+    }
+    notify->execVariable = variables;
+
+    // Signals are for the main thread
+    sigfillset(&allSignals);
+    pthread_sigmask(SIG_BLOCK, &allSignals, &previousSignals);
+    result = pthread_create(&notify->execThread, NULL, execThread, notify);
+    pthread_sigmask(SIG_SETMASK, &previousSignals, NULL);
+
+    if(result != 0)
+    {
+        errno = result;
+        return false;
+    }
+    notify->execStarted = true;
+    return true;
+}
+
+static void * execThread(void * arg)
+{
+    ALPAQA_NOTIFY * notify = arg;
+    NOTIFY_MESSAGE message;
+    char variable[sizeof(NOTIFY_EXEC_VARIABLE) + ALERT_MESSAGE_SIZE];
+    uint64_t count;
+
+    notify->execEnvironment[notify->execVariable] = variable;
+
+    while(!atomic_load(&notify->stopping))
+    {
+        if(read(notify->execWakeFd, &count, sizeof(count)) != sizeof(count) && errno != EINTR)
+        {
+            break;
+        }
+        while(!atomic_load(&notify->stopping) && ringPop(&notify->execQueue, &message))
+        {
+            // The newline is for the FIFO and socket readers
+            message.text[strcspn(message.text, "\n")] = '\0';
+            snprintf(variable, sizeof(variable), NOTIFY_EXEC_VARIABLE "=%s", message.text);
+            if(runHook(notify))
+            {
+                publish(notify, sent[NOTIFY_EXEC], notify->stats.sent[NOTIFY_EXEC] + 1);
+            }
+            else
+            {
+                publish(notify, execFailed, notify->stats.execFailed + 1);
+            }
+        }
+    }
+    return NULL;
+}
+
+// The hook starts with no signals blocked, whatever this thread has blocked
+static bool runHook(ALPAQA_NOTIFY * notify)
+{
+    char * argv[] = {"sh", "-c", (char *)notify->execCommand, NULL};
+    posix_spawnattr_t attributes;
+    sigset_t noSignals;
+    pid_t pid;
+    int status;
+    int result;
+
+    posix_spawnattr_init(&attributes);
+    sigemptyset(&noSignals);
+    posix_spawnattr_setsigmask(&attributes, &noSignals);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK);
+    result = posix_spawn(&pid, "/bin/sh", NULL, &attributes, argv, notify->execEnvironment);
+    posix_spawnattr_destroy(&attributes);
+    if(result != 0)
+    {
+        return false;
+    }
+    atomic_store(&notify->execPid, pid);
+    // Stopping may have come in before the pid was there to signal
+    if(atomic_load(&notify->stopping))
+    {
+        kill(pid, SIGTERM);
+    }
+
+    while(waitpid(pid, &status, 0) < 0)
+    {
+        if(errno != EINTR)
+        {
+            atomic_store(&notify->execPid, 0);
+            return false;
+        }
+    }
+    atomic_store(&notify->execPid, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Opening for write without blocking fails until something has the FIFO open to
+// read, so lines are dropped until then. Lines are far below PIPE_BUF, so each one
+// goes in whole or not at all.
+static void sendFifo(ALPAQA_NOTIFY * notify, const char * text, size_t length)
+{
+    ssize_t written;
+
+    if(notify->fifoFd < 0)
+    {
+        notify->fifoFd = open(notify->fifoPath, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+        if(notify->fifoFd < 0)
+        {
+            notify->stats.dropped[NOTIFY_FIFO]++;
+            return;
+        }
+    }
+
+    written = writeWithoutSigpipe(notify->fifoFd, text, length);
+    if(written == (ssize_t)length)
+    {
+        notify->stats.sent[NOTIFY_FIFO]++;
+        return;
+    }
+    notify->stats.dropped[NOTIFY_FIFO]++;
+    // The reader went away, open again for the next one
+    if(written < 0 && errno == EPIPE)
+    {
+        close(notify->fifoFd);
+        notify->fifoFd = -1;
+    }
+}
+
+// A FIFO without a reader raises SIGPIPE on write. It is held off while the write
+// goes in and taken back off the pending set, unless it was already pending.
+static ssize_t writeWithoutSigpipe(int fd, const void * data, size_t length)
+{
+    struct timespec noWait = {0, 0};
+    sigset_t pipeSignal;
+    sigset_t pending;
+    sigset_t previous;
+    bool alreadyPending;
+    ssize_t written;
+    int writeErrno;
+
+    sigemptyset(&pipeSignal);
+    sigaddset(&pipeSignal, SIGPIPE);
+    sigpending(&pending);
+    alreadyPending = sigismember(&pending, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipeSignal, &previous);
+
+    written = write(fd, data, length);
+    writeErrno = errno;
+    if(written < 0 && writeErrno == EPIPE && !alreadyPending)
+    {
+        while(sigtimedwait(&pipeSignal, NULL, &noWait) < 0 && errno == EINTR)
+        {
+        }
+    }
+
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    errno = writeErrno;
+    return written;
+}
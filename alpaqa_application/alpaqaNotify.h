@@ -0,0 +1,75 @@
+#ifndef ALPAQANOTIFY_H
+#define ALPAQANOTIFY_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "alpaqaAlert.h"
+#include "alpaqaRing.h"
+
+// Messages waiting for the exec hook. Past that they are dropped and counted.
+#define NOTIFY_EXEC_QUEUE 16
+#define NOTIFY_EXEC_VARIABLE "ALPAQA_ALERT"
+
+typedef enum
+{
+    NOTIFY_FIFO = 0,
+    NOTIFY_DATAGRAM,
+    NOTIFY_EXEC,
+    NOTIFY_SINK_COUNT
+} NOTIFY_SINK;
+
+// exec counts are written by the hook thread, read them with notifyGetStats()
+typedef struct
+{
+    uint64_t sent[NOTIFY_SINK_COUNT];
+    uint64_t dropped[NOTIFY_SINK_COUNT];
+    // Hooks that could not be started or exited other than 0
+    uint64_t execFailed;
+} NOTIFY_STATS;
+
+typedef struct
+{
+    char text[ALERT_MESSAGE_SIZE];
+} NOTIFY_MESSAGE;
+
+// Where alert lines go. None of the sinks can hold up the caller: the FIFO and the
+// datagram socket are written without blocking, whatever does not fit is dropped, and
+// the hook command runs on a thread of its own, one message at a time, fed through a
+// ring. Any sink can be left out.
+typedef struct
+{
+    // FIFO, opened when there is a reader and reopened after one goes away
+    const char * fifoPath;
+    int fifoFd;
+    // Unix datagram socket of some other process, each line one datagram
+    int datagramFd;
+    struct sockaddr_un datagramAddress;
+    socklen_t datagramAddressLength;
+    // Run with /bin/sh -c, the line in NOTIFY_EXEC_VARIABLE
+    const char * execCommand;
+    ALPAQA_RING execQueue;
+    int execWakeFd;
+    // Our environment plus the message variable, for each hook
+    char ** execEnvironment;
+    uint32_t execVariable;
+    pthread_t execThread;
+    bool execStarted;
+    // The hook running now, 0 between hooks
+    atomic_int execPid;
+    atomic_bool stopping;
+
+    NOTIFY_STATS stats;
+} ALPAQA_NOTIFY;
+
+bool notifyStart(ALPAQA_NOTIFY * notify, const char * fifoPath, const char * datagramPath, const char * execCommand);
+void notifySend(ALPAQA_NOTIFY * notify, const char * text);
+void notifyGetStats(ALPAQA_NOTIFY * notify, NOTIFY_STATS * stats);
+bool notifyActive(const ALPAQA_NOTIFY * notify);
+void notifyStop(ALPAQA_NOTIFY * notify);
+
+#endif
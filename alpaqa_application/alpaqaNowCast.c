@@ -0,0 +1,122 @@
+#include "alpaqaNowCast.h"
+
+#include <string.h>
+
+static void readHour(const ALPAQA_ROLLUP * rollup, uint64_t index, bool * valid, float * pm2_5, float * pm10_0);
+static float weightedAverage(const bool * valid, const float * hourly);
+
+void nowcastInit(ALPAQA_NOWCAST * nowcast)
+{
+    memset(nowcast, 0, sizeof(ALPAQA_NOWCAST));
+}
+
+// Weighted 12 hour concentrations, truncated to whole ug/m^3 like the breakpoint
+// table. The current hour counts as the most recent one, partial or not.
+// Returns false while 2 of the last 3 hours do not have data, in which case the
+// concentrations are the best effort over the hours there are.
+bool nowcastCompute(ALPAQA_NOWCAST * nowcast, const ALPAQA_ROLLUP * rollup, uint16_t * pm2_5, uint16_t * pm10_0)
+{
+    const ROLLUP_TIER * hours = &rollup->tiers[ROLLUP_TIER_HOURS];
+
+    *pm2_5 = 0;
+    *pm10_0 = 0;
+    if(!rollup->started)
+    {
+        return false;
+    }
+
+    // Hour rollover, the completed hours only change here
+    if(!nowcast->started || nowcast->hourIndex != hours->newestIndex)
+    {
+        nowcast->started = true;
+        nowcast->hourIndex = hours->newestIndex;
+        for(int hour = 1; hour < NOWCAST_HOURS; hour++)
+        {
+            readHour(rollup, hours->newestIndex - hour, &nowcast->valid[hour], &nowcast->pm2_5[hour], &nowcast->pm10_0[hour]);
+        }
+    }
+    readHour(rollup, hours->newestIndex, &nowcast->valid[0], &nowcast->pm2_5[0], &nowcast->pm10_0[0]);
+
+    return nowcastFromHours(nowcast->valid, nowcast->pm2_5, nowcast->pm10_0, pm2_5, pm10_0);
+}
+
+// The same from NOWCAST_HOURS hourly averages, newest first, for callers that
+// already have them such as the offline reprocessing tool
+bool nowcastFromHours(const bool * valid, const float * pm2_5Hourly, const float * pm10_0Hourly,
+                      uint16_t * pm2_5, uint16_t * pm10_0)
+{
+    int recentHours = 0;
+
+    for(int hour = 0; hour < 3; hour++)
+    {
+        recentHours += valid[hour] ? 1 : 0;
+    }
+
+    *pm2_5 = weightedAverage(valid, pm2_5Hourly);
+    *pm10_0 = weightedAverage(valid, pm10_0Hourly);
+    return recentHours >= 2;
+}
+
+static void readHour(const ALPAQA_ROLLUP * rollup, uint64_t index, bool * valid, float * pm2_5, float * pm10_0)
+{
+    ROLLUP_SUMMARY summary;
+
+    *valid = rollupBucket(rollup, ROLLUP_TIER_HOURS, index, &summary) && summary.count > 0;
+    if(*valid)
+    {
+        *pm2_5 = (float)summary.sumPm2_5 / summary.count;
+        *pm10_0 = (float)summary.sumPm10_0 / summary.count;
+    }
+}
+
+// Hours without data are left out of both sums, which is how the EPA handles
+// missing hours
+static float weightedAverage(const bool * valid, const float * hourly)
+{
+    float minimum = 0.0f;
+    float maximum = 0.0f;
+    float weight = 1.0f;
+    float factor = 1.0f;
+    float sum = 0.0f;
+    float weights = 0.0f;
+    bool first = true;
+
+    for(int hour = 0; hour < NOWCAST_HOURS; hour++)
+    {
+        if(!valid[hour])
+        {
+            continue;
+        }
+        if(first || hourly[hour] < minimum)
+        {
+            minimum = hourly[hour];
+        }
+        if(first || hourly[hour] > maximum)
+        {
+            maximum = hourly[hour];
+        }
+        first = false;
+    }
+
+    if(maximum > 0.0f)
+    {
+        weight = minimum / maximum;
+    }
+    if(weight < NOWCAST_MIN_WEIGHT)
+    {
+        weight = NOWCAST_MIN_WEIGHT;
+    }
+
+    // factor is weight^hour
+    for(int hour = 0; hour < NOWCAST_HOURS; hour++)
+    {
+        if(valid[hour])
+        {
+            sum += factor * hourly[hour];
+            weights += factor;
+        }
+        factor *= weight;
+    }
+
+    return weights > 0.0f ? sum / weights : 0.0f;
+}
@@ -0,0 +1,31 @@
+#ifndef ALPAQANOWCAST_H
+#define ALPAQANOWCAST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "alpaqaRollup.h"
+
+#define NOWCAST_HOURS 12
+// EPA floor on the weight factor for particulate matter
+#define NOWCAST_MIN_WEIGHT 0.5f
+
+// NowCast as in the EPA technical assistance document, fed from the rollup's
+// hour tier. The rollup already adds every sample to the current hour, so all
+// this keeps is the hourly averages of the 11 completed hours, reread from the
+// rollup only when the hour rolls over. Index 0 is the current hour.
+typedef struct
+{
+    bool started;
+    uint64_t hourIndex;
+    bool valid[NOWCAST_HOURS];
+    float pm2_5[NOWCAST_HOURS];
+    float pm10_0[NOWCAST_HOURS];
+} ALPAQA_NOWCAST;
+
+void nowcastInit(ALPAQA_NOWCAST * nowcast);
+bool nowcastCompute(ALPAQA_NOWCAST * nowcast, const ALPAQA_ROLLUP * rollup, uint16_t * pm2_5, uint16_t * pm10_0);
+bool nowcastFromHours(const bool * valid, const float * pm2_5Hourly, const float * pm10_0Hourly,
+                      uint16_t * pm2_5, uint16_t * pm10_0);
+
+#endif
@@ -0,0 +1,177 @@
+#include "alpaqaPercentile.h"
+
+#include <string.h>
+
+static void advanceSlices(ALPAQA_QUANTILE * quantile, uint64_t slice);
+static void dropSlice(ALPAQA_QUANTILE * quantile, uint32_t sliceId);
+
+// The window covers the newest PERCENTILE_SLICES slices, the one filling included
+void quantileInit(ALPAQA_QUANTILE * quantile, uint32_t windowSeconds, uint8_t shift)
+{
+    memset(quantile, 0, sizeof(ALPAQA_QUANTILE));
+    quantile->sliceSeconds = windowSeconds / PERCENTILE_SLICES;
+    if(quantile->sliceSeconds == 0)
+    {
+        quantile->sliceSeconds = 1;
+    }
+    quantile->shift = shift;
+}
+
+// O(1) apart from a slice leaving the window, which costs one pass over the bins
+// once per slice width. A clock stepped back files the sample in the newest slice.
+void quantileAdd(ALPAQA_QUANTILE * quantile, uint64_t timeSeconds, uint16_t value)
+{
+    uint64_t slice = timeSeconds / quantile->sliceSeconds;
+    uint32_t bin = value >> quantile->shift;
+    uint32_t sliceId;
+
+    if(!quantile->started)
+    {
+        quantile->newestSlice = slice;
+        quantile->started = true;
+    }
+    else if(slice > quantile->newestSlice)
+    {
+        advanceSlices(quantile, slice);
+    }
+
+    if(bin >= PERCENTILE_BINS)
+    {
+        bin = PERCENTILE_BINS - 1;
+    }
+    sliceId = quantile->newestSlice % PERCENTILE_SLICES;
+    quantile->slices[sliceId][bin]++;
+    quantile->sliceCounts[sliceId]++;
+    quantile->totals[bin]++;
+    quantile->groupTotals[bin >> PERCENTILE_GROUP_BITS]++;
+    quantile->count++;
+}
+
+// Nearest rank: the smallest value with at least fraction of the window at or
+// below it. Binned values come back as the middle of their bin.
+bool quantileValue(const ALPAQA_QUANTILE * quantile, float fraction, uint16_t * value)
+{
+    uint32_t rank;
+    uint32_t seen = 0;
+    uint32_t group = 0;
+    uint32_t bin;
+
+    if(quantile->count == 0)
+    {
+        return false;
+    }
+
+    if(fraction <= 0.0f)
+    {
+        rank = 1;
+    }
+    else if(fraction >= 1.0f)
+    {
+        rank = quantile->count;
+    }
+    else
+    {
+        rank = (uint32_t)(fraction * quantile->count);
+        if((float)rank < fraction * quantile->count)
+        {
+            rank++;
+        }
+        if(rank == 0)
+        {
+            rank = 1;
+        }
+    }
+
+    while(seen + quantile->groupTotals[group] < rank)
+    {
+        seen += quantile->groupTotals[group];
+        group++;
+    }
+    bin = group << PERCENTILE_GROUP_BITS;
+    while(seen + quantile->totals[bin] < rank)
+    {
+        seen += quantile->totals[bin];
+        bin++;
+    }
+
+    *value = (bin << quantile->shift) + ((1U << quantile->shift) >> 1);
+    return true;
+}
+
+void percentilesInit(ALPAQA_PERCENTILES * percentiles, uint32_t windowSeconds)
+{
+    quantileInit(&percentiles->channels[PERCENTILE_PM1_0], windowSeconds, 0);
+    quantileInit(&percentiles->channels[PERCENTILE_PM2_5], windowSeconds, 0);
+    quantileInit(&percentiles->channels[PERCENTILE_PM10_0], windowSeconds, 0);
+    quantileInit(&percentiles->channels[PERCENTILE_TEMPERATURE_TICKS], windowSeconds, PERCENTILE_TICK_SHIFT);
+    quantileInit(&percentiles->channels[PERCENTILE_HUMIDITY_TICKS], windowSeconds, PERCENTILE_TICK_SHIFT);
+}
+
+void percentilesAddParticulate(ALPAQA_PERCENTILES * percentiles, uint64_t timeSeconds, const PARTICULATE_MATTER_DATA * data)
+{
+    quantileAdd(&percentiles->channels[PERCENTILE_PM1_0], timeSeconds, data->pm1_0);
+    quantileAdd(&percentiles->channels[PERCENTILE_PM2_5], timeSeconds, data->pm2_5);
+    quantileAdd(&percentiles->channels[PERCENTILE_PM10_0], timeSeconds, data->pm10_0);
+}
+
+// Raw ticks rather than converted values, so the bins are exact steps of the sensor
+void percentilesAddTicks(ALPAQA_PERCENTILES * percentiles, uint64_t timeSeconds, uint16_t temperatureTicks, uint16_t humidityTicks)
+{
+    quantileAdd(&percentiles->channels[PERCENTILE_TEMPERATURE_TICKS], timeSeconds, temperatureTicks);
+    quantileAdd(&percentiles->channels[PERCENTILE_HUMIDITY_TICKS], timeSeconds, humidityTicks);
+}
+
+bool percentileValue(const ALPAQA_PERCENTILES * percentiles, PERCENTILE_CHANNEL channel, float fraction, uint16_t * value)
+{
+    if(channel >= PERCENTILE_CHANNEL_COUNT)
+    {
+        return false;
+    }
+    return quantileValue(&percentiles->channels[channel], fraction, value);
+}
+
+// Slices the window has moved past are dropped, after a gap of a whole window or
+// more that is all of them
+static void advanceSlices(ALPAQA_QUANTILE * quantile, uint64_t slice)
+{
+    uint64_t steps = slice - quantile->newestSlice;
+
+    if(steps >= PERCENTILE_SLICES)
+    {
+        memset(quantile->totals, 0, sizeof(quantile->totals));
+        memset(quantile->groupTotals, 0, sizeof(quantile->groupTotals));
+        memset(quantile->sliceCounts, 0, sizeof(quantile->sliceCounts));
+        memset(quantile->slices, 0, sizeof(quantile->slices));
+        quantile->count = 0;
+    }
+    else
+    {
+        for(uint64_t next = quantile->newestSlice + 1; next <= slice; next++)
+        {
+            dropSlice(quantile, next % PERCENTILE_SLICES);
+        }
+    }
+    quantile->newestSlice = slice;
+}
+
+static void dropSlice(ALPAQA_QUANTILE * quantile, uint32_t sliceId)
+{
+    uint32_t * counts = quantile->slices[sliceId];
+
+    if(quantile->sliceCounts[sliceId] == 0)
+    {
+        return;
+    }
+
+    for(uint32_t bin = 0; bin < PERCENTILE_BINS; bin++)
+    {
+        if(counts[bin] > 0)
+        {
+            quantile->totals[bin] -= counts[bin];
+            quantile->groupTotals[bin >> PERCENTILE_GROUP_BITS] -= counts[bin];
+            counts[bin] = 0;
+        }
+    }
+    quantile->count -= quantile->sliceCounts[sliceId];
+    quantile->sliceCounts[sliceId] = 0;
+}
@@ -0,0 +1,61 @@
+#ifndef ALPAQAPERCENTILE_H
+#define ALPAQAPERCENTILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "PMSA003I.h"
+
+#define PERCENTILE_BINS 1024
+#define PERCENTILE_GROUP_BITS 5
+#define PERCENTILE_GROUPS (PERCENTILE_BINS >> PERCENTILE_GROUP_BITS)
+#define PERCENTILE_SLICES 24
+#define PERCENTILE_DEFAULT_WINDOW (24 * 60 * 60)
+// SHT41 ticks are 16 bit, dropping 6 bits leaves 0.17 C and 0.12 %RH per bin
+#define PERCENTILE_TICK_SHIFT 6
+
+typedef enum
+{
+    PERCENTILE_PM1_0 = 0,
+    PERCENTILE_PM2_5,
+    PERCENTILE_PM10_0,
+    PERCENTILE_TEMPERATURE_TICKS,
+    PERCENTILE_HUMIDITY_TICKS,
+    PERCENTILE_CHANNEL_COUNT
+} PERCENTILE_CHANNEL;
+
+// Count histogram of one channel over a sliding window. The window is cut into
+// PERCENTILE_SLICES slices, each with its own counts, and a running total holds
+// their sum: a sample adds one to its bin in both, and a slice leaving the window
+// is subtracted from the total once. Memory is the same for any window length,
+// which only sets how wide the slices are and so how coarsely the window slides.
+// Values past the last bin are counted in it.
+typedef struct
+{
+    uint32_t sliceSeconds;
+    uint8_t shift;
+    bool started;
+    uint64_t newestSlice;
+    uint32_t count;
+    uint32_t totals[PERCENTILE_BINS];
+    // Totals per run of 1 << PERCENTILE_GROUP_BITS bins, so a query skips whole runs
+    uint32_t groupTotals[PERCENTILE_GROUPS];
+    uint32_t sliceCounts[PERCENTILE_SLICES];
+    uint32_t slices[PERCENTILE_SLICES][PERCENTILE_BINS];
+} ALPAQA_QUANTILE;
+
+typedef struct
+{
+    ALPAQA_QUANTILE channels[PERCENTILE_CHANNEL_COUNT];
+} ALPAQA_PERCENTILES;
+
+void quantileInit(ALPAQA_QUANTILE * quantile, uint32_t windowSeconds, uint8_t shift);
+void quantileAdd(ALPAQA_QUANTILE * quantile, uint64_t timeSeconds, uint16_t value);
+bool quantileValue(const ALPAQA_QUANTILE * quantile, float fraction, uint16_t * value);
+
+void percentilesInit(ALPAQA_PERCENTILES * percentiles, uint32_t windowSeconds);
+void percentilesAddParticulate(ALPAQA_PERCENTILES * percentiles, uint64_t timeSeconds, const PARTICULATE_MATTER_DATA * data);
+void percentilesAddTicks(ALPAQA_PERCENTILES * percentiles, uint64_t timeSeconds, uint16_t temperatureTicks, uint16_t humidityTicks);
+bool percentileValue(const ALPAQA_PERCENTILES * percentiles, PERCENTILE_CHANNEL channel, float fraction, uint16_t * value);
+
+#endif
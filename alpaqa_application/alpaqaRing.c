@@ -0,0 +1,83 @@
+#include "alpaqaRing.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+bool ringInit(ALPAQA_RING * ring, size_t capacity, size_t elementSize)
+{
+    memset(ring, 0, sizeof(ALPAQA_RING));
+
+    if(capacity == 0 || (capacity & (capacity - 1)) != 0)
+    {
+        return false;
+    }
+
+    ring->buffer = calloc(capacity, elementSize);
+    if(ring->buffer == NULL)
+    {
+        return false;
+    }
+
+    ring->capacity = capacity;
+    ring->mask = capacity - 1;
+    ring->elementSize = elementSize;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    return true;
+}
+
+void ringFree(ALPAQA_RING * ring)
+{
+    free(ring->buffer);
+    ring->buffer = NULL;
+}
+
+// Producer side. A full ring drops the element rather than waiting on the consumer.
+bool ringPush(ALPAQA_RING * ring, const void * element)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    if(head - ring->cachedTail >= ring->capacity)
+    {
+        ring->cachedTail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if(head - ring->cachedTail >= ring->capacity)
+        {
+            __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+            return false;
+        }
+    }
+
+    memcpy(ring->buffer + ((head & ring->mask) * ring->elementSize), element, ring->elementSize);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return true;
+}
+
+// Consumer side
+bool ringPop(ALPAQA_RING * ring, void * element)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    if(tail == ring->cachedHead)
+    {
+        ring->cachedHead = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if(tail == ring->cachedHead)
+        {
+            return false;
+        }
+    }
+
+    memcpy(element, ring->buffer + ((tail & ring->mask) * ring->elementSize), ring->elementSize);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+size_t ringCount(ALPAQA_RING * ring)
+{
+    return atomic_load_explicit(&ring->head, memory_order_acquire) -
+           atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
+
+uint64_t ringDropped(ALPAQA_RING * ring)
+{
+    return __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+}
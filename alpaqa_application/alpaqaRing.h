@@ -0,0 +1,37 @@
+#ifndef ALPAQARING_H
+#define ALPAQARING_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define RING_CACHE_LINE 64
+
+// Single producer / single consumer ring of fixed size elements. Neither side ever
+// blocks or takes a lock: the producer only writes head, the consumer only writes
+// tail, and each keeps a cached copy of the other's index so the shared cache lines
+// are only touched when the cached view runs out. Capacity must be a power of two.
+typedef struct
+{
+    _Alignas(RING_CACHE_LINE) atomic_size_t head;
+    size_t cachedTail;
+    uint64_t dropped;
+
+    _Alignas(RING_CACHE_LINE) atomic_size_t tail;
+    size_t cachedHead;
+
+    _Alignas(RING_CACHE_LINE) size_t capacity;
+    size_t mask;
+    size_t elementSize;
+    uint8_t * buffer;
+} ALPAQA_RING;
+
+bool ringInit(ALPAQA_RING * ring, size_t capacity, size_t elementSize);
+void ringFree(ALPAQA_RING * ring);
+bool ringPush(ALPAQA_RING * ring, const void * element);
+bool ringPop(ALPAQA_RING * ring, void * element);
+size_t ringCount(ALPAQA_RING * ring);
+uint64_t ringDropped(ALPAQA_RING * ring);
+
+#endif
@@ -0,0 +1,321 @@
+#include "alpaqaRollup.h"
+
+#include <string.h>
+
+static const uint32_t tierBuckets[ROLLUP_TIER_COUNT] = {ROLLUP_SECOND_BUCKETS, ROLLUP_MINUTE_BUCKETS, ROLLUP_HOUR_BUCKETS};
+static const uint32_t tierWidths[ROLLUP_TIER_COUNT] = {1, ROLLUP_MINUTE, ROLLUP_HOUR};
+
+static ROLLUP_BUCKET * tierBucket(ALPAQA_ROLLUP * rollup, const ROLLUP_TIER * tier, uint64_t index);
+static const ROLLUP_BUCKET * tierBucketConst(const ALPAQA_ROLLUP * rollup, const ROLLUP_TIER * tier, uint64_t index);
+static bool tierHolds(const ROLLUP_TIER * tier, uint64_t index);
+static void advanceTier(ALPAQA_ROLLUP * rollup, ROLLUP_TIER * tier, uint64_t index);
+static void openBucket(ALPAQA_ROLLUP * rollup, const ROLLUP_TIER * tier, uint64_t index);
+static bool findWindowStart(const ALPAQA_ROLLUP * rollup, uint32_t windowSeconds, ROLLUP_TIER_ID * tierId, uint64_t * startIndex);
+static void totalsBefore(const ALPAQA_ROLLUP * rollup, const ROLLUP_TIER * tier, uint64_t index, ROLLUP_SUMMARY * totals);
+
+void rollupInit(ALPAQA_ROLLUP * rollup)
+{
+    uint32_t offset = 0;
+
+    memset(rollup, 0, sizeof(ALPAQA_ROLLUP));
+    for(int id = 0; id < ROLLUP_TIER_COUNT; id++)
+    {
+        rollup->tiers[id].offset = offset;
+        rollup->tiers[id].size = tierBuckets[id];
+        rollup->tiers[id].widthSeconds = tierWidths[id];
+        offset += tierBuckets[id];
+    }
+}
+
+// A sample that stands for one second
+void rollupAdd(ALPAQA_ROLLUP * rollup, uint64_t timeSeconds, uint16_t pm2_5, uint16_t pm10_0)
+{
+    rollupAddWeighted(rollup, timeSeconds, pm2_5, pm10_0, 1);
+}
+
+// Samples are expected in time order. A clock stepped backwards files samples
+// under the newest second. The whole weight goes into the sample's own bucket,
+// which only blurs the edges of windows by the time between samples.
+void rollupAddWeighted(ALPAQA_ROLLUP * rollup, uint64_t timeSeconds, uint16_t pm2_5, uint16_t pm10_0, uint32_t weightSeconds)
+{
+    rollupAdvance(rollup, timeSeconds);
+
+    if(!rollup->started)
+    {
+        rollup->started = true;
+        rollup->firstSeconds = timeSeconds;
+        rollup->newestSeconds = timeSeconds;
+        for(int id = 0; id < ROLLUP_TIER_COUNT; id++)
+        {
+            ROLLUP_TIER * tier = &rollup->tiers[id];
+
+            tier->firstIndex = timeSeconds / tier->widthSeconds;
+            tier->newestIndex = tier->firstIndex;
+            openBucket(rollup, tier, tier->firstIndex);
+        }
+    }
+
+    rollup->totalPm2_5 += (uint32_t)pm2_5 * weightSeconds;
+    rollup->totalPm10_0 += (uint32_t)pm10_0 * weightSeconds;
+    rollup->totalCount += weightSeconds;
+
+    for(int id = 0; id < ROLLUP_TIER_COUNT; id++)
+    {
+        ROLLUP_TIER * tier = &rollup->tiers[id];
+        ROLLUP_BUCKET * bucket = tierBucket(rollup, tier, tier->newestIndex);
+
+        bucket->totalPm2_5 = rollup->totalPm2_5;
+        bucket->totalPm10_0 = rollup->totalPm10_0;
+        bucket->totalCount = rollup->totalCount;
+        if(pm2_5 < bucket->minPm2_5) bucket->minPm2_5 = pm2_5;
+        if(pm2_5 > bucket->maxPm2_5) bucket->maxPm2_5 = pm2_5;
+        if(pm10_0 < bucket->minPm10_0) bucket->minPm10_0 = pm10_0;
+        if(pm10_0 > bucket->maxPm10_0) bucket->maxPm10_0 = pm10_0;
+    }
+}
+
+// Moves the newest second up to timeSeconds without adding a sample, so windows
+// end at that time and any time without samples shows as empty buckets. A step
+// forwards by more than the longest tier leaves nothing worth keeping and starts
+// the history over.
+void rollupAdvance(ALPAQA_ROLLUP * rollup, uint64_t timeSeconds)
+{
+    const ROLLUP_TIER * hours = &rollup->tiers[ROLLUP_TIER_HOURS];
+
+    if(!rollup->started || timeSeconds <= rollup->newestSeconds)
+    {
+        return;
+    }
+
+    if(timeSeconds / hours->widthSeconds >= hours->newestIndex + hours->size)
+    {
+        rollupInit(rollup);
+        return;
+    }
+
+    for(int id = 0; id < ROLLUP_TIER_COUNT; id++)
+    {
+        advanceTier(rollup, &rollup->tiers[id], timeSeconds / rollup->tiers[id].widthSeconds);
+    }
+    rollup->newestSeconds = timeSeconds;
+}
+
+// Averages over the last windowSeconds ending at the newest second. Costs one
+// subtraction against the finest tier still holding the window start, so the
+// window is widened to that tier's bucket boundary: at most 59 seconds extra on
+// a 24 hour window. Returns true only if the history covers the whole window,
+// otherwise the averages are over everything that is kept.
+bool rollupWindowAverage(const ALPAQA_ROLLUP * rollup, uint32_t windowSeconds, uint16_t * pm2_5, uint16_t * pm10_0)
+{
+    ROLLUP_TIER_ID tierId;
+    ROLLUP_SUMMARY before;
+    uint64_t startIndex;
+    uint32_t count;
+    bool full;
+
+    *pm2_5 = 0;
+    *pm10_0 = 0;
+    if(!rollup->started)
+    {
+        return false;
+    }
+
+    full = findWindowStart(rollup, windowSeconds, &tierId, &startIndex);
+    totalsBefore(rollup, &rollup->tiers[tierId], startIndex, &before);
+
+    count = rollup->totalCount - before.count;
+    if(count > 0)
+    {
+        *pm2_5 = (rollup->totalPm2_5 - before.sumPm2_5) / count;
+        *pm10_0 = (rollup->totalPm10_0 - before.sumPm10_0) / count;
+    }
+    return full;
+}
+
+// As rollupWindowAverage(), adding the window's minimum and maximum. Those take
+// a pass over the tier's buckets in the window, up to a day of minutes or a
+// month of hours.
+bool rollupWindowSummary(const ALPAQA_ROLLUP * rollup, uint32_t windowSeconds, ROLLUP_SUMMARY * summary)
+{
+    const ROLLUP_TIER * tier;
+    ROLLUP_TIER_ID tierId;
+    ROLLUP_SUMMARY before;
+    uint64_t startIndex;
+    bool full;
+
+    memset(summary, 0, sizeof(ROLLUP_SUMMARY));
+    if(!rollup->started)
+    {
+        return false;
+    }
+
+    full = findWindowStart(rollup, windowSeconds, &tierId, &startIndex);
+    tier = &rollup->tiers[tierId];
+    totalsBefore(rollup, tier, startIndex, &before);
+
+    summary->count = rollup->totalCount - before.count;
+    summary->sumPm2_5 = rollup->totalPm2_5 - before.sumPm2_5;
+    summary->sumPm10_0 = rollup->totalPm10_0 - before.sumPm10_0;
+    if(summary->count == 0)
+    {
+        return full;
+    }
+
+    summary->minPm2_5 = UINT16_MAX;
+    summary->minPm10_0 = UINT16_MAX;
+    // Buckets nothing landed in hold an empty range and never win
+    for(uint64_t index = startIndex; index <= tier->newestIndex; index++)
+    {
+        const ROLLUP_BUCKET * bucket = tierBucketConst(rollup, tier, index);
+
+        if(bucket->minPm2_5 < summary->minPm2_5) summary->minPm2_5 = bucket->minPm2_5;
+        if(bucket->maxPm2_5 > summary->maxPm2_5) summary->maxPm2_5 = bucket->maxPm2_5;
+        if(bucket->minPm10_0 < summary->minPm10_0) summary->minPm10_0 = bucket->minPm10_0;
+        if(bucket->maxPm10_0 > summary->maxPm10_0) summary->maxPm10_0 = bucket->maxPm10_0;
+    }
+    return full;
+}
+
+// One bucket of history, index being time / the tier's width. False if the
+// tier no longer (or never) held it. Empty buckets report a zero range.
+bool rollupBucket(const ALPAQA_ROLLUP * rollup, ROLLUP_TIER_ID tierId, uint64_t index, ROLLUP_SUMMARY * summary)
+{
+    const ROLLUP_TIER * tier;
+    const ROLLUP_BUCKET * bucket;
+    ROLLUP_SUMMARY before;
+
+    memset(summary, 0, sizeof(ROLLUP_SUMMARY));
+    if(!rollup->started || tierId >= ROLLUP_TIER_COUNT)
+    {
+        return false;
+    }
+
+    tier = &rollup->tiers[tierId];
+    if(!tierHolds(tier, index) || (index > tier->firstIndex && !tierHolds(tier, index - 1)))
+    {
+        return false;
+    }
+
+    bucket = tierBucketConst(rollup, tier, index);
+    totalsBefore(rollup, tier, index, &before);
+    summary->count = bucket->totalCount - before.count;
+    summary->sumPm2_5 = bucket->totalPm2_5 - before.sumPm2_5;
+    summary->sumPm10_0 = bucket->totalPm10_0 - before.sumPm10_0;
+    if(summary->count > 0)
+    {
+        summary->minPm2_5 = bucket->minPm2_5;
+        summary->maxPm2_5 = bucket->maxPm2_5;
+        summary->minPm10_0 = bucket->minPm10_0;
+        summary->maxPm10_0 = bucket->maxPm10_0;
+    }
+    return true;
+}
+
+// Seconds from the first sample added to the newest
+uint64_t rollupCoverageSeconds(const ALPAQA_ROLLUP * rollup)
+{
+    return rollup->started ? rollup->newestSeconds - rollup->firstSeconds + 1 : 0;
+}
+
+static ROLLUP_BUCKET * tierBucket(ALPAQA_ROLLUP * rollup, const ROLLUP_TIER * tier, uint64_t index)
+{
+    return &rollup->storage[tier->offset + (index % tier->size)];
+}
+
+static const ROLLUP_BUCKET * tierBucketConst(const ALPAQA_ROLLUP * rollup, const ROLLUP_TIER * tier, uint64_t index)
+{
+    return &rollup->storage[tier->offset + (index % tier->size)];
+}
+
+static bool tierHolds(const ROLLUP_TIER * tier, uint64_t index)
+{
+    return index >= tier->firstIndex && index <= tier->newestIndex && index + tier->size > tier->newestIndex;
+}
+
+// Opens every bucket up to index, carrying the running totals forward so empty
+// buckets still subtract correctly. A gap longer than the tier only opens the
+// buckets that will be kept.
+static void advanceTier(ALPAQA_ROLLUP * rollup, ROLLUP_TIER * tier, uint64_t index)
+{
+    if(index <= tier->newestIndex)
+    {
+        return;
+    }
+    if(index - tier->newestIndex > tier->size)
+    {
+        tier->newestIndex = index - tier->size;
+    }
+
+    while(tier->newestIndex < index)
+    {
+        tier->newestIndex++;
+        openBucket(rollup, tier, tier->newestIndex);
+    }
+}
+
+static void openBucket(ALPAQA_ROLLUP * rollup, const ROLLUP_TIER * tier, uint64_t index)
+{
+    ROLLUP_BUCKET * bucket = tierBucket(rollup, tier, index);
+
+    bucket->totalPm2_5 = rollup->totalPm2_5;
+    bucket->totalPm10_0 = rollup->totalPm10_0;
+    bucket->totalCount = rollup->totalCount;
+    bucket->minPm2_5 = UINT16_MAX;
+    bucket->maxPm2_5 = 0;
+    bucket->minPm10_0 = UINT16_MAX;
+    bucket->maxPm10_0 = 0;
+}
+
+// Picks the finest tier that still holds the bucket a window starts in and the
+// one before it. Returns false when the window reaches past everything kept, in
+// which case the start is the oldest bucket the hour tier can subtract from.
+static bool findWindowStart(const ALPAQA_ROLLUP * rollup, uint32_t windowSeconds, ROLLUP_TIER_ID * tierId, uint64_t * startIndex)
+{
+    const ROLLUP_TIER * hours = &rollup->tiers[ROLLUP_TIER_HOURS];
+    uint64_t startSeconds = 0;
+    bool full;
+
+    if(rollup->newestSeconds + 1 > windowSeconds)
+    {
+        startSeconds = rollup->newestSeconds + 1 - windowSeconds;
+    }
+    full = windowSeconds > 0 && startSeconds >= rollup->firstSeconds;
+
+    for(int id = 0; id < ROLLUP_TIER_COUNT; id++)
+    {
+        const ROLLUP_TIER * tier = &rollup->tiers[id];
+        uint64_t index = startSeconds / tier->widthSeconds;
+
+        // Nothing was added before the first bucket
+        if(index <= tier->firstIndex && tierHolds(tier, tier->firstIndex))
+        {
+            *tierId = id;
+            *startIndex = tier->firstIndex;
+            return full;
+        }
+        if(index > tier->firstIndex && tierHolds(tier, index - 1))
+        {
+            *tierId = id;
+            *startIndex = index;
+            return full;
+        }
+    }
+
+    *tierId = ROLLUP_TIER_HOURS;
+    *startIndex = hours->newestIndex + 2 - hours->size;
+    return false;
+}
+
+// Running totals at the end of the bucket before index
+static void totalsBefore(const ALPAQA_ROLLUP * rollup, const ROLLUP_TIER * tier, uint64_t index, ROLLUP_SUMMARY * totals)
+{
+    memset(totals, 0, sizeof(ROLLUP_SUMMARY));
+    if(index > tier->firstIndex)
+    {
+        const ROLLUP_BUCKET * bucket = tierBucketConst(rollup, tier, index - 1);
+
+        totals->count = bucket->totalCount;
+        totals->sumPm2_5 = bucket->totalPm2_5;
+        totals->sumPm10_0 = bucket->totalPm10_0;
+    }
+}
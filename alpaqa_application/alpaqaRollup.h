@@ -0,0 +1,90 @@
+#ifndef ALPAQAROLLUP_H
+#define ALPAQAROLLUP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define ROLLUP_MINUTE 60
+#define ROLLUP_HOUR (60 * ROLLUP_MINUTE)
+#define ROLLUP_DAY (24 * ROLLUP_HOUR)
+
+// Each tier holds two buckets more than its span: a window of the full span can
+// start part way into a bucket, and the totals just before that bucket must
+// still be there to subtract
+#define ROLLUP_SECOND_BUCKETS (5 * 60 + 2)
+#define ROLLUP_MINUTE_BUCKETS (24 * 60 + 2)
+#define ROLLUP_HOUR_BUCKETS (31 * 24 + 2)
+#define ROLLUP_TOTAL_BUCKETS (ROLLUP_SECOND_BUCKETS + ROLLUP_MINUTE_BUCKETS + ROLLUP_HOUR_BUCKETS)
+
+typedef enum
+{
+    ROLLUP_TIER_SECONDS = 0,
+    ROLLUP_TIER_MINUTES,
+    ROLLUP_TIER_HOURS,
+    ROLLUP_TIER_COUNT
+} ROLLUP_TIER_ID;
+
+// Sums and counts are running totals over everything added up to the end of
+// the bucket, so any run of buckets sums with one subtraction. A sample counts
+// once for every whole second it stands for, at least once, so with samples a
+// second or more apart counts are seconds covered and sums are time weighted
+// however the rate changes. Faster samples count once each, which only weights
+// a steady rate correctly, so the app keeps adaptive sampling at 1 s or slower.
+// Totals wrap at 2^32, which stays exact for any window whose true sum fits in
+// 32 bits: a month averaging over 1000 ug/m^3.
+typedef struct
+{
+    uint32_t totalPm2_5;
+    uint32_t totalPm10_0;
+    uint32_t totalCount;
+    uint16_t minPm2_5;
+    uint16_t maxPm2_5;
+    uint16_t minPm10_0;
+    uint16_t maxPm10_0;
+} ROLLUP_BUCKET;
+
+// Buckets are found by offset into the rollup's storage rather than by pointer
+// so a rollup can be copied or mapped as one block
+typedef struct
+{
+    uint32_t offset;
+    uint32_t size;
+    uint32_t widthSeconds;
+    // Absolute bucket numbers, time / widthSeconds
+    uint64_t firstIndex;
+    uint64_t newestIndex;
+} ROLLUP_TIER;
+
+typedef struct
+{
+    ROLLUP_TIER tiers[ROLLUP_TIER_COUNT];
+    bool started;
+    uint64_t firstSeconds;
+    uint64_t newestSeconds;
+    uint32_t totalPm2_5;
+    uint32_t totalPm10_0;
+    uint32_t totalCount;
+    ROLLUP_BUCKET storage[ROLLUP_TOTAL_BUCKETS];
+} ALPAQA_ROLLUP;
+
+typedef struct
+{
+    uint32_t count;
+    uint32_t sumPm2_5;
+    uint32_t sumPm10_0;
+    uint16_t minPm2_5;
+    uint16_t maxPm2_5;
+    uint16_t minPm10_0;
+    uint16_t maxPm10_0;
+} ROLLUP_SUMMARY;
+
+void rollupInit(ALPAQA_ROLLUP * rollup);
+void rollupAdd(ALPAQA_ROLLUP * rollup, uint64_t timeSeconds, uint16_t pm2_5, uint16_t pm10_0);
+void rollupAddWeighted(ALPAQA_ROLLUP * rollup, uint64_t timeSeconds, uint16_t pm2_5, uint16_t pm10_0, uint32_t weightSeconds);
+void rollupAdvance(ALPAQA_ROLLUP * rollup, uint64_t timeSeconds);
+bool rollupWindowAverage(const ALPAQA_ROLLUP * rollup, uint32_t windowSeconds, uint16_t * pm2_5, uint16_t * pm10_0);
+bool rollupWindowSummary(const ALPAQA_ROLLUP * rollup, uint32_t windowSeconds, ROLLUP_SUMMARY * summary);
+bool rollupBucket(const ALPAQA_ROLLUP * rollup, ROLLUP_TIER_ID tier, uint64_t index, ROLLUP_SUMMARY * summary);
+uint64_t rollupCoverageSeconds(const ALPAQA_ROLLUP * rollup);
+
+#endif
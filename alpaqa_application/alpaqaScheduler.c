@@ -0,0 +1,299 @@
+#include "alpaqaScheduler.h"
+#include "alpaqaTime.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+static int addSchedule(ALPAQA_SCHEDULER * scheduler, const char * name, uint64_t periodNs, bool periodic,
+                       SCHEDULE_CALLBACK callback, void * context);
+static bool watchFd(ALPAQA_SCHEDULER * scheduler, int id, int fd);
+static void runSchedule(ALPAQA_SCHEDULE * schedule, uint64_t nowNs);
+static bool armPeriodic(ALPAQA_SCHEDULER * scheduler, ALPAQA_SCHEDULE * schedule);
+
+bool schedulerInit(ALPAQA_SCHEDULER * scheduler)
+{
+    memset(scheduler, 0, sizeof(ALPAQA_SCHEDULER));
+    scheduler->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    scheduler->epochNs = monotonicNowNs();
+    return scheduler->epollFd >= 0;
+}
+
+int schedulerAddPeriodic(ALPAQA_SCHEDULER * scheduler, const char * name, uint64_t periodNs, SCHEDULE_CALLBACK callback, void * context)
+{
+    int id;
+    ALPAQA_SCHEDULE * schedule;
+
+    if((id = addSchedule(scheduler, name, periodNs, true, callback, context)) < 0)
+    {
+        return -1;
+    }
+    schedule = &scheduler->schedules[id];
+
+    if(!schedule->continuous && !armPeriodic(scheduler, schedule))
+    {
+        return -1;
+    }
+    return id;
+}
+
+int schedulerAddOneShot(ALPAQA_SCHEDULER * scheduler, const char * name, SCHEDULE_CALLBACK callback, void * context)
+{
+    return addSchedule(scheduler, name, 0, false, callback, context);
+}
+
+// The caller keeps ownership of the descriptor and is responsible for draining it
+int schedulerAddFd(ALPAQA_SCHEDULER * scheduler, const char * name, int fd, SCHEDULE_CALLBACK callback, void * context)
+{
+    int id;
+
+    if(scheduler->count >= SCHEDULER_MAX_SCHEDULES)
+    {
+        return -1;
+    }
+
+    id = scheduler->count;
+    memset(&scheduler->schedules[id], 0, sizeof(ALPAQA_SCHEDULE));
+    strncpy(scheduler->schedules[id].name, name, SCHEDULER_NAME_SIZE - 1);
+    scheduler->schedules[id].fdSource = true;
+    scheduler->schedules[id].timerFd = fd;
+    scheduler->schedules[id].callback = callback;
+    scheduler->schedules[id].context = context;
+
+    if(!watchFd(scheduler, id, fd))
+    {
+        return -1;
+    }
+    scheduler->count++;
+    return id;
+}
+
+bool schedulerArmAt(ALPAQA_SCHEDULER * scheduler, int id, uint64_t deadlineNs)
+{
+    ALPAQA_SCHEDULE * schedule;
+    struct itimerspec timerSpec;
+
+    if(id < 0 || (uint32_t)id >= scheduler->count)
+    {
+        return false;
+    }
+    schedule = &scheduler->schedules[id];
+
+    // A zero it_value would disarm the timer, a deadline already in the past fires right away
+    memset(&timerSpec, 0, sizeof(timerSpec));
+    nsToTimespec(deadlineNs > 0 ? deadlineNs : 1, &timerSpec.it_value);
+    schedule->nextDeadlineNs = deadlineNs;
+    return timerfd_settime(schedule->timerFd, TFD_TIMER_ABSTIME, &timerSpec, NULL) == 0;
+}
+
+// Moves a periodic schedule onto the grid of another period, from the next point on
+// it. Periods that are multiples of each other keep coming due on the same wakeups.
+// Its deadline accounting carries on.
+bool schedulerSetPeriod(ALPAQA_SCHEDULER * scheduler, int id, uint64_t periodNs)
+{
+    ALPAQA_SCHEDULE * schedule;
+
+    if(id < 0 || (uint32_t)id >= scheduler->count)
+    {
+        return false;
+    }
+    schedule = &scheduler->schedules[id];
+
+    // A continuous schedule has no timer to move
+    if(!schedule->periodic || schedule->continuous || periodNs == 0)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    schedule->periodNs = periodNs;
+    return armPeriodic(scheduler, schedule);
+}
+
+void schedulerSetAfterDispatch(ALPAQA_SCHEDULER * scheduler, SCHEDULER_DISPATCH_CALLBACK callback, void * context)
+{
+    scheduler->afterDispatch = callback;
+    scheduler->afterDispatchContext = context;
+}
+
+// Waits for the next deadline and runs everything that is due. A signal just ends the
+// wait early so the caller can check whether to stop. Returns false on a real failure.
+bool schedulerRunOnce(ALPAQA_SCHEDULER * scheduler)
+{
+    struct epoll_event events[SCHEDULER_MAX_SCHEDULES];
+    int eventCount;
+    int timeoutMs = -1;
+    uint64_t nowNs;
+
+    for(uint32_t idx = 0; idx < scheduler->count; idx++)
+    {
+        if(scheduler->schedules[idx].continuous)
+        {
+            timeoutMs = 0;
+        }
+    }
+
+    eventCount = epoll_wait(scheduler->epollFd, events, SCHEDULER_MAX_SCHEDULES, timeoutMs);
+    if(eventCount < 0)
+    {
+        return errno == EINTR;
+    }
+
+    nowNs = monotonicNowNs();
+
+    // Continuous schedules first, they stand in for deadlines that are always due
+    for(uint32_t idx = 0; idx < scheduler->count; idx++)
+    {
+        ALPAQA_SCHEDULE * schedule = &scheduler->schedules[idx];
+
+        if(schedule->continuous)
+        {
+            schedule->runs++;
+            schedule->deadlineNs = nowNs;
+            schedule->callback(schedule->context);
+        }
+    }
+
+    for(int idx = 0; idx < eventCount; idx++)
+    {
+        runSchedule(&scheduler->schedules[events[idx].data.u32], nowNs);
+    }
+
+    if(scheduler->afterDispatch != NULL)
+    {
+        scheduler->afterDispatch(scheduler->afterDispatchContext);
+    }
+    return true;
+}
+
+const ALPAQA_SCHEDULE * schedulerGet(const ALPAQA_SCHEDULER * scheduler, int id)
+{
+    if(id < 0 || (uint32_t)id >= scheduler->count)
+    {
+        return NULL;
+    }
+    return &scheduler->schedules[id];
+}
+
+void schedulerClose(ALPAQA_SCHEDULER * scheduler)
+{
+    for(uint32_t idx = 0; idx < scheduler->count; idx++)
+    {
+        if(scheduler->schedules[idx].timerFd >= 0 && !scheduler->schedules[idx].fdSource)
+        {
+            close(scheduler->schedules[idx].timerFd);
+        }
+    }
+    if(scheduler->epollFd >= 0)
+    {
+        close(scheduler->epollFd);
+    }
+    scheduler->count = 0;
+    scheduler->epollFd = -1;
+}
+
+static int addSchedule(ALPAQA_SCHEDULER * scheduler, const char * name, uint64_t periodNs, bool periodic,
+                       SCHEDULE_CALLBACK callback, void * context)
+{
+    ALPAQA_SCHEDULE * schedule;
+    int id;
+
+    if(scheduler->count >= SCHEDULER_MAX_SCHEDULES)
+    {
+        return -1;
+    }
+
+    id = scheduler->count;
+    schedule = &scheduler->schedules[id];
+    memset(schedule, 0, sizeof(ALPAQA_SCHEDULE));
+    strncpy(schedule->name, name, SCHEDULER_NAME_SIZE - 1);
+    schedule->periodNs = periodNs;
+    schedule->periodic = periodic;
+    schedule->continuous = periodic && periodNs == 0;
+    schedule->callback = callback;
+    schedule->context = context;
+    schedule->timerFd = -1;
+
+    if(!schedule->continuous)
+    {
+        schedule->timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if(schedule->timerFd < 0)
+        {
+            return -1;
+        }
+
+        if(!watchFd(scheduler, id, schedule->timerFd))
+        {
+            close(schedule->timerFd);
+            return -1;
+        }
+    }
+
+    scheduler->count++;
+    return id;
+}
+
+static bool watchFd(ALPAQA_SCHEDULER * scheduler, int id, int fd)
+{
+    struct epoll_event event;
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u32 = id;
+    return epoll_ctl(scheduler->epollFd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+static void runSchedule(ALPAQA_SCHEDULE * schedule, uint64_t nowNs)
+{
+    uint64_t expirations;
+    uint64_t latenessNs;
+
+    if(schedule->fdSource)
+    {
+        schedule->runs++;
+        schedule->deadlineNs = nowNs;
+        schedule->callback(schedule->context);
+        return;
+    }
+
+    if(read(schedule->timerFd, &expirations, sizeof(expirations)) != sizeof(expirations) || expirations == 0)
+    {
+        return;
+    }
+
+    if(schedule->periodic)
+    {
+        // The most recent deadline that passed is the one being served now
+        schedule->nextDeadlineNs += (expirations - 1) * schedule->periodNs;
+        schedule->missed += expirations - 1;
+    }
+
+    latenessNs = nowNs > schedule->nextDeadlineNs ? nowNs - schedule->nextDeadlineNs : 0;
+    if(latenessNs > schedule->maxLatenessNs)
+    {
+        schedule->maxLatenessNs = latenessNs;
+    }
+
+    schedule->deadlineNs = schedule->nextDeadlineNs;
+    if(schedule->periodic)
+    {
+        schedule->nextDeadlineNs += schedule->periodNs;
+    }
+
+    schedule->runs++;
+    schedule->callback(schedule->context);
+}
+
+// First deadline is the next point on this schedule's grid, then every period after
+static bool armPeriodic(ALPAQA_SCHEDULER * scheduler, ALPAQA_SCHEDULE * schedule)
+{
+    struct itimerspec timerSpec;
+    uint64_t periodNs = schedule->periodNs;
+
+    schedule->nextDeadlineNs = scheduler->epochNs + (((monotonicNowNs() - scheduler->epochNs) / periodNs) + 1) * periodNs;
+    memset(&timerSpec, 0, sizeof(timerSpec));
+    nsToTimespec(schedule->nextDeadlineNs, &timerSpec.it_value);
+    nsToTimespec(periodNs, &timerSpec.it_interval);
+    return timerfd_settime(schedule->timerFd, TFD_TIMER_ABSTIME, &timerSpec, NULL) == 0;
+}
@@ -0,0 +1,64 @@
+#ifndef ALPAQASCHEDULER_H
+#define ALPAQASCHEDULER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+// The main loop has a frames fd for each bus on top of its own timers
+#define SCHEDULER_MAX_SCHEDULES 12
+#define SCHEDULER_NAME_SIZE 16
+
+typedef void (*SCHEDULE_CALLBACK)(void * context);
+typedef void (*SCHEDULER_DISPATCH_CALLBACK)(void * context);
+
+// A schedule is either periodic, with its deadlines laid out on an absolute
+// CLOCK_MONOTONIC grid so they never drift, or one-shot and armed explicitly.
+// A period of zero runs the schedule on every pass through the loop. Other file
+// descriptors can be watched as well, their callback runs whenever they are readable.
+typedef struct
+{
+    char name[SCHEDULER_NAME_SIZE];
+    int timerFd;
+    uint64_t periodNs;
+    bool periodic;
+    bool continuous;
+    bool fdSource;
+    SCHEDULE_CALLBACK callback;
+    void * context;
+
+    // Deadline accounting. Expirations beyond the first one seen on a wakeup were
+    // deadlines that passed while the loop was busy, they are counted as missed.
+    uint64_t runs;
+    uint64_t missed;
+    uint64_t maxLatenessNs;
+    uint64_t nextDeadlineNs;
+    // The deadline the callback is currently serving
+    uint64_t deadlineNs;
+} ALPAQA_SCHEDULE;
+
+typedef struct
+{
+    int epollFd;
+    // Periodic deadlines are multiples of their period after this, so schedules whose
+    // periods divide each other come due on the same wakeup
+    uint64_t epochNs;
+    ALPAQA_SCHEDULE schedules[SCHEDULER_MAX_SCHEDULES];
+    uint32_t count;
+    // Runs once after every batch of due schedules, so their work can share a bus transfer
+    SCHEDULER_DISPATCH_CALLBACK afterDispatch;
+    void * afterDispatchContext;
+} ALPAQA_SCHEDULER;
+
+bool schedulerInit(ALPAQA_SCHEDULER * scheduler);
+int schedulerAddPeriodic(ALPAQA_SCHEDULER * scheduler, const char * name, uint64_t periodNs, SCHEDULE_CALLBACK callback, void * context);
+int schedulerAddOneShot(ALPAQA_SCHEDULER * scheduler, const char * name, SCHEDULE_CALLBACK callback, void * context);
+int schedulerAddFd(ALPAQA_SCHEDULER * scheduler, const char * name, int fd, SCHEDULE_CALLBACK callback, void * context);
+bool schedulerArmAt(ALPAQA_SCHEDULER * scheduler, int id, uint64_t deadlineNs);
+bool schedulerSetPeriod(ALPAQA_SCHEDULER * scheduler, int id, uint64_t periodNs);
+void schedulerSetAfterDispatch(ALPAQA_SCHEDULER * scheduler, SCHEDULER_DISPATCH_CALLBACK callback, void * context);
+bool schedulerRunOnce(ALPAQA_SCHEDULER * scheduler);
+const ALPAQA_SCHEDULE * schedulerGet(const ALPAQA_SCHEDULER * scheduler, int id);
+void schedulerClose(ALPAQA_SCHEDULER * scheduler);
+
+#endif
@@ -0,0 +1,394 @@
+#include "alpaqaScreen.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// CAN aborts any escape sequence a torn frame left half sent, then autowrap off,
+// default style and clear screen
+#define SCREEN_REPAINT_PREFIX "\x18\e[?7l\e[0m\e[2J"
+#define SCREEN_RESTORE "\e[0m\e[?7h"
+// Unchanged cells up to this many in a row are resent rather than jumped over,
+// a cursor move costs about as much
+#define SCREEN_GAP_FILL 6
+#define SCREEN_TEXT_SIZE (SCREEN_COLS * 2)
+
+typedef struct
+{
+    char * buffer;
+    size_t length;
+    int row;
+    int col;
+    SCREEN_CELL style;
+    bool styleKnown;
+} FRAME_BUILDER;
+
+static SCREEN_CELL blankCells[SCREEN_ROWS][SCREEN_COLS];
+
+static void blankRow(SCREEN_CELL * row);
+static bool sameCell(const SCREEN_CELL * a, const SCREEN_CELL * b);
+static bool sameStyle(const SCREEN_CELL * a, const SCREEN_CELL * b);
+static size_t buildFrame(ALPAQA_SCREEN * screen, SCREEN_CELL (*base)[SCREEN_COLS], bool repaint);
+static void appendBytes(FRAME_BUILDER * builder, const char * bytes, size_t length);
+static void appendMove(FRAME_BUILDER * builder, int row, int col);
+static void appendStyle(FRAME_BUILDER * builder, const SCREEN_CELL * cell);
+static void appendCell(FRAME_BUILDER * builder, const SCREEN_CELL * cell);
+static bool writeFrame(SCREEN_OUTPUT * output, const char * data, size_t length);
+
+bool screenInit(ALPAQA_SCREEN * screen)
+{
+    memset(screen, 0, sizeof(ALPAQA_SCREEN));
+
+    screen->frame = malloc(SCREEN_FRAME_SIZE);
+    if(screen->frame == NULL)
+    {
+        return false;
+    }
+
+    for(int row = 0; row < SCREEN_ROWS; row++)
+    {
+        blankRow(blankCells[row]);
+        blankRow(screen->next[row]);
+        blankRow(screen->shown[row]);
+    }
+    return true;
+}
+
+// New outputs get a full repaint on the next flush
+bool screenAddOutput(ALPAQA_SCREEN * screen, int fd, bool ownsFd)
+{
+    SCREEN_OUTPUT * output;
+
+    if(fd < 0 || screen->outputCount >= SCREEN_MAX_OUTPUTS)
+    {
+        return false;
+    }
+
+    output = &screen->outputs[screen->outputCount++];
+    memset(output, 0, sizeof(SCREEN_OUTPUT));
+    output->fd = fd;
+    output->ownsFd = ownsFd;
+    output->needsRepaint = true;
+    return true;
+}
+
+// Opened non-blocking: a slow serial console drops a frame and is repainted
+// rather than holding up the loop
+bool screenOpenOutput(ALPAQA_SCREEN * screen, const char * filename)
+{
+    int fd = open(filename, O_WRONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+
+    if(fd < 0)
+    {
+        return false;
+    }
+    if(!screenAddOutput(screen, fd, true))
+    {
+        close(fd);
+        return false;
+    }
+    return true;
+}
+
+// With nothing to show the screen on, callers can skip drawing altogether
+bool screenActive(const ALPAQA_SCREEN * screen)
+{
+    return screen->outputCount > 0;
+}
+
+// 1 based, as in the escape sequence
+void screenMoveTo(ALPAQA_SCREEN * screen, int row, int col)
+{
+    screen->row = row - 1;
+    screen->col = col - 1;
+}
+
+void screenClearLine(ALPAQA_SCREEN * screen)
+{
+    if(screen->row >= 0 && screen->row < SCREEN_ROWS)
+    {
+        blankRow(screen->next[screen->row]);
+    }
+}
+
+void screenSetColor(ALPAQA_SCREEN * screen, uint8_t fg, uint8_t bg)
+{
+    screen->style.fg = fg;
+    screen->style.bg = bg;
+}
+
+void screenSetBold(ALPAQA_SCREEN * screen)
+{
+    screen->style.bold = 1;
+}
+
+void screenResetStyle(ALPAQA_SCREEN * screen)
+{
+    memset(&screen->style, 0, sizeof(SCREEN_CELL));
+}
+
+// Text past the right edge is dropped and a newline goes to the start of the next row
+void screenPrintf(ALPAQA_SCREEN * screen, const char * format, ...)
+{
+    char text[SCREEN_TEXT_SIZE];
+    va_list args;
+    int length;
+
+    va_start(args, format);
+    length = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    if(length < 0)
+    {
+        return;
+    }
+    if((size_t)length >= sizeof(text))
+    {
+        length = sizeof(text) - 1;
+    }
+
+    for(int idx = 0; idx < length; idx++)
+    {
+        if(text[idx] == '\n')
+        {
+            screen->row++;
+            screen->col = 0;
+            continue;
+        }
+        if(screen->row >= 0 && screen->row < SCREEN_ROWS && screen->col >= 0 && screen->col < SCREEN_COLS)
+        {
+            SCREEN_CELL * cell = &screen->next[screen->row][screen->col];
+
+            *cell = screen->style;
+            cell->ch = text[idx];
+        }
+        screen->col++;
+    }
+}
+
+// Sends what changed since the last flush to every output, and a full repaint to
+// any output that missed part of an earlier frame
+void screenFlush(ALPAQA_SCREEN * screen)
+{
+    size_t length;
+    bool repaint = false;
+
+    if(screen->outputCount == 0)
+    {
+        return;
+    }
+
+    length = buildFrame(screen, screen->shown, false);
+    screen->lastFrameBytes = length;
+    for(int idx = 0; idx < screen->outputCount; idx++)
+    {
+        SCREEN_OUTPUT * output = &screen->outputs[idx];
+
+        if(output->needsRepaint)
+        {
+            repaint = true;
+        }
+        else if(length > 0 && !writeFrame(output, screen->frame, length))
+        {
+            output->needsRepaint = true;
+        }
+    }
+
+    if(repaint)
+    {
+        length = buildFrame(screen, blankCells, true);
+        for(int idx = 0; idx < screen->outputCount; idx++)
+        {
+            SCREEN_OUTPUT * output = &screen->outputs[idx];
+
+            if(output->needsRepaint)
+            {
+                output->repaints++;
+                output->needsRepaint = !writeFrame(output, screen->frame, length);
+            }
+        }
+    }
+
+    memcpy(screen->shown, screen->next, sizeof(screen->shown));
+    screen->frames++;
+    screen->frameBytes += screen->lastFrameBytes;
+}
+
+// Leaves the terminals with the default style, autowrap back on and the cursor
+// below the screen
+void screenClose(ALPAQA_SCREEN * screen)
+{
+    char restore[32];
+    int length;
+
+    length = snprintf(restore, sizeof(restore), SCREEN_RESTORE "\e[%d;1H\n", SCREEN_ROWS);
+    for(int idx = 0; idx < screen->outputCount; idx++)
+    {
+        writeFrame(&screen->outputs[idx], restore, length);
+        if(screen->outputs[idx].ownsFd)
+        {
+            close(screen->outputs[idx].fd);
+        }
+    }
+    screen->outputCount = 0;
+    free(screen->frame);
+    screen->frame = NULL;
+}
+
+static void blankRow(SCREEN_CELL * row)
+{
+    for(int col = 0; col < SCREEN_COLS; col++)
+    {
+        row[col].ch = ' ';
+        row[col].fg = SCREEN_DEFAULT_COLOR;
+        row[col].bg = SCREEN_DEFAULT_COLOR;
+        row[col].bold = 0;
+    }
+}
+
+static bool sameCell(const SCREEN_CELL * a, const SCREEN_CELL * b)
+{
+    return a->ch == b->ch && sameStyle(a, b);
+}
+
+static bool sameStyle(const SCREEN_CELL * a, const SCREEN_CELL * b)
+{
+    return a->fg == b->fg && a->bg == b->bg && a->bold == b->bold;
+}
+
+// Builds the bytes that turn base into the model. A repaint starts from a
+// cleared terminal, so base is then all blank.
+static size_t buildFrame(ALPAQA_SCREEN * screen, SCREEN_CELL (*base)[SCREEN_COLS], bool repaint)
+{
+    FRAME_BUILDER builder;
+
+    memset(&builder, 0, sizeof(builder));
+    builder.buffer = screen->frame;
+    builder.row = -1;
+
+    if(repaint)
+    {
+        appendBytes(&builder, SCREEN_REPAINT_PREFIX, sizeof(SCREEN_REPAINT_PREFIX) - 1);
+        builder.styleKnown = true;
+    }
+
+    for(int row = 0; row < SCREEN_ROWS; row++)
+    {
+        for(int col = 0; col < SCREEN_COLS; col++)
+        {
+            const SCREEN_CELL * cell = &screen->next[row][col];
+
+            if(sameCell(cell, &base[row][col]))
+            {
+                continue;
+            }
+
+            // Close a short gap by resending it if that needs no style change
+            if(builder.row == row && col > builder.col && col - builder.col <= SCREEN_GAP_FILL)
+            {
+                int gap = builder.col;
+
+                while(gap < col && sameStyle(&screen->next[row][gap], &builder.style))
+                {
+                    gap++;
+                }
+                if(gap == col)
+                {
+                    while(builder.col < col)
+                    {
+                        appendCell(&builder, &screen->next[row][builder.col]);
+                    }
+                }
+            }
+
+            if(builder.row != row || builder.col != col)
+            {
+                appendMove(&builder, row, col);
+            }
+            appendCell(&builder, cell);
+        }
+    }
+    return builder.length;
+}
+
+static void appendBytes(FRAME_BUILDER * builder, const char * bytes, size_t length)
+{
+    if(builder->length + length <= SCREEN_FRAME_SIZE)
+    {
+        memcpy(builder->buffer + builder->length, bytes, length);
+        builder->length += length;
+    }
+}
+
+static void appendMove(FRAME_BUILDER * builder, int row, int col)
+{
+    char move[16];
+    int length = snprintf(move, sizeof(move), "\e[%d;%dH", row + 1, col + 1);
+
+    appendBytes(builder, move, length);
+    builder->row = row;
+    builder->col = col;
+}
+
+// Every style change starts from a reset, so nothing carries over from before
+static void appendStyle(FRAME_BUILDER * builder, const SCREEN_CELL * cell)
+{
+    char sgr[24];
+    int length = 0;
+
+    length += snprintf(sgr + length, sizeof(sgr) - length, "\e[0");
+    if(cell->bold)
+    {
+        length += snprintf(sgr + length, sizeof(sgr) - length, ";1");
+    }
+    if(cell->fg != SCREEN_DEFAULT_COLOR)
+    {
+        length += snprintf(sgr + length, sizeof(sgr) - length, ";%d", cell->fg);
+    }
+    if(cell->bg != SCREEN_DEFAULT_COLOR)
+    {
+        length += snprintf(sgr + length, sizeof(sgr) - length, ";%d", cell->bg);
+    }
+    length += snprintf(sgr + length, sizeof(sgr) - length, "m");
+
+    appendBytes(builder, sgr, length);
+    builder->style = *cell;
+    builder->styleKnown = true;
+}
+
+static void appendCell(FRAME_BUILDER * builder, const SCREEN_CELL * cell)
+{
+    if(!builder->styleKnown || !sameStyle(cell, &builder->style))
+    {
+        appendStyle(builder, cell);
+    }
+    appendBytes(builder, &cell->ch, 1);
+    builder->col++;
+}
+
+// One write() for the whole frame. A blocking output is waited on until it has
+// taken all of it, a non-blocking one that fills up fails the frame.
+static bool writeFrame(SCREEN_OUTPUT * output, const char * data, size_t length)
+{
+    ssize_t written;
+
+    while(length > 0)
+    {
+        written = write(output->fd, data, length);
+        if(written < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        output->bytes += written;
+        data += written;
+        length -= written;
+    }
+    return true;
+}
@@ -0,0 +1,72 @@
+#ifndef ALPAQASCREEN_H
+#define ALPAQASCREEN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SCREEN_ROWS 54
+// Lines are clipped here rather than wrapped, wrapping would put the terminal
+// out of step with the model
+#define SCREEN_COLS 160
+#define SCREEN_MAX_OUTPUTS 4
+// Worst case frame: a style change before every cell plus a cursor move per row
+#define SCREEN_FRAME_SIZE ((SCREEN_ROWS * SCREEN_COLS * 16) + (SCREEN_ROWS * 16) + 64)
+
+// SGR colour codes, 0 is the terminal default
+#define SCREEN_DEFAULT_COLOR 0
+
+typedef struct
+{
+    char ch;
+    uint8_t fg;
+    uint8_t bg;
+    uint8_t bold;
+} SCREEN_CELL;
+
+typedef struct
+{
+    int fd;
+    bool ownsFd;
+    // Set when a frame did not make it out whole, the next flush repaints this output
+    bool needsRepaint;
+    uint64_t bytes;
+    uint64_t repaints;
+} SCREEN_OUTPUT;
+
+// The screen is drawn into a model of cells with the same calls the console code
+// used to print escape sequences with. A flush compares the model with what the
+// terminals were last sent and builds one buffer holding only the cursor moves,
+// style changes and characters for cells that changed, which is written to
+// every output with a single write() each.
+typedef struct
+{
+    SCREEN_CELL next[SCREEN_ROWS][SCREEN_COLS];
+    SCREEN_CELL shown[SCREEN_ROWS][SCREEN_COLS];
+    int row;
+    int col;
+    SCREEN_CELL style;
+
+    SCREEN_OUTPUT outputs[SCREEN_MAX_OUTPUTS];
+    int outputCount;
+
+    char * frame;
+    uint64_t frames;
+    uint64_t frameBytes;
+    uint32_t lastFrameBytes;
+} ALPAQA_SCREEN;
+
+bool screenInit(ALPAQA_SCREEN * screen);
+bool screenAddOutput(ALPAQA_SCREEN * screen, int fd, bool ownsFd);
+bool screenOpenOutput(ALPAQA_SCREEN * screen, const char * filename);
+bool screenActive(const ALPAQA_SCREEN * screen);
+void screenMoveTo(ALPAQA_SCREEN * screen, int row, int col);
+void screenClearLine(ALPAQA_SCREEN * screen);
+void screenSetColor(ALPAQA_SCREEN * screen, uint8_t fg, uint8_t bg);
+void screenSetBold(ALPAQA_SCREEN * screen);
+void screenResetStyle(ALPAQA_SCREEN * screen);
+void screenPrintf(ALPAQA_SCREEN * screen, const char * format, ...) __attribute__((format(printf, 2, 3)));
+void screenFlush(ALPAQA_SCREEN * screen);
+void screenClose(ALPAQA_SCREEN * screen);
+
+#endif
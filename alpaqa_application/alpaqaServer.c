@@ -0,0 +1,967 @@
+#define _GNU_SOURCE
+#include "alpaqaServer.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "alpaqaTime.h"
+
+// epoll tokens past the client slots mark the listeners
+#define TOKEN_UNIX SERVER_MAX_CLIENTS
+#define TOKEN_TCP (SERVER_MAX_CLIENTS + 1)
+#define SERVER_BACKLOG 128
+#define SERVER_EVENTS 64
+#define SERVER_INITIAL_OUTPUT 4096
+#define SERVER_DISCARD_SIZE 512
+#define SERVER_HEADER_SIZE 256
+
+static const char * tierNames[ROLLUP_TIER_COUNT] = { "seconds", "minutes", "hours" };
+
+static int openUnixListener(const char * path);
+static int openTcpListener(uint16_t port);
+static bool watch(ALPAQA_SERVER * server, int fd, uint32_t token, uint32_t events);
+static void acceptClients(ALPAQA_SERVER * server, int listenFd);
+static void readClient(ALPAQA_SERVER * server, SERVER_CLIENT * client);
+static void processRequests(ALPAQA_SERVER * server, SERVER_CLIENT * client);
+static void handleRequest(ALPAQA_SERVER * server, SERVER_CLIENT * client, char * request);
+static void handleNow(ALPAQA_SERVER * server, SERVER_CLIENT * client, const char * query);
+static void handleStream(ALPAQA_SERVER * server, SERVER_CLIENT * client);
+static void handleHistory(ALPAQA_SERVER * server, SERVER_CLIENT * client, const char * query);
+static int formatWindow(ALPAQA_SERVER * server, uint32_t windowSeconds);
+static int formatTier(ALPAQA_SERVER * server, ROLLUP_TIER_ID tierId, uint32_t count);
+static bool queryValue(const char * query, const char * name, char * value, size_t size);
+static void respond(ALPAQA_SERVER * server, SERVER_CLIENT * client, int status, const char * contentType,
+                    const char * body, size_t length);
+static void respondError(ALPAQA_SERVER * server, SERVER_CLIENT * client, int status, bool close);
+static void respondReading(ALPAQA_SERVER * server, SERVER_CLIENT * client);
+static bool appendOutput(SERVER_CLIENT * client, const char * data, size_t length);
+static void sendOutput(ALPAQA_SERVER * server, SERVER_CLIENT * client);
+static void setClientState(ALPAQA_SERVER * server, SERVER_CLIENT * client, SERVER_CLIENT_STATE clientState);
+static void closeClient(ALPAQA_SERVER * server, SERVER_CLIENT * client);
+static const char * statusText(int status);
+
+bool serverStart(ALPAQA_SERVER * server, const char * unixPath, uint16_t tcpPort, const ALPAQA_ROLLUP * history)
+{
+    memset(server, 0, sizeof(ALPAQA_SERVER));
+    server->epollFd = -1;
+    server->unixFd = -1;
+    server->tcpFd = -1;
+    server->history = history;
+
+    server->clients = calloc(SERVER_MAX_CLIENTS, sizeof(SERVER_CLIENT));
+    server->body = malloc(SERVER_MAX_OUTPUT);
+    if(server->clients == NULL || server->body == NULL)
+    {
+        serverStop(server);
+        return false;
+    }
+    // Popped from the end, so slot 0 is handed out first
+    for(int idx = 0; idx < SERVER_MAX_CLIENTS; idx++)
+    {
+        server->clients[idx].fd = -1;
+        server->freeSlots[idx] = SERVER_MAX_CLIENTS - 1 - idx;
+    }
+    server->freeCount = SERVER_MAX_CLIENTS;
+
+    server->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if(server->epollFd < 0)
+    {
+        serverStop(server);
+        return false;
+    }
+
+    if(unixPath != NULL && unixPath[0] != '\0')
+    {
+        server->unixFd = openUnixListener(unixPath);
+        if(server->unixFd < 0 || !watch(server, server->unixFd, TOKEN_UNIX, EPOLLIN))
+        {
+            serverStop(server);
+            return false;
+        }
+        server->unixPath = unixPath;
+    }
+
+    if(tcpPort != 0)
+    {
+        server->tcpFd = openTcpListener(tcpPort);
+        if(server->tcpFd < 0 || !watch(server, server->tcpFd, TOKEN_TCP, EPOLLIN))
+        {
+            serverStop(server);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Readable whenever a listener or client has something to do
+int serverFd(const ALPAQA_SERVER * server)
+{
+    return server->epollFd;
+}
+
+// Handles whatever is ready without waiting for anything
+void serverProcess(ALPAQA_SERVER * server)
+{
+    struct epoll_event events[SERVER_EVENTS];
+    int count;
+
+    do
+    {
+        count = epoll_wait(server->epollFd, events, SERVER_EVENTS, 0);
+        if(count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        for(int idx = 0; idx < count; idx++)
+        {
+            uint32_t token = events[idx].data.u32;
+            SERVER_CLIENT * client;
+
+            if(token == TOKEN_UNIX || token == TOKEN_TCP)
+            {
+                acceptClients(server, token == TOKEN_UNIX ? server->unixFd : server->tcpFd);
+                continue;
+            }
+
+            client = &server->clients[token];
+            if(client->state == CLIENT_FREE)
+            {
+                continue;
+            }
+            if(events[idx].events & EPOLLOUT)
+            {
+                sendOutput(server, client);
+            }
+            if(client->state != CLIENT_FREE && (events[idx].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+            {
+                readClient(server, client);
+            }
+        }
+    } while(count == SERVER_EVENTS);
+}
+
+// The reading is formatted once here and copied to every client that asks for it
+void serverPublish(ALPAQA_SERVER * server, const SERVER_READING * reading)
+{
+    char event[SERVER_READING_JSON_SIZE + 64];
+    int length;
+
+    server->sequence++;
+    length = snprintf(server->readingJson, sizeof(server->readingJson),
+                      "{\"seq\":%llu,\"time\":%llu.%03llu,"
+                      "\"pm\":{\"connected\":%s,\"pm1_0\":%u,\"pm2_5\":%u,\"pm10_0\":%u},"
+                      "\"sht\":{\"connected\":%s,\"temperature_c\":%0.2f,\"temperature_f\":%0.2f,"
+                      "\"humidity\":%0.2f,\"heat_index_f\":%0.2f},"
+                      "\"aqi\":{\"instant\":%u,\"average_24h\":%u,\"full_24h\":%s,\"nowcast\":%u,\"nowcast_valid\":%s}}",
+                      (unsigned long long)server->sequence,
+                      (unsigned long long)(reading->realtimeNs / NS_PER_SECOND),
+                      (unsigned long long)((reading->realtimeNs % NS_PER_SECOND) / NS_PER_MS),
+                      reading->pmConnected ? "true" : "false", reading->particulate.pm1_0,
+                      reading->particulate.pm2_5, reading->particulate.pm10_0,
+                      reading->shtConnected ? "true" : "false", reading->tempHumidity.temperatureC,
+                      reading->tempHumidity.temperatureF, reading->tempHumidity.humidity, reading->heatIndex,
+                      reading->instantAqi, reading->calculatedAqi, reading->aqiFull24Hour ? "true" : "false",
+                      reading->nowcastAqi, reading->nowcastValid ? "true" : "false");
+    if(length < 0 || (size_t)length >= sizeof(server->readingJson))
+    {
+        server->readingJsonLength = 0;
+        return;
+    }
+    server->readingJsonLength = length;
+    server->stats.published++;
+
+    length = snprintf(event, sizeof(event), "id: %llu\ndata: %s\n\n",
+                      (unsigned long long)server->sequence, server->readingJson);
+
+    for(int idx = 0; idx < SERVER_MAX_CLIENTS; idx++)
+    {
+        SERVER_CLIENT * client = &server->clients[idx];
+
+        if(client->state == CLIENT_WAITING && client->waitingAfter < server->sequence)
+        {
+            setClientState(server, client, CLIENT_READING);
+            respondReading(server, client);
+            // Anything pipelined behind the long poll was held until now
+            if(client->state == CLIENT_READING)
+            {
+                processRequests(server, client);
+            }
+        }
+        else if(client->state == CLIENT_STREAMING)
+        {
+            // A subscriber that has not kept up misses this update rather than growing without bound
+            if(!appendOutput(client, event, length))
+            {
+                server->stats.updatesDropped++;
+                continue;
+            }
+            sendOutput(server, client);
+        }
+    }
+}
+
+// Called about once a second: ends long polls that waited too long and closes idle connections
+void serverExpire(ALPAQA_SERVER * server)
+{
+    uint64_t nowNs = monotonicNowNs();
+
+    for(int idx = 0; idx < SERVER_MAX_CLIENTS; idx++)
+    {
+        SERVER_CLIENT * client = &server->clients[idx];
+
+        if(client->deadlineNs == 0 || nowNs < client->deadlineNs)
+        {
+            continue;
+        }
+        if(client->state == CLIENT_WAITING)
+        {
+            setClientState(server, client, CLIENT_READING);
+            respond(server, client, 204, NULL, NULL, 0);
+            if(client->state == CLIENT_READING)
+            {
+                processRequests(server, client);
+            }
+        }
+        else if(client->state == CLIENT_READING || client->state == CLIENT_CLOSING)
+        {
+            closeClient(server, client);
+        }
+    }
+}
+
+void serverStop(ALPAQA_SERVER * server)
+{
+    if(server->clients != NULL)
+    {
+        for(int idx = 0; idx < SERVER_MAX_CLIENTS; idx++)
+        {
+            if(server->clients[idx].state != CLIENT_FREE)
+            {
+                closeClient(server, &server->clients[idx]);
+            }
+            free(server->clients[idx].output);
+        }
+        free(server->clients);
+        server->clients = NULL;
+    }
+    free(server->body);
+    server->body = NULL;
+
+    if(server->unixFd >= 0)
+    {
+        close(server->unixFd);
+        unlink(server->unixPath);
+        server->unixFd = -1;
+    }
+    if(server->tcpFd >= 0)
+    {
+        close(server->tcpFd);
+        server->tcpFd = -1;
+    }
+    if(server->epollFd >= 0)
+    {
+        close(server->epollFd);
+        server->epollFd = -1;
+    }
+}
+
+// A socket left behind by a run that did not exit cleanly is replaced
+static int openUnixListener(const char * path)
+{
+    struct sockaddr_un address;
+    int fd;
+
+    if(strlen(path) >= sizeof(address.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0)
+    {
+        return -1;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    unlink(path);
+    if(bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(fd, SERVER_BACKLOG) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Loopback only, the readings are not meant to leave the device this way
+static int openTcpListener(uint16_t port)
+{
+    struct sockaddr_in address;
+    int reuse = 1;
+    int fd;
+
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0)
+    {
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(fd, SERVER_BACKLOG) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool watch(ALPAQA_SERVER * server, int fd, uint32_t token, uint32_t events)
+{
+    struct epoll_event event;
+
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.u32 = token;
+    return epoll_ctl(server->epollFd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+static void acceptClients(ALPAQA_SERVER * server, int listenFd)
+{
+    SERVER_CLIENT * client;
+    int slot;
+    int fd;
+
+    while((fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+        if(server->freeCount == 0)
+        {
+            server->stats.rejected++;
+            close(fd);
+            continue;
+        }
+
+        slot = server->freeSlots[--server->freeCount];
+        if(!watch(server, fd, slot, EPOLLIN))
+        {
+            server->freeSlots[server->freeCount++] = slot;
+            server->stats.rejected++;
+            close(fd);
+            continue;
+        }
+
+        client = &server->clients[slot];
+        client->fd = fd;
+        client->keepAlive = true;
+        client->writing = false;
+        client->requestLength = 0;
+        client->outputLength = 0;
+        client->outputSent = 0;
+        setClientState(server, client, CLIENT_READING);
+        server->stats.accepted++;
+        server->stats.clients++;
+    }
+}
+
+static void readClient(ALPAQA_SERVER * server, SERVER_CLIENT * client)
+{
+    char discard[SERVER_DISCARD_SIZE];
+    ssize_t length;
+
+    for(;;)
+    {
+        // A connection between requests or held on a long poll reads into its request
+        // buffer, so requests pipelined behind the poll are answered once it ends. What
+        // comes in on a stream or a closing connection is read and dropped.
+        if((client->state == CLIENT_READING || client->state == CLIENT_WAITING) &&
+           client->requestLength < SERVER_REQUEST_SIZE - 1)
+        {
+            length = recv(client->fd, client->request + client->requestLength,
+                          SERVER_REQUEST_SIZE - 1 - client->requestLength, 0);
+        }
+        else if(client->state == CLIENT_WAITING)
+        {
+            // Nothing can be answered ahead of the poll, so there is no room to be made
+            closeClient(server, client);
+            return;
+        }
+        else
+        {
+            length = recv(client->fd, discard, sizeof(discard), 0);
+        }
+
+        if(length == 0)
+        {
+            closeClient(server, client);
+            return;
+        }
+        if(length < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            if(errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                closeClient(server, client);
+                return;
+            }
+            break;
+        }
+
+        if(client->state == CLIENT_READING)
+        {
+            client->deadlineNs = monotonicNowNs() + (SERVER_IDLE_SECONDS * NS_PER_SECOND);
+            client->requestLength += length;
+            client->request[client->requestLength] = '\0';
+            processRequests(server, client);
+            if(client->state == CLIENT_FREE)
+            {
+                return;
+            }
+        }
+        else if(client->state == CLIENT_WAITING)
+        {
+            client->requestLength += length;
+            client->request[client->requestLength] = '\0';
+        }
+    }
+}
+
+// Answers every complete request in the buffer, in order, until one has to wait
+static void processRequests(ALPAQA_SERVER * server, SERVER_CLIENT * client)
+{
+    char * end;
+    uint32_t used;
+
+    while(client->state == CLIENT_READING && (end = strstr(client->request, "\r\n\r\n")) != NULL)
+    {
+        *end = '\0';
+        used = (end + 4) - client->request;
+        handleRequest(server, client, client->request);
+        if(client->state == CLIENT_FREE)
+        {
+            return;
+        }
+
+        client->requestLength -= used;
+        memmove(client->request, client->request + used, client->requestLength);
+        client->request[client->requestLength] = '\0';
+    }
+
+    if(client->state == CLIENT_READING && client->requestLength >= SERVER_REQUEST_SIZE - 1)
+    {
+        respondError(server, client, 431, true);
+    }
+}
+
+static void handleRequest(ALPAQA_SERVER * server, SERVER_CLIENT * client, char * request)
+{
+    char * method;
+    char * target;
+    char * version;
+    char * query;
+    char * headers;
+    char * connection;
+
+    server->stats.requests++;
+
+    headers = strstr(request, "\r\n");
+    if(headers != NULL)
+    {
+        *headers = '\0';
+        headers += 2;
+    }
+
+    method = strtok_r(request, " ", &request);
+    target = strtok_r(NULL, " ", &request);
+    version = strtok_r(NULL, " ", &request);
+    if(method == NULL || target == NULL || version == NULL || strncmp(version, "HTTP/1.", 7) != 0)
+    {
+        respondError(server, client, 400, true);
+        return;
+    }
+
+    // HTTP/1.1 keeps the connection unless told otherwise, 1.0 only when asked to
+    client->keepAlive = strcmp(version, "HTTP/1.0") != 0;
+    connection = headers != NULL ? strcasestr(headers, "\nconnection:") : NULL;
+    if(connection == NULL && headers != NULL && strncasecmp(headers, "connection:", 11) == 0)
+    {
+        connection = headers - 1;
+    }
+    if(connection != NULL)
+    {
+        connection += 12;
+        connection += strspn(connection, " \t");
+        if(strncasecmp(connection, "close", 5) == 0)
+        {
+            client->keepAlive = false;
+        }
+        else if(strncasecmp(connection, "keep-alive", 10) == 0)
+        {
+            client->keepAlive = true;
+        }
+    }
+
+    // A body would be left in the buffer as the next request, so anything but GET ends the connection
+    if(strcmp(method, "GET") != 0)
+    {
+        respondError(server, client, 405, true);
+        return;
+    }
+
+    query = strchr(target, '?');
+    if(query != NULL)
+    {
+        *query++ = '\0';
+    }
+
+    if(strcmp(target, "/now") == 0)
+    {
+        handleNow(server, client, query);
+    }
+    else if(strcmp(target, "/stream") == 0)
+    {
+        handleStream(server, client);
+    }
+    else if(strcmp(target, "/history") == 0)
+    {
+        handleHistory(server, client, query);
+    }
+    else
+    {
+        respondError(server, client, 404, false);
+    }
+}
+
+static void handleNow(ALPAQA_SERVER * server, SERVER_CLIENT * client, const char * query)
+{
+    char value[24];
+    char * end;
+
+    if(query != NULL && queryValue(query, "after", value, sizeof(value)))
+    {
+        uint64_t after = strtoull(value, &end, 10);
+
+        if(end == value || *end != '\0')
+        {
+            respondError(server, client, 400, false);
+            return;
+        }
+        if(after >= server->sequence)
+        {
+            client->waitingAfter = after;
+            setClientState(server, client, CLIENT_WAITING);
+            return;
+        }
+    }
+    respondReading(server, client);
+}
+
+static void handleStream(ALPAQA_SERVER * server, SERVER_CLIENT * client)
+{
+    static const char header[] = "HTTP/1.1 200 OK\r\n"
+                                 "Content-Type: text/event-stream\r\n"
+                                 "Cache-Control: no-cache\r\n"
+                                 "Connection: close\r\n\r\n";
+    char event[SERVER_READING_JSON_SIZE + 64];
+    int length;
+
+    if(!appendOutput(client, header, sizeof(header) - 1))
+    {
+        closeClient(server, client);
+        return;
+    }
+    // The latest reading goes out straight away, a new subscriber should not wait a report period
+    if(server->readingJsonLength > 0)
+    {
+        length = snprintf(event, sizeof(event), "id: %llu\ndata: %s\n\n",
+                          (unsigned long long)server->sequence, server->readingJson);
+        appendOutput(client, event, length);
+    }
+    setClientState(server, client, CLIENT_STREAMING);
+    sendOutput(server, client);
+}
+
+static void handleHistory(ALPAQA_SERVER * server, SERVER_CLIENT * client, const char * query)
+{
+    char value[24];
+    char * end;
+    int length = -1;
+
+    if(query != NULL && queryValue(query, "tier", value, sizeof(value)))
+    {
+        uint32_t count = SERVER_MAX_HISTORY_BUCKETS;
+        int tierId;
+
+        for(tierId = 0; tierId < ROLLUP_TIER_COUNT; tierId++)
+        {
+            if(strcmp(value, tierNames[tierId]) == 0)
+            {
+                break;
+            }
+        }
+        if(tierId < ROLLUP_TIER_COUNT && queryValue(query, "count", value, sizeof(value)))
+        {
+            count = strtoul(value, &end, 10);
+            if(end == value || *end != '\0' || count == 0)
+            {
+                tierId = ROLLUP_TIER_COUNT;
+            }
+        }
+        if(tierId < ROLLUP_TIER_COUNT)
+        {
+            length = formatTier(server, tierId, count < SERVER_MAX_HISTORY_BUCKETS ? count : SERVER_MAX_HISTORY_BUCKETS);
+        }
+    }
+    else
+    {
+        uint32_t windowSeconds = ROLLUP_HOUR;
+
+        if(query != NULL && queryValue(query, "window", value, sizeof(value)))
+        {
+            windowSeconds = strtoul(value, &end, 10);
+            if(end == value || *end != '\0')
+            {
+                windowSeconds = 0;
+            }
+        }
+        if(windowSeconds > 0)
+        {
+            length = formatWindow(server, windowSeconds);
+        }
+    }
+
+    if(length < 0)
+    {
+        respondError(server, client, 400, false);
+        return;
+    }
+    respond(server, client, 200, "application/json", server->body, length);
+}
+
+static int formatWindow(ALPAQA_SERVER * server, uint32_t windowSeconds)
+{
+    ROLLUP_SUMMARY summary;
+    uint32_t count;
+    int length;
+
+    rollupWindowSummary(server->history, windowSeconds, &summary);
+    count = summary.count > 0 ? summary.count : 1;
+    length = snprintf(server->body, SERVER_MAX_OUTPUT,
+                      "{\"window\":%u,\"coverage\":%llu,\"count\":%u,"
+                      "\"pm2_5\":{\"avg\":%0.1f,\"min\":%u,\"max\":%u},"
+                      "\"pm10_0\":{\"avg\":%0.1f,\"min\":%u,\"max\":%u}}",
+                      windowSeconds, (unsigned long long)rollupCoverageSeconds(server->history), summary.count,
+                      (double)summary.sumPm2_5 / count, summary.minPm2_5, summary.maxPm2_5,
+                      (double)summary.sumPm10_0 / count, summary.minPm10_0, summary.maxPm10_0);
+    return length < SERVER_MAX_OUTPUT ? length : -1;
+}
+
+// Oldest first, ending with the bucket still filling
+static int formatTier(ALPAQA_SERVER * server, ROLLUP_TIER_ID tierId, uint32_t count)
+{
+    const ROLLUP_TIER * tier = &server->history->tiers[tierId];
+    ROLLUP_SUMMARY summary;
+    uint64_t first;
+    size_t length;
+    bool comma = false;
+
+    length = snprintf(server->body, SERVER_MAX_OUTPUT, "{\"tier\":\"%s\",\"width\":%u,\"buckets\":[",
+                      tierNames[tierId], tier->widthSeconds);
+
+    if(server->history->started)
+    {
+        // Buckets before the tier's first hold nothing, so they are not asked for
+        first = tier->newestIndex + 1 >= count ? tier->newestIndex + 1 - count : 0;
+        if(first < tier->firstIndex)
+        {
+            first = tier->firstIndex;
+        }
+        for(uint64_t index = first; index <= tier->newestIndex; index++)
+        {
+            if(!rollupBucket(server->history, tierId, index, &summary))
+            {
+                continue;
+            }
+            length += snprintf(server->body + length, SERVER_MAX_OUTPUT - length,
+                               "%s{\"start\":%llu,\"count\":%u,"
+                               "\"pm2_5\":{\"avg\":%0.1f,\"min\":%u,\"max\":%u},"
+                               "\"pm10_0\":{\"avg\":%0.1f,\"min\":%u,\"max\":%u}}",
+                               comma ? "," : "", (unsigned long long)(index * tier->widthSeconds), summary.count,
+                               summary.count > 0 ? (double)summary.sumPm2_5 / summary.count : 0.0,
+                               summary.minPm2_5, summary.maxPm2_5,
+                               summary.count > 0 ? (double)summary.sumPm10_0 / summary.count : 0.0,
+                               summary.minPm10_0, summary.maxPm10_0);
+            comma = true;
+            if(length >= SERVER_MAX_OUTPUT)
+            {
+                return -1;
+            }
+        }
+    }
+
+    length += snprintf(server->body + length, SERVER_MAX_OUTPUT - length, "]}");
+    return length < SERVER_MAX_OUTPUT ? (int)length : -1;
+}
+
+// Finds name=value in a query string, no percent decoding is needed for these parameters
+static bool queryValue(const char * query, const char * name, char * value, size_t size)
+{
+    size_t nameLength = strlen(name);
+
+    while(query != NULL && *query != '\0')
+    {
+        size_t length = strcspn(query, "&");
+
+        if(length > nameLength && strncmp(query, name, nameLength) == 0 && query[nameLength] == '=')
+        {
+            length -= nameLength + 1;
+            if(length >= size)
+            {
+                return false;
+            }
+            memcpy(value, query + nameLength + 1, length);
+            value[length] = '\0';
+            return true;
+        }
+        query += length;
+        if(*query == '&')
+        {
+            query++;
+        }
+    }
+    return false;
+}
+
+static void respond(ALPAQA_SERVER * server, SERVER_CLIENT * client, int status, const char * contentType,
+                    const char * body, size_t length)
+{
+    char header[SERVER_HEADER_SIZE];
+    int headerLength;
+
+    headerLength = snprintf(header, sizeof(header), "HTTP/1.1 %d %s\r\n%s%s%sContent-Length: %zu\r\nConnection: %s\r\n\r\n",
+                            status, statusText(status), contentType != NULL ? "Content-Type: " : "",
+                            contentType != NULL ? contentType : "", contentType != NULL ? "\r\n" : "",
+                            length, client->keepAlive ? "keep-alive" : "close");
+
+    if(!appendOutput(client, header, headerLength) || (length > 0 && !appendOutput(client, body, length)))
+    {
+        closeClient(server, client);
+        return;
+    }
+    if(!client->keepAlive)
+    {
+        setClientState(server, client, CLIENT_CLOSING);
+    }
+    sendOutput(server, client);
+}
+
+static void respondError(ALPAQA_SERVER * server, SERVER_CLIENT * client, int status, bool close)
+{
+    char body[64];
+    int length;
+
+    if(close)
+    {
+        client->keepAlive = false;
+    }
+    length = snprintf(body, sizeof(body), "{\"error\":\"%s\"}", statusText(status));
+    respond(server, client, status, "application/json", body, length);
+}
+
+static void respondReading(ALPAQA_SERVER * server, SERVER_CLIENT * client)
+{
+    if(server->readingJsonLength == 0)
+    {
+        respondError(server, client, 503, false);
+        return;
+    }
+    respond(server, client, 200, "application/json", server->readingJson, server->readingJsonLength);
+}
+
+static bool appendOutput(SERVER_CLIENT * client, const char * data, size_t length)
+{
+    size_t capacity;
+    char * output;
+
+    // Sent bytes are reclaimed before the buffer is allowed to grow
+    if(client->outputSent > 0)
+    {
+        client->outputLength -= client->outputSent;
+        memmove(client->output, client->output + client->outputSent, client->outputLength);
+        client->outputSent = 0;
+    }
+
+    if(client->outputLength + length > client->outputCapacity)
+    {
+        if(client->outputLength + length > SERVER_MAX_OUTPUT)
+        {
+            return false;
+        }
+        capacity = client->outputCapacity > 0 ? client->outputCapacity : SERVER_INITIAL_OUTPUT;
+        while(capacity < client->outputLength + length)
+        {
+            capacity *= 2;
+        }
+        if(capacity > SERVER_MAX_OUTPUT)
+        {
+            capacity = SERVER_MAX_OUTPUT;
+        }
+
+        output = realloc(client->output, capacity);
+        if(output == NULL)
+        {
+            return false;
+        }
+        client->output = output;
+        client->outputCapacity = capacity;
+    }
+
+    memcpy(client->output + client->outputLength, data, length);
+    client->outputLength += length;
+    return true;
+}
+
+// Sends as much as the socket takes now, and has epoll report when it can take the rest
+static void sendOutput(ALPAQA_SERVER * server, SERVER_CLIENT * client)
+{
+    struct epoll_event event;
+    ssize_t sent;
+    bool writing;
+
+    while(client->outputSent < client->outputLength)
+    {
+        sent = send(client->fd, client->output + client->outputSent, client->outputLength - client->outputSent,
+                    MSG_NOSIGNAL);
+        if(sent < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            if(errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                closeClient(server, client);
+                return;
+            }
+            break;
+        }
+        client->outputSent += sent;
+    }
+
+    if(client->outputSent == client->outputLength)
+    {
+        client->outputSent = 0;
+        client->outputLength = 0;
+        if(client->state == CLIENT_CLOSING)
+        {
+            closeClient(server, client);
+            return;
+        }
+    }
+
+    writing = client->outputLength > 0;
+    if(writing != client->writing)
+    {
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN | (writing ? EPOLLOUT : 0);
+        event.data.u32 = client - server->clients;
+        if(epoll_ctl(server->epollFd, EPOLL_CTL_MOD, client->fd, &event) != 0)
+        {
+            closeClient(server, client);
+            return;
+        }
+        client->writing = writing;
+    }
+}
+
+// Keeps the state counts and the client's deadline in step with its state
+static void setClientState(ALPAQA_SERVER * server, SERVER_CLIENT * client, SERVER_CLIENT_STATE clientState)
+{
+    uint64_t nowNs = monotonicNowNs();
+
+    if(client->state == CLIENT_STREAMING)
+    {
+        server->stats.streaming--;
+    }
+    else if(client->state == CLIENT_WAITING)
+    {
+        server->stats.waiting--;
+    }
+
+    client->state = clientState;
+    client->deadlineNs = 0;
+    switch(clientState)
+    {
+        case CLIENT_READING:
+        case CLIENT_CLOSING:
+            client->deadlineNs = nowNs + (SERVER_IDLE_SECONDS * NS_PER_SECOND);
+            break;
+
+        case CLIENT_WAITING:
+            server->stats.waiting++;
+            client->deadlineNs = nowNs + (SERVER_LONG_POLL_SECONDS * NS_PER_SECOND);
+            break;
+
+        case CLIENT_STREAMING:
+            server->stats.streaming++;
+            break;
+
+        default:
+            break;
+    }
+}
+
+// The slot keeps its output buffer for the next connection
+static void closeClient(ALPAQA_SERVER * server, SERVER_CLIENT * client)
+{
+    setClientState(server, client, CLIENT_FREE);
+    close(client->fd);
+    client->fd = -1;
+    client->writing = false;
+    client->requestLength = 0;
+    client->outputLength = 0;
+    client->outputSent = 0;
+    server->freeSlots[server->freeCount++] = client - server->clients;
+    server->stats.clients--;
+}
+
+static const char * statusText(int status)
+{
+    switch(status)
+    {
+        case 200:
+            return "OK";
+        case 204:
+            return "No Content";
+        case 400:
+            return "Bad Request";
+        case 404:
+            return "Not Found";
+        case 405:
+            return "Method Not Allowed";
+        case 431:
+            return "Request Header Fields Too Large";
+        case 503:
+            return "Service Unavailable";
+        default:
+            return "Error";
+    }
+}
@@ -0,0 +1,114 @@
+#ifndef ALPAQASERVER_H
+#define ALPAQASERVER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "PMSA003I.h"
+#include "SHT41.h"
+#include "alpaqaRollup.h"
+
+#define SERVER_MAX_CLIENTS 512
+#define SERVER_REQUEST_SIZE 1024
+// A client whose unsent output would grow past this misses stream updates, and
+// is dropped if a single response does not fit
+#define SERVER_MAX_OUTPUT (256 * 1024)
+#define SERVER_READING_JSON_SIZE 768
+#define SERVER_LONG_POLL_SECONDS 30
+#define SERVER_IDLE_SECONDS 60
+#define SERVER_MAX_HISTORY_BUCKETS 1440
+
+typedef enum
+{
+    CLIENT_FREE = 0,
+    // Reading a request, or between requests on a kept alive connection
+    CLIENT_READING,
+    // Parked until the next reading is published or the long poll times out
+    CLIENT_WAITING,
+    // Server-sent events, every published reading is pushed until the client goes away
+    CLIENT_STREAMING,
+    // Closes once its output is sent
+    CLIENT_CLOSING
+} SERVER_CLIENT_STATE;
+
+typedef struct
+{
+    int fd;
+    SERVER_CLIENT_STATE state;
+    bool keepAlive;
+    bool writing;
+    // Idle close for a kept alive connection, or when a long poll gives up
+    uint64_t deadlineNs;
+    uint64_t waitingAfter;
+    uint32_t requestLength;
+    char request[SERVER_REQUEST_SIZE];
+    char * output;
+    size_t outputLength;
+    size_t outputSent;
+    size_t outputCapacity;
+} SERVER_CLIENT;
+
+// What the app hands over after each report
+typedef struct
+{
+    uint64_t realtimeNs;
+    bool pmConnected;
+    bool shtConnected;
+    PARTICULATE_MATTER_DATA particulate;
+    TEMP_HUMIDITY_DATA tempHumidity;
+    float heatIndex;
+    uint16_t instantAqi;
+    uint16_t calculatedAqi;
+    bool aqiFull24Hour;
+    uint16_t nowcastAqi;
+    bool nowcastValid;
+} SERVER_READING;
+
+typedef struct
+{
+    uint64_t accepted;
+    uint64_t rejected;
+    uint64_t requests;
+    uint64_t published;
+    uint64_t updatesDropped;
+    uint32_t clients;
+    uint32_t streaming;
+    uint32_t waiting;
+} SERVER_STATS;
+
+// Serves JSON over HTTP/1.1 on a Unix domain socket and a localhost TCP port.
+// Every socket is non-blocking and lives in the server's own epoll set, which the
+// app's scheduler watches as one descriptor, so no client can hold up the loop.
+// Routes:
+//   GET /now                    latest reading and AQI values
+//   GET /now?after=SEQ          long poll, answered once a reading newer than SEQ exists
+//   GET /stream                 text/event-stream of every reading as it is published
+//   GET /history?window=SECONDS average, min and max over the window
+//   GET /history?tier=seconds|minutes|hours&count=N  the newest N buckets of a tier
+typedef struct
+{
+    int epollFd;
+    int unixFd;
+    int tcpFd;
+    const char * unixPath;
+    const ALPAQA_ROLLUP * history;
+    SERVER_CLIENT * clients;
+    int freeSlots[SERVER_MAX_CLIENTS];
+    int freeCount;
+    // Response bodies are built here before they are copied to a client
+    char * body;
+    uint64_t sequence;
+    char readingJson[SERVER_READING_JSON_SIZE];
+    int readingJsonLength;
+    SERVER_STATS stats;
+} ALPAQA_SERVER;
+
+bool serverStart(ALPAQA_SERVER * server, const char * unixPath, uint16_t tcpPort, const ALPAQA_ROLLUP * history);
+int serverFd(const ALPAQA_SERVER * server);
+void serverProcess(ALPAQA_SERVER * server);
+void serverPublish(ALPAQA_SERVER * server, const SERVER_READING * reading);
+void serverExpire(ALPAQA_SERVER * server);
+void serverStop(ALPAQA_SERVER * server);
+
+#endif
@@ -0,0 +1,124 @@
+#include "alpaqaShared.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+_Static_assert(sizeof(ALPAQA_SHARED_READING) % sizeof(uint32_t) == 0, "reading is copied in 32 bit words");
+
+static bool segmentValid(const ALPAQA_SHARED_SEGMENT * segment);
+
+// The segment is left in place when the app exits, so readers that have it mapped
+// carry on from the same object once the app is restarted
+bool sharedOpen(ALPAQA_SHARED * shared, const char * name)
+{
+    ALPAQA_SHARED_SEGMENT * segment;
+    uint32_t words[sizeof(ALPAQA_SHARED_READING) / sizeof(uint32_t)];
+    ALPAQA_SHARED_READING torn;
+    uint32_t sequence;
+
+    memset(shared, 0, sizeof(ALPAQA_SHARED));
+    shared->fd = shm_open(name, O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+    if(shared->fd < 0)
+    {
+        return false;
+    }
+    if(ftruncate(shared->fd, sizeof(ALPAQA_SHARED_SEGMENT)) != 0)
+    {
+        close(shared->fd);
+        shared->fd = -1;
+        return false;
+    }
+
+    segment = mmap(NULL, sizeof(ALPAQA_SHARED_SEGMENT), PROT_READ | PROT_WRITE, MAP_SHARED, shared->fd, 0);
+    if(segment == MAP_FAILED)
+    {
+        close(shared->fd);
+        shared->fd = -1;
+        return false;
+    }
+    shared->segment = segment;
+
+    // A segment from another layout is started over. The magic goes in last so
+    // a reader opening it part way through turns it down.
+    if(!segmentValid(segment))
+    {
+        memset(segment, 0, sizeof(ALPAQA_SHARED_SEGMENT));
+        segment->version = ALPAQA_SHARED_VERSION;
+        segment->size = sizeof(ALPAQA_SHARED_SEGMENT);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        memcpy(segment->magic, ALPAQA_SHARED_MAGIC, sizeof(segment->magic));
+    }
+    // A writer that died part way through a publish left the sequence odd. Publishes
+    // would then write with it even, so it is made even again here, after marking
+    // the half written reading as no longer live.
+    sequence = __atomic_load_n(&segment->sequence, __ATOMIC_RELAXED);
+    if(sequence & 1)
+    {
+        for(size_t idx = 0; idx < sizeof(ALPAQA_SHARED_READING) / sizeof(uint32_t); idx++)
+        {
+            words[idx] = __atomic_load_n(&((uint32_t *)&segment->reading)[idx], __ATOMIC_RELAXED);
+        }
+        memcpy(&torn, words, sizeof(torn));
+        torn.flags &= ~ALPAQA_SHARED_LIVE;
+        memcpy(words, &torn, sizeof(torn));
+        for(size_t idx = 0; idx < sizeof(ALPAQA_SHARED_READING) / sizeof(uint32_t); idx++)
+        {
+            __atomic_store_n(&((uint32_t *)&segment->reading)[idx], words[idx], __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&segment->sequence, sequence + 1, __ATOMIC_RELEASE);
+    }
+    shared->reading.updates = __atomic_load_n(&segment->reading.updates, __ATOMIC_RELAXED);
+    return true;
+}
+
+// Never waits on readers: a reader that overlaps a publish just reads again
+void sharedPublish(ALPAQA_SHARED * shared)
+{
+    ALPAQA_SHARED_SEGMENT * segment = shared->segment;
+    const uint32_t * from = (const uint32_t *)&shared->reading;
+    uint32_t * to = (uint32_t *)&segment->reading;
+    uint32_t sequence;
+
+    if(segment == NULL)
+    {
+        return;
+    }
+
+    shared->reading.updates++;
+    sequence = __atomic_load_n(&segment->sequence, __ATOMIC_RELAXED);
+    __atomic_store_n(&segment->sequence, sequence + 1, __ATOMIC_RELAXED);
+    // The odd sequence must be visible before any of the new reading is
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for(size_t idx = 0; idx < sizeof(ALPAQA_SHARED_READING) / sizeof(uint32_t); idx++)
+    {
+        __atomic_store_n(&to[idx], from[idx], __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&segment->sequence, sequence + 2, __ATOMIC_RELEASE);
+    shared->publishes++;
+}
+
+// Readers keep the last values, marked as no longer live
+void sharedClose(ALPAQA_SHARED * shared)
+{
+    if(shared->segment != NULL)
+    {
+        shared->reading.flags &= ~ALPAQA_SHARED_LIVE;
+        sharedPublish(shared);
+        munmap(shared->segment, sizeof(ALPAQA_SHARED_SEGMENT));
+        shared->segment = NULL;
+    }
+    if(shared->fd >= 0)
+    {
+        close(shared->fd);
+        shared->fd = -1;
+    }
+}
+
+static bool segmentValid(const ALPAQA_SHARED_SEGMENT * segment)
+{
+    return memcmp(segment->magic, ALPAQA_SHARED_MAGIC, sizeof(segment->magic)) == 0 &&
+           segment->version == ALPAQA_SHARED_VERSION && segment->size == sizeof(ALPAQA_SHARED_SEGMENT);
+}
@@ -0,0 +1,84 @@
+#ifndef ALPAQASHARED_H
+#define ALPAQASHARED_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Latest readings published in POSIX shared memory for other processes on the box.
+// The layout only uses fixed size types so readers need nothing but this header
+// and alpaqaSharedReader.c, which build into libalpaqa_shared.a.
+
+#define ALPAQA_SHARED_NAME "/alpaqa"
+#define ALPAQA_SHARED_MAGIC "AQSHARE1"
+#define ALPAQA_SHARED_VERSION 1
+#define ALPAQA_SHARED_CACHE_LINE 64
+// Gives up after this many torn reads in a row, which needs the writer to be
+// publishing non-stop for the whole time
+#define ALPAQA_SHARED_READ_RETRIES 1000
+
+#define ALPAQA_SHARED_PM_OK 0x01
+#define ALPAQA_SHARED_SHT_OK 0x02
+#define ALPAQA_SHARED_AQI_FULL_24_HOUR 0x04
+#define ALPAQA_SHARED_NOWCAST_VALID 0x08
+// Cleared when alpaqa_app exits, the values are then the last ones it had
+#define ALPAQA_SHARED_LIVE 0x80
+
+typedef struct
+{
+    uint64_t pmRealtimeNs;
+    uint64_t shtRealtimeNs;
+    // Counts publishes, so a reader can tell a new reading from one it has seen
+    uint32_t updates;
+    uint16_t flags;
+    uint16_t pm1_0;
+    uint16_t pm2_5;
+    uint16_t pm10_0;
+    uint16_t instantAqi;
+    uint16_t calculatedAqi;
+    uint16_t nowcastAqi;
+    uint16_t reserved;
+    float temperatureC;
+    float temperatureF;
+    float humidity;
+    float heatIndex;
+} ALPAQA_SHARED_READING;
+
+// The reading is guarded by a seqlock: the writer makes sequence odd, updates the
+// reading and makes it even again. A reader copies the reading between two loads
+// of sequence and keeps the copy only if both saw the same even value. Readers
+// never write to the segment, so any number of them cost the writer nothing.
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t size;
+
+    _Alignas(ALPAQA_SHARED_CACHE_LINE) uint32_t sequence;
+    ALPAQA_SHARED_READING reading;
+} ALPAQA_SHARED_SEGMENT;
+
+typedef struct
+{
+    int fd;
+    ALPAQA_SHARED_SEGMENT * segment;
+    ALPAQA_SHARED_READING reading;
+    uint64_t publishes;
+} ALPAQA_SHARED;
+
+typedef struct
+{
+    const ALPAQA_SHARED_SEGMENT * segment;
+} ALPAQA_SHARED_READER;
+
+// Writer, used by alpaqa_app
+bool sharedOpen(ALPAQA_SHARED * shared, const char * name);
+void sharedPublish(ALPAQA_SHARED * shared);
+void sharedClose(ALPAQA_SHARED * shared);
+
+// Reader library
+bool sharedReaderOpen(ALPAQA_SHARED_READER * reader, const char * name);
+bool sharedReaderRead(const ALPAQA_SHARED_READER * reader, ALPAQA_SHARED_READING * reading);
+void sharedReaderClose(ALPAQA_SHARED_READER * reader);
+
+#endif
@@ -0,0 +1,96 @@
+#include "alpaqaShared.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The only syscalls are here, reads are loads from the mapping
+bool sharedReaderOpen(ALPAQA_SHARED_READER * reader, const char * name)
+{
+    const ALPAQA_SHARED_SEGMENT * segment;
+    struct stat info;
+    int fd;
+
+    memset(reader, 0, sizeof(ALPAQA_SHARED_READER));
+    fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if(fd < 0)
+    {
+        return false;
+    }
+    if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(ALPAQA_SHARED_SEGMENT))
+    {
+        close(fd);
+        errno = EPROTO;
+        return false;
+    }
+
+    segment = mmap(NULL, sizeof(ALPAQA_SHARED_SEGMENT), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(segment == MAP_FAILED)
+    {
+        return false;
+    }
+
+    if(memcmp(segment->magic, ALPAQA_SHARED_MAGIC, sizeof(segment->magic)) != 0 ||
+       __atomic_load_n(&segment->version, __ATOMIC_ACQUIRE) != ALPAQA_SHARED_VERSION ||
+       segment->size != sizeof(ALPAQA_SHARED_SEGMENT))
+    {
+        munmap((void *)segment, sizeof(ALPAQA_SHARED_SEGMENT));
+        errno = EPROTO;
+        return false;
+    }
+    reader->segment = segment;
+    return true;
+}
+
+// Copies a consistent snapshot of the latest reading. Fails with EAGAIN only if
+// every attempt overlapped a publish, and with ENODATA before the first one.
+bool sharedReaderRead(const ALPAQA_SHARED_READER * reader, ALPAQA_SHARED_READING * reading)
+{
+    const ALPAQA_SHARED_SEGMENT * segment = reader->segment;
+    const uint32_t * from = (const uint32_t *)&segment->reading;
+    uint32_t * to = (uint32_t *)reading;
+    uint32_t before;
+    uint32_t after;
+
+    for(int attempt = 0; attempt < ALPAQA_SHARED_READ_RETRIES; attempt++)
+    {
+        before = __atomic_load_n(&segment->sequence, __ATOMIC_ACQUIRE);
+        if(before & 1)
+        {
+            continue;
+        }
+
+        for(size_t idx = 0; idx < sizeof(ALPAQA_SHARED_READING) / sizeof(uint32_t); idx++)
+        {
+            to[idx] = __atomic_load_n(&from[idx], __ATOMIC_RELAXED);
+        }
+        // The copy must be complete before sequence is checked again
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&segment->sequence, __ATOMIC_RELAXED);
+
+        if(before == after)
+        {
+            if(reading->updates == 0)
+            {
+                errno = ENODATA;
+                return false;
+            }
+            return true;
+        }
+    }
+    errno = EAGAIN;
+    return false;
+}
+
+void sharedReaderClose(ALPAQA_SHARED_READER * reader)
+{
+    if(reader->segment != NULL)
+    {
+        munmap((void *)reader->segment, sizeof(ALPAQA_SHARED_SEGMENT));
+        reader->segment = NULL;
+    }
+}
@@ -0,0 +1,262 @@
+#include "alpaqaStats.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alpaqaTime.h"
+
+static const STATS_WINDOW_CONFIG defaultWindows[] =
+{
+    { 60, 1 },
+    { 60 * 60, 10 },
+    { 8 * 60 * 60, 60 },
+    { 24 * 60 * 60, 120 },
+};
+
+static const float defaultEwmaTaus[] = { 60.0f, 10 * 60.0f, 60 * 60.0f };
+
+static bool dequeInit(STATS_DEQUE * deque, uint32_t capacity);
+static void dequePush(STATS_DEQUE * deque, uint32_t bucket, float value, bool keepLowest);
+static void dequeExpire(STATS_DEQUE * deque, uint32_t oldestBucket);
+static STATS_DEQUE_ENTRY * dequeAt(const STATS_DEQUE * deque, uint32_t idx);
+static void updateEwmas(ALPAQA_STATS * stats, STATS_CHANNEL_STATE * channel, uint64_t gapNs, float value);
+
+// 1 minute, 1 hour, 8 hour and 24 hour windows, and 1 minute, 10 minute and 1 hour averages
+void statsDefaultConfig(ALPAQA_STATS_CONFIG * config)
+{
+    memset(config, 0, sizeof(ALPAQA_STATS_CONFIG));
+    config->windowCount = sizeof(defaultWindows) / sizeof(defaultWindows[0]);
+    memcpy(config->windows, defaultWindows, sizeof(defaultWindows));
+    config->ewmaCount = sizeof(defaultEwmaTaus) / sizeof(defaultEwmaTaus[0]);
+    memcpy(config->ewmaTauSeconds, defaultEwmaTaus, sizeof(defaultEwmaTaus));
+}
+
+// Passing NULL takes the defaults. Every deque is allocated here, adding samples
+// never allocates.
+bool statsInit(ALPAQA_STATS * stats, const ALPAQA_STATS_CONFIG * config)
+{
+    memset(stats, 0, sizeof(ALPAQA_STATS));
+    if(config == NULL)
+    {
+        statsDefaultConfig(&stats->config);
+    }
+    else
+    {
+        stats->config = *config;
+    }
+
+    if(stats->config.windowCount > STATS_MAX_WINDOWS || stats->config.ewmaCount > STATS_MAX_EWMAS)
+    {
+        return false;
+    }
+
+    for(int channelId = 0; channelId < STATS_CHANNEL_COUNT; channelId++)
+    {
+        for(uint32_t windowId = 0; windowId < stats->config.windowCount; windowId++)
+        {
+            const STATS_WINDOW_CONFIG * windowConfig = &stats->config.windows[windowId];
+            STATS_WINDOW * window = &stats->channels[channelId].windows[windowId];
+
+            if(windowConfig->bucketSeconds == 0 || windowConfig->windowSeconds == 0)
+            {
+                statsFree(stats);
+                return false;
+            }
+            window->bucketSeconds = windowConfig->bucketSeconds;
+            window->buckets = (windowConfig->windowSeconds + windowConfig->bucketSeconds - 1) / windowConfig->bucketSeconds;
+            // At most one entry per bucket: the full ones plus the one filling
+            if(!dequeInit(&window->min, window->buckets + 1) || !dequeInit(&window->max, window->buckets + 1))
+            {
+                statsFree(stats);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void statsFree(ALPAQA_STATS * stats)
+{
+    for(int channelId = 0; channelId < STATS_CHANNEL_COUNT; channelId++)
+    {
+        for(int windowId = 0; windowId < STATS_MAX_WINDOWS; windowId++)
+        {
+            free(stats->channels[channelId].windows[windowId].min.entries);
+            free(stats->channels[channelId].windows[windowId].max.entries);
+            stats->channels[channelId].windows[windowId].min.entries = NULL;
+            stats->channels[channelId].windows[windowId].max.entries = NULL;
+        }
+    }
+}
+
+// Amortized O(1) per window and average. A clock stepped back files the sample
+// at the newest time seen, as the rollup does.
+void statsAdd(ALPAQA_STATS * stats, STATS_CHANNEL channelId, uint64_t timeNs, float value)
+{
+    STATS_CHANNEL_STATE * channel;
+    uint64_t seconds;
+    uint64_t gapNs = 0;
+
+    if(channelId >= STATS_CHANNEL_COUNT || isnan(value))
+    {
+        return;
+    }
+    channel = &stats->channels[channelId];
+
+    if(!stats->originSet)
+    {
+        stats->originNs = timeNs;
+        stats->originSet = true;
+    }
+    if(timeNs < stats->originNs)
+    {
+        timeNs = stats->originNs;
+    }
+    if(channel->started && timeNs < channel->newestNs)
+    {
+        timeNs = channel->newestNs;
+    }
+    if(channel->started)
+    {
+        gapNs = timeNs - channel->newestNs;
+    }
+
+    seconds = (timeNs - stats->originNs) / NS_PER_SECOND;
+    for(uint32_t windowId = 0; windowId < stats->config.windowCount; windowId++)
+    {
+        STATS_WINDOW * window = &channel->windows[windowId];
+        uint32_t bucket = seconds / window->bucketSeconds;
+        uint32_t oldest = bucket > window->buckets ? bucket - window->buckets : 0;
+
+        dequeExpire(&window->min, oldest);
+        dequeExpire(&window->max, oldest);
+        dequePush(&window->min, bucket, value, true);
+        dequePush(&window->max, bucket, value, false);
+    }
+
+    updateEwmas(stats, channel, gapNs, value);
+    channel->newestNs = timeNs;
+    channel->latest = value;
+    channel->samples++;
+    channel->started = true;
+}
+
+// Over the window ending at the channel's newest sample, so a sensor that has
+// gone quiet keeps the range it last had
+bool statsRange(const ALPAQA_STATS * stats, STATS_CHANNEL channelId, uint32_t windowId, STATS_RANGE * range)
+{
+    const STATS_WINDOW * window;
+
+    if(channelId >= STATS_CHANNEL_COUNT || windowId >= stats->config.windowCount ||
+       !stats->channels[channelId].started)
+    {
+        return false;
+    }
+
+    window = &stats->channels[channelId].windows[windowId];
+    range->min = dequeAt(&window->min, 0)->value;
+    range->max = dequeAt(&window->max, 0)->value;
+    return true;
+}
+
+bool statsEwma(const ALPAQA_STATS * stats, STATS_CHANNEL channelId, uint32_t ewmaId, float * value)
+{
+    if(channelId >= STATS_CHANNEL_COUNT || ewmaId >= stats->config.ewmaCount || !stats->channels[channelId].started)
+    {
+        return false;
+    }
+    *value = stats->channels[channelId].ewma[ewmaId];
+    return true;
+}
+
+static bool dequeInit(STATS_DEQUE * deque, uint32_t capacity)
+{
+    memset(deque, 0, sizeof(STATS_DEQUE));
+    deque->entries = calloc(capacity, sizeof(STATS_DEQUE_ENTRY));
+    deque->capacity = capacity;
+    return deque->entries != NULL;
+}
+
+// An entry the new value beats can never be the answer again: the new one is
+// at least as good and stays in the window at least as long. A value that does
+// not beat an entry from its own bucket is not needed either, they leave together.
+static void dequePush(STATS_DEQUE * deque, uint32_t bucket, float value, bool keepLowest)
+{
+    STATS_DEQUE_ENTRY * back;
+
+    while(deque->count > 0)
+    {
+        back = dequeAt(deque, deque->count - 1);
+        if(keepLowest ? back->value < value : back->value > value)
+        {
+            break;
+        }
+        deque->count--;
+    }
+
+    if(deque->count > 0 && dequeAt(deque, deque->count - 1)->bucket == bucket)
+    {
+        return;
+    }
+
+    // Only reachable if buckets arrive out of order, which the clamping in statsAdd prevents
+    if(deque->count == deque->capacity)
+    {
+        deque->head = (deque->head + 1) % deque->capacity;
+        deque->count--;
+    }
+
+    back = dequeAt(deque, deque->count);
+    back->bucket = bucket;
+    back->value = value;
+    deque->count++;
+}
+
+static void dequeExpire(STATS_DEQUE * deque, uint32_t oldestBucket)
+{
+    while(deque->count > 0 && dequeAt(deque, 0)->bucket < oldestBucket)
+    {
+        deque->head = (deque->head + 1) % deque->capacity;
+        deque->count--;
+    }
+}
+
+static STATS_DEQUE_ENTRY * dequeAt(const STATS_DEQUE * deque, uint32_t idx)
+{
+    uint32_t slot = deque->head + idx;
+
+    if(slot >= deque->capacity)
+    {
+        slot -= deque->capacity;
+    }
+    return &deque->entries[slot];
+}
+
+static void updateEwmas(ALPAQA_STATS * stats, STATS_CHANNEL_STATE * channel, uint64_t gapNs, float value)
+{
+    uint64_t gapMs = gapNs / NS_PER_MS;
+
+    if(!channel->started)
+    {
+        for(uint32_t idx = 0; idx < stats->config.ewmaCount; idx++)
+        {
+            channel->ewma[idx] = value;
+        }
+        return;
+    }
+
+    if(gapMs != channel->alphaGapMs)
+    {
+        for(uint32_t idx = 0; idx < stats->config.ewmaCount; idx++)
+        {
+            channel->alpha[idx] = 1.0f - expf(-(float)gapMs / (1000.0f * stats->config.ewmaTauSeconds[idx]));
+        }
+        channel->alphaGapMs = gapMs;
+    }
+
+    for(uint32_t idx = 0; idx < stats->config.ewmaCount; idx++)
+    {
+        channel->ewma[idx] += channel->alpha[idx] * (value - channel->ewma[idx]);
+    }
+}
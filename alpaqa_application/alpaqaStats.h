@@ -0,0 +1,101 @@
+#ifndef ALPAQASTATS_H
+#define ALPAQASTATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define STATS_MAX_WINDOWS 4
+#define STATS_MAX_EWMAS 4
+
+typedef enum
+{
+    STATS_PM1_0 = 0,
+    STATS_PM2_5,
+    STATS_PM10_0,
+    STATS_TEMPERATURE_F,
+    STATS_HUMIDITY,
+    STATS_HEAT_INDEX,
+    STATS_CHANNEL_COUNT
+} STATS_CHANNEL;
+
+// A window slides in steps of bucketSeconds, so its min and max cover between
+// windowSeconds and windowSeconds + bucketSeconds of samples. Coarser buckets
+// for the long windows keep their deques short.
+typedef struct
+{
+    uint32_t windowSeconds;
+    uint32_t bucketSeconds;
+} STATS_WINDOW_CONFIG;
+
+typedef struct
+{
+    uint32_t windowCount;
+    STATS_WINDOW_CONFIG windows[STATS_MAX_WINDOWS];
+    uint32_t ewmaCount;
+    // Time constants, each sample moves an average by 1 - e^(-dt / tau) of the way
+    float ewmaTauSeconds[STATS_MAX_EWMAS];
+} ALPAQA_STATS_CONFIG;
+
+typedef struct
+{
+    uint32_t bucket;
+    float value;
+} STATS_DEQUE_ENTRY;
+
+// Monotonic deque: values rise from front to back for a minimum and fall for a
+// maximum, so the front is always the answer. A sample removes every entry at
+// the back it beats before going on, and an entry leaves the front once its
+// bucket is out of the window, so each one is pushed and removed once.
+typedef struct
+{
+    STATS_DEQUE_ENTRY * entries;
+    uint32_t capacity;
+    uint32_t head;
+    uint32_t count;
+} STATS_DEQUE;
+
+typedef struct
+{
+    uint32_t buckets;
+    uint32_t bucketSeconds;
+    STATS_DEQUE min;
+    STATS_DEQUE max;
+} STATS_WINDOW;
+
+typedef struct
+{
+    bool started;
+    uint64_t newestNs;
+    uint64_t samples;
+    float latest;
+    float ewma[STATS_MAX_EWMAS];
+    // Samples mostly arrive a fixed period apart, so the weights for the last
+    // gap, to the millisecond, are kept rather than calling exp() every time
+    uint64_t alphaGapMs;
+    float alpha[STATS_MAX_EWMAS];
+    STATS_WINDOW windows[STATS_MAX_WINDOWS];
+} STATS_CHANNEL_STATE;
+
+typedef struct
+{
+    ALPAQA_STATS_CONFIG config;
+    // Buckets are numbered from the first sample, which keeps them to 32 bits
+    uint64_t originNs;
+    bool originSet;
+    STATS_CHANNEL_STATE channels[STATS_CHANNEL_COUNT];
+} ALPAQA_STATS;
+
+typedef struct
+{
+    float min;
+    float max;
+} STATS_RANGE;
+
+void statsDefaultConfig(ALPAQA_STATS_CONFIG * config);
+bool statsInit(ALPAQA_STATS * stats, const ALPAQA_STATS_CONFIG * config);
+void statsFree(ALPAQA_STATS * stats);
+void statsAdd(ALPAQA_STATS * stats, STATS_CHANNEL channel, uint64_t timeNs, float value);
+bool statsRange(const ALPAQA_STATS * stats, STATS_CHANNEL channel, uint32_t windowId, STATS_RANGE * range);
+bool statsEwma(const ALPAQA_STATS * stats, STATS_CHANNEL channel, uint32_t ewmaId, float * value);
+
+#endif
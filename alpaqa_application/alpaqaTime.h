@@ -0,0 +1,35 @@
+#ifndef ALPAQATIME_H
+#define ALPAQATIME_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define NS_PER_SECOND 1000000000ULL
+#define NS_PER_MS 1000000ULL
+
+static inline uint64_t timespecToNs(const struct timespec * ts)
+{
+    return ((uint64_t)ts->tv_sec * NS_PER_SECOND) + ts->tv_nsec;
+}
+
+static inline void nsToTimespec(uint64_t ns, struct timespec * ts)
+{
+    ts->tv_sec = ns / NS_PER_SECOND;
+    ts->tv_nsec = ns % NS_PER_SECOND;
+}
+
+static inline uint64_t monotonicNowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return timespecToNs(&ts);
+}
+
+static inline uint64_t realtimeNowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return timespecToNs(&ts);
+}
+
+#endif
@@ -1,17 +1,35 @@
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "PMSA003I.h"
 #include "SHT41.h"
 #include "alpaqaCalc.h"
+#include "alpaqaAlert.h"
+#include "i2cBus.h"
+#include "alpaqaAcquisition.h"
+#include "alpaqaDevices.h"
+#include "alpaqaLatency.h"
+#include "alpaqaLog.h"
+#include "alpaqaLogThread.h"
+#include "alpaqaNotify.h"
+#include "alpaqaPercentile.h"
+#include "alpaqaScheduler.h"
+#include "alpaqaScreen.h"
+#include "alpaqaServer.h"
+#include "alpaqaShared.h"
+#include "alpaqaStats.h"
+#include "alpaqaTime.h"
 
-#define ESCAPE_CLEAR_SCREEN "\e[2J"
 #define ESCAPE_CURSOR_PREVIOUS "\e[6F"
 #define BOLD "\e[1m"
 #define DEFAULT "\e[0m"
@@ -20,9 +38,9 @@
 #define SECTION_SPACING 2
 #define ALPAQA_BANNER_LINE 1
 #define PM_BANNER_LINE (ALPAQA_BANNER_LINE + BANNER_SIZE + 1 + SECTION_SPACING)
-#define PM_DATA_SIZE 3
+#define PM_DATA_SIZE 6
 #define SHT_BANNER_LINE (PM_BANNER_LINE + BANNER_SIZE + PM_DATA_SIZE + SECTION_SPACING)
-#define SHT_DATA_SIZE 3
+#define SHT_DATA_SIZE 5
 #define SYS_INFO_BANNER_LINE (SHT_BANNER_LINE + BANNER_SIZE + SHT_DATA_SIZE + SECTION_SPACING)
 
 #define PM_DATA_START_LINE (PM_BANNER_LINE + BANNER_SIZE)
@@ -33,6 +51,19 @@
 #define SYS_INFO_I2C_LINE (SYS_INFO_LOG_SIZE_LINE + 1)
 #define SYS_INFO_PM_LINE (SYS_INFO_I2C_LINE + 1)
 #define SYS_INFO_TEMPERATURE_LINE (SYS_INFO_PM_LINE + 1)
+#define SYS_INFO_BUS_STATS_LINE (SYS_INFO_TEMPERATURE_LINE + 1)
+#define SYS_INFO_ACQUISITION_LINE (SYS_INFO_BUS_STATS_LINE + 1)
+#define SYS_INFO_SCHEDULE_LINE (SYS_INFO_ACQUISITION_LINE + 1)
+#define SYS_INFO_SAMPLING_LINE (SYS_INFO_SCHEDULE_LINE + 1)
+#define SYS_INFO_JITTER_LINE (SYS_INFO_SAMPLING_LINE + 1)
+#define SYS_INFO_STATE_LINE (SYS_INFO_JITTER_LINE + 1)
+#define SYS_INFO_DISPLAY_LINE (SYS_INFO_STATE_LINE + 1)
+#define SYS_INFO_SERVER_LINE (SYS_INFO_DISPLAY_LINE + 1)
+#define SYS_INFO_SHARED_LINE (SYS_INFO_SERVER_LINE + 1)
+#define SYS_INFO_LATENCY_LINE (SYS_INFO_SHARED_LINE + 1)
+#define SYS_INFO_ALERTS_LINE (SYS_INFO_LATENCY_LINE + 1)
+// One line for each location past the primary one
+#define SYS_INFO_LOCATIONS_LINE (SYS_INFO_ALERTS_LINE + 1)
 
 #define BLACK_BG 40
 #define RED_FG 31
@@ -42,40 +73,210 @@
 #define CYAN_BG 46
 #define WHITE_FG 37
 
-#define BUFFER_SIZE 256
-
-#define ALPAQA_LOG_FILE "/var/log/alpaqa/alpaqa_log.txt"
+#define ALPAQA_LOG_FILE "/var/log/alpaqa/alpaqa_log.bin"
+#define ALPAQA_STATE_FILE "/var/log/alpaqa/alpaqa_state.bin"
+#define DEFAULT_STATE_SAVE_SECONDS 60
+#define ALPAQA_SERVER_SOCKET "/var/run/alpaqa.sock"
+#define ALPAQA_LATENCY_FILE "/var/run/alpaqa_latency.txt"
+#define LATENCY_WRITE_SECONDS 10
+#define DEFAULT_SERVER_PORT 8090
 #define I2C_DEVICE_FILENAME "/dev/i2c-1"
+#define DEFAULT_PERIOD_MS 1000
+// Each PM sample counts for whole seconds in the averages, up to a limit, so
+// stretched periods start from at least a second and stay within the limit
+#define ADAPTIVE_MIN_PERIOD_MS 1000
+#define ADAPTIVE_MAX_PERIOD_MS (CALC_MAX_SAMPLE_SECONDS * 1000)
+#define SYNTHETIC_SEED 1
+
+typedef struct
+{
+    const char * logFilename;
+    const char * stateFilename;
+    // DEVICE[:MUX CHANNEL] of the primary location and of any others
+    const char * i2cDeviceFilename;
+    const char * extraLocations[DEVICES_MAX_LOCATIONS - 1];
+    int extraLocationCount;
+    const char * replayFilename;
+    const char * captureFilename;
+    I2C_BUS_TYPE busType;
+    float syntheticRateHz;
+    uint32_t pmPeriodMs;
+    uint32_t shtPeriodMs;
+    uint32_t reportPeriodMs;
+    // 0 samples at the fixed periods
+    uint32_t adaptivePeriodMaxMs;
+    float pmSteadyThreshold;
+    float temperatureSteadyThreshold;
+    uint32_t stateSaveSeconds;
+    SHT41_PRECISION shtPrecision;
+    uint64_t cycles;
+    bool legacyTransfers;
+    int acquisitionCpu;
+    int acquisitionPriority;
+    ALPAQA_LOG_THREAD_CONFIG logConfig;
+    const char * outputFilenames[SCREEN_MAX_OUTPUTS];
+    int outputCount;
+    const char * serverSocketPath;
+    uint16_t serverPort;
+    const char * sharedName;
+    const char * latencyFilename;
+    // Alerts are only evaluated with a rules file, and only sent to the sinks given
+    const char * alertRulesFilename;
+    const char * alertFifoPath;
+    const char * alertSocketPath;
+    const char * alertCommand;
+} ALPAQA_OPTIONS;
+
+// Latest readings of one location and what was worked out from them
+typedef struct
+{
+    // Each location keeps its own AQI history and saves it to its own state file
+    ALPAQA_CALC_CONTEXT calc;
+    bool pmConnected;
+    bool shtConnected;
+    PARTICULATE_MATTER_DATA particulateData;
+    // Every channel of the last good frame, particle counts included
+    PMSA003I_FRAME_DATA pmFrame;
+    TEMP_HUMIDITY_DATA tempHumidityData;
+    uint64_t pmRealtimeNs;
+    uint16_t temperatureTicks;
+    uint16_t humidityTicks;
+    float heatIndex;
+    uint16_t calculatedAqi;
+    uint16_t instantAqi;
+    bool aqiFull24Hour;
+    uint16_t nowcastAqi;
+    bool nowcastValid;
+} ALPAQA_LOCATION;
+
+typedef struct
+{
+    const ALPAQA_OPTIONS * options;
+    ALPAQA_DEVICES * devices;
+    // The primary location's bus, the one the sampling stats are shown for
+    ALPAQA_ACQUISITION * acquisition;
+    ALPAQA_SCHEDULER * scheduler;
+    ALPAQA_LOG_THREAD * logThread;
+    // NULL when neither the socket nor the port is served
+    ALPAQA_SERVER * server;
+    // NULL when readings are not published in shared memory
+    ALPAQA_SHARED * shared;
+    // NULL without a rules file, and without any sink to send alerts to
+    ALPAQA_ALERTS * alerts;
+    ALPAQA_NOTIFY * notify;
+    ALERT_EVENT lastAlert;
+    bool alerted;
+    int reportSchedule;
+    // Reports are stretched along with the primary bus's sampling periods
+    uint32_t reportScale;
+    uint64_t samplingStartNs;
+    int stateSchedule;
+    uint64_t latencyWrites;
+
+    // By location number. Location 0 is the primary one: it is what the display shows
+    // in full and what the statistics, server and shared memory are kept for.
+    ALPAQA_LOCATION * locations;
+    uint32_t locationCount;
+    JITTER_STATS jitter[SENSOR_COUNT];
+    // Peaks, lows and smoothed trends of every channel over the last minute to day
+    ALPAQA_STATS stats;
+    // 24 hour distributions, about half a megabyte so kept off the stack
+    ALPAQA_PERCENTILES * percentiles;
+} ALPAQA_STATE;
 
 bool alpaqaRunning;
+// Set by SIGUSR1, the latency file is rewritten as soon as the main loop wakes
+static volatile sig_atomic_t latencyRequested;
+// Everything shown on the consoles is drawn here and sent out once per report
+static ALPAQA_SCREEN screen;
 
 static void signalHandler(int signalNumber);
+static bool parseOptions(int argc, char * argv[], ALPAQA_OPTIONS * options);
+static bool addLocations(const ALPAQA_OPTIONS * options, ALPAQA_DEVICES * devices);
+static bool openBus(const ALPAQA_OPTIONS * options, uint32_t busIndex, ALPAQA_DEVICE_BUS * deviceBus);
+static void loadLocationStates(ALPAQA_STATE * state);
+static bool saveLocationStates(ALPAQA_STATE * state, bool close);
+static bool openScreen(const ALPAQA_OPTIONS * options);
+static void framesReady(void * context);
+static void processFrame(ALPAQA_STATE * state, const ALPAQA_FRAME * frame);
+static void reportDue(void * context);
+static void stateSaveDue(void * context);
+static void latencyDue(void * context);
+static void writeLatency(ALPAQA_STATE * state);
+static void writeStateStatus(const char * status);
+static void writeReport(ALPAQA_STATE * state);
+static void writeDisplay(const ALPAQA_STATE * state);
+static void writeLocations(const ALPAQA_STATE * state);
+static void writeLogRecord(ALPAQA_STATE * state);
+static void serverReady(void * context);
+static void serverTick(void * context);
+static void publishReading(ALPAQA_STATE * state);
+static void writeServerStats(const ALPAQA_SERVER * server);
+static void publishShared(ALPAQA_STATE * state, const ALPAQA_FRAME * frame);
+static bool loadAlerts(const ALPAQA_OPTIONS * options, ALPAQA_ALERTS * alerts, uint32_t locationCount);
+static void evaluateAlerts(ALPAQA_STATE * state, const ALPAQA_FRAME * frame, uint32_t channelMask);
+static void writeAlertStats(const ALPAQA_STATE * state);
+static void writeBusStats(const I2C_BUS_STATS * stats, uint64_t samples);
+static void writeAcquisitionStats(const ALPAQA_ACQUISITION_STATUS * status);
+static void writeScheduleStats(const ALPAQA_ACQUISITION_STATUS * status);
+static void writeSamplingStats(const ALPAQA_STATE * state, const ALPAQA_ACQUISITION_STATUS * status);
+static void writeJitterStats(const ALPAQA_STATE * state, const ALPAQA_ACQUISITION_STATUS * status);
+static void writeDisplayStats();
 static void writeBanners();
-static void writePM(const PARTICULATE_MATTER_DATA * pm_data, uint16_t calculatedAqi, uint16_t instantAqi, bool aqiFull24Hour);
+static void writePM(const ALPAQA_LOCATION * location);
 static void writeTempHumidity(const TEMP_HUMIDITY_DATA * tempHumidityData, float heatIndex);
+static void writeTrends(const ALPAQA_STATE * state);
+static void writePercentiles(const ALPAQA_STATE * state);
 
-#define cursorPosition(xLoc, yLoc) printf("\e[%d;%dH", xLoc, yLoc);
-#define clearLine() printf("\e[2K");
-#define setColor(foreground, background) printf("\e[%d;%dm", foreground, background);
-#define resetColor() printf("\e[0m");
-#define setBold() printf("\e[1m");
+#define cursorPosition(xLoc, yLoc) screenMoveTo(&screen, xLoc, yLoc);
+#define clearLine() screenClearLine(&screen);
+#define setColor(foreground, background) screenSetColor(&screen, foreground, background);
+#define resetColor() screenResetStyle(&screen);
+#define setBold() screenSetBold(&screen);
 
-int main()
+int main(int argc, char * argv[])
 {
-    FILE * logFile;
+    ALPAQA_LOG_WRITER log;
+    ALPAQA_LOG_THREAD logThread;
+    ALPAQA_LOG_INDEX_WRITER logIndex;
+    bool logIndexed = false;
     struct sigaction sigAction;
-    int i2cFile;
-    PARTICULATE_MATTER_DATA particulateData;
-    TEMP_HUMIDITY_DATA tempHumidityData;
-    float heatIndex;
-    uint16_t calculatedAqi;
-    uint16_t instantAqi;
-    bool aqiFull24Hour;
-    char fileBuffer[BUFFER_SIZE];
+    ALPAQA_OPTIONS options;
+    ALPAQA_DEVICES devices;
+    ALPAQA_ACQUISITION_CONFIG acquisitionConfig;
+    ALPAQA_SCHEDULER scheduler;
+    ALPAQA_SERVER server;
+    ALPAQA_SHARED shared;
+    ALPAQA_ALERTS alerts;
+    ALPAQA_NOTIFY notify;
+    ALPAQA_STATE state;
+    ALPAQA_LOCATION * primary;
+    const char * failedDevice = NULL;
+    int failedErrno = 0;
+
+    if(!parseOptions(argc, argv, &options))
+    {
+        return 1;
+    }
+
+    devicesInit(&devices);
+    if(!addLocations(&options, &devices))
+    {
+        return 1;
+    }
+    // A rule that does not parse is a typo worth stopping for, not one to run without
+    if(!loadAlerts(&options, &alerts, devices.locationCount))
+    {
+        return 1;
+    }
 
     alpaqaRunning = true;
 
-    printf(ESCAPE_CLEAR_SCREEN);
+    if(!openScreen(&options))
+    {
+        fprintf(stderr, "Failed to open display output! errno: %d\n", errno);
+        return 1;
+    }
     writeBanners();
 
     // register the signal handler to allow graceful quitting
@@ -87,109 +288,728 @@ int main()
     if( sigaction(SIGINT, &sigAction, NULL) != 0)
     {
     }
+    // Interrupting the scheduler wait is what gets the dump written, so no SA_RESTART
+    if( sigaction(SIGUSR1, &sigAction, NULL) != 0)
+    {
+    }
 
-    logFile = fopen(ALPAQA_LOG_FILE, "a+");
     cursorPosition(SYS_INFO_LOG_LINE,1);
-    if(logFile == NULL)
+    memset(&logThread, 0, sizeof(logThread));
+    // Records are committed in batches by the log thread, never from the report path
+    // The time index is only there for readers, the log is kept without it if need be
+    if(!alpaqaLogOpen(&log, options.logFilename) ||
+       !logThreadStart(&logThread, &log,
+                       (logIndexed = alpaqaLogIndexOpen(&logIndex, &log, options.logFilename, ALPAQA_LOG_INDEX_DEFAULT_RECORDS)) ?
+                       &logIndex : NULL, &options.logConfig))
     {
-        printf("Log Status: Failed to open log file: %s! errno: %d\n", ALPAQA_LOG_FILE, errno);
+        screenPrintf(&screen, "Log Status: Failed to open log file: %s! errno: %d\n", options.logFilename, errno);
     }
     else
     {
-        printf("Log Status: Opened file: %s", ALPAQA_LOG_FILE);
+        screenPrintf(&screen, "Log Status: Opened file: %s, %s", options.logFilename, logIndexed ? "indexed" : "not indexed");
     }
 
-    // Attempt to open i2c device
+    // Attempt to open the i2c devices
+    for(uint32_t idx = 0; idx < devices.busCount; idx++)
+    {
+        devices.buses[idx].opened = openBus(&options, idx, &devices.buses[idx]);
+        if(!devices.buses[idx].opened && failedDevice == NULL)
+        {
+            failedDevice = devices.buses[idx].deviceFilename;
+            failedErrno = errno;
+        }
+        devices.buses[idx].bus.legacyTransfers = options.legacyTransfers;
+    }
     cursorPosition(SYS_INFO_I2C_LINE,1);
-    if( (i2cFile = open(I2C_DEVICE_FILENAME, O_RDWR)) < 0)
+    if(failedDevice != NULL)
     {
-        printf("I2C Status: Failed to open the I2C Bus! errno: %d\n", errno);
+        screenPrintf(&screen, "I2C Status: Failed to open the I2C Bus %s! errno: %d\n", failedDevice, failedErrno);
+    }
+    else if(devices.busCount > 1 || devices.locationCount > 1)
+    {
+        screenPrintf(&screen, "I2C Status: Connected, %u buses, %u locations", devices.busCount, devices.locationCount);
     }
     else
     {
-        printf("I2C Status: Connected");
+        screenPrintf(&screen, "I2C Status: Connected");
     }
+    setTempAndHumidityPrecision(options.shtPrecision);
 
-    initAlpaqaCalc();
+    memset(&state, 0, sizeof(state));
+    state.options = &options;
+    state.reportScale = 1;
+    state.devices = &devices;
+    state.acquisition = &devicesLocationBus(&devices, 0)->acquisition;
+    state.scheduler = &scheduler;
+    state.logThread = &logThread;
+    state.stateSchedule = -1;
+    // A day of AQI history each, too much for the stack once there are a few locations
+    state.locationCount = devices.locationCount;
+    state.locations = calloc(state.locationCount, sizeof(ALPAQA_LOCATION));
+    state.percentiles = malloc(sizeof(ALPAQA_PERCENTILES));
+    if(state.locations == NULL || state.percentiles == NULL)
+    {
+        fprintf(stderr, "Failed to allocate location state! errno: %d\n", errno);
+        screenClose(&screen);
+        devicesClose(&devices);
+        return 1;
+    }
+    primary = &state.locations[0];
 
-    while(alpaqaRunning)
+    // Pick the averages up where the last run left them instead of starting a new day
+    loadLocationStates(&state);
+
+    // A real-time sampling thread must not page fault on its way to the bus
+    if(options.acquisitionPriority > 0)
     {
-        // Read data from AQI sensor
-        cursorPosition(SYS_INFO_PM_LINE,1);
-        clearLine();
-        if(readAqiDataFromDevice(i2cFile) == true)
+        mlockall(MCL_CURRENT | MCL_FUTURE);
+    }
+
+    // Sampling runs on a thread per bus so nothing done here, or on another bus, can
+    // delay a bus read
+    memset(&acquisitionConfig, 0, sizeof(acquisitionConfig));
+    acquisitionConfig.pmPeriodMs = options.pmPeriodMs;
+    acquisitionConfig.shtPeriodMs = options.shtPeriodMs;
+    acquisitionConfig.adaptivePeriodMaxMs = options.adaptivePeriodMaxMs;
+    acquisitionConfig.pmSteadyThreshold = options.pmSteadyThreshold;
+    acquisitionConfig.temperatureSteadyThreshold = options.temperatureSteadyThreshold;
+    acquisitionConfig.maxPmSamples = options.cycles;
+    acquisitionConfig.cpu = options.acquisitionCpu;
+    acquisitionConfig.fifoPriority = options.acquisitionPriority;
+    state.samplingStartNs = monotonicNowNs();
+    if(!devicesStart(&devices, &acquisitionConfig))
+    {
+        fprintf(stderr, "Failed to start sampling! errno: %d\n", errno);
+        screenClose(&screen);
+        devicesClose(&devices);
+        return 1;
+    }
+
+    for(uint32_t idx = 0; idx < state.locationCount; idx++)
+    {
+        state.locations[idx].aqiFull24Hour = calcContextAQI(&state.locations[idx].calc, &state.locations[idx].calculatedAqi);
+        state.locations[idx].nowcastValid = calcContextNowCastAQI(&state.locations[idx].calc, &state.locations[idx].nowcastAqi);
+    }
+    if(!statsInit(&state.stats, NULL))
+    {
+        fprintf(stderr, "Failed to set up reading statistics! errno: %d\n", errno);
+        alpaqaRunning = false;
+    }
+    else
+    {
+        percentilesInit(state.percentiles, PERCENTILE_DEFAULT_WINDOW);
+    }
+
+    if(!schedulerInit(&scheduler) ||
+    (state.reportSchedule = schedulerAddPeriodic(&scheduler, "Report", options.reportPeriodMs * NS_PER_MS, reportDue, &state)) < 0)
+    {
+        fprintf(stderr, "Failed to set up report timer! errno: %d\n", errno);
+        alpaqaRunning = false;
+    }
+    for(uint32_t idx = 0; idx < devices.busCount; idx++)
+    {
+        if(schedulerAddFd(&scheduler, "Frames", acquisitionNotifyFd(&devices.buses[idx].acquisition), framesReady, &state) < 0)
+        {
+            fprintf(stderr, "Failed to wait for frames from %s! errno: %d\n", devices.buses[idx].deviceFilename, errno);
+            alpaqaRunning = false;
+        }
+    }
+
+    if(primary->calc.state.file != NULL && options.stateSaveSeconds > 0)
+    {
+        state.stateSchedule = schedulerAddPeriodic(&scheduler, "State", options.stateSaveSeconds * NS_PER_SECOND, stateSaveDue, &state);
+    }
+
+    // Stage latencies are always recorded, the file is only for reading them from outside
+    if(options.latencyFilename[0] != '\0' &&
+    schedulerAddPeriodic(&scheduler, "Latency", LATENCY_WRITE_SECONDS * NS_PER_SECOND, latencyDue, &state) < 0)
+    {
+        cursorPosition(SYS_INFO_LATENCY_LINE,1);
+        screenPrintf(&screen, "Latency: Failed to schedule writes to %s! errno: %d", options.latencyFilename, errno);
+    }
+
+    // Clients are served from the same loop, every socket is non-blocking so none of
+    // them can hold up frames or reports
+    if(options.serverSocketPath[0] != '\0' || options.serverPort != 0)
+    {
+        cursorPosition(SYS_INFO_SERVER_LINE,1);
+        if(!serverStart(&server, options.serverSocketPath, options.serverPort, &primary->calc.rollup) ||
+        schedulerAddFd(&scheduler, "Server", serverFd(&server), serverReady, &server) < 0 ||
+        schedulerAddPeriodic(&scheduler, "ServerTick", NS_PER_SECOND, serverTick, &server) < 0)
         {
-            printf("Particulate Matter Sensor Status: Connected");
-            getParticulateMatterData(&particulateData);
-            storeAqiData(&particulateData);
-            aqiFull24Hour = calcAQI(&calculatedAqi);
-            instantAqi = calcInstantAQI(&particulateData);
+            screenPrintf(&screen, "Server: Failed to start on %s port %u! errno: %d", options.serverSocketPath,
+                         options.serverPort, errno);
+            serverStop(&server);
         }
         else
         {
-            printf("Particulate Matter Sensor Status: Disconnected");
+            state.server = &server;
         }
+    }
 
-        // Read data from Temperature and Humidity sensor
-        cursorPosition(SYS_INFO_TEMPERATURE_LINE,1);
-        clearLine();
-        if(readTempAndHumidityFromDevice(i2cFile) == true)
+    // Every frame is published for local readers as soon as it is processed
+    if(options.sharedName[0] != '\0')
+    {
+        cursorPosition(SYS_INFO_SHARED_LINE,1);
+        if(!sharedOpen(&shared, options.sharedName))
+        {
+            screenPrintf(&screen, "Shared Memory: Failed to open %s! errno: %d", options.sharedName, errno);
+        }
+        else
+        {
+            screenPrintf(&screen, "Shared Memory: Publishing to %s", options.sharedName);
+            state.shared = &shared;
+        }
+    }
+
+    // Alerts go out from the main loop as frames are processed, the sinks never block it
+    if(alerts.compiled)
+    {
+        state.alerts = &alerts;
+        cursorPosition(SYS_INFO_ALERTS_LINE,1);
+        if(!notifyStart(&notify, options.alertFifoPath, options.alertSocketPath, options.alertCommand))
         {
-            printf("Temperature and Humidity Sensor Status: Connected");
-            getTempAndHumidityData(&tempHumidityData);
-            heatIndex = calcHeatIndex(&tempHumidityData);
+            screenPrintf(&screen, "Alerts: Failed to start notifications! errno: %d", errno);
         }
         else
         {
-            printf("Temperature and Humidity Sensor Status: Disconnected");
+            screenPrintf(&screen, "Alerts: %u rules from %s", alerts.ruleCount, options.alertRulesFilename);
+            state.notify = notifyActive(&notify) ? &notify : NULL;
         }
+    }
 
-        writePM(&particulateData, calculatedAqi, instantAqi, aqiFull24Hour);
-        
-        writeTempHumidity(&tempHumidityData, heatIndex);
+    // Startup status shows without waiting for the first report
+    screenFlush(&screen);
 
-        if(logFile != NULL)
+    while(alpaqaRunning)
+    {
+        if(!schedulerRunOnce(&scheduler))
         {
-            size_t bufferStringSize;
-            long fileSize;
+            break;
+        }
+        if(latencyRequested)
+        {
+            latencyRequested = 0;
+            writeLatency(&state);
+        }
+    }
+
+    devicesStop(&devices);
+    schedulerClose(&scheduler);
+    if(state.server != NULL)
+    {
+        serverStop(state.server);
+    }
+    if(state.shared != NULL)
+    {
+        sharedClose(state.shared);
+    }
+    if(state.notify != NULL)
+    {
+        notifyStop(state.notify);
+    }
+    alertsFree(&alerts);
+    statsFree(&state.stats);
+    free(state.percentiles);
+    screenClose(&screen);
 
-            memset(fileBuffer, 0, sizeof(fileBuffer));
+    saveLocationStates(&state, true);
+    free(state.locations);
+    devicesClose(&devices);
 
-            // PM 1.0, PM 2.5, PM 10.0, AQI, AQI avg, Temp F, Temp C, Humidity, Heat Index
-            snprintf(fileBuffer, sizeof(fileBuffer), "%d, %d, %d, %d, %d, %0.2f, %0.2f, %0.2f, %0.2f\n",
-                    particulateData.pm1_0, particulateData.pm2_5, particulateData.pm10_0,
-                    instantAqi, calculatedAqi,
-                    tempHumidityData.temperatureF, tempHumidityData.temperatureC,
-                    tempHumidityData.humidity,
-                    heatIndex);
+    if(logThread.threadStarted)
+    {
+        logThreadStop(&logThread);
+        alpaqaLogClose(&log);
+    }
+    else
+    {
+        fprintf(stderr, "Log file was not written!\n");
+    }
+    if(logIndexed)
+    {
+        alpaqaLogIndexClose(&logIndex);
+    }
 
-            bufferStringSize = strlen(fileBuffer);
+    // Last, so the log thread's final commit is in it
+    if(options.latencyFilename[0] != '\0')
+    {
+        latencyWriteFile(options.latencyFilename);
+    }
 
-            fwrite(fileBuffer, bufferStringSize, sizeof(char), logFile);
-            fflush(logFile);
+    return 0;
+}
 
-            cursorPosition(SYS_INFO_LOG_SIZE_LINE,1);
-            clearLine();
+// Drains everything the sampling threads have produced since the last wakeup. Any
+// bus waking the loop drains them all, an empty ring costs next to nothing.
+static void framesReady(void * context)
+{
+    ALPAQA_STATE * state = context;
+    ALPAQA_FRAME frame;
+    ALPAQA_ACQUISITION_STATUS status;
+    bool finished = true;
 
-            fileSize = ftell(logFile);
+    for(uint32_t idx = 0; idx < state->devices->busCount; idx++)
+    {
+        ALPAQA_ACQUISITION * acquisition = &state->devices->buses[idx].acquisition;
 
-            printf("Log File Size: %lu bytes\n", fileSize);
+        acquisitionClearNotify(acquisition);
+        while(acquisitionPop(acquisition, &frame))
+        {
+            processFrame(state, &frame);
         }
 
-        fflush(stdout);
-        sleep(1);
+        acquisitionGetStatus(acquisition, &status);
+        finished = finished && status.finished;
     }
 
-    if(logFile != NULL)
+    // A report per sample is all there is to show, so reports follow the primary
+    // bus's periods as adaptive sampling stretches and resets them
+    if(state->options->adaptivePeriodMaxMs > 0 && state->options->reportPeriodMs > 0)
     {
-        fclose(logFile);
+        acquisitionGetStatus(state->acquisition, &status);
+        if(status.periodScale != state->reportScale &&
+           schedulerSetPeriod(state->scheduler, state->reportSchedule,
+                              (uint64_t)state->options->reportPeriodMs * status.periodScale * NS_PER_MS))
+        {
+            state->reportScale = status.periodScale;
+        }
+    }
+
+    // Every bus reached the sample limit, report what was collected and stop
+    if(finished)
+    {
+        writeReport(state);
+        alpaqaRunning = false;
+    }
+}
+
+static void processFrame(ALPAQA_STATE * state, const ALPAQA_FRAME * frame)
+{
+    ALPAQA_LOCATION * location;
+    uint64_t startNs;
+
+    if(frame->location >= state->locationCount)
+    {
+        return;
+    }
+    location = &state->locations[frame->location];
+
+    if(frame->sensor < SENSOR_COUNT)
+    {
+        jitterRecord(&state->jitter[frame->sensor], frame);
+    }
+
+    startNs = latencyStart();
+
+    switch(frame->sensor)
+    {
+        case SENSOR_PMSA003I:
+            // A frame that failed its checksum keeps the last readings, it never
+            // reaches the averages
+            location->pmConnected = frame->ok;
+            if(frame->ok && decodeParticulateMatterFrame(frame->data, &location->pmFrame))
+            {
+                location->particulateData.pm1_0 = location->pmFrame.pm1_0;
+                location->particulateData.pm2_5 = location->pmFrame.pm2_5;
+                location->particulateData.pm10_0 = location->pmFrame.pm10_0;
+                location->pmRealtimeNs = frame->realtimeNs;
+                calcContextStoreAqiData(&location->calc, &location->particulateData, frame->realtimeNs);
+                location->aqiFull24Hour = calcContextAQI(&location->calc, &location->calculatedAqi);
+                location->nowcastValid = calcContextNowCastAQI(&location->calc, &location->nowcastAqi);
+                location->instantAqi = calcInstantAQI(&location->particulateData);
+                startNs = latencyEnd(LATENCY_FRAME_CALC, startNs);
+                if(state->alerts != NULL)
+                {
+                    evaluateAlerts(state, frame, ALERT_PM_CHANNELS);
+                    startNs = latencyEnd(LATENCY_ALERT_EVAL, startNs);
+                }
+                if(frame->location == 0)
+                {
+                    statsAdd(&state->stats, STATS_PM1_0, frame->realtimeNs, location->particulateData.pm1_0);
+                    statsAdd(&state->stats, STATS_PM2_5, frame->realtimeNs, location->particulateData.pm2_5);
+                    statsAdd(&state->stats, STATS_PM10_0, frame->realtimeNs, location->particulateData.pm10_0);
+                    percentilesAddParticulate(state->percentiles, frame->realtimeNs / NS_PER_SECOND, &location->particulateData);
+                    startNs = latencyEnd(LATENCY_FRAME_STATS, startNs);
+                }
+            }
+            break;
+
+        case SENSOR_SHT41:
+            location->shtConnected = frame->ok;
+            if(frame->ok && decodeTempAndHumidityTicks(frame->data, &location->temperatureTicks, &location->humidityTicks))
+            {
+                convertTempAndHumidityTicks(location->temperatureTicks, location->humidityTicks, &location->tempHumidityData);
+                location->heatIndex = calcHeatIndex(&location->tempHumidityData);
+                startNs = latencyEnd(LATENCY_FRAME_CALC, startNs);
+                if(state->alerts != NULL)
+                {
+                    evaluateAlerts(state, frame, ALERT_SHT_CHANNELS);
+                    startNs = latencyEnd(LATENCY_ALERT_EVAL, startNs);
+                }
+                if(frame->location == 0)
+                {
+                    statsAdd(&state->stats, STATS_TEMPERATURE_F, frame->realtimeNs, location->tempHumidityData.temperatureF);
+                    statsAdd(&state->stats, STATS_HUMIDITY, frame->realtimeNs, location->tempHumidityData.humidity);
+                    statsAdd(&state->stats, STATS_HEAT_INDEX, frame->realtimeNs, location->heatIndex);
+                    percentilesAddTicks(state->percentiles, frame->realtimeNs / NS_PER_SECOND,
+                                        location->temperatureTicks, location->humidityTicks);
+                    startNs = latencyEnd(LATENCY_FRAME_STATS, startNs);
+                }
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    if(state->shared != NULL && frame->location == 0)
+    {
+        publishShared(state, frame);
+        latencyEnd(LATENCY_SHARED_PUBLISH, startNs);
+    }
+}
+
+// Only the channels the frame brought are checked. Anything raised or cleared is
+// sent as soon as it happens, the sinks drop rather than wait.
+static void evaluateAlerts(ALPAQA_STATE * state, const ALPAQA_FRAME * frame, uint32_t channelMask)
+{
+    const ALPAQA_LOCATION * location = &state->locations[frame->location];
+    ALERT_EVENT events[ALERT_MAX_RULES];
+    char message[ALERT_MESSAGE_SIZE];
+    float values[ALERT_CHANNEL_COUNT];
+    uint32_t count;
+
+    values[ALERT_PM1_0] = location->particulateData.pm1_0;
+    values[ALERT_PM2_5] = location->particulateData.pm2_5;
+    values[ALERT_PM10_0] = location->particulateData.pm10_0;
+    values[ALERT_INSTANT_AQI] = location->instantAqi;
+    values[ALERT_AQI] = location->calculatedAqi;
+    values[ALERT_NOWCAST_AQI] = location->nowcastAqi;
+    values[ALERT_TEMPERATURE_F] = location->tempHumidityData.temperatureF;
+    values[ALERT_HUMIDITY] = location->tempHumidityData.humidity;
+    values[ALERT_HEAT_INDEX] = location->heatIndex;
+
+    count = alertsEvaluate(state->alerts, frame->location, channelMask, values, frame->timestampNs, frame->realtimeNs, events);
+    for(uint32_t idx = 0; idx < count; idx++)
+    {
+        if(state->notify != NULL)
+        {
+            alertsFormatEvent(state->alerts, &events[idx], message, sizeof(message));
+            notifySend(state->notify, message);
+        }
+    }
+    if(count > 0)
+    {
+        state->lastAlert = events[count - 1];
+        state->alerted = true;
+    }
+}
+
+static void publishShared(ALPAQA_STATE * state, const ALPAQA_FRAME * frame)
+{
+    const ALPAQA_LOCATION * primary = &state->locations[0];
+    ALPAQA_SHARED_READING * reading = &state->shared->reading;
+
+    if(frame->ok && frame->sensor == SENSOR_PMSA003I)
+    {
+        reading->pmRealtimeNs = frame->realtimeNs;
+    }
+    else if(frame->ok && frame->sensor == SENSOR_SHT41)
+    {
+        reading->shtRealtimeNs = frame->realtimeNs;
+    }
+    reading->flags = ALPAQA_SHARED_LIVE |
+                     (primary->pmConnected ? ALPAQA_SHARED_PM_OK : 0) |
+                     (primary->shtConnected ? ALPAQA_SHARED_SHT_OK : 0) |
+                     (primary->aqiFull24Hour ? ALPAQA_SHARED_AQI_FULL_24_HOUR : 0) |
+                     (primary->nowcastValid ? ALPAQA_SHARED_NOWCAST_VALID : 0);
+    reading->pm1_0 = primary->particulateData.pm1_0;
+    reading->pm2_5 = primary->particulateData.pm2_5;
+    reading->pm10_0 = primary->particulateData.pm10_0;
+    reading->instantAqi = primary->instantAqi;
+    reading->calculatedAqi = primary->calculatedAqi;
+    reading->nowcastAqi = primary->nowcastAqi;
+    reading->temperatureC = primary->tempHumidityData.temperatureC;
+    reading->temperatureF = primary->tempHumidityData.temperatureF;
+    reading->humidity = primary->tempHumidityData.humidity;
+    reading->heatIndex = primary->heatIndex;
+    sharedPublish(state->shared);
+}
+
+static void reportDue(void * context)
+{
+    writeReport(context);
+}
+
+static void stateSaveDue(void * context)
+{
+    ALPAQA_STATE * state = context;
+    const ALPAQA_CALC_STATE * calcState = &state->locations[0].calc.state;
+    char stateStatus[128];
+    uint64_t startNs;
+    bool saved;
+
+    startNs = latencyStart();
+    saved = saveLocationStates(state, false);
+    latencyEnd(LATENCY_STATE_SAVE, startNs);
+    snprintf(stateStatus, sizeof(stateStatus), "State: %s, %llu saves, %0.2f ms max save",
+             saved ? "Saved" : "Save failed", (unsigned long long)calcState->saves,
+             (double)calcState->maxSaveNs / 1000000.0);
+    writeStateStatus(stateStatus);
+}
+
+static void latencyDue(void * context)
+{
+    writeLatency(context);
+}
+
+static void writeLatency(ALPAQA_STATE * state)
+{
+    static LATENCY_HISTOGRAM report;
+    uint64_t p99Ns = 0;
+
+    if(state->options->latencyFilename[0] == '\0')
+    {
+        return;
+    }
+
+    cursorPosition(SYS_INFO_LATENCY_LINE,1);
+    clearLine();
+    if(!latencyWriteFile(state->options->latencyFilename))
+    {
+        screenPrintf(&screen, "Latency: Failed to write %s! errno: %d", state->options->latencyFilename, errno);
     }
     else
     {
-        printf("Log file was not written!");
+        state->latencyWrites++;
+        latencySnapshot(LATENCY_REPORT, &report);
+        latencyValue(&report, 0.99, &p99Ns);
+        screenPrintf(&screen, "Latency: %llu writes to %s, %0.2f ms p99 report",
+                     (unsigned long long)state->latencyWrites, state->options->latencyFilename, (double)p99Ns / 1000000.0);
     }
+}
 
-    return 0;
+static void writeStateStatus(const char * status)
+{
+    cursorPosition(SYS_INFO_STATE_LINE,1);
+    clearLine();
+    screenPrintf(&screen, "%s", status);
+}
+
+static void writeReport(ALPAQA_STATE * state)
+{
+    uint64_t reportStartNs = latencyStart();
+    uint64_t startNs = reportStartNs;
+
+    if(screenActive(&screen))
+    {
+        writeDisplay(state);
+        startNs = latencyEnd(LATENCY_RENDER, startNs);
+    }
+
+    if(state->logThread->threadStarted)
+    {
+        writeLogRecord(state);
+        startNs = latencyEnd(LATENCY_LOG_APPEND, startNs);
+    }
+
+    if(state->server != NULL)
+    {
+        publishReading(state);
+        startNs = latencyEnd(LATENCY_SERVER_PUBLISH, startNs);
+    }
+
+    screenFlush(&screen);
+    latencyEnd(LATENCY_SCREEN_FLUSH, startNs);
+    latencyEnd(LATENCY_REPORT, reportStartNs);
+}
+
+static void writeDisplay(const ALPAQA_STATE * state)
+{
+    const ALPAQA_LOCATION * primary = &state->locations[0];
+    ALPAQA_ACQUISITION_STATUS status;
+
+    acquisitionGetStatus(state->acquisition, &status);
+
+    cursorPosition(SYS_INFO_PM_LINE,1);
+    clearLine();
+    if(primary->pmConnected)
+    {
+        screenPrintf(&screen, "Particulate Matter Sensor Status: Connected, %llu reread, %llu rejected. "
+                     "Particles/0.1L >0.3um %u, >0.5um %u, >1um %u, >2.5um %u, >5um %u, >10um %u",
+                     (unsigned long long)status.pmRetries, (unsigned long long)status.pmRejected,
+                     primary->pmFrame.particles0_3, primary->pmFrame.particles0_5, primary->pmFrame.particles1_0,
+                     primary->pmFrame.particles2_5, primary->pmFrame.particles5_0, primary->pmFrame.particles10_0);
+    }
+    else
+    {
+        screenPrintf(&screen, "Particulate Matter Sensor Status: Disconnected");
+    }
+
+    cursorPosition(SYS_INFO_TEMPERATURE_LINE,1);
+    clearLine();
+    if(primary->shtConnected)
+    {
+        screenPrintf(&screen, "Temperature and Humidity Sensor Status: Connected, %llu rejected",
+                     (unsigned long long)status.shtRejected);
+    }
+    else
+    {
+        screenPrintf(&screen, "Temperature and Humidity Sensor Status: Disconnected");
+    }
+
+    writeBusStats(&status.bus, status.pmSamples);
+    writeAcquisitionStats(&status);
+    writeScheduleStats(&status);
+    writeSamplingStats(state, &status);
+    writeJitterStats(state, &status);
+
+    writePM(primary);
+
+    writeTempHumidity(&primary->tempHumidityData, primary->heatIndex);
+
+    writeTrends(state);
+
+    writePercentiles(state);
+
+    writeDisplayStats();
+
+    writeAlertStats(state);
+
+    writeLocations(state);
+}
+
+// One record per location each report, all in the same log
+// Records carry the time of the report, so they stay in time order for the index
+// whatever state the sensors are in. Before the first PM frame, or while the
+// PMSA003I is failing, its values are marked by PM not OK.
+static void writeLogRecord(ALPAQA_STATE * state)
+{
+    ALPAQA_LOG_RECORD record;
+    ALPAQA_LOG_THREAD_STATS logStats;
+    uint64_t reportNs = realtimeNowNs();
+
+    for(uint32_t idx = 0; idx < state->locationCount; idx++)
+    {
+        const ALPAQA_LOCATION * location = &state->locations[idx];
+
+        memset(&record, 0, sizeof(record));
+        alpaqaLogRecordSetTime(&record, reportNs);
+        record.location = idx;
+        record.pm1_0 = location->particulateData.pm1_0;
+        record.pm2_5 = location->particulateData.pm2_5;
+        record.pm10_0 = location->particulateData.pm10_0;
+        record.temperatureTicks = location->temperatureTicks;
+        record.humidityTicks = location->humidityTicks;
+        record.instantAqi = location->instantAqi;
+        record.calculatedAqi = location->calculatedAqi;
+        record.nowcastAqi = location->nowcastAqi;
+        alpaqaLogRecordSetHeatIndex(&record, location->heatIndex);
+        record.flags = (location->pmConnected ? ALPAQA_LOG_PM_OK : 0) |
+                       (location->shtConnected ? ALPAQA_LOG_SHT_OK : 0) |
+                       (location->aqiFull24Hour ? ALPAQA_LOG_AQI_FULL_24_HOUR : 0) |
+                       (location->nowcastValid ? ALPAQA_LOG_NOWCAST_VALID : 0);
+
+        logThreadAppend(state->logThread, &record);
+    }
+
+    if(screenActive(&screen))
+    {
+        logThreadGetStats(state->logThread, &logStats);
+
+        cursorPosition(SYS_INFO_LOG_SIZE_LINE,1);
+        clearLine();
+
+        screenPrintf(&screen, "Log File Size: %llu bytes (%u pending), %llu flushes, %llu syncs, %0.2f ms max commit, %llu dropped, "
+                     "%llu rotated, %llu bytes archived\n",
+                     (unsigned long long)logStats.fileSize, logStats.pendingBytes,
+                     (unsigned long long)logStats.flushes, (unsigned long long)logStats.syncs,
+                     (double)logStats.maxCommitNs / 1000000.0, (unsigned long long)logStats.recordsDropped,
+                     (unsigned long long)logStats.rotations, (unsigned long long)logStats.archiveBytes);
+    }
+}
+
+static void serverReady(void * context)
+{
+    uint64_t startNs = latencyStart();
+
+    serverProcess(context);
+    latencyEnd(LATENCY_SERVER_IO, startNs);
+}
+
+static void serverTick(void * context)
+{
+    serverExpire(context);
+}
+
+// Long polls and streams are answered from here, at the report rate
+static void publishReading(ALPAQA_STATE * state)
+{
+    const ALPAQA_LOCATION * primary = &state->locations[0];
+    SERVER_READING reading;
+
+    memset(&reading, 0, sizeof(reading));
+    reading.realtimeNs = primary->pmRealtimeNs;
+    reading.pmConnected = primary->pmConnected;
+    reading.shtConnected = primary->shtConnected;
+    reading.particulate = primary->particulateData;
+    reading.tempHumidity = primary->tempHumidityData;
+    reading.heatIndex = primary->heatIndex;
+    reading.instantAqi = primary->instantAqi;
+    reading.calculatedAqi = primary->calculatedAqi;
+    reading.aqiFull24Hour = primary->aqiFull24Hour;
+    reading.nowcastAqi = primary->nowcastAqi;
+    reading.nowcastValid = primary->nowcastValid;
+    serverPublish(state->server, &reading);
+
+    if(screenActive(&screen))
+    {
+        writeServerStats(state->server);
+    }
+}
+
+static void writeServerStats(const ALPAQA_SERVER * server)
+{
+    cursorPosition(SYS_INFO_SERVER_LINE,1);
+    clearLine();
+    screenPrintf(&screen, "Server: %u clients (%u streaming, %u waiting), %llu requests, %llu rejected, %llu updates dropped",
+                 server->stats.clients, server->stats.streaming, server->stats.waiting,
+                 (unsigned long long)server->stats.requests, (unsigned long long)server->stats.rejected,
+                 (unsigned long long)server->stats.updatesDropped);
+}
+
+// Sent and dropped for each sink, and the last alert raised or cleared
+static void writeAlertStats(const ALPAQA_STATE * state)
+{
+    const ALERT_EVENT * last = &state->lastAlert;
+    NOTIFY_STATS stats;
+
+    if(state->alerts == NULL)
+    {
+        return;
+    }
+    memset(&stats, 0, sizeof(stats));
+    if(state->notify != NULL)
+    {
+        notifyGetStats(state->notify, &stats);
+    }
+
+    cursorPosition(SYS_INFO_ALERTS_LINE,1);
+    clearLine();
+    screenPrintf(&screen, "Alerts: %u rules, %u active, %llu raised, %llu cleared. Sent/dropped FIFO %llu/%llu, "
+                 "socket %llu/%llu, hook %llu/%llu, %llu failed",
+                 state->alerts->ruleCount, state->alerts->active, (unsigned long long)state->alerts->raised,
+                 (unsigned long long)state->alerts->cleared,
+                 (unsigned long long)stats.sent[NOTIFY_FIFO], (unsigned long long)stats.dropped[NOTIFY_FIFO],
+                 (unsigned long long)stats.sent[NOTIFY_DATAGRAM], (unsigned long long)stats.dropped[NOTIFY_DATAGRAM],
+                 (unsigned long long)stats.sent[NOTIFY_EXEC], (unsigned long long)stats.dropped[NOTIFY_EXEC],
+                 (unsigned long long)stats.execFailed);
+    if(state->alerted)
+    {
+        screenPrintf(&screen, ". Last: %s %s at %u", state->alerts->rules[last->rule].name,
+                     last->raised ? "raised" : "cleared", last->location);
+    }
 }
 
 static void signalHandler(int signalNumber)
@@ -202,84 +1022,603 @@ static void signalHandler(int signalNumber)
             alpaqaRunning = false;
             break;
 
+        case SIGUSR1:
+            latencyRequested = 1;
+            break;
+
         default:
             break;
     }
     errno = errnoSaved;
 }
 
+static bool parseOptions(int argc, char * argv[], ALPAQA_OPTIONS * options)
+{
+    int opt;
+
+    memset(options, 0, sizeof(ALPAQA_OPTIONS));
+    options->logFilename = ALPAQA_LOG_FILE;
+    options->stateFilename = ALPAQA_STATE_FILE;
+    options->stateSaveSeconds = DEFAULT_STATE_SAVE_SECONDS;
+    options->serverSocketPath = ALPAQA_SERVER_SOCKET;
+    options->serverPort = DEFAULT_SERVER_PORT;
+    options->sharedName = ALPAQA_SHARED_NAME;
+    options->latencyFilename = ALPAQA_LATENCY_FILE;
+    options->i2cDeviceFilename = I2C_DEVICE_FILENAME;
+    options->busType = I2C_BUS_REAL;
+    options->pmPeriodMs = DEFAULT_PERIOD_MS;
+    options->shtPeriodMs = DEFAULT_PERIOD_MS;
+    options->reportPeriodMs = DEFAULT_PERIOD_MS;
+    options->pmSteadyThreshold = ACQUISITION_DEFAULT_PM_STEADY;
+    options->temperatureSteadyThreshold = ACQUISITION_DEFAULT_TEMPERATURE_STEADY;
+    options->shtPrecision = SHT41_PRECISION_HIGH;
+    options->acquisitionCpu = -1;
+    options->logConfig.flushBytes = LOG_THREAD_DEFAULT_FLUSH_BYTES;
+    options->logConfig.flushIntervalMs = LOG_THREAD_DEFAULT_FLUSH_MS;
+    options->logConfig.syncIntervalMs = LOG_THREAD_DEFAULT_SYNC_MS;
+    options->logConfig.rotateBytes = LOG_THREAD_DEFAULT_ROTATE_BYTES;
+    options->logConfig.rotateSeconds = LOG_THREAD_DEFAULT_ROTATE_SECONDS;
+    options->logConfig.archive = true;
+
+    while((opt = getopt(argc, argv, "d:x:s:r:w:p:t:u:e:v:T:qn:l:Lc:f:b:i:y:B:R:ka:A:o:U:P:m:S:g:F:D:X:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'd':
+                options->i2cDeviceFilename = optarg;
+                break;
+            case 'x':
+                if(options->extraLocationCount >= DEVICES_MAX_LOCATIONS - 1)
+                {
+                    fprintf(stderr, "At most %d locations\n", DEVICES_MAX_LOCATIONS);
+                    return false;
+                }
+                options->extraLocations[options->extraLocationCount++] = optarg;
+                break;
+            case 's':
+                options->busType = I2C_BUS_SYNTHETIC;
+                options->syntheticRateHz = strtof(optarg, NULL);
+                break;
+            case 'r':
+                options->busType = I2C_BUS_REPLAY;
+                options->replayFilename = optarg;
+                break;
+            case 'w':
+                options->captureFilename = optarg;
+                break;
+            case 'p':
+                options->pmPeriodMs = strtoul(optarg, NULL, 0);
+                break;
+            case 't':
+                options->shtPeriodMs = strtoul(optarg, NULL, 0);
+                break;
+            case 'u':
+                options->reportPeriodMs = strtoul(optarg, NULL, 0);
+                break;
+            case 'q':
+                options->shtPrecision = SHT41_PRECISION_LOW;
+                break;
+            case 'n':
+                options->cycles = strtoull(optarg, NULL, 0);
+                break;
+            case 'l':
+                options->logFilename = optarg;
+                break;
+            case 'L':
+                options->legacyTransfers = true;
+                break;
+            case 'c':
+                options->acquisitionCpu = strtol(optarg, NULL, 0);
+                break;
+            case 'f':
+                options->acquisitionPriority = strtol(optarg, NULL, 0);
+                break;
+            case 'b':
+                options->logConfig.flushBytes = strtoul(optarg, NULL, 0);
+                break;
+            case 'i':
+                options->logConfig.flushIntervalMs = strtoul(optarg, NULL, 0);
+                break;
+            case 'y':
+                options->logConfig.syncIntervalMs = strtoul(optarg, NULL, 0);
+                break;
+            case 'B':
+                options->logConfig.rotateBytes = strtoull(optarg, NULL, 0);
+                break;
+            case 'R':
+                options->logConfig.rotateSeconds = strtoul(optarg, NULL, 0);
+                break;
+            case 'k':
+                options->logConfig.archive = false;
+                break;
+            case 'a':
+                options->stateFilename = optarg;
+                break;
+            case 'A':
+                options->stateSaveSeconds = strtoul(optarg, NULL, 0);
+                break;
+            case 'o':
+                if(options->outputCount >= SCREEN_MAX_OUTPUTS)
+                {
+                    fprintf(stderr, "At most %d display outputs\n", SCREEN_MAX_OUTPUTS);
+                    return false;
+                }
+                options->outputFilenames[options->outputCount++] = optarg;
+                break;
+            case 'U':
+                options->serverSocketPath = optarg;
+                break;
+            case 'P':
+                options->serverPort = strtoul(optarg, NULL, 0);
+                break;
+            case 'm':
+                options->sharedName = optarg;
+                break;
+            case 'S':
+                options->latencyFilename = optarg;
+                break;
+            case 'g':
+                options->alertRulesFilename = optarg;
+                break;
+            case 'F':
+                options->alertFifoPath = optarg;
+                break;
+            case 'D':
+                options->alertSocketPath = optarg;
+                break;
+            case 'X':
+                options->alertCommand = optarg;
+                break;
+            case 'e':
+                options->adaptivePeriodMaxMs = strtoul(optarg, NULL, 0);
+                break;
+            case 'v':
+                options->pmSteadyThreshold = strtof(optarg, NULL);
+                break;
+            case 'T':
+                options->temperatureSteadyThreshold = strtof(optarg, NULL);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-d i2c device[:mux channel]] [-x another location's i2c device[:mux channel], repeatable]\n"
+                        "       [-s synthetic frame rate Hz] [-r replay capture] [-w write capture, first bus only]\n"
+                        "       [-p PM period ms] [-t SHT41 period ms] [-q SHT41 low precision]\n"
+                        "       [-u display/log period ms] [-n PM samples] [-l log file]\n"
+                        "       [-e stretch periods up to this PM period ms while the air is steady, 0 fixed, at most %d. -p is at least %d]\n"
+                        "       [-v steady PM2.5 std dev ug/m^3] [-T steady temperature std dev C]\n"
+                        "       [-L use I2C_SLAVE + read/write instead of I2C_RDWR]\n"
+                        "       [-c pin sampling thread to cpu] [-f sampling thread SCHED_FIFO priority]\n"
+                        "       [-b log flush bytes] [-i log flush interval ms] [-y log sync interval ms, 0 never]\n"
+                        "       [-B rotate log at bytes, 0 never] [-R rotate log after s, 0 never]\n"
+                        "       [-k keep rotated logs as they are instead of archiving them]\n"
+                        "       [-a state file, \"\" for none] [-A state save interval s, 0 only on exit]\n"
+                        "       [-o display output, repeatable, - for stdout. Default stdout if it is a terminal]\n"
+                        "       [-U server socket, \"\" for none] [-P localhost server port, 0 for none]\n"
+                        "       [-m shared memory name, \"\" for none]\n"
+                        "       [-S stage latency file, rewritten every %d s and on SIGUSR1, \"\" for none]\n"
+                        "       [-g alert rules file] [-F alert FIFO] [-D alert datagram socket]\n"
+                        "       [-X alert hook command, run by /bin/sh with the alert in $" NOTIFY_EXEC_VARIABLE "]\n",
+                        argv[0], ADAPTIVE_MAX_PERIOD_MS, ADAPTIVE_MIN_PERIOD_MS, LATENCY_WRITE_SECONDS);
+                return false;
+        }
+    }
+    if(options->adaptivePeriodMaxMs > 0 && options->pmPeriodMs < ADAPTIVE_MIN_PERIOD_MS)
+    {
+        options->pmPeriodMs = ADAPTIVE_MIN_PERIOD_MS;
+    }
+    if(options->adaptivePeriodMaxMs > ADAPTIVE_MAX_PERIOD_MS)
+    {
+        options->adaptivePeriodMaxMs = ADAPTIVE_MAX_PERIOD_MS;
+    }
+    return true;
+}
+
+// Rules are compiled for every location, so they are loaded once the locations are known
+static bool loadAlerts(const ALPAQA_OPTIONS * options, ALPAQA_ALERTS * alerts, uint32_t locationCount)
+{
+    uint32_t errorLine;
+
+    alertsInit(alerts);
+    if(options->alertRulesFilename == NULL)
+    {
+        return true;
+    }
+    if(!alertsLoad(alerts, options->alertRulesFilename, &errorLine))
+    {
+        fprintf(stderr, "Failed to load alert rules from %s, line %u! errno: %d\n", options->alertRulesFilename,
+                errorLine, errno);
+        return false;
+    }
+    if(!alertsCompile(alerts, locationCount))
+    {
+        fprintf(stderr, "Failed to set up alert rules! errno: %d\n", errno);
+        return false;
+    }
+    return true;
+}
+
+// The primary location first, so it is location 0
+static bool addLocations(const ALPAQA_OPTIONS * options, ALPAQA_DEVICES * devices)
+{
+    if(!devicesAdd(devices, options->i2cDeviceFilename))
+    {
+        fprintf(stderr, "Bad location %s! errno: %d\n", options->i2cDeviceFilename, errno);
+        return false;
+    }
+    for(int idx = 0; idx < options->extraLocationCount; idx++)
+    {
+        if(!devicesAdd(devices, options->extraLocations[idx]))
+        {
+            fprintf(stderr, "Bad location %s! errno: %d\n", options->extraLocations[idx], errno);
+            return false;
+        }
+    }
+    return true;
+}
+
+// A capture or replay holds the traffic of one bus, so only the first bus records
+// or replays one. Synthetic buses are seeded apart so they do not read alike.
+static bool openBus(const ALPAQA_OPTIONS * options, uint32_t busIndex, ALPAQA_DEVICE_BUS * deviceBus)
+{
+    I2C_BUS * bus = &deviceBus->bus;
+    bool opened;
+
+    switch(options->busType)
+    {
+        case I2C_BUS_SYNTHETIC:
+            opened = i2cBusOpenSynthetic(bus, options->syntheticRateHz, SYNTHETIC_SEED + busIndex);
+            break;
+        case I2C_BUS_REPLAY:
+            if(busIndex > 0)
+            {
+                errno = EINVAL;
+                return false;
+            }
+            opened = i2cBusOpenReplay(bus, options->replayFilename, true);
+            break;
+        case I2C_BUS_REAL:
+        default:
+            opened = i2cBusOpenReal(bus, deviceBus->deviceFilename);
+            break;
+    }
+
+    if(opened && busIndex == 0 && options->captureFilename != NULL)
+    {
+        opened = i2cBusStartCapture(bus, options->captureFilename);
+    }
+    return opened;
+}
+
+// Location 0 uses the state file as given, the others add their number to it
+static void loadLocationStates(ALPAQA_STATE * state)
+{
+    const char * stateFilename = state->options->stateFilename;
+    char filename[PATH_MAX];
+    char stateStatus[128];
+    uint64_t nowSeconds = realtimeNowNs() / NS_PER_SECOND;
+    uint64_t savedSeconds = 0;
+    uint64_t locationSavedSeconds;
+    uint32_t restored = 0;
+    bool primaryLoaded = false;
+
+    for(uint32_t idx = 0; idx < state->locationCount; idx++)
+    {
+        ALPAQA_CALC_CONTEXT * calc = &state->locations[idx].calc;
+
+        calcContextInit(calc);
+        if(stateFilename[0] == '\0')
+        {
+            continue;
+        }
+        if(idx == 0)
+        {
+            snprintf(filename, sizeof(filename), "%s", stateFilename);
+        }
+        else
+        {
+            snprintf(filename, sizeof(filename), "%s.%u", stateFilename, idx);
+        }
+        if(calcContextLoadState(calc, filename, nowSeconds, &locationSavedSeconds))
+        {
+            if(idx == 0)
+            {
+                primaryLoaded = true;
+                savedSeconds = locationSavedSeconds;
+            }
+            restored++;
+        }
+    }
+
+    if(stateFilename[0] == '\0')
+    {
+        snprintf(stateStatus, sizeof(stateStatus), "State: Not kept");
+    }
+    else if(primaryLoaded)
+    {
+        snprintf(stateStatus, sizeof(stateStatus), "State: Restored %0.1f hours of history, saved %llu s ago (%u of %u locations)",
+                 (double)rollupCoverageSeconds(&state->locations[0].calc.rollup) / ROLLUP_HOUR,
+                 (unsigned long long)(nowSeconds > savedSeconds ? nowSeconds - savedSeconds : 0),
+                 restored, state->locationCount);
+    }
+    else if(state->locations[0].calc.state.file != NULL)
+    {
+        snprintf(stateStatus, sizeof(stateStatus), "State: No saved history in %s", stateFilename);
+    }
+    else
+    {
+        snprintf(stateStatus, sizeof(stateStatus), "State: Failed to open %s! errno: %d", stateFilename, errno);
+    }
+    writeStateStatus(stateStatus);
+}
+
+// True if every location with a state file saved
+static bool saveLocationStates(ALPAQA_STATE * state, bool close)
+{
+    bool saved = true;
+
+    for(uint32_t idx = 0; idx < state->locationCount; idx++)
+    {
+        ALPAQA_CALC_CONTEXT * calc = &state->locations[idx].calc;
+
+        if(calc->state.file == NULL)
+        {
+            continue;
+        }
+        saved = calcContextSaveState(calc) && saved;
+        if(close)
+        {
+            calcContextCloseState(calc);
+        }
+    }
+    return saved;
+}
+
+// Without -o the display goes to stdout, but only if it is a terminal: run as a
+// service with nowhere to show it, nothing is drawn at all
+static bool openScreen(const ALPAQA_OPTIONS * options)
+{
+    if(!screenInit(&screen))
+    {
+        return false;
+    }
+
+    if(options->outputCount == 0)
+    {
+        if(isatty(STDOUT_FILENO))
+        {
+            screenAddOutput(&screen, STDOUT_FILENO, false);
+        }
+        return true;
+    }
+
+    for(int idx = 0; idx < options->outputCount; idx++)
+    {
+        if(strcmp(options->outputFilenames[idx], "-") == 0)
+        {
+            screenAddOutput(&screen, STDOUT_FILENO, false);
+        }
+        else if(!screenOpenOutput(&screen, options->outputFilenames[idx]))
+        {
+            screenClose(&screen);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void writeBusStats(const I2C_BUS_STATS * stats, uint64_t samples)
+{
+    cursorPosition(SYS_INFO_BUS_STATS_LINE,1);
+    clearLine();
+    screenPrintf(&screen, "I2C Bus: %0.2f syscalls/PM sample, %0.1f us/transfer avg, %0.1f us max, %llu failed",
+                 samples > 0 ? (double)stats->syscalls / samples : 0.0,
+                 stats->transfers > 0 ? (double)stats->totalNs / stats->transfers / 1000.0 : 0.0,
+                 (double)stats->maxNs / 1000.0,
+                 (unsigned long long)stats->failures);
+}
+
+static void writeAcquisitionStats(const ALPAQA_ACQUISITION_STATUS * status)
+{
+    cursorPosition(SYS_INFO_ACQUISITION_LINE,1);
+    clearLine();
+    screenPrintf(&screen, "Acquisition: %0.3f ms last, %0.3f ms avg, %0.3f ms max",
+                 (double)status->conversionLastNs / 1000000.0,
+                 status->shtSamples > 0 ? (double)status->conversionTotalNs / status->shtSamples / 1000000.0 : 0.0,
+                 (double)status->conversionMaxNs / 1000000.0);
+}
+
+// Missed deadlines are ones that passed while the sampling thread was still busy with earlier work
+static void writeScheduleStats(const ALPAQA_ACQUISITION_STATUS * status)
+{
+    cursorPosition(SYS_INFO_SCHEDULE_LINE,1);
+    clearLine();
+    screenPrintf(&screen, "Missed deadlines: PM %llu, SHT41 %llu (+%llu busy). Max late %0.2f ms. Dropped frames %llu",
+                 (unsigned long long)status->pmMissed, (unsigned long long)status->shtMissed,
+                 (unsigned long long)status->shtSkipped, (double)status->maxLatenessNs / 1000000.0,
+                 (unsigned long long)status->framesDropped);
+}
+
+// Wakeups and bus traffic against sampling at the configured periods throughout. Every
+// stretched PMSA003I sample stands in for periodScale fixed ones, and the fixed rate
+// figures scale the actual ones by that.
+static void writeSamplingStats(const ALPAQA_STATE * state, const ALPAQA_ACQUISITION_STATUS * status)
+{
+    double hours = (double)(monotonicNowNs() - state->samplingStartNs) / NS_PER_SECOND / ROLLUP_HOUR;
+    double fixedRatio = status->pmSamples > 0 ? (double)status->pmSamplesFixed / status->pmSamples : 1.0;
+
+    cursorPosition(SYS_INFO_SAMPLING_LINE,1);
+    clearLine();
+    if(state->options->adaptivePeriodMaxMs == 0)
+    {
+        screenPrintf(&screen, "Sampling: Fixed, %0.0f wakeups/hour", hours > 0 ? status->wakeups / hours : 0.0);
+        return;
+    }
+    screenPrintf(&screen, "Sampling: Adaptive x%u (PM every %u ms), %llu changes. %0.0f wakeups/hour vs %0.0f fixed, "
+                 "%0.0f bus messages saved (%0.0f%%)",
+                 status->periodScale, state->options->pmPeriodMs * status->periodScale,
+                 (unsigned long long)status->periodChanges,
+                 hours > 0 ? status->wakeups / hours : 0.0, hours > 0 ? status->wakeups * fixedRatio / hours : 0.0,
+                 status->bus.messages * (fixedRatio - 1.0), 100.0 * (1.0 - (1.0 / fixedRatio)));
+}
+
+// How late after its deadline each sample was taken
+static void writeJitterStats(const ALPAQA_STATE * state, const ALPAQA_ACQUISITION_STATUS * status)
+{
+    const JITTER_STATS * pm = &state->jitter[SENSOR_PMSA003I];
+    const JITTER_STATS * sht = &state->jitter[SENSOR_SHT41];
+
+    cursorPosition(SYS_INFO_JITTER_LINE,1);
+    clearLine();
+    screenPrintf(&screen, "Jitter (us avg/sd/max): PM %0.1f/%0.1f/%0.1f, SHT41 %0.1f/%0.1f/%0.1f%s%s",
+                 jitterMeanUs(pm), jitterStdDevUs(pm), (double)pm->maxNs / 1000.0,
+                 jitterMeanUs(sht), jitterStdDevUs(sht), (double)sht->maxNs / 1000.0,
+                 status->pinned ? " pinned" : "", status->realtime ? " SCHED_FIFO" : "");
+}
+
+// What the console traffic costs: the changes sent for the last report, and how often
+// an output fell behind and had to be repainted
+static void writeDisplayStats()
+{
+    uint64_t repaints = 0;
+
+    for(int idx = 0; idx < screen.outputCount; idx++)
+    {
+        repaints += screen.outputs[idx].repaints;
+    }
+
+    cursorPosition(SYS_INFO_DISPLAY_LINE,1);
+    clearLine();
+    screenPrintf(&screen, "Display: %u bytes last frame, %0.1f bytes/frame avg, %d outputs, %llu repaints",
+                 screen.lastFrameBytes, screen.frames > 0 ? (double)screen.frameBytes / screen.frames : 0.0,
+                 screen.outputCount, (unsigned long long)repaints);
+}
+
+// Everything but the primary location gets a line of its own under the system information
+static void writeLocations(const ALPAQA_STATE * state)
+{
+    for(uint32_t idx = 1; idx < state->locationCount; idx++)
+    {
+        const ALPAQA_LOCATION * location = &state->locations[idx];
+        const ALPAQA_DEVICE_BUS * bus = devicesLocationBus(state->devices, idx);
+        int muxChannel = state->devices->locationMux[idx];
+
+        cursorPosition(SYS_INFO_LOCATIONS_LINE + idx - 1,1);
+        clearLine();
+        screenPrintf(&screen, "Location %u (%s", idx, bus->deviceFilename);
+        if(muxChannel != I2C_MUX_NONE)
+        {
+            screenPrintf(&screen, " ch %d", muxChannel);
+        }
+        screenPrintf(&screen, "): ");
+        if(location->pmConnected)
+        {
+            screenPrintf(&screen, "PM 2.5 %d, AQI now/NowCast/24h %d/%d/%d", location->particulateData.pm2_5,
+                         location->instantAqi, location->nowcastAqi, location->calculatedAqi);
+        }
+        else
+        {
+            screenPrintf(&screen, "PM disconnected");
+        }
+        if(location->shtConnected)
+        {
+            screenPrintf(&screen, ", %0.1f F, %0.1f %%RH, heat index %0.1f", location->tempHumidityData.temperatureF,
+                         location->tempHumidityData.humidity, location->heatIndex);
+        }
+        else
+        {
+            screenPrintf(&screen, ", temperature disconnected");
+        }
+    }
+}
+
 static void writeBanners()
 {
     setColor(GREEN_FG, BLACK_BG);
     cursorPosition(ALPAQA_BANNER_LINE, 1);
-    printf("============================================================\n");
-    printf(" ALPAQA - Automatic Low-cost Personal Air Quality Assistant \n");
-    printf("===================A project by Matt Geib===================\n");
-    printf("============================================================\n");
+    screenPrintf(&screen, "============================================================\n");
+    screenPrintf(&screen, " ALPAQA - Automatic Low-cost Personal Air Quality Assistant \n");
+    screenPrintf(&screen, "===================A project by Matt Geib===================\n");
+    screenPrintf(&screen, "============================================================\n");
 
     setColor(CYAN_FG, BLACK_BG);
     cursorPosition(PM_BANNER_LINE,1);
-    printf("============================================================\n");
-    printf("===============Particulate Matter (ug / m^3)================\n");
-    printf("============================================================\n");
+    screenPrintf(&screen, "============================================================\n");
+    screenPrintf(&screen, "===============Particulate Matter (ug / m^3)================\n");
+    screenPrintf(&screen, "============================================================\n");
 
     setColor(RED_FG, BLACK_BG);
     cursorPosition(SHT_BANNER_LINE, 1);
-    printf("============================================================\n");
-    printf("==================Temperature and Humidity==================\n");
-    printf("============================================================\n");
+    screenPrintf(&screen, "============================================================\n");
+    screenPrintf(&screen, "==================Temperature and Humidity==================\n");
+    screenPrintf(&screen, "============================================================\n");
 
     resetColor();
     cursorPosition(SYS_INFO_BANNER_LINE,1);
-    printf("============================================================\n");
-    printf("=====================System Information=====================\n");
-    printf("============================================================\n");
+    screenPrintf(&screen, "============================================================\n");
+    screenPrintf(&screen, "=====================System Information=====================\n");
+    screenPrintf(&screen, "============================================================\n");
 }
 
-static void writePM(const PARTICULATE_MATTER_DATA * pm_data, uint16_t calculatedAqi, uint16_t instantAqi, bool aqiFull24Hour)
+static void writePM(const ALPAQA_LOCATION * location)
 {
+    const PARTICULATE_MATTER_DATA * pm_data = &location->particulateData;
+
     cursorPosition(PM_DATA_START_LINE,1);
     clearLine();
     setBold();
 
-    printf("PM 1.0: ");
+    screenPrintf(&screen, "PM 1.0: ");
     setColor(WHITE_FG, CYAN_BG);
-    printf("%d", pm_data->pm1_0);
+    screenPrintf(&screen, "%d", pm_data->pm1_0);
 
     setColor(WHITE_FG, BLACK_BG);
-    printf(" PM 2.5: ");
+    screenPrintf(&screen, " PM 2.5: ");
     setColor(WHITE_FG, CYAN_BG);
-    printf("%d", pm_data->pm2_5);
+    screenPrintf(&screen, "%d", pm_data->pm2_5);
 
     setColor(WHITE_FG, BLACK_BG);
-    printf(" PM 10.0: ");
+    screenPrintf(&screen, " PM 10.0: ");
+    setColor(WHITE_FG, CYAN_BG);
+    screenPrintf(&screen, "%d", pm_data->pm10_0);
+    setColor(WHITE_FG, BLACK_BG);
+    screenPrintf(&screen, "\n");
+
+    clearLine();
+    setColor(WHITE_FG, BLACK_BG);
+    screenPrintf(&screen, "AQI now: ");
     setColor(WHITE_FG, CYAN_BG);
-    printf("%d", pm_data->pm10_0);
+    screenPrintf(&screen, "%d", location->instantAqi);
     setColor(WHITE_FG, BLACK_BG);
-    printf("\n");
+    screenPrintf(&screen, "\n");
 
     clearLine();
     setColor(WHITE_FG, BLACK_BG);
-    printf("AQI now: ");
+    if(location->nowcastValid)
+    {
+        screenPrintf(&screen, "NowCast AQI: ");
+    }
+    else
+    {
+        screenPrintf(&screen, "NowCast AQI (Under 2 Hours): ");
+    }
     setColor(WHITE_FG, CYAN_BG);
-    printf("%d", instantAqi);
+    screenPrintf(&screen, "%d", location->nowcastAqi);
     setColor(WHITE_FG, BLACK_BG);
-    printf("\n");
+    screenPrintf(&screen, "\n");
 
     clearLine();
     setColor(WHITE_FG, BLACK_BG);
-    if(aqiFull24Hour)
+    if(location->aqiFull24Hour)
     {
-        printf("Calculated AQI (24 hour): ");
+        screenPrintf(&screen, "Calculated AQI (24 hour): ");
     }
     else
     {
-        printf("Calculated AQI (Running Average): ");
+        screenPrintf(&screen, "Calculated AQI (Running Average): ");
     }
     setColor(WHITE_FG, CYAN_BG);
-    printf("%d", calculatedAqi);
+    screenPrintf(&screen, "%d", location->calculatedAqi);
     setColor(WHITE_FG, BLACK_BG);
-    printf("\n");
+    screenPrintf(&screen, "\n");
 
     resetColor();
 }
@@ -290,31 +1629,104 @@ static void writeTempHumidity(const TEMP_HUMIDITY_DATA * tempHumidityData, float
     clearLine();
     setBold();
 
-    printf("Temperature: ");
+    screenPrintf(&screen, "Temperature: ");
     setColor(WHITE_FG, RED_BG);
-    printf("%0.2f F", tempHumidityData->temperatureF);
+    screenPrintf(&screen, "%0.2f F", tempHumidityData->temperatureF);
     setColor(WHITE_FG, BLACK_BG);
-    printf(" / ");
+    screenPrintf(&screen, " / ");
     setColor(WHITE_FG, RED_BG);
-    printf("%0.2f C", tempHumidityData->temperatureC);
+    screenPrintf(&screen, "%0.2f C", tempHumidityData->temperatureC);
     setColor(WHITE_FG, BLACK_BG);
-    printf("\n");
+    screenPrintf(&screen, "\n");
 
     clearLine();
     setColor(WHITE_FG, BLACK_BG);
-    printf("Humidity: ");
+    screenPrintf(&screen, "Humidity: ");
     setColor(WHITE_FG, RED_BG);
-    printf("%0.2f", tempHumidityData->humidity);
+    screenPrintf(&screen, "%0.2f", tempHumidityData->humidity);
     setColor(WHITE_FG, BLACK_BG);
-    printf("\n");
+    screenPrintf(&screen, "\n");
 
     clearLine();
     setColor(WHITE_FG, BLACK_BG);
-    printf("Heat Index: ");
+    screenPrintf(&screen, "Heat Index: ");
     setColor(WHITE_FG, RED_BG);
-    printf("%0.2f", heatIndex);
+    screenPrintf(&screen, "%0.2f", heatIndex);
     setColor(WHITE_FG, BLACK_BG);
-    printf("\n");
+    screenPrintf(&screen, "\n");
 
     resetColor();
-}
\ No newline at end of file
+}
+
+// Windowed range and the 1 minute / 10 minute / 1 hour averages with the
+// default statistics config, under the PM and temperature readings
+static void writeTrends(const ALPAQA_STATE * state)
+{
+    STATS_RANGE hour;
+    STATS_RANGE eightHour;
+    STATS_RANGE day;
+    float trend[3];
+
+    cursorPosition(PM_DATA_START_LINE + PM_DATA_SIZE - 2,1);
+    clearLine();
+    if(statsRange(&state->stats, STATS_PM2_5, 1, &hour) && statsRange(&state->stats, STATS_PM2_5, 2, &eightHour) &&
+       statsRange(&state->stats, STATS_PM2_5, 3, &day))
+    {
+        statsEwma(&state->stats, STATS_PM2_5, 0, &trend[0]);
+        statsEwma(&state->stats, STATS_PM2_5, 1, &trend[1]);
+        statsEwma(&state->stats, STATS_PM2_5, 2, &trend[2]);
+        screenPrintf(&screen, "PM 2.5 max 1h/24h: %0.0f/%0.0f, min 8h: %0.0f, trend 1m/10m/1h: %0.1f/%0.1f/%0.1f",
+                     hour.max, day.max, eightHour.min, trend[0], trend[1], trend[2]);
+    }
+
+    cursorPosition(SHT_DATA_START_LINE + SHT_DATA_SIZE - 2,1);
+    clearLine();
+    if(statsRange(&state->stats, STATS_TEMPERATURE_F, 3, &day) &&
+       statsRange(&state->stats, STATS_HEAT_INDEX, 3, &hour))
+    {
+        statsEwma(&state->stats, STATS_TEMPERATURE_F, 0, &trend[0]);
+        statsEwma(&state->stats, STATS_TEMPERATURE_F, 2, &trend[2]);
+        screenPrintf(&screen, "Temperature 24h: %0.1f to %0.1f F, trend 1m/1h: %0.2f/%0.2f, heat index max 24h: %0.1f",
+                     day.min, day.max, trend[0], trend[2], hour.max);
+    }
+}
+
+// The last line of the PM and temperature sections: where the last 24 hours sit
+static void writePercentiles(const ALPAQA_STATE * state)
+{
+    uint16_t pm2_5[3];
+    uint16_t pm10_0;
+    uint16_t temperatureTicks[3];
+    uint16_t humidityTicks[3];
+    TEMP_HUMIDITY_DATA low;
+    TEMP_HUMIDITY_DATA median;
+    TEMP_HUMIDITY_DATA high;
+
+    cursorPosition(PM_DATA_START_LINE + PM_DATA_SIZE - 1,1);
+    clearLine();
+    if(percentileValue(state->percentiles, PERCENTILE_PM2_5, 0.50f, &pm2_5[0]) &&
+       percentileValue(state->percentiles, PERCENTILE_PM2_5, 0.95f, &pm2_5[1]) &&
+       percentileValue(state->percentiles, PERCENTILE_PM2_5, 0.99f, &pm2_5[2]) &&
+       percentileValue(state->percentiles, PERCENTILE_PM10_0, 0.95f, &pm10_0))
+    {
+        screenPrintf(&screen, "PM 2.5 24h P50/P95/P99: %u/%u/%u, PM 10.0 24h P95: %u",
+                     pm2_5[0], pm2_5[1], pm2_5[2], pm10_0);
+    }
+
+    cursorPosition(SHT_DATA_START_LINE + SHT_DATA_SIZE - 1,1);
+    clearLine();
+    if(percentileValue(state->percentiles, PERCENTILE_TEMPERATURE_TICKS, 0.05f, &temperatureTicks[0]) &&
+       percentileValue(state->percentiles, PERCENTILE_TEMPERATURE_TICKS, 0.50f, &temperatureTicks[1]) &&
+       percentileValue(state->percentiles, PERCENTILE_TEMPERATURE_TICKS, 0.95f, &temperatureTicks[2]) &&
+       percentileValue(state->percentiles, PERCENTILE_HUMIDITY_TICKS, 0.05f, &humidityTicks[0]) &&
+       percentileValue(state->percentiles, PERCENTILE_HUMIDITY_TICKS, 0.50f, &humidityTicks[1]) &&
+       percentileValue(state->percentiles, PERCENTILE_HUMIDITY_TICKS, 0.95f, &humidityTicks[2]))
+    {
+        convertTempAndHumidityTicks(temperatureTicks[0], humidityTicks[0], &low);
+        convertTempAndHumidityTicks(temperatureTicks[1], humidityTicks[1], &median);
+        convertTempAndHumidityTicks(temperatureTicks[2], humidityTicks[2], &high);
+        screenPrintf(&screen, "24h P5/P50/P95: %0.1f/%0.1f/%0.1f F, %0.1f/%0.1f/%0.1f %%RH",
+                     low.temperatureF, median.temperatureF, high.temperatureF,
+                     low.humidity, median.humidity, high.humidity);
+    }
+}
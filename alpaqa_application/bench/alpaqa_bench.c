@@ -0,0 +1,62 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#define DEFAULT_ITERATIONS 100000
+
+void benchBegin(const BENCH_RESULT * result)
+{
+    printf("{\"bench\": \"%s\", \"variant\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %0.2f",
+           result->name, result->variant, (unsigned long long)result->iterations,
+           result->iterations > 0 ? (double)result->elapsedNs / result->iterations : 0.0);
+}
+
+void benchField(const char * key, double value)
+{
+    printf(", \"%s\": %0.3f", key, value);
+}
+
+void benchEnd(void)
+{
+    printf("}\n");
+    fflush(stdout);
+}
+
+int main(int argc, char * argv[])
+{
+    BENCH_OPTIONS options;
+    int opt;
+
+    memset(&options, 0, sizeof(options));
+    options.iterations = DEFAULT_ITERATIONS;
+
+    while((opt = getopt(argc, argv, "d:n:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'd':
+                options.i2cDeviceFilename = optarg;
+                break;
+            case 'n':
+                options.iterations = strtoull(optarg, NULL, 0);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-d i2c device to also bench real hardware] [-n iterations]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    benchI2c(&options);
+    benchLog(&options);
+    benchRollup(&options);
+    benchStats(&options);
+    benchPercentile(&options);
+    benchCalc(&options);
+    benchLatency(&options);
+    benchPipeline(&options);
+    benchAlert(&options);
+
+    return 0;
+}
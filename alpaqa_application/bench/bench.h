@@ -0,0 +1,47 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// Results are printed one JSON object per line so runs from different builds and
+// targets can be collected and compared by scripts
+typedef struct
+{
+    const char * name;
+    const char * variant;
+    uint64_t iterations;
+    uint64_t elapsedNs;
+} BENCH_RESULT;
+
+typedef struct
+{
+    const char * i2cDeviceFilename;
+    uint64_t iterations;
+} BENCH_OPTIONS;
+
+static inline uint64_t benchNowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+// Starts a result line; callers may add extra fields with benchField() before benchEnd()
+void benchBegin(const BENCH_RESULT * result);
+void benchField(const char * key, double value);
+void benchEnd(void);
+
+void benchI2c(const BENCH_OPTIONS * options);
+void benchLog(const BENCH_OPTIONS * options);
+void benchRollup(const BENCH_OPTIONS * options);
+void benchStats(const BENCH_OPTIONS * options);
+void benchPercentile(const BENCH_OPTIONS * options);
+void benchCalc(const BENCH_OPTIONS * options);
+void benchLatency(const BENCH_OPTIONS * options);
+void benchPipeline(const BENCH_OPTIONS * options);
+void benchAlert(const BENCH_OPTIONS * options);
+
+#endif
@@ -0,0 +1,88 @@
+#include <stdio.h>
+
+#include "bench.h"
+#include "../alpaqaAlert.h"
+
+#define BENCH_SAMPLE_NS 100000000ULL
+
+// Rules spread over every channel, mixing levels and rates so some raise and clear
+static const char * ruleTemplates[] =
+{
+    "level%u pm2_5 above 20 clear 15 for 2",
+    "rate%u pm10_0 rises 15 within 30 clear 5",
+    "aqi%u nowcast_aqi above 100 clear 90",
+    "low%u humidity below 30 clear 35 for 10",
+    "heat%u heat_index above 74 clear 73",
+    "drop%u temperature_f falls 2 within 60",
+    "pm1%u pm1_0 above 12",
+    "inst%u instant_aqi rises 40 within 10 for 1",
+};
+
+// PM2.5-like trace with plumes, temperature with a slow swing
+static void benchValues(uint64_t idx, float * values)
+{
+    float base = (float)((idx * 2654435761U >> 24) % 30);
+    float pm = ((idx / 600) % 8 == 0) ? base + 40.0f : base;
+
+    values[ALERT_PM1_0] = pm * 0.7f;
+    values[ALERT_PM2_5] = pm;
+    values[ALERT_PM10_0] = pm * 1.4f;
+    values[ALERT_INSTANT_AQI] = pm * 3.0f;
+    values[ALERT_AQI] = pm * 2.8f;
+    values[ALERT_NOWCAST_AQI] = pm * 2.9f;
+    values[ALERT_TEMPERATURE_F] = 72.0f + (float)((idx / 50) % 40) * 0.1f;
+    values[ALERT_HUMIDITY] = 28.0f + (float)((idx / 70) % 20) * 0.5f;
+    values[ALERT_HEAT_INDEX] = values[ALERT_TEMPERATURE_F] + 0.5f;
+}
+
+// One PM frame and one SHT frame per iteration, as the main loop sees them
+static void benchAlertEvaluate(uint64_t iterations, uint32_t ruleCount, const char * variant)
+{
+    ALPAQA_ALERTS alerts;
+    ALERT_EVENT events[ALERT_MAX_RULES];
+    BENCH_RESULT result;
+    char line[ALERT_LINE_SIZE];
+    float values[ALERT_CHANNEL_COUNT];
+    uint64_t startNs;
+    uint64_t sum = 0;
+    uint64_t timeNs;
+
+    alertsInit(&alerts);
+    for(uint32_t idx = 0; idx < ruleCount; idx++)
+    {
+        snprintf(line, sizeof(line), ruleTemplates[idx % (sizeof(ruleTemplates) / sizeof(ruleTemplates[0]))], idx);
+        if(!alertsAddRule(&alerts, line))
+        {
+            return;
+        }
+    }
+    if(!alertsCompile(&alerts, 1))
+    {
+        return;
+    }
+
+    startNs = benchNowNs();
+    for(uint64_t idx = 0; idx < iterations; idx++)
+    {
+        timeNs = idx * BENCH_SAMPLE_NS;
+        benchValues(idx, values);
+        sum += alertsEvaluate(&alerts, 0, ALERT_PM_CHANNELS, values, timeNs, timeNs, events);
+        sum += alertsEvaluate(&alerts, 0, ALERT_SHT_CHANNELS, values, timeNs, timeNs, events);
+    }
+    result.name = "alert_evaluate";
+    result.variant = variant;
+    result.iterations = iterations;
+    result.elapsedNs = benchNowNs() - startNs;
+    benchBegin(&result);
+    benchField("rules", (double)alerts.ruleCount);
+    benchField("events", (double)sum);
+    benchEnd();
+
+    alertsFree(&alerts);
+}
+
+void benchAlert(const BENCH_OPTIONS * options)
+{
+    benchAlertEvaluate(options->iterations, 8, "rules_8");
+    benchAlertEvaluate(options->iterations, ALERT_MAX_RULES, "rules_32");
+}
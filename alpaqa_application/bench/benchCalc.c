@@ -0,0 +1,218 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "../alpaqaCalc.h"
+
+// Passes over one block of samples, about what a reprocessing worker batches up
+#define CALC_SAMPLES 4096
+
+typedef struct
+{
+    uint16_t pm2_5[2];
+    uint16_t pm10_0[2];
+    uint16_t aqi[2];
+} REFERENCE_BREAKPOINTS;
+
+// The breakpoint scan calcInstantAQI() used before its lookup tables, kept here as
+// the baseline and to check results against
+static const REFERENCE_BREAKPOINTS referenceTable[BREAKPOINT_TABLE_SIZE] =
+{
+    {{0, 12}, {0, 54}, {0, 50}},
+    {{13, 35}, {55, 154}, {51, 100}},
+    {{36, 55}, {155, 254}, {101, 150}},
+    {{56, 150}, {255, 354}, {151, 200}},
+    {{151, 250}, {355, 424}, {201, 300}},
+    {{251, 350}, {425, 504}, {301, 400}},
+    {{351, 500}, {505, 604}, {401, 500}}
+};
+
+static uint16_t referenceAqi(uint16_t pm2_5, uint16_t pm10_0)
+{
+    const uint16_t * breakpoints = NULL;
+    const uint16_t * aqi = NULL;
+    uint16_t pm = pm2_5 > pm10_0 ? pm2_5 : pm10_0;
+
+    for(uint8_t idx = 0; idx < BREAKPOINT_TABLE_SIZE; idx++)
+    {
+        const uint16_t * row = pm2_5 > pm10_0 ? referenceTable[idx].pm2_5 : referenceTable[idx].pm10_0;
+
+        if(pm >= row[0] && pm <= row[1])
+        {
+            breakpoints = row;
+            aqi = referenceTable[idx].aqi;
+        }
+    }
+    return (uint16_t)(((float)(aqi[1] - aqi[0]) / (breakpoints[1] - breakpoints[0])) * (float)(pm - breakpoints[0]) + aqi[0]);
+}
+
+static void benchCalcReport(const char * name, const char * variant, uint64_t samples, uint64_t startNs, double checksum,
+                            uint64_t mismatches)
+{
+    BENCH_RESULT result;
+
+    result.name = name;
+    result.variant = variant;
+    result.iterations = samples;
+    result.elapsedNs = benchNowNs() - startNs;
+    benchBegin(&result);
+    benchField("checksum", checksum);
+    benchField("mismatches", (double)mismatches);
+    benchEnd();
+}
+
+static void benchCalcAqi(uint64_t passes)
+{
+    static PARTICULATE_MATTER_DATA samples[CALC_SAMPLES];
+    static uint16_t aqi[CALC_SAMPLES];
+    static uint16_t expected[CALC_SAMPLES];
+    uint64_t mismatches = 0;
+    uint64_t startNs;
+    double sum = 0;
+
+    // Spread over the whole table, so the scan cannot settle on one row
+    for(uint32_t idx = 0; idx < CALC_SAMPLES; idx++)
+    {
+        samples[idx].pm1_0 = 0;
+        samples[idx].pm2_5 = (idx * 2654435761U >> 16) % (AQI_PM2_5_MAX + 1);
+        samples[idx].pm10_0 = (idx * 40503U >> 4) % (AQI_PM10_0_MAX + 1);
+    }
+
+    startNs = benchNowNs();
+    for(uint64_t pass = 0; pass < passes; pass++)
+    {
+        for(uint32_t idx = 0; idx < CALC_SAMPLES; idx++)
+        {
+            expected[idx] = referenceAqi(samples[idx].pm2_5, samples[idx].pm10_0);
+        }
+        sum += expected[pass % CALC_SAMPLES];
+    }
+    benchCalcReport("calc_aqi", "breakpoint_scan", passes * CALC_SAMPLES, startNs, sum, 0);
+
+    sum = 0;
+    startNs = benchNowNs();
+    for(uint64_t pass = 0; pass < passes; pass++)
+    {
+        for(uint32_t idx = 0; idx < CALC_SAMPLES; idx++)
+        {
+            aqi[idx] = calcInstantAQI(&samples[idx]);
+        }
+        sum += aqi[pass % CALC_SAMPLES];
+    }
+    for(uint32_t idx = 0; idx < CALC_SAMPLES; idx++)
+    {
+        mismatches += aqi[idx] != expected[idx];
+    }
+    benchCalcReport("calc_aqi", "table", passes * CALC_SAMPLES, startNs, sum, mismatches);
+
+    sum = 0;
+    mismatches = 0;
+    startNs = benchNowNs();
+    for(uint64_t pass = 0; pass < passes; pass++)
+    {
+        calcInstantAQIBatch(samples, aqi, CALC_SAMPLES);
+        sum += aqi[pass % CALC_SAMPLES];
+    }
+    for(uint32_t idx = 0; idx < CALC_SAMPLES; idx++)
+    {
+        mismatches += aqi[idx] != expected[idx];
+    }
+    benchCalcReport("calc_aqi", "table_batch", passes * CALC_SAMPLES, startNs, sum, mismatches);
+}
+
+// Indoor readings nearly always stay on the simple formula, hot ones need the full one
+static void benchCalcHeatIndex(uint64_t passes, bool hot)
+{
+    static TEMP_HUMIDITY_DATA samples[CALC_SAMPLES];
+    static float heatIndex[CALC_SAMPLES];
+    static float expected[CALC_SAMPLES];
+    float lowestF = hot ? 80.0f : 60.0f;
+    uint64_t mismatches = 0;
+    uint64_t startNs;
+    double sum = 0;
+
+    for(uint32_t idx = 0; idx < CALC_SAMPLES; idx++)
+    {
+        samples[idx].temperatureF = lowestF + ((idx * 2654435761U >> 8) % 2000) / 100.0f;
+        samples[idx].temperatureC = (samples[idx].temperatureF - 32.0f) * 5.0f / 9.0f;
+        samples[idx].humidity = ((idx * 40503U >> 4) % 1000) / 10.0f;
+    }
+
+    startNs = benchNowNs();
+    for(uint64_t pass = 0; pass < passes; pass++)
+    {
+        for(uint32_t idx = 0; idx < CALC_SAMPLES; idx++)
+        {
+            expected[idx] = calcHeatIndex(&samples[idx]);
+        }
+        sum += expected[pass % CALC_SAMPLES];
+    }
+    benchCalcReport("calc_heat_index", hot ? "scalar_hot" : "scalar_indoor", passes * CALC_SAMPLES, startNs, sum, 0);
+
+    sum = 0;
+    startNs = benchNowNs();
+    for(uint64_t pass = 0; pass < passes; pass++)
+    {
+        calcHeatIndexBatch(samples, heatIndex, CALC_SAMPLES);
+        sum += heatIndex[pass % CALC_SAMPLES];
+    }
+    for(uint32_t idx = 0; idx < CALC_SAMPLES; idx++)
+    {
+        mismatches += memcmp(&heatIndex[idx], &expected[idx], sizeof(float)) != 0;
+    }
+    benchCalcReport("calc_heat_index", hot ? "lanes_batch_hot" : "lanes_batch_indoor", passes * CALC_SAMPLES, startNs, sum,
+                    mismatches);
+}
+
+// Logged ticks to engineering units, as alpaqa_log2csv and backfill do
+static void benchCalcTicks(uint64_t passes)
+{
+    static uint16_t temperatureTicks[CALC_SAMPLES];
+    static uint16_t humidityTicks[CALC_SAMPLES];
+    static TEMP_HUMIDITY_DATA data[CALC_SAMPLES];
+    static TEMP_HUMIDITY_DATA expected[CALC_SAMPLES];
+    uint64_t mismatches = 0;
+    uint64_t startNs;
+    double sum = 0;
+
+    for(uint32_t idx = 0; idx < CALC_SAMPLES; idx++)
+    {
+        temperatureTicks[idx] = idx * 2654435761U >> 16;
+        humidityTicks[idx] = idx * 40503U;
+    }
+
+    startNs = benchNowNs();
+    for(uint64_t pass = 0; pass < passes; pass++)
+    {
+        for(uint32_t idx = 0; idx < CALC_SAMPLES; idx++)
+        {
+            convertTempAndHumidityTicks(temperatureTicks[idx], humidityTicks[idx], &expected[idx]);
+        }
+        sum += expected[pass % CALC_SAMPLES].humidity;
+    }
+    benchCalcReport("calc_ticks", "scalar", passes * CALC_SAMPLES, startNs, sum, 0);
+
+    sum = 0;
+    startNs = benchNowNs();
+    for(uint64_t pass = 0; pass < passes; pass++)
+    {
+        convertTempAndHumidityTicksBatch(temperatureTicks, humidityTicks, data, CALC_SAMPLES);
+        sum += data[pass % CALC_SAMPLES].humidity;
+    }
+    for(uint32_t idx = 0; idx < CALC_SAMPLES; idx++)
+    {
+        mismatches += memcmp(&data[idx], &expected[idx], sizeof(TEMP_HUMIDITY_DATA)) != 0;
+    }
+    benchCalcReport("calc_ticks", "lanes_batch", passes * CALC_SAMPLES, startNs, sum, mismatches);
+}
+
+void benchCalc(const BENCH_OPTIONS * options)
+{
+    // The iteration count is in samples, rounded up to whole blocks
+    uint64_t passes = (options->iterations + CALC_SAMPLES - 1) / CALC_SAMPLES;
+
+    benchCalcAqi(passes);
+    benchCalcHeatIndex(passes, false);
+    benchCalcHeatIndex(passes, true);
+    benchCalcTicks(passes);
+}
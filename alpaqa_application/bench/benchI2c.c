@@ -0,0 +1,93 @@
+#include <string.h>
+
+#include "bench.h"
+#include "../i2cBus.h"
+#include "../PMSA003I.h"
+#include "../SHT41.h"
+
+// One sample cycle the way the drivers used to do it: select + read the PMSA003I,
+// then select + write + wait + read the SHT41
+static void legacyCycle(I2C_BUS * bus)
+{
+    readAqiDataFromDevice(bus);
+    readTempAndHumidityFromDevice(bus);
+}
+
+// One sample cycle as alpaqa_app does it now: the PMSA003I read and SHT41 command
+// share one I2C_RDWR, the SHT41 result is a second
+static void batchedCycle(I2C_BUS * bus)
+{
+    I2C_BATCH batch;
+
+    i2cBatchInit(&batch);
+    queueAqiDataRead(&batch);
+    queueTempAndHumidityCommand(&batch);
+    i2cBusTransfer(bus, &batch);
+
+    i2cBusConversionWait(bus, SHT41_HIGH_PRECISION_WAIT_MS);
+    i2cBatchInit(&batch);
+    queueTempAndHumidityRead(&batch);
+    i2cBusTransfer(bus, &batch);
+}
+
+static void runCycles(I2C_BUS * bus, const char * variant, bool legacy, uint64_t iterations)
+{
+    BENCH_RESULT result;
+    uint64_t startNs;
+
+    bus->legacyTransfers = legacy;
+    memset(&bus->stats, 0, sizeof(bus->stats));
+
+    startNs = benchNowNs();
+    for(uint64_t idx = 0; idx < iterations; idx++)
+    {
+        if(legacy)
+        {
+            legacyCycle(bus);
+        }
+        else
+        {
+            batchedCycle(bus);
+        }
+    }
+
+    result.name = "i2c_cycle";
+    result.variant = variant;
+    result.iterations = iterations;
+    result.elapsedNs = benchNowNs() - startNs;
+
+    benchBegin(&result);
+    benchField("syscalls_per_cycle", (double)bus->stats.syscalls / iterations);
+    benchField("transfers_per_cycle", (double)bus->stats.transfers / iterations);
+    benchField("us_per_transfer", bus->stats.transfers > 0 ? (double)bus->stats.totalNs / bus->stats.transfers / 1000.0 : 0.0);
+    benchField("us_per_transfer_max", (double)bus->stats.maxNs / 1000.0);
+    benchField("failures", (double)bus->stats.failures);
+    benchEnd();
+}
+
+// Syscall counts are exact on any backend. Latency is only meaningful on real
+// hardware, which is benched as well when a device is given with -d.
+void benchI2c(const BENCH_OPTIONS * options)
+{
+    I2C_BUS bus;
+
+    i2cBusOpenSynthetic(&bus, 0, 1);
+    runCycles(&bus, "synthetic_legacy", true, options->iterations);
+    runCycles(&bus, "synthetic_rdwr", false, options->iterations);
+    i2cBusClose(&bus);
+
+    if(options->i2cDeviceFilename != NULL)
+    {
+        // Each cycle includes the 9ms conversion wait, so keep real runs short
+        uint64_t iterations = options->iterations < 100 ? options->iterations : 100;
+
+        if(!i2cBusOpenReal(&bus, options->i2cDeviceFilename))
+        {
+            fprintf(stderr, "Failed to open %s\n", options->i2cDeviceFilename);
+            return;
+        }
+        runCycles(&bus, "real_legacy", true, iterations);
+        runCycles(&bus, "real_rdwr", false, iterations);
+        i2cBusClose(&bus);
+    }
+}
@@ -0,0 +1,46 @@
+#include <stdlib.h>
+
+#include "bench.h"
+#include "../alpaqaLatency.h"
+
+// Cost of leaving the stage probes in: the histogram update on its own, and with
+// the clock reads on either side as every probed stage pays it
+void benchLatency(const BENCH_OPTIONS * options)
+{
+    BENCH_RESULT result;
+    LATENCY_HISTOGRAM * snapshot;
+    uint64_t startNs;
+    uint64_t p99Ns = 0;
+
+    result.name = "latency_probe";
+    result.variant = "record";
+    result.iterations = options->iterations;
+    startNs = benchNowNs();
+    for(uint64_t idx = 0; idx < options->iterations; idx++)
+    {
+        // Spread over a few decades of buckets, like real stage times
+        latencyRecord(LATENCY_FRAME_CALC, (idx * 2654435761U) >> (idx % 24));
+    }
+    result.elapsedNs = benchNowNs() - startNs;
+    benchBegin(&result);
+    benchEnd();
+
+    result.variant = "start_end";
+    startNs = benchNowNs();
+    for(uint64_t idx = 0; idx < options->iterations; idx++)
+    {
+        latencyEnd(LATENCY_FRAME_STATS, latencyStart());
+    }
+    result.elapsedNs = benchNowNs() - startNs;
+
+    snapshot = malloc(sizeof(LATENCY_HISTOGRAM));
+    if(snapshot != NULL)
+    {
+        latencySnapshot(LATENCY_FRAME_STATS, snapshot);
+        latencyValue(snapshot, 0.99, &p99Ns);
+        free(snapshot);
+    }
+    benchBegin(&result);
+    benchField("p99_ns", (double)p99Ns);
+    benchEnd();
+}
@@ -0,0 +1,390 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "../alpaqaArchive.h"
+#include "../alpaqaLog.h"
+#include "../alpaqaLogIndex.h"
+
+#define BENCH_LOG_FILE "/tmp/alpaqa_bench_log.bin"
+#define BENCH_ARCHIVE_FILE "/tmp/alpaqa_bench_log.aqz"
+#define CSV_LINE_SIZE 256
+// An hour of records at 1 Hz, what a chart of the recent past asks for
+#define QUERY_WINDOW_SECONDS 3600
+// A full scan per query is slow enough that a few make the point
+#define QUERY_SCANS 4
+
+// Values that vary from record to record so neither path formats the same line twice
+static void fillRecord(ALPAQA_LOG_RECORD * record, uint64_t idx)
+{
+    memset(record, 0, sizeof(ALPAQA_LOG_RECORD));
+    alpaqaLogRecordSetTime(record, (1700000000ULL + idx) * 1000000000ULL);
+    record->pm1_0 = idx % 50;
+    record->pm2_5 = idx % 80;
+    record->pm10_0 = idx % 120;
+    record->temperatureTicks = 26000 + (idx % 2000);
+    record->humidityTicks = 30000 + (idx % 4000);
+    record->instantAqi = idx % 150;
+    record->calculatedAqi = idx % 100;
+    alpaqaLogRecordSetHeatIndex(record, 70.0f + (idx % 10) * 0.37f);
+    record->flags = ALPAQA_LOG_PM_OK | ALPAQA_LOG_SHT_OK;
+}
+
+// What the report path costs per record to produce and how many bytes it stores,
+// a text line with a timestamp column against the binary record
+static void benchLogFormat(uint64_t iterations)
+{
+    BENCH_RESULT result;
+    ALPAQA_LOG_RECORD record;
+    char line[CSV_LINE_SIZE];
+    uint64_t bytes = 0;
+    uint64_t startNs;
+
+    startNs = benchNowNs();
+    for(uint64_t idx = 0; idx < iterations; idx++)
+    {
+        fillRecord(&record, idx);
+        bytes += alpaqaLogFormatCsv(&record, true, line, sizeof(line));
+    }
+    result.name = "log_format";
+    result.variant = "csv";
+    result.iterations = iterations;
+    result.elapsedNs = benchNowNs() - startNs;
+    benchBegin(&result);
+    benchField("bytes_per_record", (double)bytes / iterations);
+    benchEnd();
+
+    bytes = 0;
+    startNs = benchNowNs();
+    for(uint64_t idx = 0; idx < iterations; idx++)
+    {
+        fillRecord(&record, idx);
+        bytes += sizeof(record);
+    }
+    // Keeps the fill loop from being optimized away
+    __asm__ volatile("" : : "r"(&record) : "memory");
+    result.variant = "binary";
+    result.elapsedNs = benchNowNs() - startNs;
+    benchBegin(&result);
+    benchField("bytes_per_record", (double)bytes / iterations);
+    benchEnd();
+}
+
+// Reading a day's worth of records back: parsing text lines against walking the mapped file
+static void benchLogRead(uint64_t iterations)
+{
+    BENCH_RESULT result;
+    ALPAQA_LOG_WRITER writer;
+    ALPAQA_LOG_READER reader;
+    ALPAQA_LOG_RECORD record;
+    char * text;
+    char * cursor;
+    size_t textSize;
+    uint64_t startNs;
+    uint64_t sum = 0;
+
+    unlink(BENCH_LOG_FILE);
+    if(!alpaqaLogOpen(&writer, BENCH_LOG_FILE))
+    {
+        return;
+    }
+    textSize = iterations * CSV_LINE_SIZE;
+    text = malloc(textSize);
+    if(text == NULL)
+    {
+        alpaqaLogClose(&writer);
+        return;
+    }
+    cursor = text;
+    for(uint64_t idx = 0; idx < iterations; idx++)
+    {
+        fillRecord(&record, idx);
+        alpaqaLogAppend(&writer, &record);
+        cursor += alpaqaLogFormatCsv(&record, false, cursor, text + textSize - cursor);
+    }
+    alpaqaLogClose(&writer);
+
+    startNs = benchNowNs();
+    cursor = text;
+    for(uint64_t idx = 0; idx < iterations; idx++)
+    {
+        int pm1_0, pm2_5, pm10_0, aqi, aqiAverage;
+        float temperatureF, temperatureC, humidity, heatIndex;
+        char * lineEnd = strchr(cursor, '\n');
+
+        if(lineEnd == NULL)
+        {
+            break;
+        }
+        // One line at a time, as fgets() would hand them over
+        *lineEnd = '\0';
+        if(sscanf(cursor, "%d, %d, %d, %d, %d, %f, %f, %f, %f", &pm1_0, &pm2_5, &pm10_0, &aqi, &aqiAverage,
+                  &temperatureF, &temperatureC, &humidity, &heatIndex) != 9)
+        {
+            break;
+        }
+        sum += pm2_5;
+        cursor = lineEnd + 1;
+    }
+    result.name = "log_read";
+    result.variant = "csv_sscanf";
+    result.iterations = iterations;
+    result.elapsedNs = benchNowNs() - startNs;
+    benchBegin(&result);
+    benchField("checksum", (double)sum);
+    benchEnd();
+    free(text);
+
+    sum = 0;
+    startNs = benchNowNs();
+    if(alpaqaLogReaderOpen(&reader, BENCH_LOG_FILE))
+    {
+        for(uint64_t idx = 0; idx < reader.count; idx++)
+        {
+            sum += alpaqaLogReaderGet(&reader, idx)->pm2_5;
+        }
+        alpaqaLogReaderClose(&reader);
+    }
+    result.variant = "binary_mmap";
+    result.elapsedNs = benchNowNs() - startNs;
+    benchBegin(&result);
+    benchField("checksum", (double)sum);
+    benchEnd();
+
+    unlink(BENCH_LOG_FILE);
+}
+
+static void benchLogQueryReport(const char * variant, uint64_t queries, uint64_t startNs, uint64_t records, uint64_t sum)
+{
+    BENCH_RESULT result;
+
+    result.name = "log_query";
+    result.variant = variant;
+    result.iterations = queries;
+    result.elapsedNs = benchNowNs() - startNs;
+    benchBegin(&result);
+    benchField("records_per_query", queries > 0 ? (double)records / queries : 0.0);
+    benchField("checksum", (double)sum);
+    benchEnd();
+}
+
+// Hour long range queries over a log of one record a second, through the index and
+// by scanning from the start as a log without one has to. Queries land all over the
+// log, so the index pays for its misses in page faults as a real one would.
+static void benchLogQuery(uint64_t iterations)
+{
+    ALPAQA_LOG_WRITER writer;
+    ALPAQA_LOG_INDEX_WRITER index;
+    ALPAQA_LOG_QUERY query;
+    ALPAQA_LOG_RECORD records[256];
+    const ALPAQA_LOG_RECORD * record;
+    uint64_t queries = iterations / 100 > 0 ? iterations / 100 : 1;
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t startNs;
+
+    unlink(BENCH_LOG_FILE);
+    unlink(BENCH_LOG_FILE ALPAQA_LOG_INDEX_SUFFIX);
+    if(!alpaqaLogOpen(&writer, BENCH_LOG_FILE))
+    {
+        return;
+    }
+    if(!alpaqaLogIndexOpen(&index, &writer, BENCH_LOG_FILE, ALPAQA_LOG_INDEX_DEFAULT_RECORDS))
+    {
+        alpaqaLogClose(&writer);
+        return;
+    }
+    for(uint64_t idx = 0; idx < iterations; idx += 256)
+    {
+        uint32_t batch = iterations - idx < 256 ? iterations - idx : 256;
+        struct iovec iov;
+
+        for(uint32_t recordIdx = 0; recordIdx < batch; recordIdx++)
+        {
+            fillRecord(&records[recordIdx], idx + recordIdx);
+        }
+        iov.iov_base = records;
+        iov.iov_len = batch * sizeof(ALPAQA_LOG_RECORD);
+        alpaqaLogWritev(&writer, &iov, 1);
+        alpaqaLogIndexAdd(&index, records, batch);
+    }
+    alpaqaLogIndexClose(&index);
+    alpaqaLogClose(&writer);
+
+    if(!alpaqaLogQueryOpen(&query, BENCH_LOG_FILE))
+    {
+        return;
+    }
+    startNs = benchNowNs();
+    for(uint64_t queryIdx = 0; queryIdx < queries; queryIdx++)
+    {
+        uint64_t fromNs = (1700000000ULL + ((queryIdx * 2654435761U) % iterations)) * 1000000000ULL;
+
+        alpaqaLogQueryStart(&query, fromNs, fromNs + (QUERY_WINDOW_SECONDS * 1000000000ULL));
+        while((record = alpaqaLogQueryNext(&query)) != NULL)
+        {
+            sum += record->pm2_5;
+            count++;
+        }
+    }
+    benchLogQueryReport("indexed", queries, startNs, count, sum);
+
+    // The same queries with the index left out
+    query.entryCount = 0;
+    queries = queries < QUERY_SCANS ? queries : QUERY_SCANS;
+    count = 0;
+    sum = 0;
+    startNs = benchNowNs();
+    for(uint64_t queryIdx = 0; queryIdx < queries; queryIdx++)
+    {
+        uint64_t fromNs = (1700000000ULL + ((queryIdx * 2654435761U) % iterations)) * 1000000000ULL;
+
+        alpaqaLogQueryStart(&query, fromNs, fromNs + (QUERY_WINDOW_SECONDS * 1000000000ULL));
+        while((record = alpaqaLogQueryNext(&query)) != NULL)
+        {
+            sum += record->pm2_5;
+            count++;
+        }
+    }
+    benchLogQueryReport("scan", queries, startNs, count, sum);
+
+    alpaqaLogQueryClose(&query);
+    unlink(BENCH_LOG_FILE);
+    unlink(BENCH_LOG_FILE ALPAQA_LOG_INDEX_SUFFIX);
+}
+
+// Readings that wander the way real ones do: particulates and humidity drift a
+// count at a time, sampling times jitter by a few milliseconds around 1 Hz
+static void fillWalkRecord(ALPAQA_LOG_RECORD * record, uint64_t idx, uint32_t * seed)
+{
+    static ALPAQA_LOG_RECORD last;
+    uint32_t random;
+
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+    random = *seed;
+
+    if(idx == 0)
+    {
+        memset(&last, 0, sizeof(last));
+        last.pm1_0 = 6;
+        last.pm2_5 = 9;
+        last.pm10_0 = 12;
+        last.temperatureTicks = 27000;
+        last.humidityTicks = 31000;
+        last.flags = ALPAQA_LOG_PM_OK | ALPAQA_LOG_SHT_OK;
+    }
+    if((random & 0x7) == 0)
+    {
+        int step = (random & 0x8) ? 1 : -1;
+
+        last.pm2_5 = last.pm2_5 + step > 0 ? last.pm2_5 + step : 0;
+        last.pm1_0 = last.pm2_5 * 2 / 3;
+        last.pm10_0 = last.pm2_5 + 3;
+    }
+    last.temperatureTicks += ((random >> 4) & 0x3) - 1;
+    if(((random >> 6) & 0x3) == 0)
+    {
+        last.humidityTicks += (random & 0x100) ? 3 : -3;
+    }
+    last.instantAqi = last.pm2_5 * 4;
+    if(idx % 60 == 0)
+    {
+        last.calculatedAqi = last.instantAqi;
+        last.nowcastAqi = last.instantAqi;
+    }
+    alpaqaLogRecordSetHeatIndex(&last, 80.0f + (last.temperatureTicks - 27000) * 0.003f);
+    alpaqaLogRecordSetTime(&last, ((1700000000ULL + idx) * 1000000000ULL) + ((random >> 12) % 8) * 1000000ULL);
+    *record = last;
+}
+
+// A log of random walk readings encoded into an archive and decoded back, with the
+// archive's size against the text log the same records made
+static void benchLogArchive(uint64_t iterations)
+{
+    BENCH_RESULT result;
+    ALPAQA_LOG_WRITER writer;
+    ALPAQA_ARCHIVE_READER reader;
+    ALPAQA_LOG_RECORD records[256];
+    const ALPAQA_LOG_RECORD * block;
+    char line[CSV_LINE_SIZE];
+    uint64_t csvBytes = 0;
+    uint64_t archiveBytes = 0;
+    uint64_t decoded = 0;
+    uint64_t sum = 0;
+    uint64_t startNs;
+    uint32_t seed = 0x2545f491;
+    uint32_t count;
+    bool encoded;
+
+    unlink(BENCH_LOG_FILE);
+    if(!alpaqaLogOpen(&writer, BENCH_LOG_FILE))
+    {
+        return;
+    }
+    for(uint64_t idx = 0; idx < iterations; idx += 256)
+    {
+        uint32_t batch = iterations - idx < 256 ? iterations - idx : 256;
+        struct iovec iov;
+
+        for(uint32_t recordIdx = 0; recordIdx < batch; recordIdx++)
+        {
+            fillWalkRecord(&records[recordIdx], idx + recordIdx, &seed);
+            csvBytes += alpaqaLogFormatCsv(&records[recordIdx], true, line, sizeof(line));
+        }
+        iov.iov_base = records;
+        iov.iov_len = batch * sizeof(ALPAQA_LOG_RECORD);
+        alpaqaLogWritev(&writer, &iov, 1);
+    }
+    alpaqaLogClose(&writer);
+
+    startNs = benchNowNs();
+    encoded = archiveEncodeLog(BENCH_LOG_FILE, BENCH_ARCHIVE_FILE, &archiveBytes);
+    result.name = "log_archive";
+    result.variant = "encode";
+    result.iterations = iterations;
+    result.elapsedNs = benchNowNs() - startNs;
+    unlink(BENCH_LOG_FILE);
+    if(!encoded)
+    {
+        return;
+    }
+    benchBegin(&result);
+    benchField("bytes_per_record", (double)archiveBytes / iterations);
+    benchField("csv_ratio", archiveBytes > 0 ? (double)csvBytes / archiveBytes : 0.0);
+    benchField("binary_ratio", archiveBytes > 0 ? (double)(iterations * sizeof(ALPAQA_LOG_RECORD)) / archiveBytes : 0.0);
+    benchEnd();
+
+    startNs = benchNowNs();
+    if(archiveReaderOpen(&reader, BENCH_ARCHIVE_FILE))
+    {
+        while((count = archiveReaderNextBlock(&reader, &block)) > 0)
+        {
+            for(uint32_t idx = 0; idx < count; idx++)
+            {
+                sum += block[idx].pm2_5;
+            }
+            decoded += count;
+        }
+        archiveReaderClose(&reader);
+    }
+    result.variant = "decode";
+    result.iterations = decoded;
+    result.elapsedNs = benchNowNs() - startNs;
+    benchBegin(&result);
+    benchField("records_per_second", result.elapsedNs > 0 ? (double)decoded * 1e9 / result.elapsedNs : 0.0);
+    benchField("checksum", (double)sum);
+    benchEnd();
+
+    unlink(BENCH_ARCHIVE_FILE);
+}
+
+void benchLog(const BENCH_OPTIONS * options)
+{
+    benchLogFormat(options->iterations);
+    benchLogRead(options->iterations);
+    benchLogQuery(options->iterations);
+    benchLogArchive(options->iterations);
+}
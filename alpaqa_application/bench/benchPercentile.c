@@ -0,0 +1,104 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "../alpaqaPercentile.h"
+
+#define SORT_WINDOW_SECONDS (60 * 60)
+#define SORT_ITERATION_DIVISOR 1000
+#define BENCH_START_SECONDS 1700000000ULL
+
+// PM2.5-like trace: mostly low with occasional plumes
+static uint16_t benchSample(uint64_t idx)
+{
+    uint16_t base = (idx * 2654435761U >> 24) % 30;
+
+    return ((idx / 900) % 8 == 0) ? base + 150 : base;
+}
+
+static int compareSamples(const void * a, const void * b)
+{
+    return (int)*(const uint16_t *)a - (int)*(const uint16_t *)b;
+}
+
+// One sample added and the window's P95 read back
+static void benchPercentileQuery(uint64_t iterations)
+{
+    BENCH_RESULT result;
+    ALPAQA_QUANTILE * quantile;
+    uint16_t * window;
+    uint16_t * sorted;
+    uint64_t sortIterations = iterations / SORT_ITERATION_DIVISOR;
+    uint64_t startNs;
+    uint64_t sum = 0;
+    uint16_t value;
+
+    // Baseline: keep every sample in the window and sort a copy for each query
+    window = malloc(SORT_WINDOW_SECONDS * sizeof(uint16_t));
+    sorted = malloc(SORT_WINDOW_SECONDS * sizeof(uint16_t));
+    quantile = malloc(sizeof(ALPAQA_QUANTILE));
+    if(window == NULL || sorted == NULL || quantile == NULL)
+    {
+        free(window);
+        free(sorted);
+        free(quantile);
+        return;
+    }
+    for(uint32_t idx = 0; idx < SORT_WINDOW_SECONDS; idx++)
+    {
+        window[idx] = benchSample(idx);
+    }
+    startNs = benchNowNs();
+    for(uint64_t idx = 0; idx < sortIterations; idx++)
+    {
+        window[idx % SORT_WINDOW_SECONDS] = benchSample(idx);
+        memcpy(sorted, window, SORT_WINDOW_SECONDS * sizeof(uint16_t));
+        qsort(sorted, SORT_WINDOW_SECONDS, sizeof(uint16_t), compareSamples);
+        sum += sorted[(SORT_WINDOW_SECONDS * 95 + 99) / 100 - 1];
+    }
+    result.name = "percentile_p95";
+    result.variant = "sort_window_1h";
+    result.iterations = sortIterations;
+    result.elapsedNs = benchNowNs() - startNs;
+    benchBegin(&result);
+    benchField("bytes", (double)SORT_WINDOW_SECONDS * sizeof(uint16_t) * 2);
+    benchField("checksum", (double)sum);
+    benchEnd();
+
+    // Histogram with the same hour, then a day: memory and cost stay the same
+    for(int day = 0; day < 2; day++)
+    {
+        uint32_t windowSeconds = day ? 24 * SORT_WINDOW_SECONDS : SORT_WINDOW_SECONDS;
+
+        quantileInit(quantile, windowSeconds, 0);
+        for(uint32_t idx = 0; idx < windowSeconds; idx++)
+        {
+            quantileAdd(quantile, BENCH_START_SECONDS + idx, benchSample(idx));
+        }
+
+        sum = 0;
+        startNs = benchNowNs();
+        for(uint64_t idx = 0; idx < iterations; idx++)
+        {
+            quantileAdd(quantile, BENCH_START_SECONDS + windowSeconds + idx, benchSample(idx));
+            quantileValue(quantile, 0.95f, &value);
+            sum += value;
+        }
+        result.variant = day ? "histogram_24h" : "histogram_1h";
+        result.iterations = iterations;
+        result.elapsedNs = benchNowNs() - startNs;
+        benchBegin(&result);
+        benchField("bytes", (double)sizeof(ALPAQA_QUANTILE));
+        benchField("checksum", (double)sum);
+        benchEnd();
+    }
+
+    free(window);
+    free(sorted);
+    free(quantile);
+}
+
+void benchPercentile(const BENCH_OPTIONS * options)
+{
+    benchPercentileQuery(options->iterations);
+}
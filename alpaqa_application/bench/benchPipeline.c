@@ -0,0 +1,324 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "../i2cBus.h"
+#include "../PMSA003I.h"
+#include "../SHT41.h"
+#include "../alpaqaCalc.h"
+#include "../alpaqaLatency.h"
+#include "../alpaqaLog.h"
+#include "../alpaqaPercentile.h"
+#include "../alpaqaStats.h"
+
+#define BENCH_PIPELINE_LOG_FILE "/tmp/alpaqa_bench_pipeline.bin"
+#define BENCH_START_SECONDS 1700000000ULL
+#define SENSOR_FRAMES 1024
+// Records per log commit, about what the log thread gathers at its default flush size
+#define PIPELINE_COMMIT_RECORDS 64
+
+typedef struct
+{
+    ALPAQA_STATS stats;
+    ALPAQA_PERCENTILES * percentiles;
+    ALPAQA_LOG_WRITER log;
+    ALPAQA_LOG_RECORD records[PIPELINE_COMMIT_RECORDS];
+    uint32_t pending;
+    uint64_t commits;
+    uint64_t commitNs;
+} PIPELINE;
+
+// Frames off the synthetic bus so the decoders see varied data
+static void captureFrames(uint8_t (* pmFrames)[PMSA003I_READ_BYTES], uint8_t (* shtFrames)[SHT41_READ_BYTES])
+{
+    I2C_BUS bus;
+
+    i2cBusOpenSynthetic(&bus, 0, 1);
+    for(uint32_t idx = 0; idx < SENSOR_FRAMES; idx++)
+    {
+        readAqiDataFromDevice(&bus);
+        readTempAndHumidityFromDevice(&bus);
+        memcpy(pmFrames[idx], getAqiRawData(), PMSA003I_READ_BYTES);
+        memcpy(shtFrames[idx], getTempAndHumidityRawData(), SHT41_READ_BYTES);
+    }
+    i2cBusClose(&bus);
+}
+
+// The driver calls the app made once per cycle before decoding moved to the consumer
+// side: get*() decodes the last frame read, decode*() takes any frame. All of them
+// check the frame's checksum or CRCs first.
+static void benchSensorDecode(uint64_t iterations)
+{
+    static uint8_t pmFrames[SENSOR_FRAMES][PMSA003I_READ_BYTES];
+    static uint8_t shtFrames[SENSOR_FRAMES][SHT41_READ_BYTES];
+    PARTICULATE_MATTER_DATA particulate;
+    PMSA003I_FRAME_DATA pmFrame;
+    TEMP_HUMIDITY_DATA tempHumidity;
+    BENCH_RESULT result;
+    uint64_t startNs;
+    double sum = 0;
+
+    captureFrames(pmFrames, shtFrames);
+    result.name = "sensor_decode";
+    result.iterations = iterations;
+
+    startNs = benchNowNs();
+    for(uint64_t idx = 0; idx < iterations; idx++)
+    {
+        getParticulateMatterData(&particulate);
+        sum += particulate.pm2_5;
+    }
+    result.variant = "pm_get";
+    result.elapsedNs = benchNowNs() - startNs;
+    benchBegin(&result);
+    benchField("checksum", sum);
+    benchEnd();
+
+    sum = 0;
+    startNs = benchNowNs();
+    for(uint64_t idx = 0; idx < iterations; idx++)
+    {
+        decodeParticulateMatterData(pmFrames[idx % SENSOR_FRAMES], &particulate);
+        sum += particulate.pm2_5;
+    }
+    result.variant = "pm_frames";
+    result.elapsedNs = benchNowNs() - startNs;
+    benchBegin(&result);
+    benchField("checksum", sum);
+    benchEnd();
+
+    // All twelve channels, what the app decodes
+    sum = 0;
+    startNs = benchNowNs();
+    for(uint64_t idx = 0; idx < iterations; idx++)
+    {
+        decodeParticulateMatterFrame(pmFrames[idx % SENSOR_FRAMES], &pmFrame);
+        sum += pmFrame.pm2_5 + pmFrame.particles0_3;
+    }
+    result.variant = "pm_all_channels";
+    result.elapsedNs = benchNowNs() - startNs;
+    benchBegin(&result);
+    benchField("checksum", sum);
+    benchEnd();
+
+    sum = 0;
+    startNs = benchNowNs();
+    for(uint64_t idx = 0; idx < iterations; idx++)
+    {
+        getTempAndHumidityData(&tempHumidity);
+        sum += tempHumidity.humidity;
+    }
+    result.variant = "sht_get";
+    result.elapsedNs = benchNowNs() - startNs;
+    benchBegin(&result);
+    benchField("checksum", sum);
+    benchEnd();
+
+    sum = 0;
+    startNs = benchNowNs();
+    for(uint64_t idx = 0; idx < iterations; idx++)
+    {
+        decodeTempAndHumidityData(shtFrames[idx % SENSOR_FRAMES], &tempHumidity);
+        sum += tempHumidity.humidity;
+    }
+    result.variant = "sht_frames";
+    result.elapsedNs = benchNowNs() - startNs;
+    benchBegin(&result);
+    benchField("checksum", sum);
+    benchEnd();
+}
+
+// storeAqiData() and the averages read back after it, at 1 Hz of simulated time
+static void benchAqiStore(uint64_t iterations)
+{
+    PARTICULATE_MATTER_DATA particulate;
+    BENCH_RESULT result;
+    uint16_t aqi = 0;
+    uint16_t nowcast = 0;
+    uint64_t startNs;
+    double sum = 0;
+
+    initAlpaqaCalc();
+    memset(&particulate, 0, sizeof(particulate));
+    startNs = benchNowNs();
+    for(uint64_t idx = 0; idx < iterations; idx++)
+    {
+        particulate.pm2_5 = (idx * 7919) % 97;
+        particulate.pm10_0 = particulate.pm2_5 + (idx % 40);
+        storeAqiData(&particulate, (BENCH_START_SECONDS + idx) * NS_PER_SECOND);
+        calcAQI(&aqi);
+        calcNowCastAQI(&nowcast);
+        sum += aqi + nowcast;
+    }
+    result.name = "aqi_store_calc";
+    result.variant = "calc_aqi_nowcast";
+    result.iterations = iterations;
+    result.elapsedNs = benchNowNs() - startNs;
+    benchBegin(&result);
+    benchField("checksum", sum);
+    benchEnd();
+}
+
+static void commitRecords(PIPELINE * pipeline)
+{
+    struct iovec iov;
+    uint64_t startNs = benchNowNs();
+
+    iov.iov_base = pipeline->records;
+    iov.iov_len = pipeline->pending * sizeof(ALPAQA_LOG_RECORD);
+    alpaqaLogWritev(&pipeline->log, &iov, 1);
+    pipeline->pending = 0;
+    pipeline->commits++;
+    pipeline->commitNs += benchNowNs() - startNs;
+}
+
+// One cycle of both sensors the way alpaqa_app handles it, from the bus transfers to
+// the log record, with the sampling and conversion waits taken out
+static void pipelineSample(PIPELINE * pipeline, I2C_BUS * bus, uint64_t idx)
+{
+    ALPAQA_LOG_RECORD * record = &pipeline->records[pipeline->pending++];
+    PARTICULATE_MATTER_DATA particulate;
+    TEMP_HUMIDITY_DATA tempHumidity;
+    uint64_t realtimeNs = (BENCH_START_SECONDS + idx) * NS_PER_SECOND;
+    uint16_t temperatureTicks;
+    uint16_t humidityTicks;
+    uint16_t calculatedAqi;
+    uint16_t nowcastAqi;
+    bool aqiFull24Hour;
+    bool nowcastValid;
+    I2C_BATCH batch;
+    int pmMessage;
+    bool pmOk;
+    float heatIndex;
+
+    i2cBatchInit(&batch);
+    pmMessage = queueAqiDataRead(&batch);
+    queueTempAndHumidityCommand(&batch);
+    i2cBusTransfer(bus, &batch);
+    pmOk = i2cBatchMessageOk(&batch, pmMessage);
+    i2cBatchInit(&batch);
+    queueTempAndHumidityRead(&batch);
+    i2cBusTransfer(bus, &batch);
+
+    memset(&particulate, 0, sizeof(particulate));
+    if(pmOk)
+    {
+        decodeParticulateMatterData(getAqiRawData(), &particulate);
+    }
+    storeAqiData(&particulate, realtimeNs);
+    aqiFull24Hour = calcAQI(&calculatedAqi);
+    nowcastValid = calcNowCastAQI(&nowcastAqi);
+    statsAdd(&pipeline->stats, STATS_PM1_0, realtimeNs, particulate.pm1_0);
+    statsAdd(&pipeline->stats, STATS_PM2_5, realtimeNs, particulate.pm2_5);
+    statsAdd(&pipeline->stats, STATS_PM10_0, realtimeNs, particulate.pm10_0);
+    percentilesAddParticulate(pipeline->percentiles, realtimeNs / NS_PER_SECOND, &particulate);
+
+    decodeTempAndHumidityTicks(getTempAndHumidityRawData(), &temperatureTicks, &humidityTicks);
+    convertTempAndHumidityTicks(temperatureTicks, humidityTicks, &tempHumidity);
+    heatIndex = calcHeatIndex(&tempHumidity);
+    statsAdd(&pipeline->stats, STATS_TEMPERATURE_F, realtimeNs, tempHumidity.temperatureF);
+    statsAdd(&pipeline->stats, STATS_HUMIDITY, realtimeNs, tempHumidity.humidity);
+    statsAdd(&pipeline->stats, STATS_HEAT_INDEX, realtimeNs, heatIndex);
+    percentilesAddTicks(pipeline->percentiles, realtimeNs / NS_PER_SECOND, temperatureTicks, humidityTicks);
+
+    memset(record, 0, sizeof(ALPAQA_LOG_RECORD));
+    alpaqaLogRecordSetTime(record, realtimeNs);
+    record->pm1_0 = particulate.pm1_0;
+    record->pm2_5 = particulate.pm2_5;
+    record->pm10_0 = particulate.pm10_0;
+    record->temperatureTicks = temperatureTicks;
+    record->humidityTicks = humidityTicks;
+    record->instantAqi = calcInstantAQI(&particulate);
+    record->calculatedAqi = calculatedAqi;
+    record->nowcastAqi = nowcastAqi;
+    alpaqaLogRecordSetHeatIndex(record, heatIndex);
+    record->flags = (pmOk ? ALPAQA_LOG_PM_OK : 0) | ALPAQA_LOG_SHT_OK |
+                    (aqiFull24Hour ? ALPAQA_LOG_AQI_FULL_24_HOUR : 0) |
+                    (nowcastValid ? ALPAQA_LOG_NOWCAST_VALID : 0);
+}
+
+// Samples are timed one by one into a latency histogram for the percentiles. Log
+// commits go to the log thread in the app, so they are timed apart but still count
+// towards samples/s.
+static void benchPipelineLoop(uint64_t iterations)
+{
+    PIPELINE * pipeline = calloc(1, sizeof(PIPELINE));
+    LATENCY_HISTOGRAM * samples = calloc(1, sizeof(LATENCY_HISTOGRAM));
+    ALPAQA_PERCENTILES * percentiles = malloc(sizeof(ALPAQA_PERCENTILES));
+    BENCH_RESULT result;
+    I2C_BUS bus;
+    uint64_t startNs;
+    uint64_t p50Ns = 0;
+    uint64_t p99Ns = 0;
+
+    if(pipeline == NULL || samples == NULL || percentiles == NULL || !statsInit(&pipeline->stats, NULL))
+    {
+        fprintf(stderr, "Failed to set up the pipeline bench\n");
+        free(pipeline);
+        free(samples);
+        free(percentiles);
+        return;
+    }
+    pipeline->percentiles = percentiles;
+    percentilesInit(pipeline->percentiles, PERCENTILE_DEFAULT_WINDOW);
+    initAlpaqaCalc();
+    unlink(BENCH_PIPELINE_LOG_FILE);
+    if(!alpaqaLogOpen(&pipeline->log, BENCH_PIPELINE_LOG_FILE))
+    {
+        fprintf(stderr, "Failed to open %s\n", BENCH_PIPELINE_LOG_FILE);
+        statsFree(&pipeline->stats);
+        free(pipeline);
+        free(samples);
+        free(percentiles);
+        return;
+    }
+    i2cBusOpenSynthetic(&bus, 0, 1);
+
+    startNs = benchNowNs();
+    for(uint64_t idx = 0; idx < iterations; idx++)
+    {
+        uint64_t sampleStartNs = benchNowNs();
+
+        pipelineSample(pipeline, &bus, idx);
+        latencyHistogramRecord(samples, benchNowNs() - sampleStartNs);
+        if(pipeline->pending == PIPELINE_COMMIT_RECORDS)
+        {
+            commitRecords(pipeline);
+        }
+    }
+    if(pipeline->pending > 0)
+    {
+        commitRecords(pipeline);
+    }
+    result.name = "pipeline";
+    result.variant = "synthetic_no_sleep";
+    result.iterations = iterations;
+    result.elapsedNs = benchNowNs() - startNs;
+
+    latencyValue(samples, 0.5, &p50Ns);
+    latencyValue(samples, 0.99, &p99Ns);
+    benchBegin(&result);
+    benchField("samples_per_s", result.elapsedNs > 0 ? (double)iterations * NS_PER_SECOND / result.elapsedNs : 0.0);
+    benchField("sample_p50_us", (double)p50Ns / 1000.0);
+    benchField("sample_p99_us", (double)p99Ns / 1000.0);
+    benchField("sample_max_us", (double)samples->maxNs / 1000.0);
+    benchField("commit_us", pipeline->commits > 0 ? (double)pipeline->commitNs / pipeline->commits / 1000.0 : 0.0);
+    benchEnd();
+
+    i2cBusClose(&bus);
+    alpaqaLogClose(&pipeline->log);
+    unlink(BENCH_PIPELINE_LOG_FILE);
+    statsFree(&pipeline->stats);
+    free(pipeline->percentiles);
+    free(pipeline);
+    free(samples);
+}
+
+void benchPipeline(const BENCH_OPTIONS * options)
+{
+    benchSensorDecode(options->iterations);
+    benchAqiStore(options->iterations);
+    benchPipelineLoop(options->iterations);
+}
@@ -0,0 +1,103 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "../alpaqaRollup.h"
+
+#define LEGACY_BUFFER_SIZE (60 * 60 * 24)
+#define BENCH_START_SECONDS 1700000000ULL
+
+// The 24 hour ring alpaqaCalc kept before the rollup, reproduced for comparison
+typedef struct
+{
+    uint16_t pm2_5[LEGACY_BUFFER_SIZE];
+    uint16_t pm10_0[LEGACY_BUFFER_SIZE];
+    uint32_t idx;
+    uint32_t sumPm2_5;
+    uint32_t sumPm10_0;
+    bool full;
+} LEGACY_AQI_BUFFER;
+
+static void legacyAdd(LEGACY_AQI_BUFFER * buffer, uint16_t pm2_5, uint16_t pm10_0)
+{
+    buffer->sumPm2_5 += pm2_5;
+    buffer->sumPm10_0 += pm10_0;
+    if(buffer->full)
+    {
+        buffer->sumPm2_5 -= buffer->pm2_5[buffer->idx];
+        buffer->sumPm10_0 -= buffer->pm10_0[buffer->idx];
+    }
+    buffer->pm2_5[buffer->idx] = pm2_5;
+    buffer->pm10_0[buffer->idx] = pm10_0;
+    if(++buffer->idx >= LEGACY_BUFFER_SIZE)
+    {
+        buffer->idx = 0;
+        buffer->full = true;
+    }
+}
+
+// One 1 Hz sample stored and the 24 hour average read back, as every PM frame does
+static void benchRollupStore(uint64_t iterations)
+{
+    BENCH_RESULT result;
+    LEGACY_AQI_BUFFER * legacy;
+    ALPAQA_ROLLUP * rollup;
+    uint64_t startNs;
+    uint64_t sum = 0;
+
+    legacy = calloc(1, sizeof(LEGACY_AQI_BUFFER));
+    rollup = malloc(sizeof(ALPAQA_ROLLUP));
+    if(legacy == NULL || rollup == NULL)
+    {
+        free(legacy);
+        free(rollup);
+        return;
+    }
+
+    startNs = benchNowNs();
+    for(uint64_t idx = 0; idx < iterations; idx++)
+    {
+        uint32_t count;
+
+        legacyAdd(legacy, idx % 80, idx % 120);
+        count = legacy->full ? LEGACY_BUFFER_SIZE : legacy->idx;
+        sum += legacy->sumPm2_5 / count;
+    }
+    result.name = "aqi_store_average";
+    result.variant = "legacy_ring";
+    result.iterations = iterations;
+    result.elapsedNs = benchNowNs() - startNs;
+    benchBegin(&result);
+    benchField("bytes", (double)sizeof(LEGACY_AQI_BUFFER));
+    benchField("history_seconds", (double)LEGACY_BUFFER_SIZE);
+    benchField("checksum", (double)sum);
+    benchEnd();
+
+    sum = 0;
+    rollupInit(rollup);
+    startNs = benchNowNs();
+    for(uint64_t idx = 0; idx < iterations; idx++)
+    {
+        uint16_t pm2_5;
+        uint16_t pm10_0;
+
+        rollupAdd(rollup, BENCH_START_SECONDS + idx, idx % 80, idx % 120);
+        rollupWindowAverage(rollup, ROLLUP_DAY, &pm2_5, &pm10_0);
+        sum += pm2_5;
+    }
+    result.variant = "rollup";
+    result.elapsedNs = benchNowNs() - startNs;
+    benchBegin(&result);
+    benchField("bytes", (double)sizeof(ALPAQA_ROLLUP));
+    benchField("history_seconds", (double)(ROLLUP_HOUR_BUCKETS - 2) * ROLLUP_HOUR);
+    benchField("checksum", (double)sum);
+    benchEnd();
+
+    free(legacy);
+    free(rollup);
+}
+
+void benchRollup(const BENCH_OPTIONS * options)
+{
+    benchRollupStore(options->iterations);
+}
@@ -0,0 +1,99 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "../alpaqaStats.h"
+
+#define RESCAN_WINDOW_SECONDS (60 * 60)
+#define RESCAN_ITERATION_DIVISOR 100
+#define BENCH_START_NS 1700000000000000000ULL
+#define BENCH_PERIOD_NS 1000000000ULL
+
+// Synthetic PM trace with drift and spikes, so the deques see both rising and falling runs
+static float benchSample(uint64_t idx)
+{
+    return (float)((idx * 7919) % 97) + (float)((idx / 600) % 40);
+}
+
+// 1 Hz samples into every channel, each updating all windows and averages
+static void benchStatsAdd(uint64_t iterations)
+{
+    BENCH_RESULT result;
+    ALPAQA_STATS * stats;
+    STATS_RANGE range;
+    uint64_t startNs;
+    double sum = 0.0;
+    float * ring;
+    uint64_t rescanIterations = iterations / RESCAN_ITERATION_DIVISOR;
+
+    // The straightforward way for comparison: keep an hour of samples and scan it
+    // for the min and max each time, for one channel and one window only
+    ring = calloc(RESCAN_WINDOW_SECONDS, sizeof(float));
+    if(ring == NULL)
+    {
+        return;
+    }
+    // Timed with the window already full, as it is after the first hour
+    for(uint32_t slot = 0; slot < RESCAN_WINDOW_SECONDS; slot++)
+    {
+        ring[slot] = benchSample(slot);
+    }
+    startNs = benchNowNs();
+    for(uint64_t idx = 0; idx < rescanIterations; idx++)
+    {
+        float min;
+        float max;
+
+        ring[idx % RESCAN_WINDOW_SECONDS] = benchSample(idx);
+        min = ring[0];
+        max = ring[0];
+        for(uint32_t slot = 1; slot < RESCAN_WINDOW_SECONDS; slot++)
+        {
+            min = ring[slot] < min ? ring[slot] : min;
+            max = ring[slot] > max ? ring[slot] : max;
+        }
+        sum += max - min;
+    }
+    result.name = "stats_add";
+    result.variant = "rescan_1ch_1h";
+    result.iterations = rescanIterations;
+    result.elapsedNs = benchNowNs() - startNs;
+    benchBegin(&result);
+    benchField("checksum", sum);
+    benchEnd();
+    free(ring);
+
+    stats = malloc(sizeof(ALPAQA_STATS));
+    if(stats == NULL || !statsInit(stats, NULL))
+    {
+        free(stats);
+        return;
+    }
+    sum = 0.0;
+    startNs = benchNowNs();
+    for(uint64_t idx = 0; idx < iterations; idx++)
+    {
+        uint64_t timeNs = BENCH_START_NS + (idx * BENCH_PERIOD_NS);
+
+        for(int channel = 0; channel < STATS_CHANNEL_COUNT; channel++)
+        {
+            statsAdd(stats, channel, timeNs, benchSample(idx + channel));
+        }
+        statsRange(stats, STATS_PM2_5, 1, &range);
+        sum += range.max - range.min;
+    }
+    result.variant = "deque_6ch_4win_3ewma";
+    result.iterations = iterations;
+    result.elapsedNs = benchNowNs() - startNs;
+    benchBegin(&result);
+    benchField("checksum", sum);
+    benchEnd();
+
+    statsFree(stats);
+    free(stats);
+}
+
+void benchStats(const BENCH_OPTIONS * options)
+{
+    benchStatsAdd(options->iterations);
+}
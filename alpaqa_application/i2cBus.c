@@ -0,0 +1,778 @@
+#include "i2cBus.h"
+#include "PMSA003I.h"
+#include "SHT41.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <linux/i2c-dev.h>
+#include <unistd.h>
+
+#define SYNTHETIC_NO_FRAME UINT64_MAX
+
+static bool realRead(I2C_BUS * bus, uint16_t addr, uint8_t * data, uint16_t length);
+static bool realWrite(I2C_BUS * bus, uint16_t addr, const uint8_t * data, uint16_t length);
+static bool realTransfer(I2C_BUS * bus, I2C_BATCH * batch);
+static void realClose(I2C_BUS * bus);
+static bool syntheticRead(I2C_BUS * bus, uint16_t addr, uint8_t * data, uint16_t length);
+static bool syntheticWrite(I2C_BUS * bus, uint16_t addr, const uint8_t * data, uint16_t length);
+static bool syntheticTransfer(I2C_BUS * bus, I2C_BATCH * batch);
+static void syntheticClose(I2C_BUS * bus);
+static bool replayRead(I2C_BUS * bus, uint16_t addr, uint8_t * data, uint16_t length);
+static bool replayWrite(I2C_BUS * bus, uint16_t addr, const uint8_t * data, uint16_t length);
+static bool replayTransfer(I2C_BUS * bus, I2C_BATCH * batch);
+static void replayClose(I2C_BUS * bus);
+
+static const I2C_BUS_OPS realOps = {realRead, realWrite, realTransfer, realClose};
+static const I2C_BUS_OPS syntheticOps = {syntheticRead, syntheticWrite, syntheticTransfer, syntheticClose};
+static const I2C_BUS_OPS replayOps = {replayRead, replayWrite, replayTransfer, replayClose};
+
+static uint64_t monotonicNs(void);
+static void captureTransfer(I2C_BUS * bus, uint16_t addr, uint8_t direction, const uint8_t * data, uint16_t length);
+static void recordStats(I2C_BUS * bus, uint64_t startNs, uint32_t syscalls, uint32_t messages, bool ok);
+static bool transferEach(I2C_BUS * bus, I2C_BATCH * batch);
+static uint64_t syntheticFrameIndex(I2C_BUS * bus, uint64_t sequence);
+static I2C_SYNTHETIC_SEGMENT * syntheticSegment(I2C_BUS * bus);
+static void syntheticBuildPmFrame(I2C_BUS * bus, uint64_t frameIndex);
+static void syntheticBuildShtFrame(I2C_BUS * bus, uint64_t frameIndex);
+static uint32_t syntheticNoise(uint32_t seed, uint64_t frameIndex, uint32_t channel);
+
+static void initBus(I2C_BUS * bus, I2C_BUS_TYPE type, const I2C_BUS_OPS * ops)
+{
+    memset(bus, 0, sizeof(I2C_BUS));
+    bus->type = type;
+    bus->ops = ops;
+    bus->fd = -1;
+    bus->currentAddr = -1;
+    bus->muxChannel = I2C_MUX_NONE;
+}
+
+bool i2cBusOpenReal(I2C_BUS * bus, const char * deviceFilename)
+{
+    initBus(bus, I2C_BUS_REAL, &realOps);
+    bus->fd = open(deviceFilename, O_RDWR);
+    return bus->fd >= 0;
+}
+
+// The synthetic bus answers at PMSA003I_ADDR and SHT41_ADDR with well formed frames
+// whose values drift slowly, so the full pipeline sees realistic but repeatable input
+bool i2cBusOpenSynthetic(I2C_BUS * bus, float frameRateHz, uint32_t seed)
+{
+    initBus(bus, I2C_BUS_SYNTHETIC, &syntheticOps);
+    bus->synthetic.frameRateHz = frameRateHz;
+    bus->synthetic.seed = seed;
+    bus->synthetic.startNs = monotonicNs();
+    bus->synthetic.muxChannel = I2C_MUX_NONE;
+    for(int idx = 0; idx <= I2C_MUX_CHANNELS; idx++)
+    {
+        bus->synthetic.segments[idx].pmSequence = SYNTHETIC_NO_FRAME;
+        bus->synthetic.segments[idx].shtSequence = SYNTHETIC_NO_FRAME;
+    }
+    return true;
+}
+
+bool i2cBusOpenReplay(I2C_BUS * bus, const char * captureFilename, bool loop)
+{
+    int fd;
+    struct stat fileStat;
+    const I2C_CAPTURE_HEADER * header;
+
+    initBus(bus, I2C_BUS_REPLAY, &replayOps);
+    bus->replay.loop = loop;
+
+    if((fd = open(captureFilename, O_RDONLY)) < 0)
+    {
+        return false;
+    }
+
+    if(fstat(fd, &fileStat) != 0 || fileStat.st_size < (off_t)sizeof(I2C_CAPTURE_HEADER))
+    {
+        close(fd);
+        return false;
+    }
+
+    bus->replay.map = mmap(NULL, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(bus->replay.map == MAP_FAILED)
+    {
+        bus->replay.map = NULL;
+        return false;
+    }
+    bus->replay.mapSize = fileStat.st_size;
+
+    header = (const I2C_CAPTURE_HEADER *)bus->replay.map;
+    if(memcmp(header->magic, I2C_CAPTURE_MAGIC, I2C_CAPTURE_MAGIC_SIZE) != 0 ||
+    header->version != I2C_CAPTURE_VERSION)
+    {
+        replayClose(bus);
+        return false;
+    }
+
+    for(int idx = 0; idx < I2C_BUS_MAX_ADDR; idx++)
+    {
+        bus->replay.cursor[idx] = sizeof(I2C_CAPTURE_HEADER);
+    }
+    return true;
+}
+
+// Any backend can record what it transfers, which is how replay captures are made on real hardware
+bool i2cBusStartCapture(I2C_BUS * bus, const char * captureFilename)
+{
+    I2C_CAPTURE_HEADER header;
+
+    bus->captureFile = fopen(captureFilename, "w");
+    if(bus->captureFile == NULL)
+    {
+        return false;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, I2C_CAPTURE_MAGIC, I2C_CAPTURE_MAGIC_SIZE);
+    header.version = I2C_CAPTURE_VERSION;
+    if(fwrite(&header, sizeof(header), 1, bus->captureFile) != 1)
+    {
+        fclose(bus->captureFile);
+        bus->captureFile = NULL;
+        return false;
+    }
+    return true;
+}
+
+void i2cBusClose(I2C_BUS * bus)
+{
+    if(bus->ops != NULL)
+    {
+        bus->ops->close(bus);
+    }
+    if(bus->captureFile != NULL)
+    {
+        fclose(bus->captureFile);
+        bus->captureFile = NULL;
+    }
+}
+
+// Plain reads and writes select the address first unless it is already selected
+bool i2cBusRead(I2C_BUS * bus, uint16_t addr, uint8_t * data, uint16_t length)
+{
+    uint64_t startNs = monotonicNs();
+    uint32_t syscalls = (bus->currentAddr == addr) ? 1 : 2;
+    bool ok = bus->ops->read(bus, addr, data, length);
+
+    recordStats(bus, startNs, syscalls, 1, ok);
+    if(!ok)
+    {
+        return false;
+    }
+    bus->currentAddr = addr;
+    captureTransfer(bus, addr, I2C_CAPTURE_READ, data, length);
+    return true;
+}
+
+bool i2cBusWrite(I2C_BUS * bus, uint16_t addr, const uint8_t * data, uint16_t length)
+{
+    uint64_t startNs = monotonicNs();
+    uint32_t syscalls = (bus->currentAddr == addr) ? 1 : 2;
+    bool ok = bus->ops->write(bus, addr, data, length);
+
+    recordStats(bus, startNs, syscalls, 1, ok);
+    if(!ok)
+    {
+        return false;
+    }
+    bus->currentAddr = addr;
+    captureTransfer(bus, addr, I2C_CAPTURE_WRITE, data, length);
+    return true;
+}
+
+bool i2cBusTransfer(I2C_BUS * bus, I2C_BATCH * batch)
+{
+    uint64_t startNs;
+    bool ok;
+
+    if(batch->count == 0)
+    {
+        return true;
+    }
+
+    if(bus->legacyTransfers)
+    {
+        return transferEach(bus, batch);
+    }
+
+    startNs = monotonicNs();
+    ok = bus->ops->transfer(bus, batch);
+    recordStats(bus, startNs, 1, batch->count, ok);
+
+    if(!ok)
+    {
+        if(batch->count == 1)
+        {
+            batch->messageOk[0] = false;
+            return false;
+        }
+
+        // Find out which message(s) failed, one transfer each
+        for(uint32_t idx = 0; idx < batch->count; idx++)
+        {
+            I2C_BATCH single;
+
+            single.msgs[0] = batch->msgs[idx];
+            single.count = 1;
+            batch->messageOk[idx] = i2cBusTransfer(bus, &single);
+        }
+        return false;
+    }
+
+    for(uint32_t idx = 0; idx < batch->count; idx++)
+    {
+        batch->messageOk[idx] = true;
+        captureTransfer(bus, batch->msgs[idx].addr,
+                        (batch->msgs[idx].flags & I2C_M_RD) ? I2C_CAPTURE_READ : I2C_CAPTURE_WRITE,
+                        batch->msgs[idx].buf, batch->msgs[idx].len);
+    }
+    return true;
+}
+
+void i2cBatchInit(I2C_BATCH * batch)
+{
+    batch->count = 0;
+}
+
+int i2cBatchAddRead(I2C_BATCH * batch, uint16_t addr, uint8_t * data, uint16_t length)
+{
+    int idx;
+
+    if(batch->count >= I2C_BUS_MAX_MESSAGES)
+    {
+        return -1;
+    }
+
+    idx = batch->count++;
+    batch->msgs[idx].addr = addr;
+    batch->msgs[idx].flags = I2C_M_RD;
+    batch->msgs[idx].len = length;
+    batch->msgs[idx].buf = data;
+    batch->messageOk[idx] = false;
+    return idx;
+}
+
+int i2cBatchAddWrite(I2C_BATCH * batch, uint16_t addr, const uint8_t * data, uint16_t length)
+{
+    int idx;
+
+    if(batch->count >= I2C_BUS_MAX_MESSAGES)
+    {
+        return -1;
+    }
+
+    idx = batch->count++;
+    batch->msgs[idx].addr = addr;
+    batch->msgs[idx].flags = 0;
+    batch->msgs[idx].len = length;
+    // The kernel never writes through a write message's buffer
+    batch->msgs[idx].buf = (uint8_t *)data;
+    batch->messageOk[idx] = false;
+    return idx;
+}
+
+bool i2cBatchMessageOk(const I2C_BATCH * batch, int idx)
+{
+    return idx >= 0 && (uint32_t)idx < batch->count && batch->messageOk[idx];
+}
+
+// The mux only switches on the stop that ends the write, so the select is a transfer
+// of its own ahead of the batch for that channel. Nothing is sent if the channel is
+// already the one connected.
+bool i2cMuxSelect(I2C_BUS * bus, int channel)
+{
+    I2C_BATCH batch;
+    uint8_t mask;
+
+    if(channel < 0 || channel >= I2C_MUX_CHANNELS)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    if(channel == bus->muxChannel)
+    {
+        return true;
+    }
+
+    mask = 1 << channel;
+    i2cBatchInit(&batch);
+    i2cBatchAddWrite(&batch, I2C_MUX_ADDR, &mask, sizeof(mask));
+    bus->muxChannel = i2cBusTransfer(bus, &batch) ? channel : I2C_MUX_NONE;
+    return bus->muxChannel == channel;
+}
+
+// Sensors on a real bus need time to convert. Simulated ones answer immediately so
+// the pipeline can be driven as fast as it will go.
+void i2cBusConversionWait(I2C_BUS * bus, uint32_t waitMs)
+{
+    struct timespec ts;
+
+    if(bus->type != I2C_BUS_REAL)
+    {
+        return;
+    }
+
+    ts.tv_sec = 0;
+    ts.tv_nsec = waitMs * 1000000;
+    nanosleep(&ts, NULL);
+}
+
+// Sleeps until an absolute CLOCK_MONOTONIC time, so work done since a command was
+// issued comes off the wait instead of adding to it
+void i2cBusWaitUntil(I2C_BUS * bus, const struct timespec * deadline)
+{
+    if(bus->type != I2C_BUS_REAL)
+    {
+        return;
+    }
+
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL) == EINTR)
+    {
+    }
+}
+
+// When a conversion started at "start" will be done. Simulated sensors are done immediately.
+void i2cBusConversionDeadline(I2C_BUS * bus, const struct timespec * start, uint32_t waitMs, struct timespec * deadline)
+{
+    *deadline = *start;
+    if(bus->type != I2C_BUS_REAL)
+    {
+        return;
+    }
+
+    deadline->tv_sec += waitMs / 1000;
+    deadline->tv_nsec += (waitMs % 1000) * 1000000L;
+    if(deadline->tv_nsec >= 1000000000L)
+    {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+static uint64_t monotonicNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static void recordStats(I2C_BUS * bus, uint64_t startNs, uint32_t syscalls, uint32_t messages, bool ok)
+{
+    uint64_t elapsedNs = monotonicNs() - startNs;
+
+    bus->stats.syscalls += syscalls;
+    bus->stats.transfers++;
+    bus->stats.messages += messages;
+    bus->stats.totalNs += elapsedNs;
+    if(elapsedNs > bus->stats.maxNs)
+    {
+        bus->stats.maxNs = elapsedNs;
+    }
+    if(!ok)
+    {
+        bus->stats.failures++;
+    }
+}
+
+// Old style access: every message selects its address and then reads or writes
+static bool transferEach(I2C_BUS * bus, I2C_BATCH * batch)
+{
+    bool allOk = true;
+
+    for(uint32_t idx = 0; idx < batch->count; idx++)
+    {
+        struct i2c_msg * msg = &batch->msgs[idx];
+
+        if(msg->flags & I2C_M_RD)
+        {
+            batch->messageOk[idx] = i2cBusRead(bus, msg->addr, msg->buf, msg->len);
+        }
+        else
+        {
+            batch->messageOk[idx] = i2cBusWrite(bus, msg->addr, msg->buf, msg->len);
+        }
+        allOk = allOk && batch->messageOk[idx];
+    }
+    return allOk;
+}
+
+static void captureTransfer(I2C_BUS * bus, uint16_t addr, uint8_t direction, const uint8_t * data, uint16_t length)
+{
+    I2C_CAPTURE_RECORD record;
+
+    if(bus->captureFile == NULL)
+    {
+        return;
+    }
+
+    memset(&record, 0, sizeof(record));
+    record.timestampNs = monotonicNs();
+    record.addr = addr;
+    record.direction = direction;
+    record.length = length;
+    fwrite(&record, sizeof(record), 1, bus->captureFile);
+    fwrite(data, length, 1, bus->captureFile);
+}
+
+//
+// Real /dev/i2c-N backend
+//
+static bool realSelect(I2C_BUS * bus, uint16_t addr)
+{
+    if(bus->currentAddr == addr)
+    {
+        return true;
+    }
+    if(ioctl(bus->fd, I2C_SLAVE, addr) < 0)
+    {
+        // Failed to acquire bus access or communicate with device
+        return false;
+    }
+    bus->currentAddr = addr;
+    return true;
+}
+
+static bool realRead(I2C_BUS * bus, uint16_t addr, uint8_t * data, uint16_t length)
+{
+    if(bus->fd < 0 || !realSelect(bus, addr))
+    {
+        return false;
+    }
+    return read(bus->fd, data, length) == length;
+}
+
+static bool realWrite(I2C_BUS * bus, uint16_t addr, const uint8_t * data, uint16_t length)
+{
+    if(bus->fd < 0 || !realSelect(bus, addr))
+    {
+        return false;
+    }
+    return write(bus->fd, data, length) == length;
+}
+
+// All messages go out in one kernel transition with repeated starts between them
+static bool realTransfer(I2C_BUS * bus, I2C_BATCH * batch)
+{
+    struct i2c_rdwr_ioctl_data rdwr;
+
+    if(bus->fd < 0)
+    {
+        return false;
+    }
+
+    rdwr.msgs = batch->msgs;
+    rdwr.nmsgs = batch->count;
+    return ioctl(bus->fd, I2C_RDWR, &rdwr) == (int)batch->count;
+}
+
+static void realClose(I2C_BUS * bus)
+{
+    if(bus->fd >= 0)
+    {
+        close(bus->fd);
+        bus->fd = -1;
+    }
+}
+
+//
+// Synthetic backend
+//
+static bool syntheticRead(I2C_BUS * bus, uint16_t addr, uint8_t * data, uint16_t length)
+{
+    I2C_SYNTHETIC_SEGMENT * state = syntheticSegment(bus);
+    uint64_t frameIndex;
+
+    switch(addr)
+    {
+        case PMSA003I_ADDR:
+            // The PMSA003I streams continuously, a read returns whatever frame is current
+            frameIndex = syntheticFrameIndex(bus, state->pmSequence);
+            if(frameIndex != state->pmSequence)
+            {
+                syntheticBuildPmFrame(bus, frameIndex);
+                state->pmSequence = frameIndex;
+            }
+            if(length > I2C_BUS_PMSA003I_FRAME_BYTES)
+            {
+                return false;
+            }
+            memcpy(data, state->pmFrame, length);
+            return true;
+
+        case SHT41_ADDR:
+            // Nothing to read until a measurement has been requested
+            if(state->shtSequence == SYNTHETIC_NO_FRAME || length > I2C_BUS_SHT41_FRAME_BYTES)
+            {
+                return false;
+            }
+            memcpy(data, state->shtFrame, length);
+            return true;
+
+        default:
+            // No device acknowledges at this address
+            return false;
+    }
+}
+
+static bool syntheticWrite(I2C_BUS * bus, uint16_t addr, const uint8_t * data, uint16_t length)
+{
+    I2C_SYNTHETIC_SEGMENT * state = syntheticSegment(bus);
+    uint64_t frameIndex;
+
+    switch(addr)
+    {
+        case PMSA003I_ADDR:
+            return true;
+
+        case I2C_MUX_ADDR:
+            // Connects the lowest channel in the mask, the only way the app drives it
+            if(length < 1)
+            {
+                return false;
+            }
+            bus->synthetic.muxChannel = data[0] != 0 ? __builtin_ctz(data[0]) : I2C_MUX_NONE;
+            return true;
+
+        case SHT41_ADDR:
+            // Any command starts a measurement, what it asks for does not matter
+            if(length < 1)
+            {
+                return false;
+            }
+            frameIndex = syntheticFrameIndex(bus, state->shtSequence);
+            if(frameIndex != state->shtSequence)
+            {
+                syntheticBuildShtFrame(bus, frameIndex);
+                state->shtSequence = frameIndex;
+            }
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+// The simulated buses run messages in order and stop at the first one that is
+// not acknowledged, like the kernel adapter does
+static bool simulatedTransfer(I2C_BUS * bus, I2C_BATCH * batch)
+{
+    for(uint32_t idx = 0; idx < batch->count; idx++)
+    {
+        struct i2c_msg * msg = &batch->msgs[idx];
+        bool ok;
+
+        if(msg->flags & I2C_M_RD)
+        {
+            ok = bus->ops->read(bus, msg->addr, msg->buf, msg->len);
+        }
+        else
+        {
+            ok = bus->ops->write(bus, msg->addr, msg->buf, msg->len);
+        }
+
+        if(!ok)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool syntheticTransfer(I2C_BUS * bus, I2C_BATCH * batch)
+{
+    return simulatedTransfer(bus, batch);
+}
+
+static void syntheticClose(I2C_BUS * bus)
+{
+    (void)bus;
+}
+
+static I2C_SYNTHETIC_SEGMENT * syntheticSegment(I2C_BUS * bus)
+{
+    return &bus->synthetic.segments[bus->synthetic.muxChannel + 1];
+}
+
+// With no frame rate every access produces the next frame, otherwise the frame index
+// follows wall time the same way a free running sensor would
+static uint64_t syntheticFrameIndex(I2C_BUS * bus, uint64_t sequence)
+{
+    I2C_SYNTHETIC_STATE * state = &bus->synthetic;
+
+    if(state->frameRateHz <= 0)
+    {
+        return sequence == SYNTHETIC_NO_FRAME ? 0 : sequence + 1;
+    }
+    return (uint64_t)((double)(monotonicNs() - state->startNs) * state->frameRateHz / 1e9);
+}
+
+static uint32_t syntheticNoise(uint32_t seed, uint64_t frameIndex, uint32_t channel)
+{
+    // Stateless hash so a given seed and frame index always give the same frame
+    uint64_t value = frameIndex * 0x9E3779B97F4A7C15ULL + ((uint64_t)seed << 32) + channel;
+    value ^= value >> 33;
+    value *= 0xFF51AFD7ED558CCDULL;
+    value ^= value >> 33;
+    value *= 0xC4CEB9FE1A85EC53ULL;
+    value ^= value >> 33;
+    return (uint32_t)value;
+}
+
+static void putWord(uint8_t * frame, int offset, uint16_t value)
+{
+    frame[offset] = value >> 8;
+    frame[offset + 1] = value & 0xFF;
+}
+
+static void syntheticBuildPmFrame(I2C_BUS * bus, uint64_t frameIndex)
+{
+    uint8_t * frame = syntheticSegment(bus)->pmFrame;
+    // Sensors behind the mux read a little higher per channel, so rooms can be told apart
+    uint32_t segment = bus->synthetic.muxChannel + 1;
+    uint32_t seed = bus->synthetic.seed + segment;
+    double pm2_5;
+    uint16_t pm1_0Value;
+    uint16_t pm2_5Value;
+    uint16_t pm10_0Value;
+    uint16_t checksum;
+
+    // Slow ten minute swell with a little noise on top
+    pm2_5 = 14.0 + (4.0 * segment) + 10.0 * sin(2.0 * M_PI * (double)frameIndex / 600.0);
+    pm2_5Value = (uint16_t)(pm2_5 + (syntheticNoise(seed, frameIndex, 0) % 4));
+    pm1_0Value = (uint16_t)(pm2_5Value * 0.7);
+    pm10_0Value = (uint16_t)(pm2_5Value * 1.4 + (syntheticNoise(seed, frameIndex, 1) % 6));
+
+    memset(frame, 0, I2C_BUS_PMSA003I_FRAME_BYTES);
+    frame[0] = 0x42;
+    frame[1] = 0x4D;
+    putWord(frame, 2, 2 * 13 + 2);
+    // Standard particles (CF=1) and environmental units
+    putWord(frame, 4, pm1_0Value);
+    putWord(frame, 6, pm2_5Value);
+    putWord(frame, 8, pm10_0Value);
+    putWord(frame, 10, pm1_0Value);
+    putWord(frame, 12, pm2_5Value);
+    putWord(frame, 14, pm10_0Value);
+    // Particle counts per 0.1L for >0.3, >0.5, >1.0, >2.5, >5.0 and >10 um
+    putWord(frame, 16, pm2_5Value * 120);
+    putWord(frame, 18, pm2_5Value * 36);
+    putWord(frame, 20, pm2_5Value * 7);
+    putWord(frame, 22, pm2_5Value);
+    putWord(frame, 24, pm10_0Value / 4);
+    putWord(frame, 26, pm10_0Value / 16);
+
+    checksum = 0;
+    for(int idx = 0; idx < I2C_BUS_PMSA003I_FRAME_BYTES - 2; idx++)
+    {
+        checksum += frame[idx];
+    }
+    putWord(frame, 30, checksum);
+
+    bus->synthetic.framesGenerated++;
+}
+
+static void syntheticBuildShtFrame(I2C_BUS * bus, uint64_t frameIndex)
+{
+    uint8_t * frame = syntheticSegment(bus)->shtFrame;
+    uint32_t segment = bus->synthetic.muxChannel + 1;
+    double temperatureC;
+    double humidity;
+    uint16_t rawTemperature;
+    uint16_t rawHumidity;
+
+    // Hourly temperature swing with humidity moving the other way
+    temperatureC = 22.0 + (0.5 * segment) + 3.0 * sin(2.0 * M_PI * (double)frameIndex / 3600.0);
+    temperatureC += (double)(syntheticNoise(bus->synthetic.seed + segment, frameIndex, 2) % 100) / 1000.0;
+    humidity = 45.0 - 10.0 * sin(2.0 * M_PI * (double)frameIndex / 3600.0);
+
+    // Inverse of the datasheet conversions used in SHT41.c
+    rawTemperature = (uint16_t)((temperatureC + 45.0) * 65535.0 / 175.0);
+    rawHumidity = (uint16_t)((humidity + 6.0) * 65535.0 / 125.0);
+
+    putWord(frame, 0, rawTemperature);
+    frame[2] = tempAndHumidityCrc(&frame[0], 2);
+    putWord(frame, 3, rawHumidity);
+    frame[5] = tempAndHumidityCrc(&frame[3], 2);
+
+    bus->synthetic.framesGenerated++;
+}
+
+//
+// Replay backend
+//
+static bool replayRead(I2C_BUS * bus, uint16_t addr, uint8_t * data, uint16_t length)
+{
+    I2C_REPLAY_STATE * state = &bus->replay;
+    size_t cursor;
+    bool wrapped = false;
+
+    if(state->map == NULL || addr >= I2C_BUS_MAX_ADDR)
+    {
+        return false;
+    }
+
+    // Walk forward from where this address last left off to its next recorded read
+    cursor = state->cursor[addr];
+    while(true)
+    {
+        const I2C_CAPTURE_RECORD * record;
+
+        if(cursor + sizeof(I2C_CAPTURE_RECORD) > state->mapSize)
+        {
+            if(!state->loop || wrapped)
+            {
+                return false;
+            }
+            cursor = sizeof(I2C_CAPTURE_HEADER);
+            wrapped = true;
+            continue;
+        }
+
+        record = (const I2C_CAPTURE_RECORD *)(state->map + cursor);
+        if(cursor + sizeof(I2C_CAPTURE_RECORD) + record->length > state->mapSize)
+        {
+            // Truncated capture, treat as the end
+            cursor = state->mapSize;
+            continue;
+        }
+
+        cursor += sizeof(I2C_CAPTURE_RECORD) + record->length;
+        if(record->addr == addr && record->direction == I2C_CAPTURE_READ && record->length == length)
+        {
+            memcpy(data, record + 1, length);
+            state->cursor[addr] = cursor;
+            return true;
+        }
+    }
+}
+
+static bool replayWrite(I2C_BUS * bus, uint16_t addr, const uint8_t * data, uint16_t length)
+{
+    // Commands have no effect on recorded data
+    (void)data;
+    (void)length;
+    return bus->replay.map != NULL && addr < I2C_BUS_MAX_ADDR;
+}
+
+static bool replayTransfer(I2C_BUS * bus, I2C_BATCH * batch)
+{
+    return simulatedTransfer(bus, batch);
+}
+
+static void replayClose(I2C_BUS * bus)
+{
+    if(bus->replay.map != NULL)
+    {
+        munmap(bus->replay.map, bus->replay.mapSize);
+        bus->replay.map = NULL;
+    }
+}
@@ -0,0 +1,155 @@
+#ifndef I2CBUS_H
+#define I2CBUS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <time.h>
+#include <linux/i2c.h>
+
+// Frame layout constants shared by the synthetic and replay backends
+#define I2C_BUS_PMSA003I_FRAME_BYTES 32
+#define I2C_BUS_SHT41_FRAME_BYTES 6
+
+#define I2C_BUS_MAX_ADDR 128
+#define I2C_BUS_MAX_MESSAGES 16
+
+// TCA9548A style mux: a one byte write to it picks which of its channels is connected
+#define I2C_MUX_ADDR 0x70
+#define I2C_MUX_CHANNELS 8
+#define I2C_MUX_NONE -1
+
+#define I2C_CAPTURE_MAGIC "AQI2CCAP"
+#define I2C_CAPTURE_MAGIC_SIZE 8
+#define I2C_CAPTURE_VERSION 1
+#define I2C_CAPTURE_READ 0x01
+#define I2C_CAPTURE_WRITE 0x02
+
+typedef enum
+{
+    I2C_BUS_REAL = 0,
+    I2C_BUS_SYNTHETIC,
+    I2C_BUS_REPLAY
+} I2C_BUS_TYPE;
+
+typedef struct I2C_BUS I2C_BUS;
+
+// A batch of address-tagged messages that goes to the bus in one I2C_RDWR call.
+// The adapter stops at the first NACK, so a failed batch is split up and retried
+// one message at a time to find out which device is missing.
+typedef struct
+{
+    struct i2c_msg msgs[I2C_BUS_MAX_MESSAGES];
+    bool messageOk[I2C_BUS_MAX_MESSAGES];
+    uint32_t count;
+} I2C_BATCH;
+
+// Each backend provides raw address-tagged reads and writes plus combined transfers.
+// The sensor drivers only ever talk to the bus through these, never to a file descriptor directly.
+typedef struct
+{
+    bool (*read)(I2C_BUS * bus, uint16_t addr, uint8_t * data, uint16_t length);
+    bool (*write)(I2C_BUS * bus, uint16_t addr, const uint8_t * data, uint16_t length);
+    bool (*transfer)(I2C_BUS * bus, I2C_BATCH * batch);
+    void (*close)(I2C_BUS * bus);
+} I2C_BUS_OPS;
+
+// Syscalls are counted as the real /dev/i2c-N path would issue them, so the
+// simulated backends report what a given access pattern costs on hardware
+typedef struct
+{
+    uint64_t syscalls;
+    uint64_t transfers;
+    uint64_t messages;
+    uint64_t failures;
+    uint64_t totalNs;
+    uint64_t maxNs;
+} I2C_BUS_STATS;
+
+// Capture files are a fixed header followed by these records, each followed by
+// "length" bytes of bus data
+typedef struct
+{
+    char magic[I2C_CAPTURE_MAGIC_SIZE];
+    uint32_t version;
+    uint32_t reserved;
+} I2C_CAPTURE_HEADER;
+
+typedef struct
+{
+    uint64_t timestampNs;
+    uint16_t addr;
+    uint8_t direction;
+    uint8_t reserved;
+    uint16_t length;
+    uint16_t reserved2;
+} I2C_CAPTURE_RECORD;
+
+// One set of synthetic sensors: the ones on the bus itself or behind one mux channel
+typedef struct
+{
+    uint8_t pmFrame[I2C_BUS_PMSA003I_FRAME_BYTES];
+    uint8_t shtFrame[I2C_BUS_SHT41_FRAME_BYTES];
+    uint64_t pmSequence;
+    uint64_t shtSequence;
+} I2C_SYNTHETIC_SEGMENT;
+
+typedef struct
+{
+    // Synthetic sensors produce a new frame this often. 0 means every read gets a new frame.
+    float frameRateHz;
+    uint32_t seed;
+    uint64_t framesGenerated;
+    uint64_t startNs;
+    // The synthetic mux answers at I2C_MUX_ADDR. Segment 0 is the bus itself, used
+    // while no channel is selected, and segment N + 1 is behind channel N.
+    int muxChannel;
+    I2C_SYNTHETIC_SEGMENT segments[I2C_MUX_CHANNELS + 1];
+} I2C_SYNTHETIC_STATE;
+
+typedef struct
+{
+    uint8_t * map;
+    size_t mapSize;
+    // Per 7-bit address read cursor into the capture
+    size_t cursor[I2C_BUS_MAX_ADDR];
+    bool loop;
+} I2C_REPLAY_STATE;
+
+struct I2C_BUS
+{
+    const I2C_BUS_OPS * ops;
+    I2C_BUS_TYPE type;
+    int fd;
+    int currentAddr;
+    // Channel the mux was last set to, I2C_MUX_NONE until then or after a failed select
+    int muxChannel;
+    // Issue batches as I2C_SLAVE + read()/write() per message, as the drivers used to
+    bool legacyTransfers;
+    I2C_BUS_STATS stats;
+    FILE * captureFile;
+    I2C_SYNTHETIC_STATE synthetic;
+    I2C_REPLAY_STATE replay;
+};
+
+bool i2cBusOpenReal(I2C_BUS * bus, const char * deviceFilename);
+bool i2cBusOpenSynthetic(I2C_BUS * bus, float frameRateHz, uint32_t seed);
+bool i2cBusOpenReplay(I2C_BUS * bus, const char * captureFilename, bool loop);
+bool i2cBusStartCapture(I2C_BUS * bus, const char * captureFilename);
+void i2cBusClose(I2C_BUS * bus);
+
+bool i2cBusRead(I2C_BUS * bus, uint16_t addr, uint8_t * data, uint16_t length);
+bool i2cBusWrite(I2C_BUS * bus, uint16_t addr, const uint8_t * data, uint16_t length);
+bool i2cBusTransfer(I2C_BUS * bus, I2C_BATCH * batch);
+void i2cBusConversionWait(I2C_BUS * bus, uint32_t waitMs);
+void i2cBusWaitUntil(I2C_BUS * bus, const struct timespec * deadline);
+void i2cBusConversionDeadline(I2C_BUS * bus, const struct timespec * start, uint32_t waitMs, struct timespec * deadline);
+bool i2cMuxSelect(I2C_BUS * bus, int channel);
+
+void i2cBatchInit(I2C_BATCH * batch);
+int i2cBatchAddRead(I2C_BATCH * batch, uint16_t addr, uint8_t * data, uint16_t length);
+int i2cBatchAddWrite(I2C_BATCH * batch, uint16_t addr, const uint8_t * data, uint16_t length);
+bool i2cBatchMessageOk(const I2C_BATCH * batch, int idx);
+
+#endif
@@ -0,0 +1,380 @@
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../alpaqaTime.h"
+
+#define DEFAULT_SOCKET "/var/run/alpaqa.sock"
+#define DEFAULT_CONNECTIONS 100
+#define DEFAULT_SECONDS 10
+#define REQUEST_SIZE 256
+#define RESPONSE_SIZE (256 * 1024)
+#define MAX_EVENTS 256
+
+typedef struct
+{
+    int fd;
+    bool sending;
+    uint64_t startNs;
+    size_t requestSent;
+    size_t responseLength;
+    char * response;
+} LOAD_CONNECTION;
+
+typedef struct
+{
+    const char * socketPath;
+    uint16_t port;
+    const char * path;
+    int connections;
+    uint32_t seconds;
+} LOAD_OPTIONS;
+
+typedef struct
+{
+    uint64_t * latencies;
+    size_t count;
+    size_t capacity;
+    uint64_t errors;
+    uint64_t reconnects;
+    uint64_t bytes;
+} LOAD_RESULTS;
+
+static char request[REQUEST_SIZE];
+static size_t requestLength;
+
+static int openConnection(const LOAD_OPTIONS * options)
+{
+    int fd;
+
+    if(options->port != 0)
+    {
+        struct sockaddr_in address;
+
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons(options->port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if(fd >= 0 && connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0 && errno != EINPROGRESS)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+    else
+    {
+        struct sockaddr_un address;
+
+        // A non-blocking Unix connect fails outright on a full backlog, so this one waits
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, options->socketPath, sizeof(address.sun_path) - 1);
+        if(fd >= 0 && (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+           fcntl(fd, F_SETFL, O_NONBLOCK) != 0))
+        {
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+static bool startConnection(int epollFd, const LOAD_OPTIONS * options, LOAD_CONNECTION * connection, uint32_t token)
+{
+    struct epoll_event event;
+
+    connection->fd = openConnection(options);
+    if(connection->fd < 0)
+    {
+        return false;
+    }
+    connection->sending = true;
+    connection->requestSent = 0;
+    connection->responseLength = 0;
+    connection->startNs = monotonicNowNs();
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLOUT;
+    event.data.u32 = token;
+    return epoll_ctl(epollFd, EPOLL_CTL_ADD, connection->fd, &event) == 0;
+}
+
+static void recordLatency(LOAD_RESULTS * results, uint64_t latencyNs)
+{
+    if(results->count == results->capacity)
+    {
+        size_t capacity = results->capacity > 0 ? results->capacity * 2 : 65536;
+        uint64_t * latencies = realloc(results->latencies, capacity * sizeof(uint64_t));
+
+        if(latencies == NULL)
+        {
+            return;
+        }
+        results->latencies = latencies;
+        results->capacity = capacity;
+    }
+    results->latencies[results->count++] = latencyNs;
+}
+
+// Returns the length of a complete response, 0 while more is needed and -1 if it cannot be parsed
+static long responseComplete(LOAD_CONNECTION * connection, bool * keepAlive)
+{
+    char * end;
+    char * field;
+    size_t headerLength;
+    size_t contentLength = 0;
+
+    connection->response[connection->responseLength] = '\0';
+    end = strstr(connection->response, "\r\n\r\n");
+    if(end == NULL)
+    {
+        return connection->responseLength >= RESPONSE_SIZE - 1 ? -1 : 0;
+    }
+    headerLength = (end + 4) - connection->response;
+    if(strncmp(connection->response, "HTTP/1.1 2", 10) != 0)
+    {
+        return -1;
+    }
+
+    field = strcasestr(connection->response, "\r\ncontent-length:");
+    if(field != NULL && field < end)
+    {
+        contentLength = strtoul(field + 17, NULL, 10);
+    }
+    field = strcasestr(connection->response, "\r\nconnection: close");
+    *keepAlive = field == NULL || field > end;
+
+    if(connection->responseLength < headerLength + contentLength)
+    {
+        return 0;
+    }
+    return headerLength + contentLength;
+}
+
+static int compareLatency(const void * a, const void * b)
+{
+    uint64_t left = *(const uint64_t *)a;
+    uint64_t right = *(const uint64_t *)b;
+
+    return left < right ? -1 : left > right;
+}
+
+static double percentileUs(const LOAD_RESULTS * results, double percentile)
+{
+    size_t idx;
+
+    if(results->count == 0)
+    {
+        return 0.0;
+    }
+    idx = (size_t)(percentile / 100.0 * (results->count - 1) + 0.5);
+    return (double)results->latencies[idx] / 1000.0;
+}
+
+// Keeps every connection busy with back to back requests and times each one
+// from the first byte sent to the last byte of the response
+static bool runLoad(const LOAD_OPTIONS * options, LOAD_RESULTS * results)
+{
+    struct epoll_event events[MAX_EVENTS];
+    LOAD_CONNECTION * connections;
+    uint64_t endNs;
+    int epollFd;
+
+    connections = calloc(options->connections, sizeof(LOAD_CONNECTION));
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if(connections == NULL || epollFd < 0)
+    {
+        free(connections);
+        return false;
+    }
+
+    for(int idx = 0; idx < options->connections; idx++)
+    {
+        connections[idx].response = malloc(RESPONSE_SIZE);
+        if(connections[idx].response == NULL || !startConnection(epollFd, options, &connections[idx], idx))
+        {
+            fprintf(stderr, "Failed to connect! errno: %d\n", errno);
+            return false;
+        }
+    }
+
+    endNs = monotonicNowNs() + (options->seconds * NS_PER_SECOND);
+    while(monotonicNowNs() < endNs)
+    {
+        int count = epoll_wait(epollFd, events, MAX_EVENTS, 100);
+
+        for(int idx = 0; idx < count; idx++)
+        {
+            LOAD_CONNECTION * connection = &connections[events[idx].data.u32];
+            struct epoll_event event;
+            bool keepAlive = true;
+            bool failed = false;
+            ssize_t length;
+            long complete;
+
+            if(connection->sending && (events[idx].events & EPOLLOUT))
+            {
+                length = send(connection->fd, request + connection->requestSent,
+                              requestLength - connection->requestSent, MSG_NOSIGNAL);
+                if(length < 0 && errno != EAGAIN)
+                {
+                    failed = true;
+                }
+                else if(length > 0 && (connection->requestSent += length) == requestLength)
+                {
+                    connection->sending = false;
+                    memset(&event, 0, sizeof(event));
+                    event.events = EPOLLIN;
+                    event.data.u32 = events[idx].data.u32;
+                    epoll_ctl(epollFd, EPOLL_CTL_MOD, connection->fd, &event);
+                }
+            }
+
+            if(!failed && !connection->sending && (events[idx].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+            {
+                length = recv(connection->fd, connection->response + connection->responseLength,
+                              RESPONSE_SIZE - 1 - connection->responseLength, 0);
+                if(length == 0 || (length < 0 && errno != EAGAIN))
+                {
+                    failed = true;
+                }
+                else if(length > 0)
+                {
+                    connection->responseLength += length;
+                    results->bytes += length;
+                    complete = responseComplete(connection, &keepAlive);
+                    if(complete < 0)
+                    {
+                        failed = true;
+                    }
+                    else if(complete > 0)
+                    {
+                        recordLatency(results, monotonicNowNs() - connection->startNs);
+                        if(keepAlive)
+                        {
+                            connection->sending = true;
+                            connection->requestSent = 0;
+                            connection->responseLength = 0;
+                            connection->startNs = monotonicNowNs();
+                            memset(&event, 0, sizeof(event));
+                            event.events = EPOLLIN | EPOLLOUT;
+                            event.data.u32 = events[idx].data.u32;
+                            epoll_ctl(epollFd, EPOLL_CTL_MOD, connection->fd, &event);
+                        }
+                    }
+                }
+            }
+
+            if(failed || !keepAlive)
+            {
+                if(failed)
+                {
+                    results->errors++;
+                }
+                results->reconnects++;
+                close(connection->fd);
+                if(!startConnection(epollFd, options, connection, events[idx].data.u32))
+                {
+                    fprintf(stderr, "Failed to reconnect! errno: %d\n", errno);
+                    return false;
+                }
+            }
+        }
+    }
+
+    for(int idx = 0; idx < options->connections; idx++)
+    {
+        close(connections[idx].fd);
+        free(connections[idx].response);
+    }
+    free(connections);
+    close(epollFd);
+    return true;
+}
+
+int main(int argc, char * argv[])
+{
+    LOAD_OPTIONS options;
+    LOAD_RESULTS results;
+    uint64_t startNs;
+    double elapsed;
+    int opt;
+
+    memset(&options, 0, sizeof(options));
+    memset(&results, 0, sizeof(results));
+    options.socketPath = DEFAULT_SOCKET;
+    options.path = "/now";
+    options.connections = DEFAULT_CONNECTIONS;
+    options.seconds = DEFAULT_SECONDS;
+
+    while((opt = getopt(argc, argv, "U:P:c:d:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'U':
+                options.socketPath = optarg;
+                break;
+            case 'P':
+                options.port = strtoul(optarg, NULL, 0);
+                break;
+            case 'c':
+                options.connections = strtol(optarg, NULL, 0);
+                break;
+            case 'd':
+                options.seconds = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-U server socket] [-P localhost port, used instead of the socket]\n"
+                        "       [-c connections] [-d seconds] [path, default /now]\n", argv[0]);
+                return 1;
+        }
+    }
+    if(optind < argc)
+    {
+        options.path = argv[optind];
+    }
+    if(options.connections <= 0)
+    {
+        options.connections = 1;
+    }
+
+    requestLength = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n", options.path);
+    if(requestLength >= sizeof(request))
+    {
+        fprintf(stderr, "Path too long\n");
+        return 1;
+    }
+
+    startNs = monotonicNowNs();
+    if(!runLoad(&options, &results))
+    {
+        return 1;
+    }
+    elapsed = (double)(monotonicNowNs() - startNs) / NS_PER_SECOND;
+
+    qsort(results.latencies, results.count, sizeof(uint64_t), compareLatency);
+    printf("{\"path\":\"%s\",\"connections\":%d,\"seconds\":%0.2f,\"requests\":%zu,\"requests_per_s\":%0.0f,"
+           "\"mb_per_s\":%0.2f,\"errors\":%llu,\"reconnects\":%llu,"
+           "\"p50_us\":%0.1f,\"p99_us\":%0.1f,\"p999_us\":%0.1f,\"max_us\":%0.1f}\n",
+           options.path, options.connections, elapsed, results.count, results.count / elapsed,
+           results.bytes / elapsed / (1024.0 * 1024.0), (unsigned long long)results.errors,
+           (unsigned long long)results.reconnects, percentileUs(&results, 50.0), percentileUs(&results, 99.0),
+           percentileUs(&results, 99.9), percentileUs(&results, 100.0));
+
+    free(results.latencies);
+    return 0;
+}
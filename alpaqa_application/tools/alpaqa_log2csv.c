@@ -0,0 +1,226 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../alpaqaArchive.h"
+#include "../alpaqaLog.h"
+#include "../alpaqaLogIndex.h"
+#include "../alpaqaTime.h"
+
+#define LINE_SIZE 256
+#define OUTPUT_BUFFER_SIZE (1 << 16)
+
+// Converts binary alpaqa logs back to the text format alpaqa_app used to write, one
+// location at a time since the text format never had more than one
+static bool convertLog(const char * filename, bool timestamp, uint8_t location, FILE * output)
+{
+    ALPAQA_LOG_READER reader;
+    char line[LINE_SIZE];
+    int length;
+
+    if(!alpaqaLogReaderOpen(&reader, filename))
+    {
+        fprintf(stderr, "Failed to open log %s! errno: %d\n", filename, errno);
+        return false;
+    }
+
+    for(uint64_t idx = 0; idx < reader.count; idx++)
+    {
+        const ALPAQA_LOG_RECORD * record = alpaqaLogReaderGet(&reader, idx);
+
+        if(record->location != location)
+        {
+            continue;
+        }
+        length = alpaqaLogFormatCsv(record, timestamp, line, sizeof(line));
+        if(length > 0)
+        {
+            fwrite(line, length, sizeof(char), output);
+        }
+    }
+
+    alpaqaLogReaderClose(&reader);
+    return true;
+}
+
+// Only the records from fromNs up to toNs, found through the log's index
+static bool convertRange(const char * filename, bool timestamp, uint8_t location, uint64_t fromNs, uint64_t toNs,
+                         FILE * output)
+{
+    ALPAQA_LOG_QUERY query;
+    const ALPAQA_LOG_RECORD * record;
+    char line[LINE_SIZE];
+    int length;
+
+    if(!alpaqaLogQueryOpen(&query, filename))
+    {
+        fprintf(stderr, "Failed to open log %s! errno: %d\n", filename, errno);
+        return false;
+    }
+    if(!alpaqaLogQueryIndexed(&query))
+    {
+        fprintf(stderr, "No index for %s, scanning all of it\n", filename);
+    }
+
+    alpaqaLogQueryStart(&query, fromNs, toNs);
+    while((record = alpaqaLogQueryNext(&query)) != NULL)
+    {
+        if(record->location != location)
+        {
+            continue;
+        }
+        length = alpaqaLogFormatCsv(record, timestamp, line, sizeof(line));
+        if(length > 0)
+        {
+            fwrite(line, length, sizeof(char), output);
+        }
+    }
+
+    alpaqaLogQueryClose(&query);
+    return true;
+}
+
+// Archives are read a block at a time, whatever the range. They hold a segment
+// each, so there is little to skip.
+static bool convertArchive(const char * filename, bool timestamp, uint8_t location, uint64_t fromNs, uint64_t toNs,
+                           FILE * output)
+{
+    ALPAQA_ARCHIVE_READER reader;
+    const ALPAQA_LOG_RECORD * records;
+    char line[LINE_SIZE];
+    uint32_t count;
+    bool corrupt;
+    int length;
+
+    if(!archiveReaderOpen(&reader, filename))
+    {
+        fprintf(stderr, "Failed to open archive %s! errno: %d\n", filename, errno);
+        return false;
+    }
+
+    while((count = archiveReaderNextBlock(&reader, &records)) > 0)
+    {
+        for(uint32_t idx = 0; idx < count; idx++)
+        {
+            uint64_t timeNs = alpaqaLogRecordTimeNs(&records[idx]);
+
+            if(records[idx].location != location || timeNs < fromNs || timeNs >= toNs)
+            {
+                continue;
+            }
+            length = alpaqaLogFormatCsv(&records[idx], timestamp, line, sizeof(line));
+            if(length > 0)
+            {
+                fwrite(line, length, sizeof(char), output);
+            }
+        }
+    }
+
+    corrupt = reader.corrupt;
+    if(corrupt)
+    {
+        fprintf(stderr, "Archive %s is corrupt, stopped after %u KB\n", filename, (unsigned)(reader.nextBlock / 1024));
+    }
+    archiveReaderClose(&reader);
+    return !corrupt;
+}
+
+static bool isArchive(const char * filename)
+{
+    char magic[ALPAQA_LOG_MAGIC_SIZE];
+    FILE * file = fopen(filename, "r");
+    bool archive;
+
+    if(file == NULL)
+    {
+        return false;
+    }
+    archive = fread(magic, sizeof(magic), 1, file) == 1 && memcmp(magic, ALPAQA_ARCHIVE_MAGIC, sizeof(magic)) == 0;
+    fclose(file);
+    return archive;
+}
+
+int main(int argc, char * argv[])
+{
+    static char outputBuffer[OUTPUT_BUFFER_SIZE];
+    const char * outputFilename = NULL;
+    FILE * output = stdout;
+    bool timestamp = false;
+    uint8_t location = 0;
+    uint64_t fromNs = 0;
+    uint64_t toNs = UINT64_MAX;
+    bool ranged = false;
+    bool ok = true;
+    int opt;
+
+    while((opt = getopt(argc, argv, "to:L:F:T:")) != -1)
+    {
+        switch(opt)
+        {
+            case 't':
+                timestamp = true;
+                break;
+            case 'o':
+                outputFilename = optarg;
+                break;
+            case 'L':
+                location = strtoul(optarg, NULL, 0);
+                break;
+            case 'F':
+                fromNs = strtoull(optarg, NULL, 0) * NS_PER_SECOND;
+                ranged = true;
+                break;
+            case 'T':
+                toNs = strtoull(optarg, NULL, 0) * NS_PER_SECOND;
+                ranged = true;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-t add timestamp column] [-o output file] [-L location, default 0]\n"
+                        "       [-F from, -T to: only records in this range, Unix time in seconds] log or archive...\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if(optind >= argc)
+    {
+        fprintf(stderr, "Usage: %s [-t add timestamp column] [-o output file] [-L location, default 0]\n"
+                        "       [-F from, -T to: only records in this range, Unix time in seconds] log or archive...\n", argv[0]);
+        return 1;
+    }
+
+    if(outputFilename != NULL)
+    {
+        output = fopen(outputFilename, "w");
+        if(output == NULL)
+        {
+            fprintf(stderr, "Failed to open %s! errno: %d\n", outputFilename, errno);
+            return 1;
+        }
+    }
+    setvbuf(output, outputBuffer, _IOFBF, sizeof(outputBuffer));
+
+    for(int idx = optind; idx < argc; idx++)
+    {
+        if(isArchive(argv[idx]))
+        {
+            ok = convertArchive(argv[idx], timestamp, location, fromNs, toNs, output) && ok;
+        }
+        else if(ranged)
+        {
+            ok = convertRange(argv[idx], timestamp, location, fromNs, toNs, output) && ok;
+        }
+        else
+        {
+            ok = convertLog(argv[idx], timestamp, location, output) && ok;
+        }
+    }
+
+    if(fclose(output) != 0)
+    {
+        ok = false;
+    }
+    return ok ? 0 : 1;
+}
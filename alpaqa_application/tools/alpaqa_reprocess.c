@@ -0,0 +1,924 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../alpaqaArchive.h"
+#include "../alpaqaCalc.h"
+#include "../alpaqaLog.h"
+#include "../alpaqaNowCast.h"
+
+#define SECONDS_PER_HOUR 3600
+#define HOURS_PER_DAY 24
+#define CHUNKS_PER_THREAD 8
+#define MIN_CHUNK_SIZE (1 << 20)
+#define MAX_FIELDS 11
+#define HOUR_TABLE_INITIAL 1024
+#define HOUR_EMPTY UINT64_MAX
+#define OUTPUT_BUFFER_SIZE (1 << 16)
+// Parsed lines are held back until there are this many, then AQI and heat index
+// are worked out for all of them in one go
+#define SAMPLE_BLOCK_SIZE 256
+// Latest timestamp taken, the log records' 32 bit seconds
+#define MAX_TIMESTAMP_SECONDS 4294967295.0
+// Far past anything the SHT41 reports, only there to keep the float conversion defined
+#define MAX_TEMPERATURE_HUMIDITY 1000.0
+#define USAGE "Usage: %s [-j threads] [-s start time of untimestamped lines, default from file mtime]\n" \
+              "       [-p seconds between untimestamped lines] [-H hourly csv] [-D daily csv] log...\n" \
+              "Reads text and CSV logs. Convert binary logs and archives with alpaqa_log2csv -t first.\n"
+
+// Everything about one hour that can be merged from any number of partial
+// summaries in any order
+typedef struct
+{
+    uint64_t hour;
+    uint64_t samples;
+    uint64_t sumPm1_0;
+    uint64_t sumPm2_5;
+    uint64_t sumPm10_0;
+    uint16_t minPm2_5;
+    uint16_t maxPm2_5;
+    uint16_t maxPm10_0;
+    uint16_t maxInstantAqi;
+    double sumTemperatureF;
+    double sumHumidity;
+    float minTemperatureF;
+    float maxTemperatureF;
+    float maxHeatIndex;
+} HOUR_SUMMARY;
+
+// Open addressing on the hour number, kept at most half full
+typedef struct
+{
+    HOUR_SUMMARY * slots;
+    size_t capacity;
+    size_t count;
+} HOUR_TABLE;
+
+typedef struct
+{
+    size_t begin;
+    size_t end;
+    uint64_t lines;
+    uint64_t firstLine;
+} CHUNK;
+
+typedef struct
+{
+    const char * data;
+    CHUNK * chunks;
+    size_t chunkCount;
+    atomic_size_t next;
+    // Lines without a timestamp are placed at start + line * period
+    uint64_t startSeconds;
+    uint32_t periodSeconds;
+} FILE_JOB;
+
+typedef struct
+{
+    size_t count;
+    uint64_t hours[SAMPLE_BLOCK_SIZE];
+    PARTICULATE_MATTER_DATA pm[SAMPLE_BLOCK_SIZE];
+    TEMP_HUMIDITY_DATA tempHumidity[SAMPLE_BLOCK_SIZE];
+    uint16_t instantAqi[SAMPLE_BLOCK_SIZE];
+    float heatIndex[SAMPLE_BLOCK_SIZE];
+} SAMPLE_BLOCK;
+
+typedef struct
+{
+    HOUR_TABLE table;
+    SAMPLE_BLOCK block;
+    uint64_t lines;
+    uint64_t rejected;
+} WORKER;
+
+typedef void (*POOL_JOB)(void * context, WORKER * worker);
+
+// Workers are started once and handed one job at a time; every worker runs the
+// job, which pulls chunks from a shared counter until there are none left
+typedef struct
+{
+    pthread_t * threads;
+    WORKER * workers;
+    int count;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    POOL_JOB job;
+    void * context;
+    uint64_t generation;
+    int busy;
+    bool stopping;
+} THREAD_POOL;
+
+typedef struct
+{
+    THREAD_POOL * pool;
+    int index;
+} POOL_THREAD;
+
+typedef struct
+{
+    const char * hourlyFilename;
+    const char * dailyFilename;
+    int threads;
+    bool startGiven;
+    uint64_t startSeconds;
+    uint32_t periodSeconds;
+} REPROCESS_OPTIONS;
+
+static POOL_THREAD * poolThreads;
+
+static bool hourTableInit(HOUR_TABLE * table, size_t capacity)
+{
+    table->slots = malloc(capacity * sizeof(HOUR_SUMMARY));
+    if(table->slots == NULL)
+    {
+        return false;
+    }
+    for(size_t idx = 0; idx < capacity; idx++)
+    {
+        table->slots[idx].hour = HOUR_EMPTY;
+    }
+    table->capacity = capacity;
+    table->count = 0;
+    return true;
+}
+
+static HOUR_SUMMARY * hourTableFind(HOUR_TABLE * table, uint64_t hour)
+{
+    size_t mask = table->capacity - 1;
+    size_t slot = (hour * 0x9E3779B97F4A7C15ULL >> 32) & mask;
+
+    while(table->slots[slot].hour != HOUR_EMPTY && table->slots[slot].hour != hour)
+    {
+        slot = (slot + 1) & mask;
+    }
+    return &table->slots[slot];
+}
+
+static bool hourTableGrow(HOUR_TABLE * table)
+{
+    HOUR_TABLE larger;
+
+    if(!hourTableInit(&larger, table->capacity * 2))
+    {
+        return false;
+    }
+    for(size_t idx = 0; idx < table->capacity; idx++)
+    {
+        if(table->slots[idx].hour != HOUR_EMPTY)
+        {
+            *hourTableFind(&larger, table->slots[idx].hour) = table->slots[idx];
+            larger.count++;
+        }
+    }
+    free(table->slots);
+    *table = larger;
+    return true;
+}
+
+static HOUR_SUMMARY * hourTableGet(HOUR_TABLE * table, uint64_t hour)
+{
+    HOUR_SUMMARY * summary = hourTableFind(table, hour);
+
+    if(summary->hour == HOUR_EMPTY)
+    {
+        if((table->count + 1) * 2 > table->capacity)
+        {
+            if(!hourTableGrow(table))
+            {
+                return NULL;
+            }
+            summary = hourTableFind(table, hour);
+        }
+        memset(summary, 0, sizeof(HOUR_SUMMARY));
+        summary->hour = hour;
+        summary->minPm2_5 = UINT16_MAX;
+        summary->minTemperatureF = INFINITY;
+        summary->maxTemperatureF = -INFINITY;
+        summary->maxHeatIndex = -INFINITY;
+        table->count++;
+    }
+    return summary;
+}
+
+static void hourMerge(HOUR_SUMMARY * into, const HOUR_SUMMARY * from)
+{
+    into->samples += from->samples;
+    into->sumPm1_0 += from->sumPm1_0;
+    into->sumPm2_5 += from->sumPm2_5;
+    into->sumPm10_0 += from->sumPm10_0;
+    into->minPm2_5 = from->minPm2_5 < into->minPm2_5 ? from->minPm2_5 : into->minPm2_5;
+    into->maxPm2_5 = from->maxPm2_5 > into->maxPm2_5 ? from->maxPm2_5 : into->maxPm2_5;
+    into->maxPm10_0 = from->maxPm10_0 > into->maxPm10_0 ? from->maxPm10_0 : into->maxPm10_0;
+    into->maxInstantAqi = from->maxInstantAqi > into->maxInstantAqi ? from->maxInstantAqi : into->maxInstantAqi;
+    into->sumTemperatureF += from->sumTemperatureF;
+    into->sumHumidity += from->sumHumidity;
+    into->minTemperatureF = from->minTemperatureF < into->minTemperatureF ? from->minTemperatureF : into->minTemperatureF;
+    into->maxTemperatureF = from->maxTemperatureF > into->maxTemperatureF ? from->maxTemperatureF : into->maxTemperatureF;
+    into->maxHeatIndex = from->maxHeatIndex > into->maxHeatIndex ? from->maxHeatIndex : into->maxHeatIndex;
+}
+
+static void * poolThread(void * argument)
+{
+    POOL_THREAD * self = argument;
+    THREAD_POOL * pool = self->pool;
+    uint64_t seen = 0;
+    POOL_JOB job;
+    void * context;
+
+    for(;;)
+    {
+        pthread_mutex_lock(&pool->lock);
+        while(pool->generation == seen && !pool->stopping)
+        {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        if(pool->stopping)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        seen = pool->generation;
+        job = pool->job;
+        context = pool->context;
+        pthread_mutex_unlock(&pool->lock);
+
+        job(context, &pool->workers[self->index]);
+
+        pthread_mutex_lock(&pool->lock);
+        if(--pool->busy == 0)
+        {
+            pthread_cond_signal(&pool->done);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static bool poolStart(THREAD_POOL * pool, int count)
+{
+    memset(pool, 0, sizeof(THREAD_POOL));
+    pool->threads = calloc(count, sizeof(pthread_t));
+    pool->workers = calloc(count, sizeof(WORKER));
+    poolThreads = calloc(count, sizeof(POOL_THREAD));
+    if(pool->threads == NULL || pool->workers == NULL || poolThreads == NULL)
+    {
+        return false;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for(int idx = 0; idx < count; idx++)
+    {
+        if(!hourTableInit(&pool->workers[idx].table, HOUR_TABLE_INITIAL))
+        {
+            return false;
+        }
+        poolThreads[idx].pool = pool;
+        poolThreads[idx].index = idx;
+        if(pthread_create(&pool->threads[idx], NULL, poolThread, &poolThreads[idx]) != 0)
+        {
+            return false;
+        }
+        pool->count++;
+    }
+    return true;
+}
+
+// Runs job on every worker and returns once all of them have finished it
+static void poolRun(THREAD_POOL * pool, POOL_JOB job, void * context)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->job = job;
+    pool->context = context;
+    pool->busy = pool->count;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->wake);
+    while(pool->busy > 0)
+    {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void poolStop(THREAD_POOL * pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for(int idx = 0; idx < pool->count; idx++)
+    {
+        pthread_join(pool->threads[idx], NULL);
+        free(pool->workers[idx].table.slots);
+    }
+    free(pool->threads);
+    free(pool->workers);
+    free(poolThreads);
+}
+
+// Numbers as the app writes them: optional sign, digits, optional fraction.
+// The mapping is not NUL terminated, so strtod cannot be used.
+static const char * parseNumber(const char * cursor, const char * end, double * value, bool * hasFraction)
+{
+    double number = 0.0;
+    double scale = 0.1;
+    bool negative = false;
+    bool digits = false;
+
+    while(cursor < end && (*cursor == ' ' || *cursor == ','))
+    {
+        cursor++;
+    }
+    if(cursor < end && *cursor == '-')
+    {
+        negative = true;
+        cursor++;
+    }
+    while(cursor < end && *cursor >= '0' && *cursor <= '9')
+    {
+        number = (number * 10.0) + (*cursor++ - '0');
+        digits = true;
+    }
+    *hasFraction = false;
+    if(cursor < end && *cursor == '.')
+    {
+        cursor++;
+        *hasFraction = true;
+        while(cursor < end && *cursor >= '0' && *cursor <= '9')
+        {
+            number += (*cursor++ - '0') * scale;
+            scale *= 0.1;
+            digits = true;
+        }
+    }
+    if(!digits)
+    {
+        return NULL;
+    }
+    *value = negative ? -number : number;
+    return cursor;
+}
+
+static bool inRange(double value, double min, double max)
+{
+    return value >= min && value <= max;
+}
+
+// The app's own binary logs and archives, which only alpaqa_log2csv reads
+static bool isBinaryLog(const void * data, size_t size)
+{
+    return size >= ALPAQA_LOG_MAGIC_SIZE && (memcmp(data, ALPAQA_LOG_MAGIC, ALPAQA_LOG_MAGIC_SIZE) == 0 ||
+                                             memcmp(data, ALPAQA_ARCHIVE_MAGIC, ALPAQA_LOG_MAGIC_SIZE) == 0);
+}
+
+// Accepts the original text log (9 columns), the CSV alpaqa_log2csv writes (10),
+// and either with a leading timestamp column. Stored AQI and heat index columns
+// are ignored and recomputed with the current code.
+static bool parseLine(SAMPLE_BLOCK * block, const FILE_JOB * job, const char * line, const char * end, uint64_t lineNumber)
+{
+    double fields[MAX_FIELDS];
+    bool fraction;
+    bool timestamped;
+    int count = 0;
+    int first;
+    uint64_t seconds;
+    PARTICULATE_MATTER_DATA * pm = &block->pm[block->count];
+    TEMP_HUMIDITY_DATA * tempHumidity = &block->tempHumidity[block->count];
+    bool firstFraction = false;
+
+    while(count < MAX_FIELDS && (line = parseNumber(line, end, &fields[count], &fraction)) != NULL)
+    {
+        if(count == 0)
+        {
+            firstFraction = fraction;
+        }
+        count++;
+    }
+
+    // Only a timestamp has a fraction in the first column
+    timestamped = count == 11 || (count == 10 && firstFraction);
+    if(count < 9 || count > 11 || (count == 11 && !firstFraction))
+    {
+        return false;
+    }
+    first = timestamped ? 1 : 0;
+    // A corrupt line can hold anything, and converting a number out of the target's
+    // range is undefined
+    if((timestamped && !inRange(fields[0], 0.0, MAX_TIMESTAMP_SECONDS)) ||
+       !inRange(fields[first], 0.0, UINT16_MAX) || !inRange(fields[first + 1], 0.0, UINT16_MAX) ||
+       !inRange(fields[first + 2], 0.0, UINT16_MAX) ||
+       !inRange(fields[first + 5], -MAX_TEMPERATURE_HUMIDITY, MAX_TEMPERATURE_HUMIDITY) ||
+       !inRange(fields[first + 6], -MAX_TEMPERATURE_HUMIDITY, MAX_TEMPERATURE_HUMIDITY) ||
+       !inRange(fields[first + 7], -MAX_TEMPERATURE_HUMIDITY, MAX_TEMPERATURE_HUMIDITY))
+    {
+        return false;
+    }
+    seconds = timestamped ? (uint64_t)fields[0] : job->startSeconds + (lineNumber * job->periodSeconds);
+
+    pm->pm1_0 = (uint16_t)fields[first];
+    pm->pm2_5 = (uint16_t)fields[first + 1];
+    pm->pm10_0 = (uint16_t)fields[first + 2];
+    tempHumidity->temperatureF = (float)fields[first + 5];
+    tempHumidity->temperatureC = (float)fields[first + 6];
+    tempHumidity->humidity = (float)fields[first + 7];
+    block->hours[block->count++] = seconds / SECONDS_PER_HOUR;
+    return true;
+}
+
+static void flushBlock(WORKER * worker)
+{
+    SAMPLE_BLOCK * block = &worker->block;
+
+    calcInstantAQIBatch(block->pm, block->instantAqi, block->count);
+    calcHeatIndexBatch(block->tempHumidity, block->heatIndex, block->count);
+
+    for(size_t idx = 0; idx < block->count; idx++)
+    {
+        const PARTICULATE_MATTER_DATA * pm = &block->pm[idx];
+        const TEMP_HUMIDITY_DATA * tempHumidity = &block->tempHumidity[idx];
+        uint16_t instantAqi = block->instantAqi[idx];
+        float heatIndex = block->heatIndex[idx];
+        HOUR_SUMMARY * summary = hourTableGet(&worker->table, block->hours[idx]);
+
+        if(summary == NULL)
+        {
+            worker->rejected++;
+            continue;
+        }
+        summary->samples++;
+        summary->sumPm1_0 += pm->pm1_0;
+        summary->sumPm2_5 += pm->pm2_5;
+        summary->sumPm10_0 += pm->pm10_0;
+        summary->minPm2_5 = pm->pm2_5 < summary->minPm2_5 ? pm->pm2_5 : summary->minPm2_5;
+        summary->maxPm2_5 = pm->pm2_5 > summary->maxPm2_5 ? pm->pm2_5 : summary->maxPm2_5;
+        summary->maxPm10_0 = pm->pm10_0 > summary->maxPm10_0 ? pm->pm10_0 : summary->maxPm10_0;
+        summary->maxInstantAqi = instantAqi > summary->maxInstantAqi ? instantAqi : summary->maxInstantAqi;
+        summary->sumTemperatureF += tempHumidity->temperatureF;
+        summary->sumHumidity += tempHumidity->humidity;
+        summary->minTemperatureF = tempHumidity->temperatureF < summary->minTemperatureF ? tempHumidity->temperatureF : summary->minTemperatureF;
+        summary->maxTemperatureF = tempHumidity->temperatureF > summary->maxTemperatureF ? tempHumidity->temperatureF : summary->maxTemperatureF;
+        summary->maxHeatIndex = heatIndex > summary->maxHeatIndex ? heatIndex : summary->maxHeatIndex;
+    }
+    block->count = 0;
+}
+
+static void countLinesJob(void * context, WORKER * worker)
+{
+    FILE_JOB * job = context;
+    size_t idx;
+
+    (void)worker;
+    while((idx = atomic_fetch_add(&job->next, 1)) < job->chunkCount)
+    {
+        CHUNK * chunk = &job->chunks[idx];
+        const char * cursor = job->data + chunk->begin;
+        const char * end = job->data + chunk->end;
+
+        chunk->lines = 0;
+        while(cursor < end && (cursor = memchr(cursor, '\n', end - cursor)) != NULL)
+        {
+            chunk->lines++;
+            cursor++;
+        }
+        // A last line without a newline still counts
+        if(chunk->end > chunk->begin && job->data[chunk->end - 1] != '\n')
+        {
+            chunk->lines++;
+        }
+    }
+}
+
+static void aggregateJob(void * context, WORKER * worker)
+{
+    FILE_JOB * job = context;
+    size_t idx;
+
+    while((idx = atomic_fetch_add(&job->next, 1)) < job->chunkCount)
+    {
+        const CHUNK * chunk = &job->chunks[idx];
+        const char * cursor = job->data + chunk->begin;
+        const char * end = job->data + chunk->end;
+        uint64_t lineNumber = chunk->firstLine;
+
+        while(cursor < end)
+        {
+            const char * newline = memchr(cursor, '\n', end - cursor);
+            const char * lineEnd = newline != NULL ? newline : end;
+
+            if(!parseLine(&worker->block, job, cursor, lineEnd, lineNumber))
+            {
+                worker->rejected++;
+            }
+            else if(worker->block.count == SAMPLE_BLOCK_SIZE)
+            {
+                flushBlock(worker);
+            }
+            worker->lines++;
+            lineNumber++;
+            cursor = lineEnd + 1;
+        }
+    }
+    flushBlock(worker);
+}
+
+// Chunk edges are moved forward to just past a newline so no line is split
+static size_t splitChunks(const char * data, size_t size, int threads, CHUNK ** chunks)
+{
+    size_t target = size / ((size_t)threads * CHUNKS_PER_THREAD);
+    size_t count = 0;
+    size_t begin = 0;
+
+    if(target < MIN_CHUNK_SIZE)
+    {
+        target = MIN_CHUNK_SIZE;
+    }
+    *chunks = calloc(size / target + 2, sizeof(CHUNK));
+    if(*chunks == NULL)
+    {
+        return 0;
+    }
+
+    while(begin < size)
+    {
+        size_t end = begin + target;
+
+        if(end >= size)
+        {
+            end = size;
+        }
+        else
+        {
+            const char * newline = memchr(data + end, '\n', size - end);
+
+            end = newline != NULL ? (size_t)(newline - data) + 1 : size;
+        }
+        (*chunks)[count].begin = begin;
+        (*chunks)[count].end = end;
+        count++;
+        begin = end;
+    }
+    return count;
+}
+
+static bool processFile(THREAD_POOL * pool, const REPROCESS_OPTIONS * options, const char * filename)
+{
+    FILE_JOB job;
+    struct stat info;
+    uint64_t lines = 0;
+    void * data;
+    int fd;
+
+    fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if(fd < 0 || fstat(fd, &info) != 0)
+    {
+        fprintf(stderr, "Failed to open %s! errno: %d\n", filename, errno);
+        if(fd >= 0)
+        {
+            close(fd);
+        }
+        return false;
+    }
+    if(info.st_size == 0)
+    {
+        close(fd);
+        return true;
+    }
+
+    data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED)
+    {
+        fprintf(stderr, "Failed to map %s! errno: %d\n", filename, errno);
+        return false;
+    }
+    if(isBinaryLog(data, info.st_size))
+    {
+        fprintf(stderr, "%s is a binary log or archive, convert it with alpaqa_log2csv -t first\n", filename);
+        munmap(data, info.st_size);
+        return false;
+    }
+    madvise(data, info.st_size, MADV_SEQUENTIAL);
+
+    memset(&job, 0, sizeof(job));
+    job.data = data;
+    job.periodSeconds = options->periodSeconds;
+    job.chunkCount = splitChunks(data, info.st_size, pool->count, &job.chunks);
+    if(job.chunkCount == 0)
+    {
+        munmap(data, info.st_size);
+        return false;
+    }
+
+    // Line numbers are needed to place lines without timestamps, so lines are
+    // counted per chunk first and each chunk is told where its first line falls
+    atomic_init(&job.next, 0);
+    poolRun(pool, countLinesJob, &job);
+    for(size_t idx = 0; idx < job.chunkCount; idx++)
+    {
+        job.chunks[idx].firstLine = lines;
+        lines += job.chunks[idx].lines;
+    }
+
+    // The app wrote a line a period apart until the file was last modified
+    job.startSeconds = options->startGiven ? options->startSeconds :
+                       (uint64_t)info.st_mtime - ((lines > 0 ? lines - 1 : 0) * options->periodSeconds);
+
+    atomic_init(&job.next, 0);
+    poolRun(pool, aggregateJob, &job);
+
+    free(job.chunks);
+    munmap(data, info.st_size);
+    return true;
+}
+
+static int compareHours(const void * a, const void * b)
+{
+    const HOUR_SUMMARY * left = a;
+    const HOUR_SUMMARY * right = b;
+
+    return left->hour < right->hour ? -1 : left->hour > right->hour;
+}
+
+static uint16_t averageAqi(uint64_t sumPm2_5, uint64_t sumPm10_0, uint64_t samples)
+{
+    PARTICULATE_MATTER_DATA pm;
+
+    memset(&pm, 0, sizeof(pm));
+    pm.pm2_5 = sumPm2_5 / samples;
+    pm.pm10_0 = sumPm10_0 / samples;
+    return calcInstantAQI(&pm);
+}
+
+// NowCast at the end of each hour from the hourly averages before it, as the
+// app would have shown it
+static bool hourNowCast(const HOUR_SUMMARY * hours, size_t idx, uint16_t * aqi)
+{
+    bool valid[NOWCAST_HOURS];
+    float pm2_5[NOWCAST_HOURS];
+    float pm10_0[NOWCAST_HOURS];
+    PARTICULATE_MATTER_DATA pm;
+    bool full;
+
+    memset(valid, 0, sizeof(valid));
+    memset(pm2_5, 0, sizeof(pm2_5));
+    memset(pm10_0, 0, sizeof(pm10_0));
+    for(size_t back = idx + 1; back-- > 0 && hours[idx].hour - hours[back].hour < NOWCAST_HOURS;)
+    {
+        uint64_t age = hours[idx].hour - hours[back].hour;
+
+        valid[age] = true;
+        pm2_5[age] = (float)hours[back].sumPm2_5 / hours[back].samples;
+        pm10_0[age] = (float)hours[back].sumPm10_0 / hours[back].samples;
+    }
+
+    memset(&pm, 0, sizeof(pm));
+    full = nowcastFromHours(valid, pm2_5, pm10_0, &pm.pm2_5, &pm.pm10_0);
+    *aqi = calcInstantAQI(&pm);
+    return full;
+}
+
+static void writeHourly(FILE * output, const HOUR_SUMMARY * hours, size_t count)
+{
+    fprintf(output, "hour_start, samples, pm1_0_avg, pm2_5_avg, pm2_5_min, pm2_5_max, pm10_0_avg, pm10_0_max, "
+            "aqi_hour, aqi_instant_max, nowcast_aqi, nowcast_valid, temperature_f_avg, temperature_f_min, "
+            "temperature_f_max, humidity_avg, heat_index_max\n");
+    for(size_t idx = 0; idx < count; idx++)
+    {
+        const HOUR_SUMMARY * hour = &hours[idx];
+        uint16_t nowcast;
+        bool nowcastValid = hourNowCast(hours, idx, &nowcast);
+
+        fprintf(output, "%llu, %llu, %0.1f, %0.1f, %u, %u, %0.1f, %u, %u, %u, %u, %d, %0.2f, %0.2f, %0.2f, %0.2f, %0.2f\n",
+                (unsigned long long)(hour->hour * SECONDS_PER_HOUR), (unsigned long long)hour->samples,
+                (double)hour->sumPm1_0 / hour->samples, (double)hour->sumPm2_5 / hour->samples,
+                hour->minPm2_5, hour->maxPm2_5, (double)hour->sumPm10_0 / hour->samples, hour->maxPm10_0,
+                averageAqi(hour->sumPm2_5, hour->sumPm10_0, hour->samples), hour->maxInstantAqi,
+                nowcast, nowcastValid ? 1 : 0, hour->sumTemperatureF / hour->samples, hour->minTemperatureF,
+                hour->maxTemperatureF, hour->sumHumidity / hour->samples, hour->maxHeatIndex);
+    }
+}
+
+// Calendar days in UTC, built from the merged hours
+static void writeDaily(FILE * output, const HOUR_SUMMARY * hours, size_t count)
+{
+    size_t dayEnd;
+
+    fprintf(output, "day_start, samples, hours, pm2_5_avg, pm2_5_max, pm10_0_avg, pm10_0_max, aqi_24_hour, "
+            "aqi_instant_max, nowcast_aqi_max, temperature_f_avg, temperature_f_min, temperature_f_max, "
+            "humidity_avg, heat_index_max\n");
+    for(size_t dayStart = 0; dayStart < count; dayStart = dayEnd)
+    {
+        uint64_t day = hours[dayStart].hour / HOURS_PER_DAY;
+        HOUR_SUMMARY total = hours[dayStart];
+        uint16_t nowcastMax = 0;
+
+        dayEnd = dayStart + 1;
+        while(dayEnd < count && hours[dayEnd].hour / HOURS_PER_DAY == day)
+        {
+            dayEnd++;
+        }
+        for(size_t hour = dayStart; hour < dayEnd; hour++)
+        {
+            uint16_t nowcast;
+
+            if(hour > dayStart)
+            {
+                hourMerge(&total, &hours[hour]);
+            }
+            hourNowCast(hours, hour, &nowcast);
+            nowcastMax = nowcast > nowcastMax ? nowcast : nowcastMax;
+        }
+
+        fprintf(output, "%llu, %llu, %u, %0.1f, %u, %0.1f, %u, %u, %u, %u, %0.2f, %0.2f, %0.2f, %0.2f, %0.2f\n",
+                (unsigned long long)(day * HOURS_PER_DAY * SECONDS_PER_HOUR), (unsigned long long)total.samples,
+                (uint32_t)(dayEnd - dayStart), (double)total.sumPm2_5 / total.samples, total.maxPm2_5,
+                (double)total.sumPm10_0 / total.samples, total.maxPm10_0,
+                averageAqi(total.sumPm2_5, total.sumPm10_0, total.samples), total.maxInstantAqi, nowcastMax,
+                total.sumTemperatureF / total.samples, total.minTemperatureF, total.maxTemperatureF,
+                total.sumHumidity / total.samples, total.maxHeatIndex);
+    }
+}
+
+// Folds every worker's partial hours into one table and returns them sorted
+static HOUR_SUMMARY * mergeWorkers(THREAD_POOL * pool, size_t * count)
+{
+    HOUR_TABLE merged;
+    HOUR_SUMMARY * hours;
+    size_t used = 0;
+
+    *count = 0;
+    if(!hourTableInit(&merged, HOUR_TABLE_INITIAL))
+    {
+        return NULL;
+    }
+    for(int worker = 0; worker < pool->count; worker++)
+    {
+        const HOUR_TABLE * table = &pool->workers[worker].table;
+
+        for(size_t idx = 0; idx < table->capacity; idx++)
+        {
+            HOUR_SUMMARY * into;
+
+            if(table->slots[idx].hour == HOUR_EMPTY)
+            {
+                continue;
+            }
+            into = hourTableGet(&merged, table->slots[idx].hour);
+            if(into == NULL)
+            {
+                free(merged.slots);
+                return NULL;
+            }
+            hourMerge(into, &table->slots[idx]);
+        }
+    }
+
+    hours = malloc((merged.count > 0 ? merged.count : 1) * sizeof(HOUR_SUMMARY));
+    if(hours != NULL)
+    {
+        for(size_t idx = 0; idx < merged.capacity; idx++)
+        {
+            if(merged.slots[idx].hour != HOUR_EMPTY)
+            {
+                hours[used++] = merged.slots[idx];
+            }
+        }
+        qsort(hours, used, sizeof(HOUR_SUMMARY), compareHours);
+    }
+    free(merged.slots);
+    *count = used;
+    return hours;
+}
+
+static FILE * openOutput(const char * filename, char * buffer)
+{
+    FILE * output = filename != NULL ? fopen(filename, "w") : stdout;
+
+    if(output == NULL)
+    {
+        fprintf(stderr, "Failed to open %s! errno: %d\n", filename, errno);
+        return NULL;
+    }
+    setvbuf(output, buffer, _IOFBF, OUTPUT_BUFFER_SIZE);
+    return output;
+}
+
+int main(int argc, char * argv[])
+{
+    static char hourlyBuffer[OUTPUT_BUFFER_SIZE];
+    static char dailyBuffer[OUTPUT_BUFFER_SIZE];
+    REPROCESS_OPTIONS options;
+    THREAD_POOL pool;
+    HOUR_SUMMARY * hours;
+    FILE * hourly;
+    FILE * daily;
+    uint64_t lines = 0;
+    uint64_t rejected = 0;
+    size_t hourCount;
+    bool ok = true;
+    int opt;
+
+    memset(&options, 0, sizeof(options));
+    options.threads = sysconf(_SC_NPROCESSORS_ONLN);
+    options.periodSeconds = 1;
+
+    while((opt = getopt(argc, argv, "j:s:p:H:D:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'j':
+                options.threads = strtol(optarg, NULL, 0);
+                break;
+            case 's':
+                options.startGiven = true;
+                options.startSeconds = strtoull(optarg, NULL, 0);
+                break;
+            case 'p':
+                options.periodSeconds = strtoul(optarg, NULL, 0);
+                break;
+            case 'H':
+                options.hourlyFilename = optarg;
+                break;
+            case 'D':
+                options.dailyFilename = optarg;
+                break;
+            default:
+                fprintf(stderr, USAGE, argv[0]);
+                return 1;
+        }
+    }
+    if(optind >= argc)
+    {
+        fprintf(stderr, USAGE, argv[0]);
+        return 1;
+    }
+    if(options.threads < 1)
+    {
+        options.threads = 1;
+    }
+    if(options.periodSeconds == 0)
+    {
+        options.periodSeconds = 1;
+    }
+
+    if(!poolStart(&pool, options.threads))
+    {
+        fprintf(stderr, "Failed to start worker threads! errno: %d\n", errno);
+        return 1;
+    }
+    for(int idx = optind; idx < argc; idx++)
+    {
+        ok = processFile(&pool, &options, argv[idx]) && ok;
+    }
+    for(int worker = 0; worker < pool.count; worker++)
+    {
+        lines += pool.workers[worker].lines;
+        rejected += pool.workers[worker].rejected;
+    }
+
+    hours = mergeWorkers(&pool, &hourCount);
+    poolStop(&pool);
+    if(hours == NULL)
+    {
+        fprintf(stderr, "Out of memory merging summaries\n");
+        return 1;
+    }
+
+    hourly = openOutput(options.hourlyFilename, hourlyBuffer);
+    if(hourly != NULL)
+    {
+        writeHourly(hourly, hours, hourCount);
+        if(options.hourlyFilename == NULL)
+        {
+            fprintf(hourly, "\n");
+        }
+    }
+    daily = options.dailyFilename != NULL ? openOutput(options.dailyFilename, dailyBuffer) : hourly;
+    if(daily != NULL)
+    {
+        writeDaily(daily, hours, hourCount);
+    }
+    if(hourly == NULL || daily == NULL || (hourly != stdout && fclose(hourly) != 0) ||
+       (daily != hourly && daily != stdout && fclose(daily) != 0))
+    {
+        ok = false;
+    }
+    fflush(stdout);
+
+    fprintf(stderr, "%llu lines, %llu rejected, %zu hours, %d threads\n", (unsigned long long)lines,
+            (unsigned long long)rejected, hourCount, options.threads);
+    free(hours);
+    return ok ? 0 : 1;
+}
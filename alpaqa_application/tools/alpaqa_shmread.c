@@ -0,0 +1,118 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../alpaqaShared.h"
+#include "../alpaqaTime.h"
+
+#define WATCH_POLL_US 10000
+
+static void printReading(const ALPAQA_SHARED_READING * reading)
+{
+    printf("{\"updates\":%u,\"live\":%s,\"pm_time\":%llu.%03llu,\"pm1_0\":%u,\"pm2_5\":%u,\"pm10_0\":%u,"
+           "\"temperature_c\":%0.2f,\"humidity\":%0.2f,\"heat_index_f\":%0.2f,"
+           "\"instant_aqi\":%u,\"aqi_24h\":%u,\"nowcast_aqi\":%u,\"flags\":%u}\n",
+           reading->updates, (reading->flags & ALPAQA_SHARED_LIVE) ? "true" : "false",
+           (unsigned long long)(reading->pmRealtimeNs / NS_PER_SECOND),
+           (unsigned long long)((reading->pmRealtimeNs % NS_PER_SECOND) / NS_PER_MS),
+           reading->pm1_0, reading->pm2_5, reading->pm10_0, reading->temperatureC, reading->humidity,
+           reading->heatIndex, reading->instantAqi, reading->calculatedAqi, reading->nowcastAqi, reading->flags);
+}
+
+// Times back to back snapshots, what a control loop polling the segment pays per read
+static bool benchmarkReads(const ALPAQA_SHARED_READER * reader, uint64_t iterations)
+{
+    ALPAQA_SHARED_READING reading;
+    uint64_t startNs;
+    uint64_t elapsedNs;
+    uint64_t failed = 0;
+    uint64_t sum = 0;
+
+    startNs = monotonicNowNs();
+    for(uint64_t idx = 0; idx < iterations; idx++)
+    {
+        if(!sharedReaderRead(reader, &reading))
+        {
+            failed++;
+            continue;
+        }
+        sum += reading.pm2_5;
+    }
+    elapsedNs = monotonicNowNs() - startNs;
+
+    printf("{\"reads\":%llu,\"failed\":%llu,\"ns_per_read\":%0.1f,\"checksum\":%llu}\n",
+           (unsigned long long)iterations, (unsigned long long)failed,
+           iterations > 0 ? (double)elapsedNs / iterations : 0.0, (unsigned long long)sum);
+    return failed < iterations;
+}
+
+int main(int argc, char * argv[])
+{
+    ALPAQA_SHARED_READER reader;
+    ALPAQA_SHARED_READING reading;
+    const char * name = ALPAQA_SHARED_NAME;
+    uint64_t iterations = 0;
+    uint32_t lastUpdates = 0;
+    bool watch = false;
+    bool ok = true;
+    int opt;
+
+    while((opt = getopt(argc, argv, "m:b:w")) != -1)
+    {
+        switch(opt)
+        {
+            case 'm':
+                name = optarg;
+                break;
+            case 'b':
+                iterations = strtoull(optarg, NULL, 0);
+                break;
+            case 'w':
+                watch = true;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-m shared memory name] [-b time this many reads] [-w print every update]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+
+    if(!sharedReaderOpen(&reader, name))
+    {
+        fprintf(stderr, "Failed to open shared readings %s! errno: %d\n", name, errno);
+        return 1;
+    }
+
+    if(iterations > 0)
+    {
+        ok = benchmarkReads(&reader, iterations);
+    }
+    else if(watch)
+    {
+        for(;;)
+        {
+            if(sharedReaderRead(&reader, &reading) && reading.updates != lastUpdates)
+            {
+                lastUpdates = reading.updates;
+                printReading(&reading);
+                fflush(stdout);
+            }
+            usleep(WATCH_POLL_US);
+        }
+    }
+    else if(sharedReaderRead(&reader, &reading))
+    {
+        printReading(&reading);
+    }
+    else
+    {
+        fprintf(stderr, "No reading published yet! errno: %d\n", errno);
+        ok = false;
+    }
+
+    sharedReaderClose(&reader);
+    return ok ? 0 : 1;
+}
@@ -6,13 +6,24 @@
 ##############################################################
 ALPAQA_APPLICATION_SITE = $(TOPDIR)/../alpaqa_application
 ALPAQA_APPLICATION_SITE_METHOD = local
+ALPAQA_APPLICATION_INSTALL_STAGING = YES
 
 define ALPAQA_APPLICATION_BUILD_CMDS
 	$(MAKE) $(TARGET_CONFIGURE_OPTS) -C $(@D) all
 endef
 
+# Shared memory reader library for other packages to build against
+define ALPAQA_APPLICATION_INSTALL_STAGING_CMDS
+	$(INSTALL) -D -m 0644 $(@D)/alpaqaShared.h $(STAGING_DIR)/usr/include/alpaqaShared.h
+	$(INSTALL) -D -m 0644 $(@D)/libalpaqa_shared.a $(STAGING_DIR)/usr/lib/libalpaqa_shared.a
+endef
+
 define ALPAQA_APPLICATION_INSTALL_TARGET_CMDS
 	$(INSTALL) -m 0755 $(@D)/alpaqa_app $(TARGET_DIR)/usr/bin
+	$(INSTALL) -m 0755 $(@D)/tools/alpaqa_log2csv $(TARGET_DIR)/usr/bin
+	$(INSTALL) -m 0755 $(@D)/tools/alpaqa_loadtest $(TARGET_DIR)/usr/bin
+	$(INSTALL) -m 0755 $(@D)/tools/alpaqa_shmread $(TARGET_DIR)/usr/bin
+	$(INSTALL) -m 0755 $(@D)/tools/alpaqa_reprocess $(TARGET_DIR)/usr/bin
 	$(INSTALL) -m 0755 $(@D)/alpaqa_app-start-stop $(TARGET_DIR)/etc/init.d/S99alpaqa_app
 endef
 